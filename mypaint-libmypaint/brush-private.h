@@ -0,0 +1,12 @@
+#ifndef BRUSHPRIVATE_H
+#define BRUSHPRIVATE_H
+
+#include "mypaint-brush.h"
+#include "brushprogram.h"
+
+BrushProgram *brush_get_program(MyPaintBrush *self);
+
+gboolean brush_load_program(MyPaintBrush *self, const float *base_values,
+                            const BrushProgramCurve *curves, int curves_n);
+
+#endif // BRUSHPRIVATE_H
@@ -18,6 +18,8 @@
 #include <assert.h>
 
 #include "helpers.h"
+#include "brushmodes.h"
+#include "simd.h"
 
 // parameters to those methods:
 //
@@ -41,6 +43,21 @@
 // resultAlpha = topAlpha + (1.0 - topAlpha) * bottomAlpha
 // resultColor = topColor + (1.0 - topAlpha) * bottomColor
 //
+static inline void
+blend_pixel_Normal (uint16_t mask,
+                    uint16_t * rgba,
+                    uint16_t color_r,
+                    uint16_t color_g,
+                    uint16_t color_b,
+                    uint16_t opacity) {
+  uint32_t opa_a = mask*(uint32_t)opacity/(1<<15); // topAlpha
+  uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
+  rgba[3] = opa_a + opa_b * rgba[3] / (1<<15);
+  rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
+  rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
+  rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
+}
+
 void draw_dab_pixels_BlendMode_Normal (uint16_t * mask,
                                        uint16_t * rgba,
                                        uint16_t color_r,
@@ -50,13 +67,7 @@ void draw_dab_pixels_BlendMode_Normal (uint16_t * mask,
 
   while (1) {
     for (; mask[0]; mask++, rgba+=4) {
-      uint32_t opa_a = mask[0]*(uint32_t)opacity/(1<<15); // topAlpha
-      uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
-      rgba[3] = opa_a + opa_b * rgba[3] / (1<<15);
-      rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
-      rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
-      rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
-
+      blend_pixel_Normal(mask[0], rgba, color_r, color_g, color_b, opacity);
     }
     if (!mask[1]) break;
     rgba += mask[1];
@@ -149,6 +160,40 @@ set_rgb16_lum_from_rgb16(const uint16_t topr,
 // the "Color" nonseparable blend mode. We do however use different
 // coefficients for the Luma value.
 
+static inline void
+blend_pixel_Color (uint16_t mask,
+                   uint16_t *rgba, // b=bottom, premult
+                   uint16_t color_r,  // }
+                   uint16_t color_g,  // }-- a=top, !premult
+                   uint16_t color_b,  // }
+                   uint16_t opacity)
+{
+  // De-premult
+  uint16_t r, g, b;
+  const uint16_t a = rgba[3];
+  r = g = b = 0;
+  if (rgba[3] != 0) {
+    r = ((1<<15)*((uint32_t)rgba[0])) / a;
+    g = ((1<<15)*((uint32_t)rgba[1])) / a;
+    b = ((1<<15)*((uint32_t)rgba[2])) / a;
+  }
+
+  // Apply luminance
+  set_rgb16_lum_from_rgb16(color_r, color_g, color_b, &r, &g, &b);
+
+  // Re-premult
+  r = ((uint32_t) r) * a / (1<<15);
+  g = ((uint32_t) g) * a / (1<<15);
+  b = ((uint32_t) b) * a / (1<<15);
+
+  // And combine as normal.
+  uint32_t opa_a = mask * opacity / (1<<15); // topAlpha
+  uint32_t opa_b = (1<<15) - opa_a; // bottomAlpha
+  rgba[0] = (opa_a*r + opa_b*rgba[0])/(1<<15);
+  rgba[1] = (opa_a*g + opa_b*rgba[1])/(1<<15);
+  rgba[2] = (opa_a*b + opa_b*rgba[2])/(1<<15);
+}
+
 void
 draw_dab_pixels_BlendMode_Color (uint16_t *mask,
                                  uint16_t *rgba, // b=bottom, premult
@@ -159,30 +204,7 @@ draw_dab_pixels_BlendMode_Color (uint16_t *mask,
 {
   while (1) {
     for (; mask[0]; mask++, rgba+=4) {
-      // De-premult
-      uint16_t r, g, b;
-      const uint16_t a = rgba[3];
-      r = g = b = 0;
-      if (rgba[3] != 0) {
-        r = ((1<<15)*((uint32_t)rgba[0])) / a;
-        g = ((1<<15)*((uint32_t)rgba[1])) / a;
-        b = ((1<<15)*((uint32_t)rgba[2])) / a;
-      }
-
-      // Apply luminance
-      set_rgb16_lum_from_rgb16(color_r, color_g, color_b, &r, &g, &b);
-
-      // Re-premult
-      r = ((uint32_t) r) * a / (1<<15);
-      g = ((uint32_t) g) * a / (1<<15);
-      b = ((uint32_t) b) * a / (1<<15);
-
-      // And combine as normal.
-      uint32_t opa_a = mask[0] * opacity / (1<<15); // topAlpha
-      uint32_t opa_b = (1<<15) - opa_a; // bottomAlpha
-      rgba[0] = (opa_a*r + opa_b*rgba[0])/(1<<15);
-      rgba[1] = (opa_a*g + opa_b*rgba[1])/(1<<15);
-      rgba[2] = (opa_a*b + opa_b*rgba[2])/(1<<15);
+      blend_pixel_Color(mask[0], rgba, color_r, color_g, color_b, opacity);
     }
     if (!mask[1]) break;
     rgba += mask[1];
@@ -197,6 +219,23 @@ draw_dab_pixels_BlendMode_Color (uint16_t *mask,
 // and color_r/g/b will be ignored. This function can also do normal
 // blending (color_a=1.0).
 //
+static inline void
+blend_pixel_Normal_and_Eraser (uint16_t mask,
+                               uint16_t * rgba,
+                               uint16_t color_r,
+                               uint16_t color_g,
+                               uint16_t color_b,
+                               uint16_t color_a,
+                               uint16_t opacity) {
+  uint32_t opa_a = mask*(uint32_t)opacity/(1<<15); // topAlpha
+  uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
+  opa_a = opa_a * color_a / (1<<15);
+  rgba[3] = opa_a + opa_b * rgba[3] / (1<<15);
+  rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
+  rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
+  rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
+}
+
 void draw_dab_pixels_BlendMode_Normal_and_Eraser (uint16_t * mask,
                                                   uint16_t * rgba,
                                                   uint16_t color_r,
@@ -207,14 +246,7 @@ void draw_dab_pixels_BlendMode_Normal_and_Eraser (uint16_t * mask,
 
   while (1) {
     for (; mask[0]; mask++, rgba+=4) {
-      uint32_t opa_a = mask[0]*(uint32_t)opacity/(1<<15); // topAlpha
-      uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
-      opa_a = opa_a * color_a / (1<<15);
-      rgba[3] = opa_a + opa_b * rgba[3] / (1<<15);
-      rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
-      rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
-      rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
-
+      blend_pixel_Normal_and_Eraser(mask[0], rgba, color_r, color_g, color_b, color_a, opacity);
     }
     if (!mask[1]) break;
     rgba += mask[1];
@@ -224,6 +256,24 @@ void draw_dab_pixels_BlendMode_Normal_and_Eraser (uint16_t * mask,
 
 // This is BlendMode_Normal with locked alpha channel.
 //
+static inline void
+blend_pixel_LockAlpha (uint16_t mask,
+                       uint16_t * rgba,
+                       uint16_t color_r,
+                       uint16_t color_g,
+                       uint16_t color_b,
+                       uint16_t opacity) {
+  uint32_t opa_a = mask*(uint32_t)opacity/(1<<15); // topAlpha
+  uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
+
+  opa_a *= rgba[3];
+  opa_a /= (1<<15);
+
+  rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
+  rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
+  rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
+}
+
 void draw_dab_pixels_BlendMode_LockAlpha (uint16_t * mask,
                                           uint16_t * rgba,
                                           uint16_t color_r,
@@ -233,15 +283,7 @@ void draw_dab_pixels_BlendMode_LockAlpha (uint16_t * mask,
 
   while (1) {
     for (; mask[0]; mask++, rgba+=4) {
-      uint32_t opa_a = mask[0]*(uint32_t)opacity/(1<<15); // topAlpha
-      uint32_t opa_b = (1<<15)-opa_a; // bottomAlpha
-      
-      opa_a *= rgba[3];
-      opa_a /= (1<<15);
-          
-      rgba[0] = (opa_a*color_r + opa_b*rgba[0])/(1<<15);
-      rgba[1] = (opa_a*color_g + opa_b*rgba[1])/(1<<15);
-      rgba[2] = (opa_a*color_b + opa_b*rgba[2])/(1<<15);
+      blend_pixel_LockAlpha(mask[0], rgba, color_r, color_g, color_b, opacity);
     }
     if (!mask[1]) break;
     rgba += mask[1];
@@ -250,6 +292,669 @@ void draw_dab_pixels_BlendMode_LockAlpha (uint16_t * mask,
 };
 
 
+// Dense (span) versions of the blend modes above, see dabmask.h.
+//
+// They give exactly the same results as the run length encoded versions,
+// which are kept as the reference implementation. SIMD kernels are
+// selected at runtime, see simd.h.
+
+#ifdef SIMD_X86
+
+// (x*y)>>15 for each uint16_t lane, truncated to 16 bits like the scalar code
+SIMD_TARGET("sse2") static inline __m128i
+mul_fix15_sse2(__m128i x, __m128i y)
+{
+  const __m128i hi = _mm_mulhi_epu16(x, y);
+  const __m128i lo = _mm_mullo_epi16(x, y);
+  return _mm_or_si128(_mm_slli_epi16(hi, 1), _mm_srli_epi16(lo, 15));
+}
+
+// (a*c + b*d)>>15 for each uint16_t lane, truncated to 16 bits like the scalar code.
+// The sum is computed with 32 bits, like the scalar code.
+SIMD_TARGET("sse2") static inline __m128i
+blend_fix15_sse2(__m128i a, __m128i c, __m128i b, __m128i d)
+{
+  const __m128i ac_lo = _mm_mullo_epi16(a, c);
+  const __m128i ac_hi = _mm_mulhi_epu16(a, c);
+  const __m128i bd_lo = _mm_mullo_epi16(b, d);
+  const __m128i bd_hi = _mm_mulhi_epu16(b, d);
+  __m128i sum0 = _mm_add_epi32(_mm_unpacklo_epi16(ac_lo, ac_hi), _mm_unpacklo_epi16(bd_lo, bd_hi));
+  __m128i sum1 = _mm_add_epi32(_mm_unpackhi_epi16(ac_lo, ac_hi), _mm_unpackhi_epi16(bd_lo, bd_hi));
+  // sign extend bits 15..30 so that packing keeps them instead of saturating
+  sum0 = _mm_srai_epi32(_mm_slli_epi32(sum0, 1), 16);
+  sum1 = _mm_srai_epi32(_mm_slli_epi32(sum1, 1), 16);
+  return _mm_packs_epi32(sum0, sum1);
+}
+
+// Copy the alpha of each pixel into all four channels
+SIMD_TARGET("sse2") static inline __m128i
+broadcast_alpha_sse2(__m128i rgba)
+{
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(rgba, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+}
+
+SIMD_TARGET("avx2") static inline __m256i
+mul_fix15_avx2(__m256i x, __m256i y)
+{
+  const __m256i hi = _mm256_mulhi_epu16(x, y);
+  const __m256i lo = _mm256_mullo_epi16(x, y);
+  return _mm256_or_si256(_mm256_slli_epi16(hi, 1), _mm256_srli_epi16(lo, 15));
+}
+
+SIMD_TARGET("avx2") static inline __m256i
+blend_fix15_avx2(__m256i a, __m256i c, __m256i b, __m256i d)
+{
+  const __m256i ac_lo = _mm256_mullo_epi16(a, c);
+  const __m256i ac_hi = _mm256_mulhi_epu16(a, c);
+  const __m256i bd_lo = _mm256_mullo_epi16(b, d);
+  const __m256i bd_hi = _mm256_mulhi_epu16(b, d);
+  __m256i sum0 = _mm256_add_epi32(_mm256_unpacklo_epi16(ac_lo, ac_hi), _mm256_unpacklo_epi16(bd_lo, bd_hi));
+  __m256i sum1 = _mm256_add_epi32(_mm256_unpackhi_epi16(ac_lo, ac_hi), _mm256_unpackhi_epi16(bd_lo, bd_hi));
+  sum0 = _mm256_srai_epi32(_mm256_slli_epi32(sum0, 1), 16);
+  sum1 = _mm256_srai_epi32(_mm256_slli_epi32(sum1, 1), 16);
+  return _mm256_packs_epi32(sum0, sum1);
+}
+
+SIMD_TARGET("avx2") static inline __m256i
+broadcast_alpha_avx2(__m256i rgba)
+{
+  return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(rgba, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+}
+
+// Expand one value per pixel (8 pixels, duplicated into both 128 bit lanes)
+// to one value per channel, for pixels 0..3 and 4..7.
+#define EXPAND_PIXELS_0123_AVX2 _mm256_setr_epi8(0,1,0,1,0,1,0,1, 2,3,2,3,2,3,2,3, \
+                                                 4,5,4,5,4,5,4,5, 6,7,6,7,6,7,6,7)
+#define EXPAND_PIXELS_4567_AVX2 _mm256_setr_epi8(8,9,8,9,8,9,8,9, 10,11,10,11,10,11,10,11, \
+                                                 12,13,12,13,12,13,12,13, 14,15,14,15,14,15,14,15)
+
+// The three linear blend modes only differ in how the top (opa_a) and bottom (opa_b)
+// weights are calculated, and in whether alpha is written.
+typedef enum {
+  LINEAR_BLEND_NORMAL,
+  LINEAR_BLEND_NORMAL_AND_ERASER,
+  LINEAR_BLEND_LOCK_ALPHA
+} LinearBlendMode;
+
+SIMD_TARGET("sse2") static inline void
+draw_dab_spans_linear_sse2 (const DabMask *mask,
+                            uint16_t * rgba,
+                            LinearBlendMode mode,
+                            uint16_t color_r,
+                            uint16_t color_g,
+                            uint16_t color_b,
+                            uint16_t color_a,
+                            uint16_t opacity) {
+
+  const __m128i one = _mm_set1_epi16((short)(1<<15));
+  const __m128i opacity_v = _mm_set1_epi16((short)opacity);
+  const __m128i color_a_v = _mm_set1_epi16((short)color_a);
+  const __m128i color = _mm_setr_epi16((short)color_r, (short)color_g, (short)color_b, (short)(1<<15),
+                                       (short)color_r, (short)color_g, (short)color_b, (short)(1<<15));
+  const __m128i rgb_lanes = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 4) {
+      // The last vector may reach past x1, or be moved back to stay inside the row.
+      // Pixels outside of the span get zero coverage then, which leaves them unchanged.
+      const int xs = MIN(x, mask->size-4);
+      __m128i opa = _mm_loadl_epi64((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 4 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      __m128i opa_a = mul_fix15_sse2(opa, opacity_v);
+      const __m128i opa_b = _mm_sub_epi16(one, opa_a);
+      if (mode == LINEAR_BLEND_NORMAL_AND_ERASER) {
+        opa_a = mul_fix15_sse2(opa_a, color_a_v);
+      }
+      const __m128i a = _mm_unpacklo_epi16(opa_a, opa_a);
+      const __m128i b = _mm_unpacklo_epi16(opa_b, opa_b);
+
+      __m128i * p = (__m128i *)(rgba_p + 4*xs);
+      for (int i = 0; i < 2; i++) {
+        const __m128i dst = _mm_loadu_si128(p + i);
+        __m128i a_i = i ? _mm_unpackhi_epi32(a, a) : _mm_unpacklo_epi32(a, a);
+        const __m128i b_i = i ? _mm_unpackhi_epi32(b, b) : _mm_unpacklo_epi32(b, b);
+        if (mode == LINEAR_BLEND_LOCK_ALPHA) {
+          a_i = mul_fix15_sse2(a_i, broadcast_alpha_sse2(dst));
+        }
+        __m128i result = blend_fix15_sse2(a_i, color, b_i, dst);
+        if (mode == LINEAR_BLEND_LOCK_ALPHA) {
+          result = _mm_or_si128(_mm_and_si128(rgb_lanes, result), _mm_andnot_si128(rgb_lanes, dst));
+        }
+        _mm_storeu_si128(p + i, result);
+      }
+    }
+  }
+}
+
+SIMD_TARGET("avx2") static inline void
+draw_dab_spans_linear_avx2 (const DabMask *mask,
+                            uint16_t * rgba,
+                            LinearBlendMode mode,
+                            uint16_t color_r,
+                            uint16_t color_g,
+                            uint16_t color_b,
+                            uint16_t color_a,
+                            uint16_t opacity) {
+
+  const __m128i one = _mm_set1_epi16((short)(1<<15));
+  const __m128i opacity_v = _mm_set1_epi16((short)opacity);
+  const __m128i color_a_v = _mm_set1_epi16((short)color_a);
+  const __m256i color = _mm256_setr_epi16((short)color_r, (short)color_g, (short)color_b, (short)(1<<15),
+                                          (short)color_r, (short)color_g, (short)color_b, (short)(1<<15),
+                                          (short)color_r, (short)color_g, (short)color_b, (short)(1<<15),
+                                          (short)color_r, (short)color_g, (short)color_b, (short)(1<<15));
+  const __m256i rgb_lanes = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0,
+                                              -1, -1, -1, 0, -1, -1, -1, 0);
+  const __m256i expand[2] = {EXPAND_PIXELS_0123_AVX2, EXPAND_PIXELS_4567_AVX2};
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 8) {
+      // The last vector may reach past x1, or be moved back to stay inside the row.
+      // Pixels outside of the span get zero coverage then, which leaves them unchanged.
+      const int xs = MIN(x, mask->size-8);
+      __m128i opa = _mm_loadu_si128((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 8 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      __m128i opa_a = mul_fix15_sse2(opa, opacity_v);
+      const __m128i opa_b = _mm_sub_epi16(one, opa_a);
+      if (mode == LINEAR_BLEND_NORMAL_AND_ERASER) {
+        opa_a = mul_fix15_sse2(opa_a, color_a_v);
+      }
+      const __m256i a = _mm256_broadcastsi128_si256(opa_a);
+      const __m256i b = _mm256_broadcastsi128_si256(opa_b);
+
+      __m256i * p = (__m256i *)(rgba_p + 4*xs);
+      for (int i = 0; i < 2; i++) {
+        const __m256i dst = _mm256_loadu_si256(p + i);
+        __m256i a_i = _mm256_shuffle_epi8(a, expand[i]);
+        const __m256i b_i = _mm256_shuffle_epi8(b, expand[i]);
+        if (mode == LINEAR_BLEND_LOCK_ALPHA) {
+          a_i = mul_fix15_avx2(a_i, broadcast_alpha_avx2(dst));
+        }
+        __m256i result = blend_fix15_avx2(a_i, color, b_i, dst);
+        if (mode == LINEAR_BLEND_LOCK_ALPHA) {
+          result = _mm256_blendv_epi8(dst, result, rgb_lanes);
+        }
+        _mm256_storeu_si256(p + i, result);
+      }
+    }
+  }
+}
+
+// One instance per blend mode, so that the mode checks are resolved at compile time
+#define DEFINE_LINEAR_SPANS(isa, name, mode) \
+  SIMD_TARGET(#isa) static void \
+  draw_dab_spans_##name##_##isa (const DabMask *mask, uint16_t *rgba, \
+                                 uint16_t color_r, uint16_t color_g, uint16_t color_b, \
+                                 uint16_t color_a, uint16_t opacity) { \
+    draw_dab_spans_linear_##isa(mask, rgba, mode, color_r, color_g, color_b, color_a, opacity); \
+  }
+
+DEFINE_LINEAR_SPANS(sse2, Normal, LINEAR_BLEND_NORMAL)
+DEFINE_LINEAR_SPANS(sse2, Normal_and_Eraser, LINEAR_BLEND_NORMAL_AND_ERASER)
+DEFINE_LINEAR_SPANS(sse2, LockAlpha, LINEAR_BLEND_LOCK_ALPHA)
+DEFINE_LINEAR_SPANS(avx2, Normal, LINEAR_BLEND_NORMAL)
+DEFINE_LINEAR_SPANS(avx2, Normal_and_Eraser, LINEAR_BLEND_NORMAL_AND_ERASER)
+DEFINE_LINEAR_SPANS(avx2, LockAlpha, LINEAR_BLEND_LOCK_ALPHA)
+
+// The Color blend mode works on 32 bit lanes, one pixel per lane, with the
+// red, green, blue and alpha channels in separate vectors. It follows
+// blend_pixel_Color() step by step, including the truncations to 16 bits,
+// so that the results are identical to the scalar code. The integer divisions
+// are done with doubles: they represent the int32 operands exactly, and the
+// correctly rounded quotient never crosses an integer, so truncating it gives
+// the result of the C division.
+
+// Low 32 bits of the products of the int32 lanes (SSE2 has no pmulld)
+SIMD_TARGET("sse2") static inline __m128i
+mullo_epi32_sse2(__m128i x, __m128i y)
+{
+  const __m128i even = _mm_mul_epu32(x, y);
+  const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+SIMD_TARGET("sse2") static inline __m128i
+select_epi32_sse2(__m128i mask, __m128i x, __m128i y)
+{
+  return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+SIMD_TARGET("sse2") static inline __m128i
+min_epi32_sse2(__m128i x, __m128i y)
+{
+  return select_epi32_sse2(_mm_cmplt_epi32(x, y), x, y);
+}
+
+SIMD_TARGET("sse2") static inline __m128i
+max_epi32_sse2(__m128i x, __m128i y)
+{
+  return select_epi32_sse2(_mm_cmpgt_epi32(x, y), x, y);
+}
+
+// n/d for each int32 lane, truncated towards zero
+SIMD_TARGET("sse2") static inline __m128i
+div_epi32_sse2(__m128i n, __m128i d)
+{
+  const __m128i lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(n), _mm_cvtepi32_pd(d)));
+  const __m128i hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(n, _MM_SHUFFLE(1,0,3,2))),
+                                                 _mm_cvtepi32_pd(_mm_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2)))));
+  return _mm_unpacklo_epi64(lo, hi);
+}
+
+// LUMA(r, g, b) / (1<<15) for each int32 lane, truncated towards zero.
+// Multiplying by 2^-15 is exact, like the division in the scalar code.
+SIMD_TARGET("sse2") static inline __m128i
+luma_sse2(__m128i r, __m128i g, __m128i b)
+{
+  const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(r), _mm_set1_ps(LUMA_RED_COEFF)),
+                                           _mm_mul_ps(_mm_cvtepi32_ps(g), _mm_set1_ps(LUMA_GREEN_COEFF))),
+                                _mm_mul_ps(_mm_cvtepi32_ps(b), _mm_set1_ps(LUMA_BLUE_COEFF)));
+  return _mm_cvttps_epi32(_mm_mul_ps(sum, _mm_set1_ps(1.0f/(1<<15))));
+}
+
+// Pack the low 16 bits of each int32 lane, without saturation
+SIMD_TARGET("sse2") static inline __m128i
+pack_low16_sse2(__m128i x, __m128i y)
+{
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(x, 16), 16),
+                         _mm_srai_epi32(_mm_slli_epi32(y, 16), 16));
+}
+
+// blend_pixel_Color() for four pixels
+SIMD_TARGET("sse2") static inline void
+blend_color_sse2(__m128i opa_a, __m128i *r, __m128i *g, __m128i *b, __m128i a,
+                 __m128i top_r, __m128i top_g, __m128i top_b, __m128i toplum)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1<<15);
+  const __m128i low16 = _mm_set1_epi32(0xffff);
+
+  // De-premult
+  const __m128i transparent = _mm_cmpeq_epi32(a, zero);
+  __m128i cr = _mm_andnot_si128(transparent, _mm_and_si128(div_epi32_sse2(_mm_slli_epi32(*r, 15), a), low16));
+  __m128i cg = _mm_andnot_si128(transparent, _mm_and_si128(div_epi32_sse2(_mm_slli_epi32(*g, 15), a), low16));
+  __m128i cb = _mm_andnot_si128(transparent, _mm_and_si128(div_epi32_sse2(_mm_slli_epi32(*b, 15), a), low16));
+
+  // Apply luminance, see set_rgb16_lum_from_rgb16()
+  const __m128i botlum = luma_sse2(cr, cg, cb);
+  const __m128i diff = _mm_srai_epi32(_mm_slli_epi32(_mm_sub_epi32(botlum, toplum), 16), 16);
+  cr = _mm_add_epi32(top_r, diff);
+  cg = _mm_add_epi32(top_g, diff);
+  cb = _mm_add_epi32(top_b, diff);
+
+  const __m128i lum = luma_sse2(cr, cg, cb);
+  const __m128i cmin = min_epi32_sse2(min_epi32_sse2(cr, cg), cb);
+  const __m128i cmax = max_epi32_sse2(max_epi32_sse2(cr, cg), cb);
+  const __m128i below = _mm_cmplt_epi32(cmin, zero);
+  if (_mm_movemask_epi8(below)) {
+    const __m128i d = _mm_sub_epi32(lum, cmin);
+    cr = select_epi32_sse2(below, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cr, lum), lum), d)), cr);
+    cg = select_epi32_sse2(below, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cg, lum), lum), d)), cg);
+    cb = select_epi32_sse2(below, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cb, lum), lum), d)), cb);
+  }
+  const __m128i above = _mm_cmpgt_epi32(cmax, one);
+  if (_mm_movemask_epi8(above)) {
+    const __m128i s = _mm_sub_epi32(one, lum);
+    const __m128i d = _mm_sub_epi32(cmax, lum);
+    cr = select_epi32_sse2(above, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cr, lum), s), d)), cr);
+    cg = select_epi32_sse2(above, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cg, lum), s), d)), cg);
+    cb = select_epi32_sse2(above, _mm_add_epi32(lum, div_epi32_sse2(mullo_epi32_sse2(_mm_sub_epi32(cb, lum), s), d)), cb);
+  }
+
+  // Re-premult
+  cr = _mm_and_si128(_mm_srli_epi32(mullo_epi32_sse2(_mm_and_si128(cr, low16), a), 15), low16);
+  cg = _mm_and_si128(_mm_srli_epi32(mullo_epi32_sse2(_mm_and_si128(cg, low16), a), 15), low16);
+  cb = _mm_and_si128(_mm_srli_epi32(mullo_epi32_sse2(_mm_and_si128(cb, low16), a), 15), low16);
+
+  // And combine as normal
+  const __m128i opa_b = _mm_sub_epi32(one, opa_a);
+  *r = _mm_srli_epi32(_mm_add_epi32(mullo_epi32_sse2(opa_a, cr), mullo_epi32_sse2(opa_b, *r)), 15);
+  *g = _mm_srli_epi32(_mm_add_epi32(mullo_epi32_sse2(opa_a, cg), mullo_epi32_sse2(opa_b, *g)), 15);
+  *b = _mm_srli_epi32(_mm_add_epi32(mullo_epi32_sse2(opa_a, cb), mullo_epi32_sse2(opa_b, *b)), 15);
+}
+
+SIMD_TARGET("sse2") static void
+draw_dab_spans_Color_sse2 (const DabMask *mask,
+                           uint16_t * rgba,
+                           uint16_t color_r,
+                           uint16_t color_g,
+                           uint16_t color_b,
+                           uint16_t opacity) {
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opacity_v = _mm_set1_epi32(opacity);
+  const __m128i top_r = _mm_set1_epi32(color_r);
+  const __m128i top_g = _mm_set1_epi32(color_g);
+  const __m128i top_b = _mm_set1_epi32(color_b);
+  const uint16_t toplum = LUMA(color_r, color_g, color_b) / (1<<15);
+  const __m128i toplum_v = _mm_set1_epi32(toplum);
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 4) {
+      // Same handling of the row ends as in draw_dab_spans_linear_sse2()
+      const int xs = MIN(x, mask->size-4);
+      __m128i opa = _mm_loadl_epi64((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 4 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      const __m128i opa_a = _mm_srli_epi32(mullo_epi32_sse2(_mm_unpacklo_epi16(opa, zero), opacity_v), 15);
+
+      // One pixel per register, transposed to one channel per register
+      __m128i * p = (__m128i *)(rgba_p + 4*xs);
+      const __m128i dst0 = _mm_loadu_si128(p);
+      const __m128i dst1 = _mm_loadu_si128(p + 1);
+      const __m128i p0 = _mm_unpacklo_epi16(dst0, zero);
+      const __m128i p1 = _mm_unpackhi_epi16(dst0, zero);
+      const __m128i p2 = _mm_unpacklo_epi16(dst1, zero);
+      const __m128i p3 = _mm_unpackhi_epi16(dst1, zero);
+      const __m128i t0 = _mm_unpacklo_epi32(p0, p1);
+      const __m128i t1 = _mm_unpackhi_epi32(p0, p1);
+      const __m128i t2 = _mm_unpacklo_epi32(p2, p3);
+      const __m128i t3 = _mm_unpackhi_epi32(p2, p3);
+      __m128i r = _mm_unpacklo_epi64(t0, t2);
+      __m128i g = _mm_unpackhi_epi64(t0, t2);
+      __m128i b = _mm_unpacklo_epi64(t1, t3);
+      const __m128i a = _mm_unpackhi_epi64(t1, t3);
+
+      blend_color_sse2(opa_a, &r, &g, &b, a, top_r, top_g, top_b, toplum_v);
+
+      const __m128i u0 = _mm_unpacklo_epi32(r, g);
+      const __m128i u1 = _mm_unpackhi_epi32(r, g);
+      const __m128i u2 = _mm_unpacklo_epi32(b, a);
+      const __m128i u3 = _mm_unpackhi_epi32(b, a);
+      _mm_storeu_si128(p, pack_low16_sse2(_mm_unpacklo_epi64(u0, u2), _mm_unpackhi_epi64(u0, u2)));
+      _mm_storeu_si128(p + 1, pack_low16_sse2(_mm_unpacklo_epi64(u1, u3), _mm_unpackhi_epi64(u1, u3)));
+    }
+  }
+}
+
+// n/d for each int32 lane, truncated towards zero
+SIMD_TARGET("avx2") static inline __m256i
+div_epi32_avx2(__m256i n, __m256i d)
+{
+  const __m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(n)),
+                                                       _mm256_cvtepi32_pd(_mm256_castsi256_si128(d))));
+  const __m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(n, 1)),
+                                                       _mm256_cvtepi32_pd(_mm256_extracti128_si256(d, 1))));
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// LUMA(r, g, b) / (1<<15) for each int32 lane, truncated towards zero
+SIMD_TARGET("avx2") static inline __m256i
+luma_avx2(__m256i r, __m256i g, __m256i b)
+{
+  const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(r), _mm256_set1_ps(LUMA_RED_COEFF)),
+                                                 _mm256_mul_ps(_mm256_cvtepi32_ps(g), _mm256_set1_ps(LUMA_GREEN_COEFF))),
+                                   _mm256_mul_ps(_mm256_cvtepi32_ps(b), _mm256_set1_ps(LUMA_BLUE_COEFF)));
+  return _mm256_cvttps_epi32(_mm256_mul_ps(sum, _mm256_set1_ps(1.0f/(1<<15))));
+}
+
+SIMD_TARGET("avx2") static inline __m256i
+pack_low16_avx2(__m256i x, __m256i y)
+{
+  return _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16),
+                            _mm256_srai_epi32(_mm256_slli_epi32(y, 16), 16));
+}
+
+// blend_pixel_Color() for eight pixels
+SIMD_TARGET("avx2") static inline void
+blend_color_avx2(__m256i opa_a, __m256i *r, __m256i *g, __m256i *b, __m256i a,
+                 __m256i top_r, __m256i top_g, __m256i top_b, __m256i toplum)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1<<15);
+  const __m256i low16 = _mm256_set1_epi32(0xffff);
+
+  // De-premult
+  const __m256i transparent = _mm256_cmpeq_epi32(a, zero);
+  __m256i cr = _mm256_andnot_si256(transparent, _mm256_and_si256(div_epi32_avx2(_mm256_slli_epi32(*r, 15), a), low16));
+  __m256i cg = _mm256_andnot_si256(transparent, _mm256_and_si256(div_epi32_avx2(_mm256_slli_epi32(*g, 15), a), low16));
+  __m256i cb = _mm256_andnot_si256(transparent, _mm256_and_si256(div_epi32_avx2(_mm256_slli_epi32(*b, 15), a), low16));
+
+  // Apply luminance, see set_rgb16_lum_from_rgb16()
+  const __m256i botlum = luma_avx2(cr, cg, cb);
+  const __m256i diff = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_sub_epi32(botlum, toplum), 16), 16);
+  cr = _mm256_add_epi32(top_r, diff);
+  cg = _mm256_add_epi32(top_g, diff);
+  cb = _mm256_add_epi32(top_b, diff);
+
+  const __m256i lum = luma_avx2(cr, cg, cb);
+  const __m256i cmin = _mm256_min_epi32(_mm256_min_epi32(cr, cg), cb);
+  const __m256i cmax = _mm256_max_epi32(_mm256_max_epi32(cr, cg), cb);
+  const __m256i below = _mm256_cmpgt_epi32(zero, cmin);
+  if (_mm256_movemask_epi8(below)) {
+    const __m256i d = _mm256_sub_epi32(lum, cmin);
+    cr = _mm256_blendv_epi8(cr, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cr, lum), lum), d)), below);
+    cg = _mm256_blendv_epi8(cg, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cg, lum), lum), d)), below);
+    cb = _mm256_blendv_epi8(cb, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cb, lum), lum), d)), below);
+  }
+  const __m256i above = _mm256_cmpgt_epi32(cmax, one);
+  if (_mm256_movemask_epi8(above)) {
+    const __m256i s = _mm256_sub_epi32(one, lum);
+    const __m256i d = _mm256_sub_epi32(cmax, lum);
+    cr = _mm256_blendv_epi8(cr, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cr, lum), s), d)), above);
+    cg = _mm256_blendv_epi8(cg, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cg, lum), s), d)), above);
+    cb = _mm256_blendv_epi8(cb, _mm256_add_epi32(lum, div_epi32_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(cb, lum), s), d)), above);
+  }
+
+  // Re-premult
+  cr = _mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(cr, low16), a), 15), low16);
+  cg = _mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(cg, low16), a), 15), low16);
+  cb = _mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(cb, low16), a), 15), low16);
+
+  // And combine as normal
+  const __m256i opa_b = _mm256_sub_epi32(one, opa_a);
+  *r = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(opa_a, cr), _mm256_mullo_epi32(opa_b, *r)), 15);
+  *g = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(opa_a, cg), _mm256_mullo_epi32(opa_b, *g)), 15);
+  *b = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(opa_a, cb), _mm256_mullo_epi32(opa_b, *b)), 15);
+}
+
+SIMD_TARGET("avx2") static void
+draw_dab_spans_Color_avx2 (const DabMask *mask,
+                           uint16_t * rgba,
+                           uint16_t color_r,
+                           uint16_t color_g,
+                           uint16_t color_b,
+                           uint16_t opacity) {
+
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i opacity_v = _mm256_set1_epi32(opacity);
+  const __m256i top_r = _mm256_set1_epi32(color_r);
+  const __m256i top_g = _mm256_set1_epi32(color_g);
+  const __m256i top_b = _mm256_set1_epi32(color_b);
+  const uint16_t toplum = LUMA(color_r, color_g, color_b) / (1<<15);
+  const __m256i toplum_v = _mm256_set1_epi32(toplum);
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  // The transposition below keeps the pixels of each 128 bit lane together,
+  // so the channel vectors hold the pixels in this order.
+  const __m256i pixel_order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 8) {
+      // Same handling of the row ends as in draw_dab_spans_linear_avx2()
+      const int xs = MIN(x, mask->size-8);
+      __m128i opa = _mm_loadu_si128((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 8 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      const __m256i opa_v = _mm256_permutevar8x32_epi32(_mm256_cvtepu16_epi32(opa), pixel_order);
+      const __m256i opa_a = _mm256_srli_epi32(_mm256_mullo_epi32(opa_v, opacity_v), 15);
+
+      __m256i * p = (__m256i *)(rgba_p + 4*xs);
+      const __m256i dst0 = _mm256_loadu_si256(p);
+      const __m256i dst1 = _mm256_loadu_si256(p + 1);
+      const __m256i p0 = _mm256_unpacklo_epi16(dst0, zero);
+      const __m256i p1 = _mm256_unpackhi_epi16(dst0, zero);
+      const __m256i p2 = _mm256_unpacklo_epi16(dst1, zero);
+      const __m256i p3 = _mm256_unpackhi_epi16(dst1, zero);
+      const __m256i t0 = _mm256_unpacklo_epi32(p0, p1);
+      const __m256i t1 = _mm256_unpackhi_epi32(p0, p1);
+      const __m256i t2 = _mm256_unpacklo_epi32(p2, p3);
+      const __m256i t3 = _mm256_unpackhi_epi32(p2, p3);
+      __m256i r = _mm256_unpacklo_epi64(t0, t2);
+      __m256i g = _mm256_unpackhi_epi64(t0, t2);
+      __m256i b = _mm256_unpacklo_epi64(t1, t3);
+      const __m256i a = _mm256_unpackhi_epi64(t1, t3);
+
+      blend_color_avx2(opa_a, &r, &g, &b, a, top_r, top_g, top_b, toplum_v);
+
+      const __m256i u0 = _mm256_unpacklo_epi32(r, g);
+      const __m256i u1 = _mm256_unpackhi_epi32(r, g);
+      const __m256i u2 = _mm256_unpacklo_epi32(b, a);
+      const __m256i u3 = _mm256_unpackhi_epi32(b, a);
+      _mm256_storeu_si256(p, pack_low16_avx2(_mm256_unpacklo_epi64(u0, u2), _mm256_unpackhi_epi64(u0, u2)));
+      _mm256_storeu_si256(p + 1, pack_low16_avx2(_mm256_unpacklo_epi64(u1, u3), _mm256_unpackhi_epi64(u1, u3)));
+    }
+  }
+}
+
+#endif // SIMD_X86
+
+void draw_dab_spans_BlendMode_Normal (const DabMask * mask,
+                                      uint16_t * rgba,
+                                      uint16_t color_r,
+                                      uint16_t color_g,
+                                      uint16_t color_b,
+                                      uint16_t opacity) {
+#ifdef SIMD_X86
+  switch (simd_level_get()) {
+  case SIMD_LEVEL_AVX2:
+    draw_dab_spans_Normal_avx2(mask, rgba, color_r, color_g, color_b, 1<<15, opacity);
+    return;
+  case SIMD_LEVEL_SSE2:
+    draw_dab_spans_Normal_sse2(mask, rgba, color_r, color_g, color_b, 1<<15, opacity);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    for (int x = mask->x0[y]; x < mask->x1[y]; x++) {
+      blend_pixel_Normal(opa_p[x], rgba_p + 4*x, color_r, color_g, color_b, opacity);
+    }
+  }
+}
+
+// The scalar code skips pixels with zero coverage, like the run length encoding did.
+void draw_dab_spans_BlendMode_Color (const DabMask * mask,
+                                     uint16_t * rgba,
+                                     uint16_t color_r,
+                                     uint16_t color_g,
+                                     uint16_t color_b,
+                                     uint16_t opacity) {
+#ifdef SIMD_X86
+  switch (simd_level_get()) {
+  case SIMD_LEVEL_AVX2:
+    draw_dab_spans_Color_avx2(mask, rgba, color_r, color_g, color_b, opacity);
+    return;
+  case SIMD_LEVEL_SSE2:
+    draw_dab_spans_Color_sse2(mask, rgba, color_r, color_g, color_b, opacity);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    for (int x = mask->x0[y]; x < mask->x1[y]; x++) {
+      if (opa_p[x]) {
+        blend_pixel_Color(opa_p[x], rgba_p + 4*x, color_r, color_g, color_b, opacity);
+      }
+    }
+  }
+}
+
+void draw_dab_spans_BlendMode_Normal_and_Eraser (const DabMask * mask,
+                                                 uint16_t * rgba,
+                                                 uint16_t color_r,
+                                                 uint16_t color_g,
+                                                 uint16_t color_b,
+                                                 uint16_t color_a,
+                                                 uint16_t opacity) {
+#ifdef SIMD_X86
+  switch (simd_level_get()) {
+  case SIMD_LEVEL_AVX2:
+    draw_dab_spans_Normal_and_Eraser_avx2(mask, rgba, color_r, color_g, color_b, color_a, opacity);
+    return;
+  case SIMD_LEVEL_SSE2:
+    draw_dab_spans_Normal_and_Eraser_sse2(mask, rgba, color_r, color_g, color_b, color_a, opacity);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    for (int x = mask->x0[y]; x < mask->x1[y]; x++) {
+      blend_pixel_Normal_and_Eraser(opa_p[x], rgba_p + 4*x, color_r, color_g, color_b, color_a, opacity);
+    }
+  }
+}
+
+void draw_dab_spans_BlendMode_LockAlpha (const DabMask * mask,
+                                         uint16_t * rgba,
+                                         uint16_t color_r,
+                                         uint16_t color_g,
+                                         uint16_t color_b,
+                                         uint16_t opacity) {
+#ifdef SIMD_X86
+  switch (simd_level_get()) {
+  case SIMD_LEVEL_AVX2:
+    draw_dab_spans_LockAlpha_avx2(mask, rgba, color_r, color_g, color_b, 1<<15, opacity);
+    return;
+  case SIMD_LEVEL_SSE2:
+    draw_dab_spans_LockAlpha_sse2(mask, rgba, color_r, color_g, color_b, 1<<15, opacity);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    uint16_t * rgba_p = rgba + y*mask->size*4;
+    for (int x = mask->x0[y]; x < mask->x1[y]; x++) {
+      blend_pixel_LockAlpha(opa_p[x], rgba_p + 4*x, color_r, color_g, color_b, opacity);
+    }
+  }
+}
+
+
 // Sum up the color/alpha components inside the masked region.
 // Called by get_color().
 //
@@ -263,7 +968,7 @@ void get_color_pixels_accumulate (uint16_t * mask,
                                   ) {
 
 
-  // The sum of a 64x64 tile fits into a 32 bit integer, but the sum
+  // The sum of a tile (up to 256x256) fits into a 32 bit integer, but the sum
   // of an arbitrary number of tiles may not fit. We assume that we
   // are processing a single tile at a time, so we can use integers.
   // But for the result we need floats.
@@ -297,3 +1002,138 @@ void get_color_pixels_accumulate (uint16_t * mask,
   *sum_a += a;
 };
 
+
+
+// Dense (span) version of get_color_pixels_accumulate().
+//
+// Adds the sums of the masked region to @sums (weight, r, g, b, a), with
+// the same 32 bit integer arithmetic, so results are identical. Keeping the
+// sums as integers lets the caller add up the tiles in a fixed order.
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2") static void
+get_color_spans_accumulate_sse2 (const DabMask * mask,
+                                 const uint16_t * rgba,
+                                 uint32_t sums[5]) {
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  __m128i weight = zero; // one lane per pixel
+  __m128i color = zero; // r, g, b, a
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    const uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 4) {
+      // Same handling of the last vector as in draw_dab_spans_linear_sse2()
+      const int xs = MIN(x, mask->size-4);
+      __m128i opa = _mm_loadl_epi64((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 4 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      weight = _mm_add_epi32(weight, _mm_unpacklo_epi16(opa, zero));
+
+      const __m128i a = _mm_unpacklo_epi16(opa, opa);
+      const __m128i * p = (const __m128i *)(rgba_p + 4*xs);
+      for (int i = 0; i < 2; i++) {
+        const __m128i a_i = i ? _mm_unpackhi_epi32(a, a) : _mm_unpacklo_epi32(a, a);
+        // opa <= 1<<15, so the products fit into 16 bits
+        const __m128i product = mul_fix15_sse2(a_i, _mm_loadu_si128(p + i));
+        color = _mm_add_epi32(color, _mm_unpacklo_epi16(product, zero));
+        color = _mm_add_epi32(color, _mm_unpackhi_epi16(product, zero));
+      }
+    }
+  }
+
+  uint32_t w[4], c[4];
+  _mm_storeu_si128((__m128i *)w, weight);
+  _mm_storeu_si128((__m128i *)c, color);
+  sums[0] += w[0] + w[1] + w[2] + w[3];
+  for (int i = 0; i < 4; i++) {
+    sums[1+i] += c[i];
+  }
+}
+
+SIMD_TARGET("avx2") static void
+get_color_spans_accumulate_avx2 (const DabMask * mask,
+                                 const uint16_t * rgba,
+                                 uint32_t sums[5]) {
+
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i expand[2] = {EXPAND_PIXELS_0123_AVX2, EXPAND_PIXELS_4567_AVX2};
+  const __m128i lane_index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i weight = zero; // one lane per pixel
+  __m256i color = zero; // r, g, b, a, r, g, b, a
+
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    const uint16_t * rgba_p = rgba + y*mask->size*4;
+    const int x1 = mask->x1[y];
+
+    for (int x = mask->x0[y]; x < x1; x += 8) {
+      // Same handling of the last vector as in draw_dab_spans_linear_avx2()
+      const int xs = MIN(x, mask->size-8);
+      __m128i opa = _mm_loadu_si128((const __m128i *)(opa_p + xs));
+      if (xs != x || x + 8 > x1) {
+        const __m128i index = _mm_add_epi16(_mm_set1_epi16(xs), lane_index);
+        opa = _mm_and_si128(opa, _mm_and_si128(_mm_cmpgt_epi16(index, _mm_set1_epi16(x-1)),
+                                               _mm_cmplt_epi16(index, _mm_set1_epi16(x1))));
+      }
+      weight = _mm256_add_epi32(weight, _mm256_cvtepu16_epi32(opa));
+
+      const __m256i a = _mm256_broadcastsi128_si256(opa);
+      const __m256i * p = (const __m256i *)(rgba_p + 4*xs);
+      for (int i = 0; i < 2; i++) {
+        const __m256i a_i = _mm256_shuffle_epi8(a, expand[i]);
+        const __m256i product = mul_fix15_avx2(a_i, _mm256_loadu_si256(p + i));
+        color = _mm256_add_epi32(color, _mm256_unpacklo_epi16(product, zero));
+        color = _mm256_add_epi32(color, _mm256_unpackhi_epi16(product, zero));
+      }
+    }
+  }
+
+  uint32_t w[8], c[8];
+  _mm256_storeu_si256((__m256i *)w, weight);
+  _mm256_storeu_si256((__m256i *)c, color);
+  sums[0] += w[0] + w[1] + w[2] + w[3] + w[4] + w[5] + w[6] + w[7];
+  for (int i = 0; i < 4; i++) {
+    sums[1+i] += c[i] + c[4+i];
+  }
+}
+
+#endif // SIMD_X86
+
+void get_color_spans_accumulate (const DabMask * mask,
+                                 const uint16_t * rgba,
+                                 uint32_t sums[5]) {
+#ifdef SIMD_X86
+  switch (simd_level_get()) {
+  case SIMD_LEVEL_AVX2:
+    get_color_spans_accumulate_avx2(mask, rgba, sums);
+    return;
+  case SIMD_LEVEL_SSE2:
+    get_color_spans_accumulate_sse2(mask, rgba, sums);
+    return;
+  default:
+    break;
+  }
+#endif
+  for (int y = mask->y0; y < mask->y1; y++) {
+    const uint16_t * opa_p = mask->opa + y*mask->size;
+    const uint16_t * rgba_p = rgba + y*mask->size*4;
+    for (int x = mask->x0[y]; x < mask->x1[y]; x++) {
+      const uint32_t opa = opa_p[x];
+      const uint16_t * pixel = rgba_p + 4*x;
+      sums[0] += opa;
+      sums[1] += opa*pixel[0]/(1<<15);
+      sums[2] += opa*pixel[1]/(1<<15);
+      sums[3] += opa*pixel[2]/(1<<15);
+      sums[4] += opa*pixel[3]/(1<<15);
+    }
+  }
+}
@@ -1,6 +1,10 @@
 #ifndef BRUSHMODES_H
 #define BRUSHMODES_H
 
+#include <stdint.h>
+
+#include "dabmask.h"
+
 void draw_dab_pixels_BlendMode_Normal (uint16_t * mask,
                                        uint16_t * rgba,
                                        uint16_t color_r,
@@ -27,6 +31,33 @@ void draw_dab_pixels_BlendMode_LockAlpha (uint16_t * mask,
                                           uint16_t color_g,
                                           uint16_t color_b,
                                           uint16_t opacity);
+
+void draw_dab_spans_BlendMode_Normal (const DabMask * mask,
+                                      uint16_t * rgba,
+                                      uint16_t color_r,
+                                      uint16_t color_g,
+                                      uint16_t color_b,
+                                      uint16_t opacity);
+void draw_dab_spans_BlendMode_Color (const DabMask * mask,
+                                     uint16_t * rgba,
+                                     uint16_t color_r,
+                                     uint16_t color_g,
+                                     uint16_t color_b,
+                                     uint16_t opacity);
+void draw_dab_spans_BlendMode_Normal_and_Eraser (const DabMask * mask,
+                                                 uint16_t * rgba,
+                                                 uint16_t color_r,
+                                                 uint16_t color_g,
+                                                 uint16_t color_b,
+                                                 uint16_t color_a,
+                                                 uint16_t opacity);
+void draw_dab_spans_BlendMode_LockAlpha (const DabMask * mask,
+                                         uint16_t * rgba,
+                                         uint16_t color_r,
+                                         uint16_t color_g,
+                                         uint16_t color_b,
+                                         uint16_t opacity);
+
 void get_color_pixels_accumulate (uint16_t * mask,
                                   uint16_t * rgba,
                                   float * sum_weight,
@@ -35,6 +66,9 @@ void get_color_pixels_accumulate (uint16_t * mask,
                                   float * sum_b,
                                   float * sum_a
                                   );
+void get_color_spans_accumulate (const DabMask * mask,
+                                 const uint16_t * rgba,
+                                 uint32_t sums[5]);
 
 
 
@@ -0,0 +1,225 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "brushprogram.h"
+
+struct _BrushProgram {
+    int settings_n;
+    int inputs_n;
+    float *base_values;
+    gboolean *inputs_used;
+    // Ordered by setting, then by input, so that the values are summed up
+    // in the same order as by mapping_calculate()
+    BrushProgramCurve *curves;
+    int curves_n;
+};
+
+BrushProgram *
+brush_program_new(int settings_n, int inputs_n)
+{
+    BrushProgram *self = (BrushProgram *)malloc(sizeof(BrushProgram));
+
+    self->settings_n = settings_n;
+    self->inputs_n = inputs_n;
+    self->base_values = (float *)calloc(settings_n, sizeof(float));
+    self->inputs_used = (gboolean *)calloc(inputs_n, sizeof(gboolean));
+    // Enough for every setting to use every input
+    self->curves = (BrushProgramCurve *)malloc(settings_n*inputs_n*sizeof(BrushProgramCurve));
+    self->curves_n = 0;
+
+    return self;
+}
+
+void
+brush_program_free(BrushProgram *self)
+{
+    free(self->base_values);
+    free(self->inputs_used);
+    free(self->curves);
+    free(self);
+}
+
+static void
+curve_update_widths(BrushProgramCurve *curve)
+{
+    curve->widths[0] = 0.0f;
+    for (int p = 1; p < curve->n; p++) {
+        curve->widths[p] = curve->xvalues[p] - curve->xvalues[p-1];
+    }
+}
+
+// Finite points with increasing (or equal) x values, like the ones of a Mapping
+static gboolean
+curve_points_valid(const BrushProgramCurve *curve)
+{
+    for (int p = 0; p < curve->n; p++) {
+        if (!isfinite(curve->xvalues[p]) || !isfinite(curve->yvalues[p])) {
+            return FALSE;
+        }
+        if (p > 0 && curve->xvalues[p] < curve->xvalues[p-1]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Compile the dynamics of @settings, one Mapping per setting
+ *
+ * Concurrency: This function is not thread-safe on the same @self instance. */
+void
+brush_program_compile(BrushProgram *self, Mapping **settings)
+{
+    self->curves_n = 0;
+    for (int j = 0; j < self->inputs_n; j++) {
+        self->inputs_used[j] = FALSE;
+    }
+
+    for (int i = 0; i < self->settings_n; i++) {
+        Mapping *mapping = settings[i];
+        self->base_values[i] = mapping_get_base_value(mapping);
+        if (mapping_is_constant(mapping)) {
+            continue;
+        }
+
+        for (int j = 0; j < self->inputs_n; j++) {
+            const int n = mapping_get_n(mapping, j);
+            if (n == 0) {
+                continue;
+            }
+            assert(n >= 2 && n <= BRUSH_PROGRAM_CURVE_MAX_POINTS);
+
+            BrushProgramCurve *curve = &self->curves[self->curves_n++];
+            curve->setting = i;
+            curve->input = j;
+            curve->n = n;
+            for (int p = 0; p < n; p++) {
+                mapping_get_point(mapping, j, p, &curve->xvalues[p], &curve->yvalues[p]);
+            }
+            curve_update_widths(curve);
+            self->inputs_used[j] = TRUE;
+        }
+    }
+}
+
+/* Use a program compiled before, e.g. stored in a brush pack
+ * @base_values: one per setting
+ * @curves: as returned by brush_program_get_curves()
+ *
+ * The widths of the curves are calculated from their x values again,
+ * the stored ones are not used.
+ *
+ * Returns: FALSE if the curves are invalid, the program is unchanged then. */
+gboolean
+brush_program_load(BrushProgram *self, const float *base_values,
+                   const BrushProgramCurve *curves, int curves_n)
+{
+    if (curves_n < 0 || curves_n > self->settings_n*self->inputs_n) {
+        return FALSE;
+    }
+    for (int c = 0; c < curves_n; c++) {
+        const BrushProgramCurve *curve = &curves[c];
+        if (curve->setting < 0 || curve->setting >= self->settings_n
+            || curve->input < 0 || curve->input >= self->inputs_n
+            || curve->n < 2 || curve->n > BRUSH_PROGRAM_CURVE_MAX_POINTS
+            || !curve_points_valid(curve)) {
+            return FALSE;
+        }
+        // The order of brush_program_compile(), which sums up like mapping_calculate()
+        if (c > 0 && (curve->setting < curves[c-1].setting
+                      || (curve->setting == curves[c-1].setting && curve->input <= curves[c-1].input))) {
+            return FALSE;
+        }
+    }
+
+    memcpy(self->base_values, base_values, self->settings_n*sizeof(float));
+    memcpy(self->curves, curves, curves_n*sizeof(BrushProgramCurve));
+    self->curves_n = curves_n;
+    for (int c = 0; c < curves_n; c++) {
+        curve_update_widths(&self->curves[c]);
+    }
+    for (int j = 0; j < self->inputs_n; j++) {
+        self->inputs_used[j] = FALSE;
+    }
+    for (int c = 0; c < curves_n; c++) {
+        self->inputs_used[curves[c].input] = TRUE;
+    }
+    return TRUE;
+}
+
+// Whether any setting depends on @input. Unused inputs need not be calculated.
+gboolean
+brush_program_uses_input(BrushProgram *self, int input)
+{
+    assert(input >= 0 && input < self->inputs_n);
+    return self->inputs_used[input];
+}
+
+int
+brush_program_get_curves_n(BrushProgram *self)
+{
+    return self->curves_n;
+}
+
+const BrushProgramCurve *
+brush_program_get_curves(BrushProgram *self)
+{
+    return self->curves;
+}
+
+const float *
+brush_program_get_base_values(BrushProgram *self)
+{
+    return self->base_values;
+}
+
+/* Calculate the value of each setting from @inputs
+ * Only the inputs used by the program are read.
+ *
+ * Concurrency: This function is reentrant on the same @self instance. */
+void
+brush_program_evaluate(BrushProgram *self, const float *inputs, float *values_out)
+{
+    memcpy(values_out, self->base_values, self->settings_n*sizeof(float));
+
+    for (int c = 0; c < self->curves_n; c++) {
+        const BrushProgramCurve *curve = &self->curves[c];
+        const float x = inputs[curve->input];
+
+        // find the segment with the slope that we need to use
+        int i = 1;
+        while (i < curve->n - 1 && x > curve->xvalues[i]) {
+            i++;
+        }
+        const float x0 = curve->xvalues[i-1];
+        const float y0 = curve->yvalues[i-1];
+        const float x1 = curve->xvalues[i];
+        const float y1 = curve->yvalues[i];
+
+        float y;
+        if (x0 == x1) {
+            y = y0;
+        } else {
+            // linear interpolation, exactly as in mapping_calculate()
+            y = (y1*(x - x0) + y0*(x1 - x)) / curve->widths[i];
+        }
+
+        values_out[curve->setting] += y;
+    }
+}
@@ -0,0 +1,80 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BRUSHPROGRAM_H
+#define BRUSHPROGRAM_H
+
+#include <stdint.h>
+
+#include <mypaint-glib-compat.h>
+
+#include "mapping.h"
+
+G_BEGIN_DECLS
+
+// The dynamics of all settings of a brush, compiled into a flat list of
+// the input curves which are actually used. Evaluating the program gives
+// the same values as mapping_calculate() on each setting, but skips the
+// constant settings and the unused inputs.
+//
+// The program is a snapshot: it must be compiled again after the base
+// values or the mappings of the settings change.
+typedef struct _BrushProgram BrushProgram;
+
+// Same limit as the control points of a Mapping
+#define BRUSH_PROGRAM_CURVE_MAX_POINTS 8
+
+// One input curve of one setting. Fixed size types, curves are stored
+// as they are in brush packs (see mypaint-brush-pack.c).
+typedef struct {
+    int32_t setting;
+    int32_t input;
+    int32_t n; // control points, at least 2
+    float xvalues[BRUSH_PROGRAM_CURVE_MAX_POINTS];
+    float yvalues[BRUSH_PROGRAM_CURVE_MAX_POINTS];
+    float widths[BRUSH_PROGRAM_CURVE_MAX_POINTS]; // xvalues[i] - xvalues[i-1], the denominator of the interpolation
+} BrushProgramCurve;
+
+BrushProgram *
+brush_program_new(int settings_n, int inputs_n);
+
+void
+brush_program_free(BrushProgram *self);
+
+void
+brush_program_compile(BrushProgram *self, Mapping **settings);
+
+gboolean
+brush_program_load(BrushProgram *self, const float *base_values,
+                   const BrushProgramCurve *curves, int curves_n);
+
+gboolean
+brush_program_uses_input(BrushProgram *self, int input);
+
+int
+brush_program_get_curves_n(BrushProgram *self);
+
+const BrushProgramCurve *
+brush_program_get_curves(BrushProgram *self);
+
+const float *
+brush_program_get_base_values(BrushProgram *self);
+
+void
+brush_program_evaluate(BrushProgram *self, const float *inputs, float *values_out);
+
+G_END_DECLS
+
+#endif // BRUSHPROGRAM_H
@@ -0,0 +1,593 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+
+#include "colorconv.h"
+#include "helpers.h"
+#include "simd.h"
+
+// The SIMD kernels give exactly the results of helpers.c, so that
+// strokes do not depend on the CPU they are painted with:
+//  - The branches of the scalar code become masks and blends, including
+//    its handling of NaN (comparisons with NaN are false).
+//  - _mm_min_ps(a, b) is a<b?a:b and _mm_max_ps(a, b) is a>b?a:b, like MIN and MAX.
+//  - Where helpers.c computes with doubles, so do the kernels. A single
+//    double operation on floats, rounded to float, equals the float
+//    operation, so those are done with floats.
+// The kernels return how many colors they converted, the remaining
+// ones are converted with the scalar functions.
+
+// rgb_to_hsv_float() compares the float delta with the double 0.0001
+static float
+hsv_delta_threshold(void)
+{
+    float threshold = (float)0.0001;
+    if ((double)threshold > 0.0001) {
+        threshold = nextafterf(threshold, 0.0f);
+    }
+    return threshold; // delta > threshold is (double)delta > 0.0001
+}
+
+#ifdef SIMD_X86
+
+/* SSE2: four floats, or two doubles at a time */
+
+SIMD_TARGET("sse2") static inline __m128
+select_ps_sse2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+SIMD_TARGET("sse2") static inline __m128d
+select_pd_sse2(__m128d mask, __m128d a, __m128d b)
+{
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+SIMD_TARGET("sse2") static inline __m128
+clamp01_sse2(__m128 x)
+{
+    return _mm_max_ps(_mm_setzero_ps(), _mm_min_ps(_mm_set1_ps(1.0f), x));
+}
+
+// h - floor(h). SSE2 has no floor instruction: round to an integer by
+// adding and subtracting 2^23, then correct the rounding up.
+SIMD_TARGET("sse2") static inline __m128
+fract_sse2(__m128 h)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 two23 = _mm_set1_ps(8388608.0f);
+    const __m128 big = _mm_cmpge_ps(_mm_andnot_ps(sign, h), two23); // integers already
+    const __m128 magic = _mm_or_ps(_mm_and_ps(h, sign), two23);
+    __m128 rounded = _mm_sub_ps(_mm_add_ps(h, magic), magic);
+    rounded = _mm_or_ps(rounded, _mm_and_ps(h, sign)); // floor(-0.0) is -0.0
+    rounded = _mm_sub_ps(rounded, _mm_and_ps(_mm_cmpgt_ps(rounded, h), _mm_set1_ps(1.0f)));
+    return _mm_sub_ps(h, select_ps_sse2(big, h, rounded));
+}
+
+SIMD_TARGET("sse2") static inline __m128d
+lo_pd_sse2(__m128 x)
+{
+    return _mm_cvtps_pd(x);
+}
+
+SIMD_TARGET("sse2") static inline __m128d
+hi_pd_sse2(__m128 x)
+{
+    return _mm_cvtps_pd(_mm_movehl_ps(x, x));
+}
+
+SIMD_TARGET("sse2") static inline __m128
+pack_ps_sse2(__m128d lo, __m128d hi)
+{
+    return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+
+SIMD_TARGET("sse2") static int
+rgb_to_hsv_sse2(const float *r_, const float *g_, const float *b_,
+                float *h_, float *s_, float *v_, int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 threshold = _mm_set1_ps(hsv_delta_threshold());
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        const __m128 r = clamp01_sse2(_mm_loadu_ps(r_ + i));
+        const __m128 g = clamp01_sse2(_mm_loadu_ps(g_ + i));
+        const __m128 b = clamp01_sse2(_mm_loadu_ps(b_ + i));
+        const __m128 max = select_ps_sse2(_mm_cmpgt_ps(r, g), _mm_max_ps(r, b), _mm_max_ps(g, b));
+        const __m128 min = select_ps_sse2(_mm_cmplt_ps(r, g), _mm_min_ps(r, b), _mm_min_ps(g, b));
+        const __m128 delta = _mm_sub_ps(max, min);
+        const __m128 chromatic = _mm_cmpgt_ps(delta, threshold);
+
+        __m128 h_r = _mm_div_ps(_mm_sub_ps(g, b), delta);
+        h_r = select_ps_sse2(_mm_cmplt_ps(h_r, zero), _mm_add_ps(h_r, _mm_set1_ps(6.0f)), h_r);
+        const __m128 h_g = _mm_add_ps(_mm_set1_ps(2.0f), _mm_div_ps(_mm_sub_ps(b, r), delta));
+        const __m128 h_b = _mm_add_ps(_mm_set1_ps(4.0f), _mm_div_ps(_mm_sub_ps(r, g), delta));
+        __m128 h = select_ps_sse2(_mm_cmpeq_ps(b, max), h_b, zero);
+        h = select_ps_sse2(_mm_cmpeq_ps(g, max), h_g, h);
+        h = select_ps_sse2(_mm_cmpeq_ps(r, max), h_r, h);
+        h = _mm_div_ps(h, _mm_set1_ps(6.0f));
+
+        _mm_storeu_ps(h_ + i, _mm_and_ps(chromatic, h));
+        _mm_storeu_ps(s_ + i, _mm_and_ps(chromatic, _mm_div_ps(delta, max)));
+        _mm_storeu_ps(v_ + i, max);
+    }
+    return i;
+}
+
+// h in [0, 1], s and v clamped
+SIMD_TARGET("sse2") static inline void
+hsv_to_rgb_pd_sse2(__m128d h, __m128d s, __m128d v, __m128d *r, __m128d *g, __m128d *b)
+{
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d hue = _mm_mul_pd(select_pd_sse2(_mm_cmpeq_pd(h, one), _mm_setzero_pd(), h),
+                                   _mm_set1_pd(6.0));
+    const __m128d i = _mm_cvtepi32_pd(_mm_cvttpd_epi32(hue));
+    const __m128d f = _mm_sub_pd(hue, i);
+    const __m128d w = _mm_mul_pd(v, _mm_sub_pd(one, s));
+    const __m128d q = _mm_mul_pd(v, _mm_sub_pd(one, _mm_mul_pd(s, f)));
+    const __m128d t = _mm_mul_pd(v, _mm_sub_pd(one, _mm_mul_pd(s, _mm_sub_pd(one, f))));
+
+    __m128d e[6];
+    for (int k = 0; k < 6; k++) {
+        e[k] = _mm_cmpeq_pd(i, _mm_set1_pd(k));
+    }
+    // The cases of the switch in hsv_to_rgb_float(), zero for none of them
+    *r = _mm_or_pd(_mm_or_pd(_mm_and_pd(_mm_or_pd(e[0], e[5]), v), _mm_and_pd(e[1], q)),
+                   _mm_or_pd(_mm_and_pd(_mm_or_pd(e[2], e[3]), w), _mm_and_pd(e[4], t)));
+    *g = _mm_or_pd(_mm_or_pd(_mm_and_pd(e[0], t), _mm_and_pd(_mm_or_pd(e[1], e[2]), v)),
+                   _mm_or_pd(_mm_and_pd(e[3], q), _mm_and_pd(_mm_or_pd(e[4], e[5]), w)));
+    *b = _mm_or_pd(_mm_or_pd(_mm_and_pd(_mm_or_pd(e[0], e[1]), w), _mm_and_pd(e[2], t)),
+                   _mm_or_pd(_mm_and_pd(_mm_or_pd(e[3], e[4]), v), _mm_and_pd(e[5], q)));
+}
+
+SIMD_TARGET("sse2") static int
+hsv_to_rgb_sse2(const float *h_, const float *s_, const float *v_,
+                float *r_, float *g_, float *b_, int n)
+{
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        const __m128 h = fract_sse2(_mm_loadu_ps(h_ + i));
+        const __m128 s = clamp01_sse2(_mm_loadu_ps(s_ + i));
+        const __m128 v = clamp01_sse2(_mm_loadu_ps(v_ + i));
+        const __m128 gray = _mm_cmpeq_ps(s, _mm_setzero_ps());
+        __m128d r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        hsv_to_rgb_pd_sse2(lo_pd_sse2(h), lo_pd_sse2(s), lo_pd_sse2(v), &r_lo, &g_lo, &b_lo);
+        hsv_to_rgb_pd_sse2(hi_pd_sse2(h), hi_pd_sse2(s), hi_pd_sse2(v), &r_hi, &g_hi, &b_hi);
+        _mm_storeu_ps(r_ + i, select_ps_sse2(gray, v, pack_ps_sse2(r_lo, r_hi)));
+        _mm_storeu_ps(g_ + i, select_ps_sse2(gray, v, pack_ps_sse2(g_lo, g_hi)));
+        _mm_storeu_ps(b_ + i, select_ps_sse2(gray, v, pack_ps_sse2(b_lo, b_hi)));
+    }
+    return i;
+}
+
+// Clamped r, g, b and their max and min; the differences are floats in helpers.c
+SIMD_TARGET("sse2") static inline void
+rgb_to_hsl_pd_sse2(__m128d r, __m128d g, __m128d b, __m128d max, __m128d min,
+                   __m128d g_b, __m128d b_r, __m128d r_g, __m128d *h, __m128d *s, __m128d *l)
+{
+    const __m128d sum = _mm_add_pd(max, min);
+    const __m128d diff = _mm_sub_pd(max, min);
+    *l = _mm_div_pd(sum, _mm_set1_pd(2.0));
+    const __m128d l_float = _mm_cvtps_pd(_mm_cvtpd_ps(*l));
+    *s = select_pd_sse2(_mm_cmple_pd(l_float, _mm_set1_pd(0.5)),
+                        _mm_div_pd(diff, sum),
+                        _mm_div_pd(diff, _mm_sub_pd(_mm_sub_pd(_mm_set1_pd(2.0), max), min)));
+
+    const __m128d delta = select_pd_sse2(_mm_cmpeq_pd(diff, _mm_setzero_pd()), _mm_set1_pd(1.0), diff);
+    const __m128d h_r = _mm_div_pd(g_b, delta);
+    const __m128d h_g = _mm_add_pd(_mm_set1_pd(2.0), _mm_div_pd(b_r, delta));
+    const __m128d h_b = _mm_add_pd(_mm_set1_pd(4.0), _mm_div_pd(r_g, delta));
+    *h = select_pd_sse2(_mm_cmpeq_pd(b, max), h_b, _mm_setzero_pd());
+    *h = select_pd_sse2(_mm_cmpeq_pd(g, max), h_g, *h);
+    *h = select_pd_sse2(_mm_cmpeq_pd(r, max), h_r, *h);
+}
+
+SIMD_TARGET("sse2") static int
+rgb_to_hsl_sse2(const float *r_, const float *g_, const float *b_,
+                float *h_, float *s_, float *l_, int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        const __m128 r = clamp01_sse2(_mm_loadu_ps(r_ + i));
+        const __m128 g = clamp01_sse2(_mm_loadu_ps(g_ + i));
+        const __m128 b = clamp01_sse2(_mm_loadu_ps(b_ + i));
+        const __m128 max = select_ps_sse2(_mm_cmpgt_ps(r, g), _mm_max_ps(r, b), _mm_max_ps(g, b));
+        const __m128 min = select_ps_sse2(_mm_cmplt_ps(r, g), _mm_min_ps(r, b), _mm_min_ps(g, b));
+        const __m128 g_b = _mm_sub_ps(g, b);
+        const __m128 b_r = _mm_sub_ps(b, r);
+        const __m128 r_g = _mm_sub_ps(r, g);
+        __m128d h_lo, s_lo, l_lo, h_hi, s_hi, l_hi;
+        rgb_to_hsl_pd_sse2(lo_pd_sse2(r), lo_pd_sse2(g), lo_pd_sse2(b), lo_pd_sse2(max), lo_pd_sse2(min),
+                           lo_pd_sse2(g_b), lo_pd_sse2(b_r), lo_pd_sse2(r_g), &h_lo, &s_lo, &l_lo);
+        rgb_to_hsl_pd_sse2(hi_pd_sse2(r), hi_pd_sse2(g), hi_pd_sse2(b), hi_pd_sse2(max), hi_pd_sse2(min),
+                           hi_pd_sse2(g_b), hi_pd_sse2(b_r), hi_pd_sse2(r_g), &h_hi, &s_hi, &l_hi);
+
+        const __m128 gray = _mm_cmpeq_ps(max, min);
+        __m128 h = _mm_div_ps(pack_ps_sse2(h_lo, h_hi), _mm_set1_ps(6.0f));
+        h = select_ps_sse2(_mm_cmplt_ps(h, zero), _mm_add_ps(h, _mm_set1_ps(1.0f)), h);
+        _mm_storeu_ps(h_ + i, _mm_andnot_ps(gray, h));
+        _mm_storeu_ps(s_ + i, _mm_andnot_ps(gray, pack_ps_sse2(s_lo, s_hi)));
+        _mm_storeu_ps(l_ + i, pack_ps_sse2(l_lo, l_hi));
+    }
+    return i;
+}
+
+SIMD_TARGET("sse2") static inline __m128d
+hsl_value_sse2(__m128d n1, __m128d n2, __m128d hue)
+{
+    const __m128d six = _mm_set1_pd(6.0);
+    hue = select_pd_sse2(_mm_cmpgt_pd(hue, six), _mm_sub_pd(hue, six),
+                         select_pd_sse2(_mm_cmplt_pd(hue, _mm_setzero_pd()), _mm_add_pd(hue, six), hue));
+    const __m128d n2_n1 = _mm_sub_pd(n2, n1);
+    __m128d val = select_pd_sse2(_mm_cmplt_pd(hue, _mm_set1_pd(4.0)),
+                                 _mm_add_pd(n1, _mm_mul_pd(n2_n1, _mm_sub_pd(_mm_set1_pd(4.0), hue))), n1);
+    val = select_pd_sse2(_mm_cmplt_pd(hue, _mm_set1_pd(3.0)), n2, val);
+    return select_pd_sse2(_mm_cmplt_pd(hue, _mm_set1_pd(1.0)), _mm_add_pd(n1, _mm_mul_pd(n2_n1, hue)), val);
+}
+
+// l + s - l*s is computed with floats in helpers.c
+SIMD_TARGET("sse2") static inline void
+hsl_to_rgb_pd_sse2(__m128d h, __m128d s, __m128d l, __m128d l_s,
+                   __m128d *r, __m128d *g, __m128d *b)
+{
+    const __m128d m2 = select_pd_sse2(_mm_cmple_pd(l, _mm_set1_pd(0.5)),
+                                      _mm_mul_pd(l, _mm_add_pd(_mm_set1_pd(1.0), s)), l_s);
+    const __m128d m1 = _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(2.0), l), m2);
+    const __m128d h6 = _mm_mul_pd(h, _mm_set1_pd(6.0));
+    *r = hsl_value_sse2(m1, m2, _mm_add_pd(h6, _mm_set1_pd(2.0)));
+    *g = hsl_value_sse2(m1, m2, h6);
+    *b = hsl_value_sse2(m1, m2, _mm_sub_pd(h6, _mm_set1_pd(2.0)));
+}
+
+SIMD_TARGET("sse2") static int
+hsl_to_rgb_sse2(const float *h_, const float *s_, const float *l_,
+                float *r_, float *g_, float *b_, int n)
+{
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        const __m128 h = fract_sse2(_mm_loadu_ps(h_ + i));
+        const __m128 s = clamp01_sse2(_mm_loadu_ps(s_ + i));
+        const __m128 l = clamp01_sse2(_mm_loadu_ps(l_ + i));
+        const __m128 l_s = _mm_sub_ps(_mm_add_ps(l, s), _mm_mul_ps(l, s));
+        const __m128 gray = _mm_cmpeq_ps(s, _mm_setzero_ps());
+        __m128d r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        hsl_to_rgb_pd_sse2(lo_pd_sse2(h), lo_pd_sse2(s), lo_pd_sse2(l), lo_pd_sse2(l_s), &r_lo, &g_lo, &b_lo);
+        hsl_to_rgb_pd_sse2(hi_pd_sse2(h), hi_pd_sse2(s), hi_pd_sse2(l), hi_pd_sse2(l_s), &r_hi, &g_hi, &b_hi);
+        _mm_storeu_ps(r_ + i, select_ps_sse2(gray, l, pack_ps_sse2(r_lo, r_hi)));
+        _mm_storeu_ps(g_ + i, select_ps_sse2(gray, l, pack_ps_sse2(g_lo, g_hi)));
+        _mm_storeu_ps(b_ + i, select_ps_sse2(gray, l, pack_ps_sse2(b_lo, b_hi)));
+    }
+    return i;
+}
+
+/* AVX2: eight floats, or four doubles at a time */
+
+SIMD_TARGET("avx2") static inline __m256
+clamp01_avx2(__m256 x)
+{
+    return _mm256_max_ps(_mm256_setzero_ps(), _mm256_min_ps(_mm256_set1_ps(1.0f), x));
+}
+
+SIMD_TARGET("avx2") static inline __m256
+fract_avx2(__m256 h)
+{
+    return _mm256_sub_ps(h, _mm256_floor_ps(h));
+}
+
+SIMD_TARGET("avx2") static inline __m256d
+lo_pd_avx2(__m256 x)
+{
+    return _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+}
+
+SIMD_TARGET("avx2") static inline __m256d
+hi_pd_avx2(__m256 x)
+{
+    return _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+}
+
+SIMD_TARGET("avx2") static inline __m256
+pack_ps_avx2(__m256d lo, __m256d hi)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+}
+
+SIMD_TARGET("avx2") static int
+rgb_to_hsv_avx2(const float *r_, const float *g_, const float *b_,
+                float *h_, float *s_, float *v_, int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 threshold = _mm256_set1_ps(hsv_delta_threshold());
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        const __m256 r = clamp01_avx2(_mm256_loadu_ps(r_ + i));
+        const __m256 g = clamp01_avx2(_mm256_loadu_ps(g_ + i));
+        const __m256 b = clamp01_avx2(_mm256_loadu_ps(b_ + i));
+        const __m256 max = _mm256_blendv_ps(_mm256_max_ps(g, b), _mm256_max_ps(r, b), _mm256_cmp_ps(r, g, _CMP_GT_OQ));
+        const __m256 min = _mm256_blendv_ps(_mm256_min_ps(g, b), _mm256_min_ps(r, b), _mm256_cmp_ps(r, g, _CMP_LT_OQ));
+        const __m256 delta = _mm256_sub_ps(max, min);
+        const __m256 chromatic = _mm256_cmp_ps(delta, threshold, _CMP_GT_OQ);
+
+        __m256 h_r = _mm256_div_ps(_mm256_sub_ps(g, b), delta);
+        h_r = _mm256_blendv_ps(h_r, _mm256_add_ps(h_r, _mm256_set1_ps(6.0f)), _mm256_cmp_ps(h_r, zero, _CMP_LT_OQ));
+        const __m256 h_g = _mm256_add_ps(_mm256_set1_ps(2.0f), _mm256_div_ps(_mm256_sub_ps(b, r), delta));
+        const __m256 h_b = _mm256_add_ps(_mm256_set1_ps(4.0f), _mm256_div_ps(_mm256_sub_ps(r, g), delta));
+        __m256 h = _mm256_and_ps(_mm256_cmp_ps(b, max, _CMP_EQ_OQ), h_b);
+        h = _mm256_blendv_ps(h, h_g, _mm256_cmp_ps(g, max, _CMP_EQ_OQ));
+        h = _mm256_blendv_ps(h, h_r, _mm256_cmp_ps(r, max, _CMP_EQ_OQ));
+        h = _mm256_div_ps(h, _mm256_set1_ps(6.0f));
+
+        _mm256_storeu_ps(h_ + i, _mm256_and_ps(chromatic, h));
+        _mm256_storeu_ps(s_ + i, _mm256_and_ps(chromatic, _mm256_div_ps(delta, max)));
+        _mm256_storeu_ps(v_ + i, max);
+    }
+    return i;
+}
+
+SIMD_TARGET("avx2") static inline void
+hsv_to_rgb_pd_avx2(__m256d h, __m256d s, __m256d v, __m256d *r, __m256d *g, __m256d *b)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d hue = _mm256_mul_pd(_mm256_andnot_pd(_mm256_cmp_pd(h, one, _CMP_EQ_OQ), h),
+                                      _mm256_set1_pd(6.0));
+    const __m256d i = _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(hue));
+    const __m256d f = _mm256_sub_pd(hue, i);
+    const __m256d w = _mm256_mul_pd(v, _mm256_sub_pd(one, s));
+    const __m256d q = _mm256_mul_pd(v, _mm256_sub_pd(one, _mm256_mul_pd(s, f)));
+    const __m256d t = _mm256_mul_pd(v, _mm256_sub_pd(one, _mm256_mul_pd(s, _mm256_sub_pd(one, f))));
+
+    __m256d e[6];
+    for (int k = 0; k < 6; k++) {
+        e[k] = _mm256_cmp_pd(i, _mm256_set1_pd(k), _CMP_EQ_OQ);
+    }
+    *r = _mm256_or_pd(_mm256_or_pd(_mm256_and_pd(_mm256_or_pd(e[0], e[5]), v), _mm256_and_pd(e[1], q)),
+                      _mm256_or_pd(_mm256_and_pd(_mm256_or_pd(e[2], e[3]), w), _mm256_and_pd(e[4], t)));
+    *g = _mm256_or_pd(_mm256_or_pd(_mm256_and_pd(e[0], t), _mm256_and_pd(_mm256_or_pd(e[1], e[2]), v)),
+                      _mm256_or_pd(_mm256_and_pd(e[3], q), _mm256_and_pd(_mm256_or_pd(e[4], e[5]), w)));
+    *b = _mm256_or_pd(_mm256_or_pd(_mm256_and_pd(_mm256_or_pd(e[0], e[1]), w), _mm256_and_pd(e[2], t)),
+                      _mm256_or_pd(_mm256_and_pd(_mm256_or_pd(e[3], e[4]), v), _mm256_and_pd(e[5], q)));
+}
+
+SIMD_TARGET("avx2") static int
+hsv_to_rgb_avx2(const float *h_, const float *s_, const float *v_,
+                float *r_, float *g_, float *b_, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        const __m256 h = fract_avx2(_mm256_loadu_ps(h_ + i));
+        const __m256 s = clamp01_avx2(_mm256_loadu_ps(s_ + i));
+        const __m256 v = clamp01_avx2(_mm256_loadu_ps(v_ + i));
+        const __m256 gray = _mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_EQ_OQ);
+        __m256d r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        hsv_to_rgb_pd_avx2(lo_pd_avx2(h), lo_pd_avx2(s), lo_pd_avx2(v), &r_lo, &g_lo, &b_lo);
+        hsv_to_rgb_pd_avx2(hi_pd_avx2(h), hi_pd_avx2(s), hi_pd_avx2(v), &r_hi, &g_hi, &b_hi);
+        _mm256_storeu_ps(r_ + i, _mm256_blendv_ps(pack_ps_avx2(r_lo, r_hi), v, gray));
+        _mm256_storeu_ps(g_ + i, _mm256_blendv_ps(pack_ps_avx2(g_lo, g_hi), v, gray));
+        _mm256_storeu_ps(b_ + i, _mm256_blendv_ps(pack_ps_avx2(b_lo, b_hi), v, gray));
+    }
+    return i;
+}
+
+SIMD_TARGET("avx2") static inline void
+rgb_to_hsl_pd_avx2(__m256d r, __m256d g, __m256d b, __m256d max, __m256d min,
+                   __m256d g_b, __m256d b_r, __m256d r_g, __m256d *h, __m256d *s, __m256d *l)
+{
+    const __m256d sum = _mm256_add_pd(max, min);
+    const __m256d diff = _mm256_sub_pd(max, min);
+    *l = _mm256_div_pd(sum, _mm256_set1_pd(2.0));
+    const __m256d l_float = _mm256_cvtps_pd(_mm256_cvtpd_ps(*l));
+    *s = _mm256_blendv_pd(_mm256_div_pd(diff, _mm256_sub_pd(_mm256_sub_pd(_mm256_set1_pd(2.0), max), min)),
+                          _mm256_div_pd(diff, sum),
+                          _mm256_cmp_pd(l_float, _mm256_set1_pd(0.5), _CMP_LE_OQ));
+
+    const __m256d delta = _mm256_blendv_pd(diff, _mm256_set1_pd(1.0),
+                                           _mm256_cmp_pd(diff, _mm256_setzero_pd(), _CMP_EQ_OQ));
+    const __m256d h_r = _mm256_div_pd(g_b, delta);
+    const __m256d h_g = _mm256_add_pd(_mm256_set1_pd(2.0), _mm256_div_pd(b_r, delta));
+    const __m256d h_b = _mm256_add_pd(_mm256_set1_pd(4.0), _mm256_div_pd(r_g, delta));
+    *h = _mm256_and_pd(_mm256_cmp_pd(b, max, _CMP_EQ_OQ), h_b);
+    *h = _mm256_blendv_pd(*h, h_g, _mm256_cmp_pd(g, max, _CMP_EQ_OQ));
+    *h = _mm256_blendv_pd(*h, h_r, _mm256_cmp_pd(r, max, _CMP_EQ_OQ));
+}
+
+SIMD_TARGET("avx2") static int
+rgb_to_hsl_avx2(const float *r_, const float *g_, const float *b_,
+                float *h_, float *s_, float *l_, int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        const __m256 r = clamp01_avx2(_mm256_loadu_ps(r_ + i));
+        const __m256 g = clamp01_avx2(_mm256_loadu_ps(g_ + i));
+        const __m256 b = clamp01_avx2(_mm256_loadu_ps(b_ + i));
+        const __m256 max = _mm256_blendv_ps(_mm256_max_ps(g, b), _mm256_max_ps(r, b), _mm256_cmp_ps(r, g, _CMP_GT_OQ));
+        const __m256 min = _mm256_blendv_ps(_mm256_min_ps(g, b), _mm256_min_ps(r, b), _mm256_cmp_ps(r, g, _CMP_LT_OQ));
+        const __m256 g_b = _mm256_sub_ps(g, b);
+        const __m256 b_r = _mm256_sub_ps(b, r);
+        const __m256 r_g = _mm256_sub_ps(r, g);
+        __m256d h_lo, s_lo, l_lo, h_hi, s_hi, l_hi;
+        rgb_to_hsl_pd_avx2(lo_pd_avx2(r), lo_pd_avx2(g), lo_pd_avx2(b), lo_pd_avx2(max), lo_pd_avx2(min),
+                           lo_pd_avx2(g_b), lo_pd_avx2(b_r), lo_pd_avx2(r_g), &h_lo, &s_lo, &l_lo);
+        rgb_to_hsl_pd_avx2(hi_pd_avx2(r), hi_pd_avx2(g), hi_pd_avx2(b), hi_pd_avx2(max), hi_pd_avx2(min),
+                           hi_pd_avx2(g_b), hi_pd_avx2(b_r), hi_pd_avx2(r_g), &h_hi, &s_hi, &l_hi);
+
+        const __m256 gray = _mm256_cmp_ps(max, min, _CMP_EQ_OQ);
+        __m256 h = _mm256_div_ps(pack_ps_avx2(h_lo, h_hi), _mm256_set1_ps(6.0f));
+        h = _mm256_blendv_ps(h, _mm256_add_ps(h, _mm256_set1_ps(1.0f)), _mm256_cmp_ps(h, zero, _CMP_LT_OQ));
+        _mm256_storeu_ps(h_ + i, _mm256_andnot_ps(gray, h));
+        _mm256_storeu_ps(s_ + i, _mm256_andnot_ps(gray, pack_ps_avx2(s_lo, s_hi)));
+        _mm256_storeu_ps(l_ + i, pack_ps_avx2(l_lo, l_hi));
+    }
+    return i;
+}
+
+SIMD_TARGET("avx2") static inline __m256d
+hsl_value_avx2(__m256d n1, __m256d n2, __m256d hue)
+{
+    const __m256d six = _mm256_set1_pd(6.0);
+    hue = _mm256_blendv_pd(_mm256_blendv_pd(hue, _mm256_add_pd(hue, six),
+                                            _mm256_cmp_pd(hue, _mm256_setzero_pd(), _CMP_LT_OQ)),
+                           _mm256_sub_pd(hue, six), _mm256_cmp_pd(hue, six, _CMP_GT_OQ));
+    const __m256d n2_n1 = _mm256_sub_pd(n2, n1);
+    __m256d val = _mm256_blendv_pd(n1, _mm256_add_pd(n1, _mm256_mul_pd(n2_n1, _mm256_sub_pd(_mm256_set1_pd(4.0), hue))),
+                                   _mm256_cmp_pd(hue, _mm256_set1_pd(4.0), _CMP_LT_OQ));
+    val = _mm256_blendv_pd(val, n2, _mm256_cmp_pd(hue, _mm256_set1_pd(3.0), _CMP_LT_OQ));
+    return _mm256_blendv_pd(val, _mm256_add_pd(n1, _mm256_mul_pd(n2_n1, hue)),
+                            _mm256_cmp_pd(hue, _mm256_set1_pd(1.0), _CMP_LT_OQ));
+}
+
+SIMD_TARGET("avx2") static inline void
+hsl_to_rgb_pd_avx2(__m256d h, __m256d s, __m256d l, __m256d l_s,
+                   __m256d *r, __m256d *g, __m256d *b)
+{
+    const __m256d m2 = _mm256_blendv_pd(l_s,
+                                        _mm256_mul_pd(l, _mm256_add_pd(_mm256_set1_pd(1.0), s)),
+                                        _mm256_cmp_pd(l, _mm256_set1_pd(0.5), _CMP_LE_OQ));
+    const __m256d m1 = _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), l), m2);
+    const __m256d h6 = _mm256_mul_pd(h, _mm256_set1_pd(6.0));
+    *r = hsl_value_avx2(m1, m2, _mm256_add_pd(h6, _mm256_set1_pd(2.0)));
+    *g = hsl_value_avx2(m1, m2, h6);
+    *b = hsl_value_avx2(m1, m2, _mm256_sub_pd(h6, _mm256_set1_pd(2.0)));
+}
+
+SIMD_TARGET("avx2") static int
+hsl_to_rgb_avx2(const float *h_, const float *s_, const float *l_,
+                float *r_, float *g_, float *b_, int n)
+{
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        const __m256 h = fract_avx2(_mm256_loadu_ps(h_ + i));
+        const __m256 s = clamp01_avx2(_mm256_loadu_ps(s_ + i));
+        const __m256 l = clamp01_avx2(_mm256_loadu_ps(l_ + i));
+        const __m256 l_s = _mm256_sub_ps(_mm256_add_ps(l, s), _mm256_mul_ps(l, s));
+        const __m256 gray = _mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_EQ_OQ);
+        __m256d r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        hsl_to_rgb_pd_avx2(lo_pd_avx2(h), lo_pd_avx2(s), lo_pd_avx2(l), lo_pd_avx2(l_s), &r_lo, &g_lo, &b_lo);
+        hsl_to_rgb_pd_avx2(hi_pd_avx2(h), hi_pd_avx2(s), hi_pd_avx2(l), hi_pd_avx2(l_s), &r_hi, &g_hi, &b_hi);
+        _mm256_storeu_ps(r_ + i, _mm256_blendv_ps(pack_ps_avx2(r_lo, r_hi), l, gray));
+        _mm256_storeu_ps(g_ + i, _mm256_blendv_ps(pack_ps_avx2(g_lo, g_hi), l, gray));
+        _mm256_storeu_ps(b_ + i, _mm256_blendv_ps(pack_ps_avx2(b_lo, b_hi), l, gray));
+    }
+    return i;
+}
+
+#endif // SIMD_X86
+
+void
+color_rgb_to_hsv_n(const float *r, const float *g, const float *b,
+                   float *h, float *s, float *v, int n)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+        i = rgb_to_hsv_avx2(r, g, b, h, s, v, n);
+        break;
+    case SIMD_LEVEL_SSE2:
+        i = rgb_to_hsv_sse2(r, g, b, h, s, v, n);
+        break;
+    default:
+        break;
+    }
+#endif
+    for (; i < n; i++) {
+        float c0 = r[i], c1 = g[i], c2 = b[i];
+        rgb_to_hsv_float(&c0, &c1, &c2);
+        h[i] = c0;
+        s[i] = c1;
+        v[i] = c2;
+    }
+}
+
+void
+color_hsv_to_rgb_n(const float *h, const float *s, const float *v,
+                   float *r, float *g, float *b, int n)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+        i = hsv_to_rgb_avx2(h, s, v, r, g, b, n);
+        break;
+    case SIMD_LEVEL_SSE2:
+        i = hsv_to_rgb_sse2(h, s, v, r, g, b, n);
+        break;
+    default:
+        break;
+    }
+#endif
+    for (; i < n; i++) {
+        float c0 = h[i], c1 = s[i], c2 = v[i];
+        hsv_to_rgb_float(&c0, &c1, &c2);
+        r[i] = c0;
+        g[i] = c1;
+        b[i] = c2;
+    }
+}
+
+void
+color_rgb_to_hsl_n(const float *r, const float *g, const float *b,
+                   float *h, float *s, float *l, int n)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+        i = rgb_to_hsl_avx2(r, g, b, h, s, l, n);
+        break;
+    case SIMD_LEVEL_SSE2:
+        i = rgb_to_hsl_sse2(r, g, b, h, s, l, n);
+        break;
+    default:
+        break;
+    }
+#endif
+    for (; i < n; i++) {
+        float c0 = r[i], c1 = g[i], c2 = b[i];
+        rgb_to_hsl_float(&c0, &c1, &c2);
+        h[i] = c0;
+        s[i] = c1;
+        l[i] = c2;
+    }
+}
+
+void
+color_hsl_to_rgb_n(const float *h, const float *s, const float *l,
+                   float *r, float *g, float *b, int n)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+        i = hsl_to_rgb_avx2(h, s, l, r, g, b, n);
+        break;
+    case SIMD_LEVEL_SSE2:
+        i = hsl_to_rgb_sse2(h, s, l, r, g, b, n);
+        break;
+    default:
+        break;
+    }
+#endif
+    for (; i < n; i++) {
+        float c0 = h[i], c1 = s[i], c2 = l[i];
+        hsl_to_rgb_float(&c0, &c1, &c2);
+        r[i] = c0;
+        g[i] = c1;
+        b[i] = c2;
+    }
+}
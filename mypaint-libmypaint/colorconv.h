@@ -0,0 +1,38 @@
+#ifndef COLORCONV_H
+#define COLORCONV_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+
+G_BEGIN_DECLS
+
+// Color space conversion of n colors at once, with the same results as
+// the single color functions of helpers.h. Each channel is an array of
+// its own. The output arrays may be the input arrays, for converting in place.
+
+void color_rgb_to_hsv_n(const float *r, const float *g, const float *b,
+                        float *h, float *s, float *v, int n);
+void color_hsv_to_rgb_n(const float *h, const float *s, const float *v,
+                        float *r, float *g, float *b, int n);
+void color_rgb_to_hsl_n(const float *r, const float *g, const float *b,
+                        float *h, float *s, float *l, int n);
+void color_hsl_to_rgb_n(const float *h, const float *s, const float *l,
+                        float *r, float *g, float *b, int n);
+
+G_END_DECLS
+
+#endif // COLORCONV_H
@@ -0,0 +1,124 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "dabmask.h"
+
+#define DAB_MASK_ALIGNMENT 32
+
+struct _DabMaskPool {
+    int size;
+    pthread_mutex_t mutex;
+    DabMask **masks; // not in use
+    int masks_n;
+    int masks_size;
+};
+
+/* Allocate an (empty) mask for tiles of @size x @size pixels.
+ * The coverage and the spans share one block of memory. */
+DabMask *
+dab_mask_new(int size)
+{
+    const size_t opa_bytes = (size_t)size*size*sizeof(uint16_t);
+    const size_t spans_bytes = 2*size*sizeof(int);
+    void *block = NULL;
+
+    if (posix_memalign(&block, DAB_MASK_ALIGNMENT, opa_bytes + spans_bytes) != 0) {
+        return NULL;
+    }
+
+    DabMask *self = (DabMask *)malloc(sizeof(DabMask));
+    if (!self) {
+        free(block);
+        return NULL;
+    }
+    self->size = size;
+    self->y0 = 0;
+    self->y1 = 0;
+    self->opa = (uint16_t *)block;
+    self->x0 = (int *)((char *)block + opa_bytes);
+    self->x1 = self->x0 + size;
+    return self;
+}
+
+void
+dab_mask_free(DabMask *self)
+{
+    if (self) {
+        free(self->opa);
+        free(self);
+    }
+}
+
+DabMaskPool *
+dab_mask_pool_new(int size)
+{
+    DabMaskPool *self = (DabMaskPool *)malloc(sizeof(DabMaskPool));
+    self->size = size;
+    pthread_mutex_init(&self->mutex, NULL);
+    self->masks_size = 8;
+    self->masks_n = 0;
+    self->masks = (DabMask **)malloc(self->masks_size*sizeof(DabMask *));
+    return self;
+}
+
+/* All masks must have been released */
+void
+dab_mask_pool_free(DabMaskPool *self)
+{
+    for (int i = 0; i < self->masks_n; i++) {
+        dab_mask_free(self->masks[i]);
+    }
+    free(self->masks);
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+}
+
+/* A mask for tiles of the size of the pool, or NULL if out of memory.
+ * Give it back with dab_mask_pool_release() */
+DabMask *
+dab_mask_pool_acquire(DabMaskPool *self)
+{
+    DabMask *mask = NULL;
+    pthread_mutex_lock(&self->mutex);
+    if (self->masks_n > 0) {
+        mask = self->masks[--self->masks_n];
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return mask ? mask : dab_mask_new(self->size);
+}
+
+void
+dab_mask_pool_release(DabMaskPool *self, DabMask *mask)
+{
+    if (!mask) {
+        return;
+    }
+    pthread_mutex_lock(&self->mutex);
+    if (self->masks_n == self->masks_size) {
+        DabMask **masks = (DabMask **)realloc(self->masks, 2*self->masks_size*sizeof(DabMask *));
+        if (!masks) {
+            pthread_mutex_unlock(&self->mutex);
+            dab_mask_free(mask);
+            return;
+        }
+        self->masks = masks;
+        self->masks_size *= 2;
+    }
+    self->masks[self->masks_n++] = mask;
+    pthread_mutex_unlock(&self->mutex);
+}
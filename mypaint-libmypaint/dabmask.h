@@ -0,0 +1,51 @@
+#ifndef DABMASK_H
+#define DABMASK_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+/* Dab mask for one tile, stored densely instead of run length encoded,
+ * so that it can be processed with SIMD instructions.
+ *
+ * Row y covers the pixels x0[y] <= x < x1[y]. Values outside of the span
+ * are undefined, rows outside of y0 <= y < y1 are empty.
+ * Coverage is fix15 (0..1<<15), same as in the run length encoded mask.
+ * Pixels inside a span may be zero, blending them is a no-op.
+ * Rows are @size pixels apart, @opa is aligned to 32 bytes. */
+typedef struct {
+    int size; // tile size
+    int y0;
+    int y1;
+    int *x0;
+    int *x1;
+    uint16_t *opa;
+} DabMask;
+
+DabMask *dab_mask_new(int size);
+void dab_mask_free(DabMask *self);
+
+/* Masks kept for reuse, so that processing a tile does not allocate one.
+ * Holds as many masks as were ever in use at the same time.
+ * Concurrency: threadsafe */
+typedef struct _DabMaskPool DabMaskPool;
+
+DabMaskPool *dab_mask_pool_new(int size);
+void dab_mask_pool_free(DabMaskPool *self);
+DabMask *dab_mask_pool_acquire(DabMaskPool *self);
+void dab_mask_pool_release(DabMaskPool *self, DabMask *mask);
+
+#endif // DABMASK_H
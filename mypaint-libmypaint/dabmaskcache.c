@@ -0,0 +1,401 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "dabmaskcache.h"
+
+// Least-recently-used cache of rendered dab masks.
+// Entries are found through a small chained hash table, and evicted
+// least-recently-used first whenever the total mask memory exceeds max_bytes.
+//
+// Entries are reference counted so that a mask handed out to one thread
+// stays valid while another thread evicts it.
+//
+// dab_mask_cache_lookup_or_render() inserts an entry before rendering its mask,
+// so that threads asking for the same key meanwhile wait instead of rendering
+// it again. Each mask is then rendered exactly once while it stays cached.
+//
+// Concurrency: all functions are thread-safe, including between the
+// thread of mypaint_tiled_surface_end_atomic_async() and the caller.
+
+#define DAB_MASK_CACHE_BUCKETS 256
+
+struct _DabMaskCache {
+    pthread_mutex_t mutex;
+    pthread_cond_t rendered;
+    DabMaskCacheEntry *buckets[DAB_MASK_CACHE_BUCKETS];
+    DabMaskCacheEntry *lru_first; // most recently used
+    DabMaskCacheEntry *lru_last; // least recently used
+    size_t bytes;
+    size_t max_bytes;
+
+    int hits;
+    int misses;
+    int evictions;
+};
+
+static unsigned int
+key_hash(const DabMaskCacheKey *key)
+{
+    unsigned int h = 2166136261u;
+    h = (h ^ (unsigned int)key->radius) * 16777619u;
+    h = (h ^ (unsigned int)key->hardness) * 16777619u;
+    h = (h ^ (unsigned int)key->aspect_ratio) * 16777619u;
+    h = (h ^ (unsigned int)key->angle) * 16777619u;
+    h = (h ^ (unsigned int)key->subpixel_x) * 16777619u;
+    h = (h ^ (unsigned int)key->subpixel_y) * 16777619u;
+    h = (h ^ (unsigned int)key->antialiased) * 16777619u;
+    // The multiplications only carry bits upwards, the exact keys of float
+    // bits differ mostly in their high bits
+    h ^= h >> 16;
+    return h % DAB_MASK_CACHE_BUCKETS;
+}
+
+static gboolean
+key_equal(const DabMaskCacheKey *a, const DabMaskCacheKey *b)
+{
+    return (a->radius == b->radius && a->hardness == b->hardness
+            && a->aspect_ratio == b->aspect_ratio && a->angle == b->angle
+            && a->subpixel_x == b->subpixel_x && a->subpixel_y == b->subpixel_y
+            && a->antialiased == b->antialiased);
+}
+
+static void
+entry_destroy(DabMaskCacheEntry *entry)
+{
+    free(entry->mask);
+    free(entry);
+}
+
+static void
+lru_unlink(DabMaskCache *self, DabMaskCacheEntry *entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        self->lru_first = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        self->lru_last = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void
+lru_push_front(DabMaskCache *self, DabMaskCacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = self->lru_first;
+    if (self->lru_first) {
+        self->lru_first->lru_prev = entry;
+    }
+    self->lru_first = entry;
+    if (!self->lru_last) {
+        self->lru_last = entry;
+    }
+}
+
+// Remove @entry from the cache. It is destroyed once the last user releases it.
+static void
+remove_entry(DabMaskCache *self, DabMaskCacheEntry *entry)
+{
+    DabMaskCacheEntry **p = &self->buckets[key_hash(&entry->key)];
+    while (*p != entry) {
+        assert(*p);
+        p = &(*p)->hash_next;
+    }
+    *p = entry->hash_next;
+    entry->hash_next = NULL;
+
+    lru_unlink(self, entry);
+    self->bytes -= entry->bytes;
+    entry->cached = FALSE;
+
+    if (entry->refcount == 0) {
+        entry_destroy(entry);
+    }
+}
+
+static void
+evict_to_fit(DabMaskCache *self, size_t max_bytes)
+{
+    while (self->bytes > max_bytes && self->lru_last) {
+        remove_entry(self, self->lru_last);
+        self->evictions++;
+    }
+}
+
+DabMaskCache *
+dab_mask_cache_new(size_t max_bytes)
+{
+    DabMaskCache *self = (DabMaskCache *)malloc(sizeof(DabMaskCache));
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->rendered, NULL);
+    for (int i = 0; i < DAB_MASK_CACHE_BUCKETS; i++) {
+        self->buckets[i] = NULL;
+    }
+    self->lru_first = NULL;
+    self->lru_last = NULL;
+    self->bytes = 0;
+    self->max_bytes = max_bytes;
+    dab_mask_cache_reset_stats(self);
+
+    return self;
+}
+
+/* Frees the cache and all its entries.
+ * All entries handed out must have been released before calling this. */
+void
+dab_mask_cache_free(DabMaskCache *self)
+{
+    dab_mask_cache_clear(self);
+    pthread_cond_destroy(&self->rendered);
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+}
+
+void
+dab_mask_cache_clear(DabMaskCache *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    evict_to_fit(self, 0);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+void
+dab_mask_cache_set_max_bytes(DabMaskCache *self, size_t max_bytes)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->max_bytes = max_bytes;
+    evict_to_fit(self, max_bytes);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+size_t
+dab_mask_cache_get_max_bytes(DabMaskCache *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    const size_t max_bytes = self->max_bytes;
+    pthread_mutex_unlock(&self->mutex);
+    return max_bytes;
+}
+
+/* Look up the mask for @key.
+ * Returns NULL on a miss. On a hit, the entry must be given back with
+ * dab_mask_cache_release() when the caller is done with the mask. */
+DabMaskCacheEntry *
+dab_mask_cache_lookup(DabMaskCache *self, const DabMaskCacheKey *key)
+{
+    DabMaskCacheEntry *entry = NULL;
+
+    pthread_mutex_lock(&self->mutex);
+    for (entry = self->buckets[key_hash(key)]; entry; entry = entry->hash_next) {
+        if (key_equal(&entry->key, key)) {
+            break;
+        }
+    }
+    if (entry) {
+        self->hits++;
+        entry->refcount++;
+        lru_unlink(self, entry);
+        lru_push_front(self, entry);
+    } else {
+        self->misses++;
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    return entry;
+}
+
+/* Insert a freshly rendered @mask of (@size x @size) pixels for @key.
+ * The cache takes ownership of @mask, which must be allocated with malloc().
+ * Returns an entry that must be given back with dab_mask_cache_release().
+ *
+ * Masks too big to ever fit are handed back without being cached.
+ * If another thread inserted the same key in the meantime, that entry is
+ * returned instead and @mask is freed. */
+DabMaskCacheEntry *
+dab_mask_cache_insert(DabMaskCache *self, const DabMaskCacheKey *key,
+                      uint16_t *mask, int size)
+{
+    DabMaskCacheEntry *entry = (DabMaskCacheEntry *)malloc(sizeof(DabMaskCacheEntry));
+    entry->key = *key;
+    entry->size = size;
+    entry->mask = mask;
+    entry->bytes = size*size*sizeof(uint16_t);
+    entry->refcount = 1;
+    entry->cached = FALSE;
+    entry->rendering = FALSE;
+    entry->hash_next = NULL;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+
+    DabMaskCacheEntry *existing = NULL;
+
+    pthread_mutex_lock(&self->mutex);
+    const unsigned int bucket = key_hash(key);
+    for (existing = self->buckets[bucket]; existing; existing = existing->hash_next) {
+        if (key_equal(&existing->key, key)) {
+            existing->refcount++;
+            break;
+        }
+    }
+
+    if (!existing && entry->bytes <= self->max_bytes) {
+        evict_to_fit(self, self->max_bytes - entry->bytes);
+
+        entry->hash_next = self->buckets[bucket];
+        self->buckets[bucket] = entry;
+        lru_push_front(self, entry);
+        self->bytes += entry->bytes;
+        entry->cached = TRUE;
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    if (existing) {
+        entry_destroy(entry);
+        return existing;
+    }
+    return entry;
+}
+
+/* Look up the mask for @key, rendering it with @render on a miss.
+ * If another thread is rendering the same mask, waits for it instead.
+ * Returns NULL if @render failed, otherwise an entry that must be given
+ * back with dab_mask_cache_release(). Masks too big to fit are rendered
+ * and handed back without being cached. */
+DabMaskCacheEntry *
+dab_mask_cache_lookup_or_render(DabMaskCache *self, const DabMaskCacheKey *key,
+                                DabMaskCacheRenderFunction render, void *user_data)
+{
+    DabMaskCacheEntry *entry = NULL;
+
+    pthread_mutex_lock(&self->mutex);
+    const unsigned int bucket = key_hash(key);
+    for (entry = self->buckets[bucket]; entry; entry = entry->hash_next) {
+        if (key_equal(&entry->key, key)) {
+            break;
+        }
+    }
+    if (entry) {
+        self->hits++;
+        entry->refcount++;
+        lru_unlink(self, entry);
+        lru_push_front(self, entry);
+        while (entry->rendering) {
+            pthread_cond_wait(&self->rendered, &self->mutex);
+        }
+        pthread_mutex_unlock(&self->mutex);
+        if (!entry->mask) {
+            dab_mask_cache_release(self, entry);
+            return NULL;
+        }
+        return entry;
+    }
+
+    // Insert the entry without its mask, which is rendered outside of the lock
+    self->misses++;
+    entry = (DabMaskCacheEntry *)malloc(sizeof(DabMaskCacheEntry));
+    if (!entry) {
+        pthread_mutex_unlock(&self->mutex);
+        return NULL;
+    }
+    entry->key = *key;
+    entry->size = 0;
+    entry->mask = NULL;
+    entry->bytes = 0;
+    entry->refcount = 1;
+    entry->cached = TRUE;
+    entry->rendering = TRUE;
+    entry->hash_next = self->buckets[bucket];
+    self->buckets[bucket] = entry;
+    lru_push_front(self, entry);
+    pthread_mutex_unlock(&self->mutex);
+
+    int size = 0;
+    uint16_t *mask = render(user_data, &size);
+
+    pthread_mutex_lock(&self->mutex);
+    entry->mask = mask;
+    entry->size = size;
+    entry->rendering = FALSE;
+    if (entry->cached) { // unless evicted meanwhile
+        const size_t bytes = mask ? size*size*sizeof(uint16_t) : 0;
+        if (!mask || bytes > self->max_bytes) {
+            remove_entry(self, entry);
+        } else {
+            // Make room without evicting the entry itself
+            lru_unlink(self, entry);
+            evict_to_fit(self, self->max_bytes - bytes);
+            lru_push_front(self, entry);
+            entry->bytes = bytes;
+            self->bytes += bytes;
+        }
+    }
+    pthread_cond_broadcast(&self->rendered);
+    pthread_mutex_unlock(&self->mutex);
+
+    if (!mask) {
+        dab_mask_cache_release(self, entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/* Give back an entry returned by dab_mask_cache_lookup(), dab_mask_cache_insert()
+ * or dab_mask_cache_lookup_or_render() */
+void
+dab_mask_cache_release(DabMaskCache *self, DabMaskCacheEntry *entry)
+{
+    gboolean destroy = FALSE;
+
+    pthread_mutex_lock(&self->mutex);
+    assert(entry->refcount > 0);
+    entry->refcount--;
+    destroy = (entry->refcount == 0 && !entry->cached);
+    pthread_mutex_unlock(&self->mutex);
+
+    if (destroy) {
+        entry_destroy(entry);
+    }
+}
+
+void
+dab_mask_cache_get_stats(DabMaskCache *self, int *hits, int *misses, int *evictions, size_t *bytes)
+{
+    pthread_mutex_lock(&self->mutex);
+    if (hits) *hits = self->hits;
+    if (misses) *misses = self->misses;
+    if (evictions) *evictions = self->evictions;
+    if (bytes) *bytes = self->bytes;
+    pthread_mutex_unlock(&self->mutex);
+}
+
+void
+dab_mask_cache_reset_stats(DabMaskCache *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->hits = 0;
+    self->misses = 0;
+    self->evictions = 0;
+    pthread_mutex_unlock(&self->mutex);
+}
@@ -0,0 +1,80 @@
+#ifndef DABMASKCACHE_H
+#define DABMASKCACHE_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mypaint-glib-compat.h>
+
+G_BEGIN_DECLS
+
+/* Quantized dab geometry. Two dabs with equal keys share the same mask. */
+typedef struct {
+    int radius;
+    int hardness;
+    int aspect_ratio;
+    int angle;
+    int subpixel_x;
+    int subpixel_y;
+    gboolean antialiased;
+} DabMaskCacheKey;
+
+/* A dab mask rendered into its own (size x size) grid, not clipped to any tile.
+ * One fix15 opacity value per pixel, zero outside of the dab. */
+typedef struct _DabMaskCacheEntry {
+    DabMaskCacheKey key;
+    int size;
+    uint16_t *mask;
+    size_t bytes;
+
+    /* private: */
+    int refcount;
+    gboolean cached;
+    gboolean rendering; /* dab_mask_cache_lookup_or_render() is rendering the mask */
+    struct _DabMaskCacheEntry *hash_next;
+    struct _DabMaskCacheEntry *lru_prev;
+    struct _DabMaskCacheEntry *lru_next;
+} DabMaskCacheEntry;
+
+typedef struct _DabMaskCache DabMaskCache;
+
+/* Renders the mask for dab_mask_cache_lookup_or_render().
+ * Returns a (@size x @size) buffer allocated with malloc(), or NULL on failure. */
+typedef uint16_t *(*DabMaskCacheRenderFunction) (void *user_data, int *size);
+
+DabMaskCache *dab_mask_cache_new(size_t max_bytes);
+void dab_mask_cache_free(DabMaskCache *self);
+
+void dab_mask_cache_set_max_bytes(DabMaskCache *self, size_t max_bytes);
+size_t dab_mask_cache_get_max_bytes(DabMaskCache *self);
+
+DabMaskCacheEntry *dab_mask_cache_lookup(DabMaskCache *self, const DabMaskCacheKey *key);
+DabMaskCacheEntry *dab_mask_cache_insert(DabMaskCache *self, const DabMaskCacheKey *key,
+                                         uint16_t *mask, int size);
+DabMaskCacheEntry *dab_mask_cache_lookup_or_render(DabMaskCache *self, const DabMaskCacheKey *key,
+                                                  DabMaskCacheRenderFunction render, void *user_data);
+void dab_mask_cache_release(DabMaskCache *self, DabMaskCacheEntry *entry);
+
+void dab_mask_cache_clear(DabMaskCache *self);
+
+void dab_mask_cache_get_stats(DabMaskCache *self, int *hits, int *misses, int *evictions, size_t *bytes);
+void dab_mask_cache_reset_stats(DabMaskCache *self);
+
+G_END_DECLS
+
+#endif // DABMASKCACHE_H
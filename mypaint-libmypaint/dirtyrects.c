@@ -0,0 +1,188 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dirtyrects.h"
+#include "helpers.h"
+
+// A bounded list of rectangles covering the changed area, used instead
+// of a single bounding box so that distant dabs do not make everything
+// between them dirty.
+//
+// A rectangle is merged into another one if their bounding box is not
+// larger than both together, which is the case for the overlapping dabs
+// of a stroke. Once the list is full, the two rectangles which waste the
+// least area when merged are merged.
+//
+// Concurrency: not threadsafe.
+
+struct _DirtyRects {
+    MyPaintRectangle *rects;
+    int rects_n;
+    int max_rects;
+    int last; // index of the rectangle merged into last, checked first
+};
+
+static int64_t
+rect_area(const MyPaintRectangle *r)
+{
+    return (int64_t)r->width * r->height;
+}
+
+static MyPaintRectangle
+rect_union(const MyPaintRectangle *a, const MyPaintRectangle *b)
+{
+    const int x1 = MIN(a->x, b->x);
+    const int y1 = MIN(a->y, b->y);
+    const int x2 = MAX(a->x + a->width, b->x + b->width);
+    const int y2 = MAX(a->y + a->height, b->y + b->height);
+    const MyPaintRectangle r = {x1, y1, x2 - x1, y2 - y1};
+    return r;
+}
+
+// Area of the bounding box of @a and @b which is in neither of them,
+// counting their overlap as negative
+static int64_t
+rect_merge_waste(const MyPaintRectangle *a, const MyPaintRectangle *b)
+{
+    const MyPaintRectangle u = rect_union(a, b);
+    return rect_area(&u) - rect_area(a) - rect_area(b);
+}
+
+DirtyRects *
+dirty_rects_new(int max_rects)
+{
+    assert(max_rects > 0);
+    DirtyRects *self = (DirtyRects *)malloc(sizeof(DirtyRects));
+    // One extra, for the rectangle being added to a full list
+    self->rects = (MyPaintRectangle *)malloc((max_rects + 1) * sizeof(MyPaintRectangle));
+    self->max_rects = max_rects;
+    dirty_rects_clear(self);
+    return self;
+}
+
+void
+dirty_rects_free(DirtyRects *self)
+{
+    free(self->rects);
+    free(self);
+}
+
+void
+dirty_rects_clear(DirtyRects *self)
+{
+    self->rects_n = 0;
+    self->last = 0;
+}
+
+static void
+remove_rect(MyPaintRectangle *rects, int *rects_n, int i)
+{
+    rects[i] = rects[*rects_n - 1];
+    (*rects_n)--;
+}
+
+// Merges rectangle @i into every rectangle it can be merged into without waste,
+// also the results. Returns the index the merged rectangle ended up at.
+static int
+merge_cascade(MyPaintRectangle *rects, int *rects_n, int i)
+{
+    gboolean merged = TRUE;
+    while (merged) {
+        merged = FALSE;
+        for (int j = 0; j < *rects_n; j++) {
+            if (j != i && rect_merge_waste(&rects[i], &rects[j]) <= 0) {
+                rects[j] = rect_union(&rects[i], &rects[j]);
+                remove_rect(rects, rects_n, i);
+                i = (j == *rects_n) ? i : j; // j was moved into the gap
+                merged = TRUE;
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+// Merges the pair of rectangles wasting the least area,
+// until there are at most @max_rects. Returns the index of the last merge.
+static int
+merge_down(MyPaintRectangle *rects, int *rects_n, int max_rects)
+{
+    int merged = 0;
+    while (*rects_n > max_rects) {
+        int best_i = 0, best_j = 1;
+        int64_t best_waste = rect_merge_waste(&rects[0], &rects[1]);
+        for (int i = 0; i < *rects_n; i++) {
+            for (int j = i + 1; j < *rects_n; j++) {
+                const int64_t waste = rect_merge_waste(&rects[i], &rects[j]);
+                if (waste < best_waste) {
+                    best_waste = waste;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        rects[best_i] = rect_union(&rects[best_i], &rects[best_j]);
+        remove_rect(rects, rects_n, best_j);
+        merged = merge_cascade(rects, rects_n, best_i);
+    }
+    return merged;
+}
+
+void
+dirty_rects_add(DirtyRects *self, const MyPaintRectangle *rect)
+{
+    if (rect->width <= 0 || rect->height <= 0) {
+        return;
+    }
+
+    // Common case: the next dab of the same stroke
+    if (self->rects_n > 0 && rect_merge_waste(&self->rects[self->last], rect) <= 0) {
+        self->rects[self->last] = rect_union(&self->rects[self->last], rect);
+        self->last = merge_cascade(self->rects, &self->rects_n, self->last);
+        return;
+    }
+
+    self->rects[self->rects_n] = *rect;
+    self->rects_n++;
+    self->last = merge_cascade(self->rects, &self->rects_n, self->rects_n - 1);
+    if (self->rects_n > self->max_rects) {
+        self->last = merge_down(self->rects, &self->rects_n, self->max_rects);
+    }
+}
+
+// Copies the rectangles into @rects, merged down to at most @max_rects.
+// Returns the number of rectangles.
+int
+dirty_rects_get(DirtyRects *self, MyPaintRectangle *rects, int max_rects)
+{
+    assert(max_rects > 0);
+    if (self->rects_n <= max_rects) {
+        memcpy(rects, self->rects, self->rects_n * sizeof(MyPaintRectangle));
+        return self->rects_n;
+    }
+
+    MyPaintRectangle *copy = (MyPaintRectangle *)malloc(self->rects_n * sizeof(MyPaintRectangle));
+    int copy_n = self->rects_n;
+    memcpy(copy, self->rects, copy_n * sizeof(MyPaintRectangle));
+    merge_down(copy, &copy_n, max_rects);
+    memcpy(rects, copy, copy_n * sizeof(MyPaintRectangle));
+    free(copy);
+    return copy_n;
+}
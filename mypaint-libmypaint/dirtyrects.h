@@ -0,0 +1,35 @@
+#ifndef DIRTYRECTS_H
+#define DIRTYRECTS_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+#include <mypaint-rectangle.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DirtyRects DirtyRects;
+
+DirtyRects *dirty_rects_new(int max_rects);
+void dirty_rects_free(DirtyRects *self);
+
+void dirty_rects_clear(DirtyRects *self);
+void dirty_rects_add(DirtyRects *self, const MyPaintRectangle *rect);
+int dirty_rects_get(DirtyRects *self, MyPaintRectangle *rects, int max_rects);
+
+G_END_DECLS
+
+#endif // DIRTYRECTS_H
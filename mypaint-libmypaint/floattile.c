@@ -0,0 +1,502 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "floattile.h"
+#include "helpers.h"
+#include "simd.h"
+
+// Blending and color sampling for the float tile formats, see MyPaintTileFormat.
+//
+// The pixels are premultiplied RGBA in linear light, 1.0 is fully opaque.
+// Float16 tiles are converted to float32 one row span at a time, blended
+// with the float32 kernels, and converted back.
+//
+// The SIMD kernels use the same operations in the same order as the scalar
+// code, so the blending results are identical for all SIMD levels.
+// The sampled sums are added up in a different order and may differ slightly.
+
+#define FIX15_TO_FLOAT (1.0f / (1<<15))
+
+size_t
+tile_format_get_pixel_bytes(MyPaintTileFormat format)
+{
+    switch (format) {
+    case MYPAINT_TILE_FORMAT_RGBA_FLOAT32:
+        return 4*sizeof(float);
+    case MYPAINT_TILE_FORMAT_RGBA16:
+    case MYPAINT_TILE_FORMAT_RGBA_FLOAT16:
+    default:
+        return 4*sizeof(uint16_t);
+    }
+}
+
+
+// IEEE 754 half floats, rounded to nearest even like the F16C instructions
+
+typedef union {
+    float f;
+    uint32_t u;
+} FloatBits;
+
+float
+half_to_float(uint16_t half)
+{
+    const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+    FloatBits bits;
+
+    if (exponent == 0) {
+        // zero or subnormal, exact in float
+        const float value = mantissa * (1.0f / (1<<24));
+        return sign ? -value : value;
+    } else if (exponent == 31) {
+        bits.u = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits.u = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    return bits.f;
+}
+
+uint16_t
+float_to_half(float value)
+{
+    FloatBits bits;
+    bits.f = value;
+    const uint16_t sign = (bits.u >> 16) & 0x8000;
+    const uint32_t abs = bits.u & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        // infinity, or NaN which stays quiet
+        return sign | 0x7c00 | ((abs > 0x7f800000) ? 0x200 | ((abs >> 13) & 0x3ff) : 0);
+    }
+    if (abs >= 0x477ff000) {
+        // 65520 and above round to infinity
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // below the smallest normal half, 2^-14
+        if (abs < 0x33000000) {
+            return sign; // at most half of the smallest subnormal, 2^-25
+        }
+        const uint32_t exponent = abs >> 23;
+        const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        const int shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t middle = 1u << (shift - 1);
+        if (rest > middle || (rest == middle && (half & 1))) {
+            half++;
+        }
+        return sign | half;
+    }
+    uint32_t half = (abs >> 13) - ((127 - 15) << 10);
+    const uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return sign | half;
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("avx2,f16c") static void
+half_to_float_array_avx2(const uint16_t *src, float *dst, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+    for (; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+
+SIMD_TARGET("avx2,f16c") static void
+float_to_half_array_avx2(const float *src, uint16_t *dst, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0));
+    }
+    for (; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+#endif // SIMD_X86
+
+void
+half_to_float_array(const uint16_t *src, float *dst, int n)
+{
+#ifdef SIMD_X86
+    if (simd_level_get() == SIMD_LEVEL_AVX2) {
+        half_to_float_array_avx2(src, dst, n);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+
+void
+float_to_half_array(const float *src, uint16_t *dst, int n)
+{
+#ifdef SIMD_X86
+    if (simd_level_get() == SIMD_LEVEL_AVX2) {
+        float_to_half_array_avx2(src, dst, n);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+
+// sRGB transfer function (IEC 61966-2-1), only used once per dab
+
+float
+srgb_to_linear(float value)
+{
+    if (value <= 0.04045f) {
+        return value / 12.92f;
+    }
+    return powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float
+linear_to_srgb(float value)
+{
+    if (value <= 0.0031308f) {
+        return value * 12.92f;
+    }
+    return 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+
+// Blending one row span of @n pixels, see brushmodes.c for the formulas
+
+static inline void
+blend_pixel_float(uint16_t opa, float *rgba, FloatBlendMode mode, const FloatDabColor *c)
+{
+    float opa_a = opa * FIX15_TO_FLOAT * c->opacity; // topAlpha
+    const float opa_b = 1.0f - opa_a; // bottomAlpha
+    if (mode == FLOAT_BLEND_NORMAL_AND_ERASER) {
+        opa_a *= c->color_a;
+    }
+    if (mode == FLOAT_BLEND_LOCK_ALPHA) {
+        opa_a *= rgba[3];
+    } else {
+        rgba[3] = opa_a*c->color[3] + opa_b*rgba[3];
+    }
+    rgba[0] = opa_a*c->color[0] + opa_b*rgba[0];
+    rgba[1] = opa_a*c->color[1] + opa_b*rgba[1];
+    rgba[2] = opa_a*c->color[2] + opa_b*rgba[2];
+}
+
+#define LUMA_FLOAT(r, g, b) ((r)*0.3f + (g)*0.59f + (b)*0.11f)
+
+// Float version of blend_pixel_Color(), keeping the bottom luminance
+static inline void
+blend_pixel_float_Color(uint16_t opa, float *rgba, const FloatDabColor *c)
+{
+    const float a = rgba[3];
+    float r = 0.0f, g = 0.0f, b = 0.0f;
+    if (a > 0.0f) {
+        r = rgba[0] / a;
+        g = rgba[1] / a;
+        b = rgba[2] / a;
+    }
+
+    // SetLum()
+    const float diff = LUMA_FLOAT(r, g, b) - LUMA_FLOAT(c->color[0], c->color[1], c->color[2]);
+    r = c->color[0] + diff;
+    g = c->color[1] + diff;
+    b = c->color[2] + diff;
+
+    // ClipColor()
+    const float lum = LUMA_FLOAT(r, g, b);
+    const float cmin = MIN3(r, g, b);
+    const float cmax = MAX3(r, g, b);
+    if (cmin < 0.0f) {
+        r = lum + (r - lum) * lum / (lum - cmin);
+        g = lum + (g - lum) * lum / (lum - cmin);
+        b = lum + (b - lum) * lum / (lum - cmin);
+    }
+    if (cmax > 1.0f) {
+        r = lum + (r - lum) * (1.0f - lum) / (cmax - lum);
+        g = lum + (g - lum) * (1.0f - lum) / (cmax - lum);
+        b = lum + (b - lum) * (1.0f - lum) / (cmax - lum);
+    }
+
+    const float opa_a = opa * FIX15_TO_FLOAT * c->opacity;
+    const float opa_b = 1.0f - opa_a;
+    rgba[0] = opa_a*(r*a) + opa_b*rgba[0];
+    rgba[1] = opa_a*(g*a) + opa_b*rgba[1];
+    rgba[2] = opa_a*(b*a) + opa_b*rgba[2];
+}
+
+typedef void (*BlendRowFunction) (const uint16_t *opa, float *rgba, int n, const FloatDabColor *c);
+
+static void
+blend_row_Color(const uint16_t *opa, float *rgba, int n, const FloatDabColor *c)
+{
+    for (int i = 0; i < n; i++) {
+        if (opa[i]) {
+            blend_pixel_float_Color(opa[i], rgba + 4*i, c);
+        }
+    }
+}
+
+static inline void
+blend_row_linear(const uint16_t *opa, float *rgba, int n, FloatBlendMode mode, const FloatDabColor *c)
+{
+    for (int i = 0; i < n; i++) {
+        blend_pixel_float(opa[i], rgba + 4*i, mode, c);
+    }
+}
+
+#ifdef SIMD_X86
+
+// One pixel per vector, the weights are calculated like in blend_pixel_float()
+SIMD_TARGET("sse2") static inline void
+blend_row_linear_sse2(const uint16_t *opa, float *rgba, int n, FloatBlendMode mode, const FloatDabColor *c)
+{
+    const __m128 color = _mm_loadu_ps(c->color);
+    for (int i = 0; i < n; i++) {
+        float opa_a = opa[i] * FIX15_TO_FLOAT * c->opacity;
+        const float opa_b = 1.0f - opa_a;
+        if (mode == FLOAT_BLEND_NORMAL_AND_ERASER) {
+            opa_a *= c->color_a;
+        }
+        float *p = rgba + 4*i;
+        const __m128 dst = _mm_loadu_ps(p);
+        if (mode == FLOAT_BLEND_LOCK_ALPHA) {
+            opa_a *= p[3];
+        }
+        __m128 result = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(opa_a), color),
+                                   _mm_mul_ps(_mm_set1_ps(opa_b), dst));
+        if (mode == FLOAT_BLEND_LOCK_ALPHA) {
+            // keep the alpha of dst
+            const __m128 alpha = _mm_shuffle_ps(result, dst, _MM_SHUFFLE(3,3,2,2));
+            result = _mm_shuffle_ps(result, alpha, _MM_SHUFFLE(2,0,1,0));
+        }
+        _mm_storeu_ps(p, result);
+    }
+}
+
+// Eight pixels at a time, two per vector
+SIMD_TARGET("avx2") static inline void
+blend_row_linear_avx2(const uint16_t *opa, float *rgba, int n, FloatBlendMode mode, const FloatDabColor *c)
+{
+    const __m256 color = _mm256_broadcast_ps((const __m128 *)c->color);
+    const __m256 fix15_to_float = _mm256_set1_ps(FIX15_TO_FLOAT);
+    const __m256 opacity = _mm256_set1_ps(c->opacity);
+    const __m256 color_a = _mm256_set1_ps(c->color_a);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i expand[4] = {_mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1),
+                               _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3),
+                               _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5),
+                               _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7)};
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i opa_i = _mm_loadu_si128((const __m128i *)(opa + i));
+        __m256 opa_a = _mm256_mul_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(opa_i)),
+                                                   fix15_to_float), opacity);
+        const __m256 opa_b = _mm256_sub_ps(one, opa_a);
+        if (mode == FLOAT_BLEND_NORMAL_AND_ERASER) {
+            opa_a = _mm256_mul_ps(opa_a, color_a);
+        }
+        for (int j = 0; j < 4; j++) {
+            float *p = rgba + 4*(i + 2*j);
+            const __m256 dst = _mm256_loadu_ps(p);
+            __m256 a = _mm256_permutevar8x32_ps(opa_a, expand[j]);
+            const __m256 b = _mm256_permutevar8x32_ps(opa_b, expand[j]);
+            if (mode == FLOAT_BLEND_LOCK_ALPHA) {
+                a = _mm256_mul_ps(a, _mm256_permute_ps(dst, _MM_SHUFFLE(3,3,3,3)));
+            }
+            __m256 result = _mm256_add_ps(_mm256_mul_ps(a, color), _mm256_mul_ps(b, dst));
+            if (mode == FLOAT_BLEND_LOCK_ALPHA) {
+                result = _mm256_blend_ps(result, dst, 0x88);
+            }
+            _mm256_storeu_ps(p, result);
+        }
+    }
+    for (; i < n; i++) {
+        blend_pixel_float(opa[i], rgba + 4*i, mode, c);
+    }
+}
+
+#endif // SIMD_X86
+
+// One instance per blend mode and instruction set, so that the mode checks
+// are resolved at compile time
+#define DEFINE_BLEND_ROW(suffix, target, name, mode) \
+    target static void \
+    blend_row_##name##suffix (const uint16_t *opa, float *rgba, int n, const FloatDabColor *c) { \
+        blend_row_linear##suffix(opa, rgba, n, mode, c); \
+    }
+
+#define NO_TARGET
+
+DEFINE_BLEND_ROW(, NO_TARGET, Normal, FLOAT_BLEND_NORMAL)
+DEFINE_BLEND_ROW(, NO_TARGET, Normal_and_Eraser, FLOAT_BLEND_NORMAL_AND_ERASER)
+DEFINE_BLEND_ROW(, NO_TARGET, LockAlpha, FLOAT_BLEND_LOCK_ALPHA)
+
+#ifdef SIMD_X86
+DEFINE_BLEND_ROW(_sse2, SIMD_TARGET("sse2"), Normal, FLOAT_BLEND_NORMAL)
+DEFINE_BLEND_ROW(_sse2, SIMD_TARGET("sse2"), Normal_and_Eraser, FLOAT_BLEND_NORMAL_AND_ERASER)
+DEFINE_BLEND_ROW(_sse2, SIMD_TARGET("sse2"), LockAlpha, FLOAT_BLEND_LOCK_ALPHA)
+DEFINE_BLEND_ROW(_avx2, SIMD_TARGET("avx2"), Normal, FLOAT_BLEND_NORMAL)
+DEFINE_BLEND_ROW(_avx2, SIMD_TARGET("avx2"), Normal_and_Eraser, FLOAT_BLEND_NORMAL_AND_ERASER)
+DEFINE_BLEND_ROW(_avx2, SIMD_TARGET("avx2"), LockAlpha, FLOAT_BLEND_LOCK_ALPHA)
+#endif
+
+static BlendRowFunction
+select_blend_row(FloatBlendMode mode)
+{
+    static const BlendRowFunction scalar[FLOAT_BLEND_MODES_COUNT] = {
+        blend_row_Normal, blend_row_Normal_and_Eraser, blend_row_LockAlpha, blend_row_Color
+    };
+#ifdef SIMD_X86
+    // The float Color mode has no SIMD version, its clipping branches per pixel
+    static const BlendRowFunction sse2[FLOAT_BLEND_MODES_COUNT] = {
+        blend_row_Normal_sse2, blend_row_Normal_and_Eraser_sse2, blend_row_LockAlpha_sse2, blend_row_Color
+    };
+    static const BlendRowFunction avx2[FLOAT_BLEND_MODES_COUNT] = {
+        blend_row_Normal_avx2, blend_row_Normal_and_Eraser_avx2, blend_row_LockAlpha_avx2, blend_row_Color
+    };
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+        return avx2[mode];
+    case SIMD_LEVEL_SSE2:
+        return sse2[mode];
+    default:
+        break;
+    }
+#endif
+    return scalar[mode];
+}
+
+void
+draw_dab_spans_float(const DabMask *mask, void *rgba, MyPaintTileFormat format,
+                     FloatBlendMode mode, const FloatDabColor *color)
+{
+    const BlendRowFunction blend_row = select_blend_row(mode);
+    float row[MYPAINT_MAX_TILE_SIZE*4];
+
+    for (int y = mask->y0; y < mask->y1; y++) {
+        const int x0 = mask->x0[y];
+        const int n = mask->x1[y] - x0;
+        if (n <= 0) {
+            continue;
+        }
+        const uint16_t *opa_p = mask->opa + y*mask->size + x0;
+        const size_t offset = (y*mask->size + x0)*4;
+        if (format == MYPAINT_TILE_FORMAT_RGBA_FLOAT32) {
+            blend_row(opa_p, (float *)rgba + offset, n, color);
+        } else {
+            uint16_t *half_p = (uint16_t *)rgba + offset;
+            half_to_float_array(half_p, row, n*4);
+            blend_row(opa_p, row, n, color);
+            float_to_half_array(row, half_p, n*4);
+        }
+    }
+}
+
+
+// Color sampling, the float version of get_color_spans_accumulate().
+// Adds the sums of the masked region to @sums (weight, r, g, b, a),
+// where the weights are the fix15 mask values.
+
+static void
+accumulate_row(const uint16_t *opa, const float *rgba, int n, double sums[5])
+{
+    for (int i = 0; i < n; i++) {
+        const float w = opa[i];
+        sums[0] += w;
+        sums[1] += w*rgba[4*i+0];
+        sums[2] += w*rgba[4*i+1];
+        sums[3] += w*rgba[4*i+2];
+        sums[4] += w*rgba[4*i+3];
+    }
+}
+
+#ifdef SIMD_X86
+
+// Summed up with floats within the row, the rows with doubles
+SIMD_TARGET("avx2") static void
+accumulate_row_avx2(const uint16_t *opa, const float *rgba, int n, double sums[5])
+{
+    const __m256i expand[4] = {_mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1),
+                               _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3),
+                               _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5),
+                               _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7)};
+    __m256 weight = _mm256_setzero_ps();
+    __m256 color = _mm256_setzero_ps(); // r, g, b, a, r, g, b, a
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 w = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(opa + i))));
+        weight = _mm256_add_ps(weight, w);
+        for (int j = 0; j < 4; j++) {
+            const __m256 src = _mm256_loadu_ps(rgba + 4*(i + 2*j));
+            color = _mm256_add_ps(color, _mm256_mul_ps(_mm256_permutevar8x32_ps(w, expand[j]), src));
+        }
+    }
+    float w[8], c[8];
+    _mm256_storeu_ps(w, weight);
+    _mm256_storeu_ps(c, color);
+    sums[0] += (double)w[0] + w[1] + w[2] + w[3] + w[4] + w[5] + w[6] + w[7];
+    for (int k = 0; k < 4; k++) {
+        sums[1+k] += (double)c[k] + c[4+k];
+    }
+    accumulate_row(opa + i, rgba + 4*i, n - i, sums);
+}
+
+#endif // SIMD_X86
+
+void
+get_color_spans_accumulate_float(const DabMask *mask, const void *rgba,
+                                 MyPaintTileFormat format, double sums[5])
+{
+    void (*accumulate) (const uint16_t *opa, const float *rgba, int n, double sums[5]) = accumulate_row;
+#ifdef SIMD_X86
+    if (simd_level_get() == SIMD_LEVEL_AVX2) {
+        accumulate = accumulate_row_avx2;
+    }
+#endif
+    float row[MYPAINT_MAX_TILE_SIZE*4];
+
+    for (int y = mask->y0; y < mask->y1; y++) {
+        const int x0 = mask->x0[y];
+        const int n = mask->x1[y] - x0;
+        if (n <= 0) {
+            continue;
+        }
+        const uint16_t *opa_p = mask->opa + y*mask->size + x0;
+        const size_t offset = (y*mask->size + x0)*4;
+        if (format == MYPAINT_TILE_FORMAT_RGBA_FLOAT32) {
+            accumulate(opa_p, (const float *)rgba + offset, n, sums);
+        } else {
+            half_to_float_array((const uint16_t *)rgba + offset, row, n*4);
+            accumulate(opa_p, row, n, sums);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef FLOATTILE_H
+#define FLOATTILE_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "mypaint-tiled-surface.h"
+#include "dabmask.h"
+
+// Blend modes of the float tile formats, the same as for the fix15 tiles
+typedef enum {
+    FLOAT_BLEND_NORMAL,
+    FLOAT_BLEND_NORMAL_AND_ERASER,
+    FLOAT_BLEND_LOCK_ALPHA,
+    FLOAT_BLEND_COLOR,
+    FLOAT_BLEND_MODES_COUNT
+} FloatBlendMode;
+
+typedef struct {
+    float color[4]; // r, g, b in linear light and not premultiplied, then 1.0
+    float color_a;  // for FLOAT_BLEND_NORMAL_AND_ERASER
+    float opacity;
+} FloatDabColor;
+
+size_t tile_format_get_pixel_bytes(MyPaintTileFormat format);
+
+float half_to_float(uint16_t half);
+uint16_t float_to_half(float value);
+void half_to_float_array(const uint16_t *src, float *dst, int n);
+void float_to_half_array(const float *src, uint16_t *dst, int n);
+
+float srgb_to_linear(float value);
+float linear_to_srgb(float value);
+
+void draw_dab_spans_float(const DabMask *mask, void *rgba, MyPaintTileFormat format,
+                          FloatBlendMode mode, const FloatDabColor *color);
+void get_color_spans_accumulate_float(const DabMask *mask, const void *rgba,
+                                      MyPaintTileFormat format, double sums[5]);
+
+#endif // FLOATTILE_H
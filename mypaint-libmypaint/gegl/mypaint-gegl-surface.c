@@ -194,10 +194,23 @@ mypaint_gegl_tiled_surface_set_buffer(MyPaintGeglTiledSurface *self, GeglBuffer
 
 MyPaintGeglTiledSurface *
 mypaint_gegl_tiled_surface_new(void)
+{
+    return mypaint_gegl_tiled_surface_new_with_tile_size(MYPAINT_TILE_SIZE);
+}
+
+/**
+ * mypaint_gegl_tiled_surface_new_with_tile_size:
+ * @tile_size: Tile width and height in pixels, see mypaint_tiled_surface_tile_size_is_supported()
+ *
+ * Buffers set with mypaint_gegl_tiled_surface_set_buffer() should use the same
+ * tile size, otherwise tiles are copied on every access.
+ */
+MyPaintGeglTiledSurface *
+mypaint_gegl_tiled_surface_new_with_tile_size(int tile_size)
 {
     MyPaintGeglTiledSurface *self = (MyPaintGeglTiledSurface *)malloc(sizeof(MyPaintGeglTiledSurface));
 
-    mypaint_tiled_surface_init(&self->parent, tile_request_start, tile_request_end);
+    mypaint_tiled_surface_init_with_tile_size(&self->parent, tile_request_start, tile_request_end, tile_size);
 
     // MyPaintSurface vfuncs
     self->parent.parent.destroy = free_gegl_tiledsurf;
@@ -38,6 +38,9 @@ mypaint_gegl_tiled_surface_interface(MyPaintGeglTiledSurface *self);
 MyPaintGeglTiledSurface *
 mypaint_gegl_tiled_surface_new(void);
 
+MyPaintGeglTiledSurface *
+mypaint_gegl_tiled_surface_new_with_tile_size(int tile_size);
+
 G_END_DECLS
 
 #endif // MYPAINTGEGLSURFACE_H
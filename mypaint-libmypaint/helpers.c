@@ -23,16 +23,6 @@
 
 #include "helpers.h"
 
-float rand_gauss (RngDouble * rng)
-{
-  double sum = 0.0;
-  sum += rng_double_next(rng);
-  sum += rng_double_next(rng);
-  sum += rng_double_next(rng);
-  sum += rng_double_next(rng);
-  return sum * 1.73205080757 - 3.46410161514;
-}
-
 // stolen from GIMP (gimpcolorspace.c)
 // (from gimp_rgb_to_hsv)
 void
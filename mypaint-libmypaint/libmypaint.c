@@ -4,16 +4,30 @@
  * for the includes here to succeed. */
 
 #include "mapping.c"
+#include "brushprogram.c"
 #include "helpers.c"
+#include "colorconv.c"
 #include "brushmodes.c"
 #include "fifo.c"
 #include "operationqueue.c"
 #include "rng-double.c"
+#include "rng-counter.c"
 #include "utils.c"
 #include "tilemap.c"
+#include "tilescheduler.c"
+#include "tileworker.c"
+#include "dabmaskcache.c"
+#include "dabmask.c"
+#include "simd.c"
+#include "surfacestats.c"
+#include "dirtyrects.c"
+#include "floattile.c"
+#include "tilecodec.c"
+#include "symmetry.c"
 
 #include "mypaint.c"
 #include "mypaint-brush.c"
+#include "mypaint-brush-pack.c"
 #include "mypaint-brush-settings.c"
 #include "mypaint-fixed-tiled-surface.c"
 #include "mypaint-surface.c"
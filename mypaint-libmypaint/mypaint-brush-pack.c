@@ -0,0 +1,382 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mypaint-brush-pack.h"
+#include "brush-private.h"
+#include "helpers.h"
+
+// Brush pack files, all in host byte order:
+//
+//   BrushPackHeader
+//   BrushPackEntry[brushes_n], sorted by name
+//   per brush: float base_values[settings_n], BrushProgramCurve curves[curves_n]
+//   the zero terminated names
+//
+// The curves are the compiled dynamics of the brush (see brushprogram.h),
+// loading a brush neither parses JSON nor compiles its mappings.
+
+#define BRUSH_PACK_MAGIC "MPBP"
+#define BRUSH_PACK_VERSION 1
+
+typedef struct {
+    char magic[4]; // BRUSH_PACK_MAGIC
+    uint32_t version; // also tells apart files written with the other byte order
+    uint32_t settings_n; // MYPAINT_BRUSH_SETTINGS_COUNT of the writer
+    uint32_t inputs_n; // MYPAINT_BRUSH_INPUTS_COUNT of the writer
+    uint32_t curve_size; // sizeof(BrushProgramCurve)
+    uint32_t brushes_n;
+} BrushPackHeader;
+
+typedef struct {
+    uint32_t name_offset; // from the start of the file
+    uint32_t data_offset; // from the start of the file
+    uint32_t curves_n;
+    uint32_t reserved;
+} BrushPackEntry;
+
+struct _MyPaintBrushPack {
+    void *mapping;
+    size_t mapping_size;
+    const BrushPackEntry *entries;
+    int brushes_n;
+    MyPaintBrush **brushes; // built on first use
+};
+
+static const char *
+entry_name(const MyPaintBrushPack *self, int index)
+{
+    return (const char *)self->mapping + self->entries[index].name_offset;
+}
+
+// Whether the header and the entries fit into the file and match this libmypaint
+static gboolean
+is_valid_pack(const void *mapping, size_t size)
+{
+    const BrushPackHeader *header = (const BrushPackHeader *)mapping;
+    if (size < sizeof(BrushPackHeader)
+        || memcmp(header->magic, BRUSH_PACK_MAGIC, 4) != 0
+        || header->version != BRUSH_PACK_VERSION
+        || header->settings_n != MYPAINT_BRUSH_SETTINGS_COUNT
+        || header->inputs_n != MYPAINT_BRUSH_INPUTS_COUNT
+        || header->curve_size != sizeof(BrushProgramCurve)
+        || header->brushes_n > (size - sizeof(BrushPackHeader)) / sizeof(BrushPackEntry)) {
+        return FALSE;
+    }
+
+    const BrushPackEntry *entries = (const BrushPackEntry *)(header + 1);
+    for (uint32_t i = 0; i < header->brushes_n; i++) {
+        const BrushPackEntry *entry = &entries[i];
+        const uint64_t data_end = (uint64_t)entry->data_offset
+                                  + MYPAINT_BRUSH_SETTINGS_COUNT*sizeof(float)
+                                  + (uint64_t)entry->curves_n*sizeof(BrushProgramCurve);
+        if (entry->name_offset >= size
+            || !memchr((const char *)mapping + entry->name_offset, '\0', size - entry->name_offset)
+            || entry->data_offset % sizeof(float) != 0
+            || data_end > size) {
+            return FALSE;
+        }
+        // mypaint_brush_pack_find() relies on the order
+        if (i > 0 && strcmp((const char *)mapping + entries[i-1].name_offset,
+                            (const char *)mapping + entry->name_offset) >= 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * mypaint_brush_pack_open:
+ *
+ * Map the brush pack @path into memory. No brush is built yet.
+ *
+ * Returns: NULL if the file could not be read, or if it is not a brush pack
+ * of this version of libmypaint.
+ */
+MyPaintBrushPack *
+mypaint_brush_pack_open(const char *path)
+{
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: Unable to open '%s'\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    const size_t size = st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map '%s'\n", path);
+        return NULL;
+    }
+
+    if (!is_valid_pack(mapping, size)) {
+        fprintf(stderr, "Error: '%s' is not a brush pack of this version, byte order or brush settings\n", path);
+        munmap(mapping, size);
+        return NULL;
+    }
+    // Only the brushes which are used are read
+    posix_madvise(mapping, size, POSIX_MADV_RANDOM);
+
+    const BrushPackHeader *header = (const BrushPackHeader *)mapping;
+    MyPaintBrushPack *self = (MyPaintBrushPack *)malloc(sizeof(MyPaintBrushPack));
+    self->mapping = mapping;
+    self->mapping_size = size;
+    self->entries = (const BrushPackEntry *)(header + 1);
+    self->brushes_n = header->brushes_n;
+    self->brushes = (MyPaintBrush **)calloc(MAX(self->brushes_n, 1), sizeof(MyPaintBrush *));
+    return self;
+}
+
+/**
+ * mypaint_brush_pack_close:
+ *
+ * Unmap the pack, and release the brushes built by mypaint_brush_pack_get_brush().
+ */
+void
+mypaint_brush_pack_close(MyPaintBrushPack *self)
+{
+    for (int i = 0; i < self->brushes_n; i++) {
+        if (self->brushes[i]) {
+            mypaint_brush_unref(self->brushes[i]);
+        }
+    }
+    free(self->brushes);
+    munmap(self->mapping, self->mapping_size);
+    free(self);
+}
+
+int
+mypaint_brush_pack_get_brushes_n(MyPaintBrushPack *self)
+{
+    return self->brushes_n;
+}
+
+/**
+ * mypaint_brush_pack_get_name:
+ *
+ * Name of the brush @index, e.g. "classic/pencil". The brushes are sorted by name.
+ */
+const char *
+mypaint_brush_pack_get_name(MyPaintBrushPack *self, int index)
+{
+    if (index < 0 || index >= self->brushes_n) {
+        return NULL;
+    }
+    return entry_name(self, index);
+}
+
+/**
+ * mypaint_brush_pack_find:
+ *
+ * Returns: the index of the brush called @name, or -1 if there is none.
+ */
+int
+mypaint_brush_pack_find(MyPaintBrushPack *self, const char *name)
+{
+    int low = 0;
+    int high = self->brushes_n - 1;
+    while (low <= high) {
+        const int middle = low + (high - low) / 2;
+        const int order = strcmp(entry_name(self, middle), name);
+        if (order == 0) {
+            return middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * mypaint_brush_pack_load_brush:
+ *
+ * Set all settings and dynamics of @brush to the ones of brush @index,
+ * like mypaint_brush_from_string() does for a .myb file.
+ *
+ * Returns: FALSE if there is no such brush, or if its dynamics are invalid.
+ */
+gboolean
+mypaint_brush_pack_load_brush(MyPaintBrushPack *self, int index, MyPaintBrush *brush)
+{
+    if (index < 0 || index >= self->brushes_n) {
+        return FALSE;
+    }
+    const BrushPackEntry *entry = &self->entries[index];
+    const float *base_values = (const float *)((const char *)self->mapping + entry->data_offset);
+    const BrushProgramCurve *curves = (const BrushProgramCurve *)(base_values + MYPAINT_BRUSH_SETTINGS_COUNT);
+
+    if (!brush_load_program(brush, base_values, curves, entry->curves_n)) {
+        fprintf(stderr, "Error: Invalid dynamics of brush '%s'\n", entry_name(self, index));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * mypaint_brush_pack_get_brush:
+ *
+ * The brush @index, built when it is first asked for.
+ * It belongs to the pack and is released by mypaint_brush_pack_close(),
+ * use mypaint_brush_ref() to keep it longer.
+ *
+ * Returns: (transfer none): NULL if there is no such brush, or if it is invalid.
+ */
+MyPaintBrush *
+mypaint_brush_pack_get_brush(MyPaintBrushPack *self, int index)
+{
+    if (index < 0 || index >= self->brushes_n) {
+        return NULL;
+    }
+    if (!self->brushes[index]) {
+        MyPaintBrush *brush = mypaint_brush_new();
+        if (!mypaint_brush_pack_load_brush(self, index, brush)) {
+            mypaint_brush_unref(brush);
+            return NULL;
+        }
+        self->brushes[index] = brush;
+    }
+    return self->brushes[index];
+}
+
+typedef struct {
+    const char *name;
+    MyPaintBrush *brush;
+} NamedBrush;
+
+static int
+compare_named_brushes(const void *a, const void *b)
+{
+    return strcmp(((const NamedBrush *)a)->name, ((const NamedBrush *)b)->name);
+}
+
+/**
+ * mypaint_brush_pack_save:
+ * @names: one unique name per brush, e.g. "classic/pencil"
+ *
+ * Write @brushes into the brush pack @path, see mypaint_brush_pack_open().
+ * The settings of each brush are compiled if they changed since its last dab.
+ * The pack is written to "@path.tmp" first, and only replaces @path when complete.
+ *
+ * Returns: FALSE if the file could not be written, a name is used twice,
+ * or the pack would be larger than 4 GiB.
+ */
+gboolean
+mypaint_brush_pack_save(const char *path, MyPaintBrush **brushes, const char **names, int brushes_n)
+{
+    NamedBrush *sorted = (NamedBrush *)malloc(MAX(brushes_n, 1)*sizeof(NamedBrush));
+    for (int i = 0; i < brushes_n; i++) {
+        sorted[i].name = names[i];
+        sorted[i].brush = brushes[i];
+    }
+    qsort(sorted, brushes_n, sizeof(NamedBrush), compare_named_brushes);
+    for (int i = 1; i < brushes_n; i++) {
+        if (strcmp(sorted[i-1].name, sorted[i].name) == 0) {
+            fprintf(stderr, "Error: Brush name '%s' is used twice\n", sorted[i].name);
+            free(sorted);
+            return FALSE;
+        }
+    }
+
+    // The data of all brushes after the entries, then all names.
+    // The offsets are 32 bit, larger packs are refused before anything is written.
+    BrushPackEntry *entries = (BrushPackEntry *)calloc(MAX(brushes_n, 1), sizeof(BrushPackEntry));
+    uint64_t offset = sizeof(BrushPackHeader) + (uint64_t)brushes_n*sizeof(BrushPackEntry);
+    for (int i = 0; i < brushes_n && offset <= UINT32_MAX; i++) {
+        entries[i].data_offset = offset;
+        entries[i].curves_n = brush_program_get_curves_n(brush_get_program(sorted[i].brush));
+        offset += MYPAINT_BRUSH_SETTINGS_COUNT*sizeof(float) + entries[i].curves_n*sizeof(BrushProgramCurve);
+    }
+    for (int i = 0; i < brushes_n && offset <= UINT32_MAX; i++) {
+        entries[i].name_offset = offset;
+        offset += strlen(sorted[i].name) + 1;
+    }
+    if (offset > UINT32_MAX) {
+        fprintf(stderr, "Error: Brush pack '%s' would be larger than 4 GiB\n", path);
+        free(entries);
+        free(sorted);
+        return FALSE;
+    }
+
+    // Written next to @path and renamed over it when complete, so that
+    // a failed save neither leaves a partial pack nor destroys the old one
+    char *temp_path = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    sprintf(temp_path, "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to write '%s'\n", temp_path);
+        free(temp_path);
+        free(entries);
+        free(sorted);
+        return FALSE;
+    }
+    gboolean written = TRUE;
+
+    BrushPackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BRUSH_PACK_MAGIC, 4);
+    header.version = BRUSH_PACK_VERSION;
+    header.settings_n = MYPAINT_BRUSH_SETTINGS_COUNT;
+    header.inputs_n = MYPAINT_BRUSH_INPUTS_COUNT;
+    header.curve_size = sizeof(BrushProgramCurve);
+    header.brushes_n = brushes_n;
+    written &= fwrite(&header, sizeof(header), 1, file) == 1;
+    if (brushes_n > 0) {
+        written &= fwrite(entries, sizeof(BrushPackEntry), brushes_n, file) == (size_t)brushes_n;
+    }
+
+    for (int i = 0; i < brushes_n; i++) {
+        BrushProgram *program = brush_get_program(sorted[i].brush);
+        const int curves_n = entries[i].curves_n;
+        written &= fwrite(brush_program_get_base_values(program), sizeof(float),
+                          MYPAINT_BRUSH_SETTINGS_COUNT, file) == MYPAINT_BRUSH_SETTINGS_COUNT;
+        if (curves_n > 0) {
+            written &= fwrite(brush_program_get_curves(program), sizeof(BrushProgramCurve),
+                              curves_n, file) == (size_t)curves_n;
+        }
+    }
+    for (int i = 0; i < brushes_n; i++) {
+        written &= fwrite(sorted[i].name, strlen(sorted[i].name) + 1, 1, file) == 1;
+    }
+
+    written &= (fclose(file) == 0);
+    if (written && rename(temp_path, path) != 0) {
+        fprintf(stderr, "Error: Unable to replace '%s'\n", path);
+        written = FALSE;
+    }
+    if (!written) {
+        remove(temp_path);
+    }
+    free(temp_path);
+    free(entries);
+    free(sorted);
+    return written;
+}
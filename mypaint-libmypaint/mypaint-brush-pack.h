@@ -0,0 +1,61 @@
+#ifndef MYPAINTBRUSHPACK_H
+#define MYPAINTBRUSHPACK_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+#include <mypaint-brush.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MyPaintBrushPack:
+ *
+ * Many brushes in one binary file, with their settings already compiled.
+ * Opening a pack maps the file into memory, the brushes are only built
+ * when they are first used. Packs are a cache of the .myb files, written
+ * by mypaint_brush_pack_save(). A pack written by a libmypaint with
+ * other brush settings or inputs cannot be opened and must be written again.
+ */
+typedef struct _MyPaintBrushPack MyPaintBrushPack;
+
+MyPaintBrushPack *
+mypaint_brush_pack_open(const char *path);
+
+void
+mypaint_brush_pack_close(MyPaintBrushPack *self);
+
+int
+mypaint_brush_pack_get_brushes_n(MyPaintBrushPack *self);
+
+const char *
+mypaint_brush_pack_get_name(MyPaintBrushPack *self, int index);
+
+int
+mypaint_brush_pack_find(MyPaintBrushPack *self, const char *name);
+
+MyPaintBrush *
+mypaint_brush_pack_get_brush(MyPaintBrushPack *self, int index);
+
+gboolean
+mypaint_brush_pack_load_brush(MyPaintBrushPack *self, int index, MyPaintBrush *brush);
+
+gboolean
+mypaint_brush_pack_save(const char *path, MyPaintBrush **brushes, const char **names, int brushes_n);
+
+G_END_DECLS
+
+#endif // MYPAINTBRUSHPACK_H
@@ -24,8 +24,11 @@
 
 #include "mypaint-brush-settings.h"
 #include "mapping.h"
+#include "brushprogram.h"
+#include "brush-private.h"
 #include "helpers.h"
-#include "rng-double.h"
+#include "colorconv.h"
+#include "rng-counter.h"
 
 #ifdef HAVE_JSON_C
 // Allow the C99 define from json.h
@@ -60,6 +63,47 @@
  */
 
 
+// Dabs are handed to the surface in batches of up to this many
+#define DAB_BATCH_SIZE 64
+
+// Dabs which are prepared but not drawn yet, see flush_dabs()
+typedef struct {
+    int count;
+    int painted; // dabs drawn by the current stroke_to() which modified the surface
+    float x[DAB_BATCH_SIZE];
+    float y[DAB_BATCH_SIZE];
+    float radius[DAB_BATCH_SIZE];
+    // HSV while queued, converted to RGB all at once by flush_dabs()
+    float color_r[DAB_BATCH_SIZE];
+    float color_g[DAB_BATCH_SIZE];
+    float color_b[DAB_BATCH_SIZE];
+    float opaque[DAB_BATCH_SIZE];
+    float hardness[DAB_BATCH_SIZE];
+    float alpha_eraser[DAB_BATCH_SIZE];
+    float aspect_ratio[DAB_BATCH_SIZE];
+    float angle[DAB_BATCH_SIZE];
+    float lock_alpha[DAB_BATCH_SIZE];
+    float colorize[DAB_BATCH_SIZE];
+} DabBatch;
+
+// Streams of the counter-based random numbers, see rng-counter.c
+enum {
+    RNG_STREAM_INPUT,          // the "random" input, per step
+    RNG_STREAM_OFFSET,         // offset_by_random, per dab
+    RNG_STREAM_RADIUS,         // radius_by_random, per dab
+    RNG_STREAM_TRACKING_NOISE, // per motion event
+    RNG_STREAM_SEED            // the seed of the next motion event
+};
+
+// The bits of the float state, every value is a different seed
+static uint64_t
+rng_seed_from_state(float state)
+{
+    union { float f; uint32_t i; } bits;
+    bits.f = state;
+    return bits.i;
+}
+
 /**
   * MyPaintBrush:
   *
@@ -74,7 +118,9 @@ struct _MyPaintBrush {
 
     // the states (get_state, set_state, reset) that change during a stroke
     float states[MYPAINT_BRUSH_STATES_COUNT];
-    RngDouble * rng;
+    // keyed with states[MYPAINT_BRUSH_STATE_RNG_SEED] on every motion event
+    RngCounter *rng;
+    uint64_t rng_step; // index of the current step within the motion event
 
     // Those mappings describe how to calculate the current value for each setting.
     // Most of settings will be constant (eg. only their base_value is used).
@@ -83,14 +129,22 @@ struct _MyPaintBrush {
     // the current value of all settings (calculated using the current state)
     float settings_value[MYPAINT_BRUSH_SETTINGS_COUNT];
 
+    // the dynamics of all settings, compiled on the first dab after they changed
+    BrushProgram *program;
+    gboolean program_outdated;
+
     // see also brushsettings.py
 
     // cached calculation results
     float speed_mapping_gamma[2];
     float speed_mapping_m[2];
     float speed_mapping_q[2];
+    float base_radius; // not clamped
+    float pressure_gain;
 
     gboolean reset_requested;
+
+    DabBatch dabs;
 #ifdef HAVE_JSON_C
     json_object *brush_json;
 #endif
@@ -118,8 +172,11 @@ mypaint_brush_new(void)
     for (i=0; i<MYPAINT_BRUSH_SETTINGS_COUNT; i++) {
       self->settings[i] = mapping_new(MYPAINT_BRUSH_INPUTS_COUNT);
     }
-    self->rng = rng_double_new(1000);
+    self->rng = rng_counter_new(0);
+    self->rng_step = 0;
     self->print_inputs = FALSE;
+    self->program = brush_program_new(MYPAINT_BRUSH_SETTINGS_COUNT, MYPAINT_BRUSH_INPUTS_COUNT);
+    self->program_outdated = TRUE;
 
     for (i=0; i<MYPAINT_BRUSH_STATES_COUNT; i++) {
       self->states[i] = 0;
@@ -130,6 +187,9 @@ mypaint_brush_new(void)
 
     self->reset_requested = TRUE;
 
+    self->dabs.count = 0;
+    self->dabs.painted = 0;
+
 #ifdef HAVE_JSON_C
     self->brush_json = json_object_new_object();
 #endif
@@ -143,8 +203,9 @@ brush_free(MyPaintBrush *self)
     for (int i=0; i<MYPAINT_BRUSH_SETTINGS_COUNT; i++) {
         mapping_free(self->settings[i]);
     }
-    rng_double_free (self->rng);
+    rng_counter_free (self->rng);
     self->rng = NULL;
+    brush_program_free (self->program);
 
 #ifdef HAVE_JSON_C
     json_object_put(self->brush_json);
@@ -260,6 +321,7 @@ mypaint_brush_set_mapping_n(MyPaintBrush *self, MyPaintBrushSetting id, MyPaintB
 {
     assert (id >= 0 && id < MYPAINT_BRUSH_SETTINGS_COUNT);
     mapping_set_n(self->settings[id], input, n);
+    self->program_outdated = TRUE;
 }
 
 /**
@@ -308,6 +370,7 @@ mypaint_brush_set_mapping_point(MyPaintBrush *self, MyPaintBrushSetting id, MyPa
 {
     assert (id >= 0 && id < MYPAINT_BRUSH_SETTINGS_COUNT);
     mapping_set_point(self->settings[id], input, index, x, y);
+    self->program_outdated = TRUE;
 }
 
 /**
@@ -388,6 +451,10 @@ smallest_angular_difference(float a, float b)
   {
     // precalculate stuff that does not change dynamically
 
+    self->program_outdated = TRUE;
+    self->base_radius = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+    self->pressure_gain = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_PRESSURE_GAIN_LOG]));
+
     // Precalculate how the physical speed will be mapped to the speed input value.
     // The forumla for this mapping is:
     //
@@ -451,7 +518,7 @@ smallest_angular_difference(float a, float b)
     self->states[MYPAINT_BRUSH_STATE_DECLINATION] += step_declination;
     self->states[MYPAINT_BRUSH_STATE_ASCENSION] += step_ascension;
 
-    float base_radius = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+    float base_radius = self->base_radius;
 
     // FIXME: does happen (interpolation problem?)
     if (self->states[MYPAINT_BRUSH_STATE_PRESSURE] <= 0.0) self->states[MYPAINT_BRUSH_STATE_PRESSURE] = 0.0;
@@ -482,14 +549,32 @@ smallest_angular_difference(float a, float b)
     norm_speed = sqrt(SQR(norm_dx) + SQR(norm_dy));
     norm_dist = norm_speed * step_dtime;
 
-    inputs[MYPAINT_BRUSH_INPUT_PRESSURE] = pressure * expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_PRESSURE_GAIN_LOG]));
-    inputs[MYPAINT_BRUSH_INPUT_SPEED1] = log(self->speed_mapping_gamma[0] + self->states[MYPAINT_BRUSH_STATE_NORM_SPEED1_SLOW])*self->speed_mapping_m[0] + self->speed_mapping_q[0];
-    inputs[MYPAINT_BRUSH_INPUT_SPEED2] = log(self->speed_mapping_gamma[1] + self->states[MYPAINT_BRUSH_STATE_NORM_SPEED2_SLOW])*self->speed_mapping_m[1] + self->speed_mapping_q[1];
-    inputs[MYPAINT_BRUSH_INPUT_RANDOM] = rng_double_next(self->rng);
+    BrushProgram *compiled = brush_get_program(self);
+    // Only the inputs used by some setting are calculated (all of them for printing).
+    // The random numbers are counter-based, skipping one does not change the others.
+    BrushProgram *program = self->print_inputs ? NULL : compiled;
+#define INPUT_USED(input) (!program || brush_program_uses_input(program, input))
+
+    inputs[MYPAINT_BRUSH_INPUT_PRESSURE] = pressure * self->pressure_gain;
+    if (INPUT_USED(MYPAINT_BRUSH_INPUT_SPEED1)) {
+      inputs[MYPAINT_BRUSH_INPUT_SPEED1] = log(self->speed_mapping_gamma[0] + self->states[MYPAINT_BRUSH_STATE_NORM_SPEED1_SLOW])*self->speed_mapping_m[0] + self->speed_mapping_q[0];
+    }
+    if (INPUT_USED(MYPAINT_BRUSH_INPUT_SPEED2)) {
+      inputs[MYPAINT_BRUSH_INPUT_SPEED2] = log(self->speed_mapping_gamma[1] + self->states[MYPAINT_BRUSH_STATE_NORM_SPEED2_SLOW])*self->speed_mapping_m[1] + self->speed_mapping_q[1];
+    }
+    self->rng_step++;
+    if (INPUT_USED(MYPAINT_BRUSH_INPUT_RANDOM)) {
+      inputs[MYPAINT_BRUSH_INPUT_RANDOM] = rng_counter_double(self->rng, RNG_STREAM_INPUT, self->rng_step, 0);
+    }
     inputs[MYPAINT_BRUSH_INPUT_STROKE] = MIN(self->states[MYPAINT_BRUSH_STATE_STROKE], 1.0);
-    inputs[MYPAINT_BRUSH_INPUT_DIRECTION] = fmodf (atan2f (self->states[MYPAINT_BRUSH_STATE_DIRECTION_DY], self->states[MYPAINT_BRUSH_STATE_DIRECTION_DX])/(2*M_PI)*360 + 180.0, 180.0);
+    if (INPUT_USED(MYPAINT_BRUSH_INPUT_DIRECTION)) {
+      inputs[MYPAINT_BRUSH_INPUT_DIRECTION] = fmodf (atan2f (self->states[MYPAINT_BRUSH_STATE_DIRECTION_DY], self->states[MYPAINT_BRUSH_STATE_DIRECTION_DX])/(2*M_PI)*360 + 180.0, 180.0);
+    }
     inputs[MYPAINT_BRUSH_INPUT_TILT_DECLINATION] = self->states[MYPAINT_BRUSH_STATE_DECLINATION];
-    inputs[MYPAINT_BRUSH_INPUT_TILT_ASCENSION] = fmodf(self->states[MYPAINT_BRUSH_STATE_ASCENSION] + 180.0, 360.0) - 180.0;
+    if (INPUT_USED(MYPAINT_BRUSH_INPUT_TILT_ASCENSION)) {
+      inputs[MYPAINT_BRUSH_INPUT_TILT_ASCENSION] = fmodf(self->states[MYPAINT_BRUSH_STATE_ASCENSION] + 180.0, 360.0) - 180.0;
+    }
+#undef INPUT_USED
 
     inputs[MYPAINT_BRUSH_INPUT_CUSTOM] = self->states[MYPAINT_BRUSH_STATE_CUSTOM_INPUT];
     if (self->print_inputs) {
@@ -498,10 +583,7 @@ smallest_angular_difference(float a, float b)
     // FIXME: this one fails!!!
     //assert(inputs[MYPAINT_BRUSH_INPUT_SPEED1] >= 0.0 && inputs[MYPAINT_BRUSH_INPUT_SPEED1] < 1e8); // checking for inf
 
-    int i=0;
-    for (i=0; i<MYPAINT_BRUSH_SETTINGS_COUNT; i++) {
-      self->settings_value[i] = mapping_calculate(self->settings[i], (inputs));
-    }
+    brush_program_evaluate(self->program, inputs, self->settings_value);
 
     {
       float fac = 1.0 - exp_decay (self->settings_value[MYPAINT_BRUSH_SETTING_SLOW_TRACKING_PER_DAB], 1.0);
@@ -588,12 +670,61 @@ smallest_angular_difference(float a, float b)
     self->states[MYPAINT_BRUSH_STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE] = self->settings_value[MYPAINT_BRUSH_SETTING_ELLIPTICAL_DAB_ANGLE];
   }
 
+  // Draws the queued dabs with a single call to the surface
+  void flush_dabs (MyPaintBrush *self, MyPaintSurface *surface)
+  {
+    DabBatch *batch = &self->dabs;
+    if (batch->count == 0) return;
+
+    color_hsv_to_rgb_n (batch->color_r, batch->color_g, batch->color_b,
+                        batch->color_r, batch->color_g, batch->color_b, batch->count);
+    const MyPaintDabs dabs = {
+      batch->count,
+      batch->x, batch->y, batch->radius,
+      batch->color_r, batch->color_g, batch->color_b,
+      batch->opaque, batch->hardness, batch->alpha_eraser,
+      batch->aspect_ratio, batch->angle,
+      batch->lock_alpha, batch->colorize
+    };
+    batch->painted += mypaint_surface_draw_dabs (surface, &dabs);
+    batch->count = 0;
+  }
+
+  void queue_dab (MyPaintBrush *self, MyPaintSurface *surface,
+                  float x, float y, float radius,
+                  float color_h, float color_s, float color_v,
+                  float opaque, float hardness, float alpha_eraser,
+                  float aspect_ratio, float angle,
+                  float lock_alpha, float colorize)
+  {
+    DabBatch *batch = &self->dabs;
+    if (batch->count == DAB_BATCH_SIZE) {
+      flush_dabs (self, surface);
+    }
+
+    const int i = batch->count++;
+    batch->x[i] = x;
+    batch->y[i] = y;
+    batch->radius[i] = radius;
+    batch->color_r[i] = color_h;
+    batch->color_g[i] = color_s;
+    batch->color_b[i] = color_v;
+    batch->opaque[i] = opaque;
+    batch->hardness[i] = hardness;
+    batch->alpha_eraser[i] = alpha_eraser;
+    batch->aspect_ratio[i] = aspect_ratio;
+    batch->angle[i] = angle;
+    batch->lock_alpha[i] = lock_alpha;
+    batch->colorize[i] = colorize;
+  }
+
   // Called only from stroke_to(). Calculate everything needed to
-  // draw the dab, then let the surface do the actual drawing.
+  // draw the dab, then queue it for the surface to do the actual drawing.
+  // The queue is flushed before reading back from the surface, and at the
+  // end of stroke_to().
   //
   // This is only gets called right after update_states_and_setting_values().
-  // Returns TRUE if the surface was modified.
-  gboolean prepare_and_draw_dab (MyPaintBrush *self, MyPaintSurface * surface)
+  void prepare_and_queue_dab (MyPaintBrush *self, MyPaintSurface * surface)
   {
     float x, y, opaque;
     float radius;
@@ -633,7 +764,7 @@ smallest_angular_difference(float a, float b)
     x = self->states[MYPAINT_BRUSH_STATE_ACTUAL_X];
     y = self->states[MYPAINT_BRUSH_STATE_ACTUAL_Y];
 
-    float base_radius = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+    float base_radius = self->base_radius;
 
     if (self->settings_value[MYPAINT_BRUSH_SETTING_OFFSET_BY_SPEED]) {
       x += self->states[MYPAINT_BRUSH_STATE_NORM_DX_SLOW] * self->settings_value[MYPAINT_BRUSH_SETTING_OFFSET_BY_SPEED] * 0.1 * base_radius;
@@ -643,8 +774,8 @@ smallest_angular_difference(float a, float b)
     if (self->settings_value[MYPAINT_BRUSH_SETTING_OFFSET_BY_RANDOM]) {
       float amp = self->settings_value[MYPAINT_BRUSH_SETTING_OFFSET_BY_RANDOM];
       if (amp < 0.0) amp = 0.0;
-      x += rand_gauss (self->rng) * amp * base_radius;
-      y += rand_gauss (self->rng) * amp * base_radius;
+      x += rng_counter_gauss (self->rng, RNG_STREAM_OFFSET, self->rng_step, 0) * amp * base_radius;
+      y += rng_counter_gauss (self->rng, RNG_STREAM_OFFSET, self->rng_step, 1) * amp * base_radius;
     }
 
 
@@ -653,7 +784,7 @@ smallest_angular_difference(float a, float b)
       float radius_log, alpha_correction;
       // go back to logarithmic radius to add the noise
       radius_log  = self->settings_value[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC];
-      radius_log += rand_gauss (self->rng) * self->settings_value[MYPAINT_BRUSH_SETTING_RADIUS_BY_RANDOM];
+      radius_log += rng_counter_gauss (self->rng, RNG_STREAM_RADIUS, self->rng_step, 0) * self->settings_value[MYPAINT_BRUSH_SETTING_RADIUS_BY_RANDOM];
       radius = expf(radius_log);
       radius = CLAMP(radius, ACTUAL_RADIUS_MIN, ACTUAL_RADIUS_MAX);
       alpha_correction = self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] / radius;
@@ -689,6 +820,7 @@ smallest_angular_difference(float a, float b)
 
         float smudge_radius = radius * expf(self->settings_value[MYPAINT_BRUSH_SETTING_SMUDGE_RADIUS_LOG]);
         smudge_radius = CLAMP(smudge_radius, ACTUAL_RADIUS_MIN, ACTUAL_RADIUS_MAX);
+        flush_dabs(self, surface); // the color depends on the dabs before
         mypaint_surface_get_color(surface, px, py, smudge_radius, &r, &g, &b, &a);
 
         self->states[MYPAINT_BRUSH_STATE_LAST_GETCOLOR_R] = r;
@@ -812,11 +944,10 @@ smallest_angular_difference(float a, float b)
     }
 
     // the functions below will CLAMP most inputs
-    hsv_to_rgb_float (&color_h, &color_s, &color_v);
-    return mypaint_surface_draw_dab (surface, x, y, radius, color_h, color_s, color_v, opaque, hardness, eraser_target_alpha,
-                              self->states[MYPAINT_BRUSH_STATE_ACTUAL_ELLIPTICAL_DAB_RATIO], self->states[MYPAINT_BRUSH_STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE],
-                              self->settings_value[MYPAINT_BRUSH_SETTING_LOCK_ALPHA],
-                              self->settings_value[MYPAINT_BRUSH_SETTING_COLORIZE]);
+    queue_dab (self, surface, x, y, radius, color_h, color_s, color_v, opaque, hardness, eraser_target_alpha,
+               self->states[MYPAINT_BRUSH_STATE_ACTUAL_ELLIPTICAL_DAB_RATIO], self->states[MYPAINT_BRUSH_STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE],
+               self->settings_value[MYPAINT_BRUSH_SETTING_LOCK_ALPHA],
+               self->settings_value[MYPAINT_BRUSH_SETTING_COLORIZE]);
   }
 
   // How many dabs will be drawn between the current and the next (x, y, pressure, +dt) position?
@@ -826,13 +957,12 @@ smallest_angular_difference(float a, float b)
     float res1, res2, res3;
     float dist;
 
-    if (self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] == 0.0) self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+    if (self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] == 0.0) self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] = self->base_radius;
     if (self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] < ACTUAL_RADIUS_MIN) self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] = ACTUAL_RADIUS_MIN;
     if (self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] > ACTUAL_RADIUS_MAX) self->states[MYPAINT_BRUSH_STATE_ACTUAL_RADIUS] = ACTUAL_RADIUS_MAX;
 
 
-    // OPTIMIZE: expf() called too often
-    float base_radius = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+    float base_radius = self->base_radius;
     if (base_radius < ACTUAL_RADIUS_MIN) base_radius = ACTUAL_RADIUS_MIN;
     if (base_radius > ACTUAL_RADIUS_MAX) base_radius = ACTUAL_RADIUS_MAX;
     //if (base_radius < 0.5) base_radius = 0.5;
@@ -911,10 +1041,6 @@ smallest_angular_difference(float a, float b)
     if (dtime < 0) printf("Time jumped backwards by dtime=%f seconds!\n", dtime);
     if (dtime <= 0) dtime = 0.0001; // protect against possible division by zero bugs
 
-    /* way too slow with the new rng, and not working any more anyway...
-    rng_double_set_seed (self->rng, self->states[MYPAINT_BRUSH_STATE_RNG_SEED]*0x40000000);
-    */
-
     if (dtime > 0.100 && pressure && self->states[MYPAINT_BRUSH_STATE_PRESSURE] == 0) {
       // Workaround for tablets that don't report motion events without pressure.
       // This is to avoid linear interpolation of the pressure between two events.
@@ -922,15 +1048,19 @@ smallest_angular_difference(float a, float b)
       dtime = 0.0001;
     }
 
+    // The random numbers of this event only depend on the seed state and the step,
+    // so that a stroke can be reproduced from its starting states and events.
+    rng_counter_set_seed (self->rng, rng_seed_from_state (self->states[MYPAINT_BRUSH_STATE_RNG_SEED]));
+    self->rng_step = 0;
+
     { // calculate the actual "virtual" cursor position
 
       // noise first
       if (mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_TRACKING_NOISE])) {
-        // OPTIMIZE: expf() called too often
-        const float base_radius = expf(mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC]));
+        const float base_radius = self->base_radius;
 
-        x += rand_gauss (self->rng) * mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_TRACKING_NOISE]) * base_radius;
-        y += rand_gauss (self->rng) * mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_TRACKING_NOISE]) * base_radius;
+        x += rng_counter_gauss (self->rng, RNG_STREAM_TRACKING_NOISE, 0, 0) * mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_TRACKING_NOISE]) * base_radius;
+        y += rng_counter_gauss (self->rng, RNG_STREAM_TRACKING_NOISE, 0, 1) * mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_TRACKING_NOISE]) * base_radius;
       }
 
       const float fac = 1.0 - exp_decay (mapping_get_base_value(self->settings[MYPAINT_BRUSH_SETTING_SLOW_TRACKING]), 100.0*dtime);
@@ -970,6 +1100,8 @@ smallest_angular_difference(float a, float b)
     //g_print("dist = %f\n", states[MYPAINT_BRUSH_STATE_DIST]);
     enum { UNKNOWN, YES, NO } painted = UNKNOWN;
     double dtime_left = dtime;
+    int dabs_queued = 0;
+    self->dabs.painted = 0;
 
     float step_dx, step_dy, step_dpressure, step_dtime;
     float step_declination, step_ascension;
@@ -994,12 +1126,8 @@ smallest_angular_difference(float a, float b)
       }
 
       update_states_and_setting_values (self, step_dx, step_dy, step_dpressure, step_declination, step_ascension, step_dtime);
-      gboolean painted_now = prepare_and_draw_dab (self, surface);
-      if (painted_now) {
-        painted = YES;
-      } else if (painted == UNKNOWN) {
-        painted = NO;
-      }
+      prepare_and_queue_dab (self, surface);
+      dabs_queued++;
 
       dtime_left   -= step_dtime;
       dist_todo  = count_dabs_to (self, x, y, pressure, dtime_left);
@@ -1024,14 +1152,19 @@ smallest_angular_difference(float a, float b)
       update_states_and_setting_values (self, step_dx, step_dy, step_dpressure, step_declination, step_ascension, step_dtime);
     }
 
+    flush_dabs (self, surface);
+    if (self->dabs.painted > 0) {
+      painted = YES;
+    } else if (dabs_queued > 0) {
+      painted = NO;
+    }
+
     // save the fraction of a dab that is already done now
     self->states[MYPAINT_BRUSH_STATE_DIST] = dist_moved + dist_todo;
     //g_print("dist_final = %f\n", states[MYPAINT_BRUSH_STATE_DIST]);
 
-    /* not working any more with the new rng...
-    // next seed for the RNG (GRand has no get_state() and states[] must always contain our full state)
-    self->states[MYPAINT_BRUSH_STATE_RNG_SEED] = rng_double_next(self->rng);
-    */
+    // next seed for the RNG (states[] must always contain our full state)
+    self->states[MYPAINT_BRUSH_STATE_RNG_SEED] = rng_counter_double(self->rng, RNG_STREAM_SEED, 0, 0);
 
     // stroke separation logic (for undo/redo)
 
@@ -1154,6 +1287,47 @@ mypaint_brush_from_string(MyPaintBrush *self, const char *string)
 }
 
 
+// The dynamics of all settings, compiled if they changed since the last dab
+BrushProgram *
+brush_get_program(MyPaintBrush *self)
+{
+    if (self->program_outdated) {
+      brush_program_compile(self->program, self->settings);
+      self->program_outdated = FALSE;
+    }
+    return self->program;
+}
+
+// Set all settings from a compiled program, see brush_program_load().
+// The mappings are set from the curves, the program is not compiled again.
+gboolean
+brush_load_program(MyPaintBrush *self, const float *base_values,
+                   const BrushProgramCurve *curves, int curves_n)
+{
+    if (!brush_program_load(self->program, base_values, curves, curves_n)) {
+        return FALSE;
+    }
+
+    for (int s = 0; s < MYPAINT_BRUSH_SETTINGS_COUNT; s++) {
+        for (int i = 0; i < MYPAINT_BRUSH_INPUTS_COUNT; i++) {
+            mapping_set_n(self->settings[s], i, 0);
+        }
+        mapping_set_base_value(self->settings[s], base_values[s]);
+    }
+    for (int c = 0; c < curves_n; c++) {
+        const BrushProgramCurve *curve = &curves[c];
+        mapping_set_n(self->settings[curve->setting], curve->input, curve->n);
+        for (int p = 0; p < curve->n; p++) {
+            mapping_set_point(self->settings[curve->setting], curve->input, p,
+                              curve->xvalues[p], curve->yvalues[p]);
+        }
+    }
+
+    settings_base_values_have_changed(self);
+    self->program_outdated = FALSE;
+    return TRUE;
+}
+
 void
 mypaint_brush_from_defaults(MyPaintBrush *self) {
     for (int s = 0; s < MYPAINT_BRUSH_SETTINGS_COUNT; s++) {
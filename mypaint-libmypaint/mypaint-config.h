@@ -1,10 +1,15 @@
 #ifndef MYPAINTCONFIG_H
 #define MYPAINTCONFIG_H
 
+// Default tile size. Tiled surfaces can choose another one at creation,
+// any power of two from MYPAINT_MIN_TILE_SIZE to MYPAINT_MAX_TILE_SIZE.
 #ifndef MYPAINT_TILE_SIZE
 #define MYPAINT_TILE_SIZE 64
 #endif
 
+#define MYPAINT_MIN_TILE_SIZE 32
+#define MYPAINT_MAX_TILE_SIZE 256
+
 #ifndef MYPAINT_MAX_THREADS
 #define MYPAINT_MAX_THREADS 16
 #endif
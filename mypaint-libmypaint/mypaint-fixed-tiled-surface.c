@@ -3,15 +3,48 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <mypaint-fixed-tiled-surface.h>
-
+#include "tilecodec.h"
+
+#define DEFAULT_MAX_RAW_TILES 256
+
+// Tiles are allocated when first requested. A tile which has not been
+// requested recently is compressed, or stored as a single pixel if all of
+// its pixels are the same. Tiles are decompressed again when requested.
+// The compression happens without the mutex, so that the tile requests of
+// other threads are not blocked by it.
+typedef enum {
+    FIXED_TILE_UNIFORM,    // all pixels are the same, stored once
+    FIXED_TILE_RAW,        // allocated, in the list of raw tiles
+    FIXED_TILE_COMPRESSED, // compressed with tilecodec.c
+    FIXED_TILE_COLD        // raw, being compressed by make_old_tiles_cold()
+} FixedTileState;
+
+typedef struct {
+    FixedTileState state;
+    int users; // requests which have not ended yet, the tile stays raw
+    uint8_t *data; // the pixels if raw, the compressed data if compressed
+    size_t data_bytes; // size of the compressed data
+    uint8_t pixel[TILE_CODEC_MAX_PIXEL_BYTES]; // if uniform
+    int newer; // list of raw tiles, -1 at the ends
+    int older; // also the list of the tiles being compressed
+} FixedTile;
 
 struct _MyPaintFixedTiledSurface {
     MyPaintTiledSurface parent;
 
     size_t tile_size; // Size (in bytes) of single tile
-    uint16_t *tile_buffer; // Stores tiles in a linear chunk of memory (16bpc RGBA)
+    int tile_pixels; // pixels of a tile
+    int pixel_bytes; // size of a pixel of the tile format
+    FixedTile *tiles; // tiles_width * tiles_height, row by row
+    int newest_raw; // most recently requested raw tile
+    int oldest_raw;
+    int raw_tiles_n;
+    int max_raw_tiles;
+    pthread_mutex_t mutex; // protects the tiles, for threadsafe_tile_requests
+    pthread_cond_t cold_done; // signalled when tiles being compressed are done
     uint16_t *null_tile; // Single tile that we hand out and ignore writes to
     int tiles_width; // width in tiles
     int tiles_height; // height in tiles
@@ -27,6 +60,139 @@ void reset_null_tile(MyPaintFixedTiledSurface *self)
     memset(self->null_tile, 0, self->tile_size);
 }
 
+static void
+raw_list_remove(MyPaintFixedTiledSurface *self, int i)
+{
+    FixedTile *tile = &self->tiles[i];
+    if (tile->newer >= 0) {
+        self->tiles[tile->newer].older = tile->older;
+    } else {
+        self->newest_raw = tile->older;
+    }
+    if (tile->older >= 0) {
+        self->tiles[tile->older].newer = tile->newer;
+    } else {
+        self->oldest_raw = tile->newer;
+    }
+    tile->newer = tile->older = -1;
+}
+
+static void
+raw_list_push(MyPaintFixedTiledSurface *self, int i)
+{
+    FixedTile *tile = &self->tiles[i];
+    tile->newer = -1;
+    tile->older = self->newest_raw;
+    if (self->newest_raw >= 0) {
+        self->tiles[self->newest_raw].newer = i;
+    } else {
+        self->oldest_raw = i;
+    }
+    self->newest_raw = i;
+}
+
+// Decompresses or expands tile @i, and makes it the most recently used one.
+// The mutex must be locked.
+static void
+tile_make_raw(MyPaintFixedTiledSurface *self, int i)
+{
+    FixedTile *tile = &self->tiles[i];
+    if (tile->state == FIXED_TILE_RAW) {
+        raw_list_remove(self, i);
+        raw_list_push(self, i);
+        return;
+    }
+
+    uint8_t *raw = (uint8_t *)malloc(self->tile_size);
+    if (tile->state == FIXED_TILE_UNIFORM) {
+        tile_codec_fill(raw, self->tile_pixels, self->pixel_bytes, tile->pixel);
+    } else {
+        tile_codec_decompress(tile->data, tile->data_bytes, self->parent.tile_size, self->pixel_bytes, raw);
+        free(tile->data);
+    }
+    tile->data = raw;
+    tile->data_bytes = 0;
+    tile->state = FIXED_TILE_RAW;
+    raw_list_push(self, i);
+    self->raw_tiles_n++;
+}
+
+// Stores the pixels of @tile, which is being made cold, as uniform or compressed.
+// Called without the mutex, the tile is not touched by anything else meanwhile.
+static void
+tile_compress(MyPaintFixedTiledSurface *self, FixedTile *tile)
+{
+    assert(tile->state == FIXED_TILE_COLD && tile->users == 0);
+
+    if (tile_codec_is_uniform(tile->data, self->tile_pixels, self->pixel_bytes)) {
+        memcpy(tile->pixel, tile->data, self->pixel_bytes);
+        free(tile->data);
+        tile->data = NULL;
+        return;
+    }
+
+    uint8_t *compressed = (uint8_t *)malloc(tile_codec_max_bytes(self->parent.tile_size, self->pixel_bytes));
+    if (!compressed) {
+        return; // stays raw
+    }
+    const size_t bytes = tile_codec_compress(tile->data, self->parent.tile_size, self->pixel_bytes,
+                                             compressed);
+    uint8_t *shrunk = (uint8_t *)realloc(compressed, bytes);
+    free(tile->data);
+    tile->data = shrunk ? shrunk : compressed;
+    tile->data_bytes = bytes;
+}
+
+// Makes the least recently used tiles cold, down to max_raw_tiles.
+// The mutex must be locked. It is unlocked while the tiles are compressed,
+// requests for them wait until they are done.
+static void
+make_old_tiles_cold(MyPaintFixedTiledSurface *self)
+{
+    // Taken out of the list of raw tiles under the mutex
+    int cold = -1;
+    int i = self->oldest_raw;
+    while (self->raw_tiles_n > self->max_raw_tiles && i >= 0) {
+        FixedTile *tile = &self->tiles[i];
+        const int newer = tile->newer;
+        if (tile->users == 0) {
+            raw_list_remove(self, i);
+            self->raw_tiles_n--;
+            tile->state = FIXED_TILE_COLD;
+            tile->older = cold;
+            cold = i;
+        }
+        i = newer;
+    }
+    if (cold < 0) {
+        return;
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+    for (i = cold; i >= 0; i = self->tiles[i].older) {
+        tile_compress(self, &self->tiles[i]);
+    }
+    pthread_mutex_lock(&self->mutex);
+
+    // Published under the mutex
+    while (cold >= 0) {
+        FixedTile *tile = &self->tiles[cold];
+        const int older = tile->older;
+        tile->older = -1;
+        if (!tile->data) {
+            tile->state = FIXED_TILE_UNIFORM;
+        } else if (tile->data_bytes > 0) {
+            tile->state = FIXED_TILE_COMPRESSED;
+        } else {
+            tile->state = FIXED_TILE_RAW;
+            raw_list_push(self, cold);
+            self->raw_tiles_n++;
+        }
+        cold = older;
+    }
+    pthread_cond_broadcast(&self->cold_done);
+}
+
 static void
 tile_request_start(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *request)
 {
@@ -36,18 +202,32 @@ tile_request_start(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *reque
     const int ty = request->ty;
 
     uint16_t *tile_pointer = NULL;
+    request->context = NULL;
 
     if (tx >= self->tiles_width || ty >= self->tiles_height || tx < 0 || ty < 0) {
         // Give it a tile which we will ignore writes to
         tile_pointer = self->null_tile;
 
     } else {
-        // Compute the offset for the tile into our linear memory buffer of tiles
-        size_t rowstride = self->tiles_width * self->tile_size;
-        size_t x_offset = tx * self->tile_size;
-        size_t tile_offset = (rowstride * ty) + x_offset;
-
-        tile_pointer = self->tile_buffer + tile_offset/sizeof(uint16_t);
+        const int i = ty*self->tiles_width + tx;
+        FixedTile *tile = &self->tiles[i];
+
+        pthread_mutex_lock(&self->mutex);
+        while (tile->state == FIXED_TILE_COLD) {
+            pthread_cond_wait(&self->cold_done, &self->mutex);
+        }
+        if (request->readonly && tile->state == FIXED_TILE_UNIFORM) {
+            // Expanded only for this request, the tile stays uniform
+            uint8_t *expanded = (uint8_t *)malloc(self->tile_size);
+            tile_codec_fill(expanded, self->tile_pixels, self->pixel_bytes, tile->pixel);
+            request->context = expanded;
+            tile_pointer = (uint16_t *)expanded;
+        } else {
+            tile_make_raw(self, i);
+            tile->users++;
+            tile_pointer = (uint16_t *)tile->data;
+        }
+        pthread_mutex_unlock(&self->mutex);
     }
 
     request->buffer = tile_pointer;
@@ -64,8 +244,14 @@ tile_request_end(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *request
     if (tx >= self->tiles_width || ty >= self->tiles_height || tx < 0 || ty < 0) {
         // Wipe any changed done to the null tile
         reset_null_tile(self);
+    } else if (request->context) {
+        free(request->context);
+        request->context = NULL;
     } else {
-        // We hand out direct pointers to our buffer, so for the normal case nothing needs to be done
+        pthread_mutex_lock(&self->mutex);
+        self->tiles[ty*self->tiles_width + tx].users--;
+        make_old_tiles_cold(self);
+        pthread_mutex_unlock(&self->mutex);
     }
 }
 
@@ -87,39 +273,108 @@ mypaint_fixed_tiled_surface_get_height(MyPaintFixedTiledSurface *self)
     return self->height;
 }
 
+/**
+ * mypaint_fixed_tiled_surface_set_max_raw_tiles:
+ *
+ * Set how many of the most recently used tiles are kept uncompressed.
+ * Tiles which are in use by a tile request are never compressed.
+ * The default is 256.
+ */
+void
+mypaint_fixed_tiled_surface_set_max_raw_tiles(MyPaintFixedTiledSurface *self, int max_tiles)
+{
+    assert(max_tiles >= 0);
+    pthread_mutex_lock(&self->mutex);
+    self->max_raw_tiles = max_tiles;
+    make_old_tiles_cold(self);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+/**
+ * mypaint_fixed_tiled_surface_get_memory_usage:
+ *
+ * Returns: The memory used for the tiles, in bytes.
+ */
+size_t
+mypaint_fixed_tiled_surface_get_memory_usage(MyPaintFixedTiledSurface *self)
+{
+    const int tiles_n = self->tiles_width * self->tiles_height;
+    size_t bytes = tiles_n * sizeof(FixedTile) + 2 * self->tile_size; // with the null tile
+    pthread_mutex_lock(&self->mutex);
+    for (int i = 0; i < tiles_n; i++) {
+        if (self->tiles[i].state == FIXED_TILE_RAW || self->tiles[i].state == FIXED_TILE_COLD) {
+            bytes += self->tile_size;
+        } else if (self->tiles[i].state == FIXED_TILE_COMPRESSED) {
+            bytes += self->tiles[i].data_bytes;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return bytes;
+}
+
 MyPaintFixedTiledSurface *
 mypaint_fixed_tiled_surface_new(int width, int height)
+{
+    return mypaint_fixed_tiled_surface_new_with_tile_size(width, height, MYPAINT_TILE_SIZE);
+}
+
+MyPaintFixedTiledSurface *
+mypaint_fixed_tiled_surface_new_with_tile_size(int width, int height, int tile_size_pixels)
+{
+    return mypaint_fixed_tiled_surface_new_with_format(width, height, tile_size_pixels,
+                                                       MYPAINT_TILE_FORMAT_RGBA16);
+}
+
+MyPaintFixedTiledSurface *
+mypaint_fixed_tiled_surface_new_with_format(int width, int height, int tile_size_pixels,
+                                            MyPaintTileFormat format)
 {
     assert(width > 0);
     assert(height > 0);
 
     MyPaintFixedTiledSurface *self = (MyPaintFixedTiledSurface *)malloc(sizeof(MyPaintFixedTiledSurface));
 
-    mypaint_tiled_surface_init(&self->parent, tile_request_start, tile_request_end);
-
-    const int tile_size_pixels = self->parent.tile_size;
+    mypaint_tiled_surface_init_with_tile_size(&self->parent, tile_request_start, tile_request_end, tile_size_pixels);
+    mypaint_tiled_surface_set_tile_format(&self->parent, format);
 
     // MyPaintSurface vfuncs
     self->parent.parent.destroy = free_simple_tiledsurf;
 
     const int tiles_width = ceil((float)width / tile_size_pixels);
     const int tiles_height = ceil((float)height / tile_size_pixels);
-    const size_t tile_size = tile_size_pixels * tile_size_pixels * 4 * sizeof(uint16_t);
-    const size_t buffer_size = tiles_width * tiles_height * tile_size;
+    const size_t tile_size = mypaint_tile_format_get_tile_bytes(format, tile_size_pixels);
+    const int tile_pixels = tile_size_pixels * tile_size_pixels;
 
     assert(tile_size_pixels*tiles_width >= width);
     assert(tile_size_pixels*tiles_height >= height);
-    assert(buffer_size >= width*height*4*sizeof(uint16_t));
 
-    uint16_t * buffer = (uint16_t *)malloc(buffer_size);
-    if (!buffer) {
-        fprintf(stderr, "CRITICAL: unable to allocate enough memory: %Zu bytes", buffer_size);
+    FixedTile *tiles = (FixedTile *)malloc(tiles_width * tiles_height * sizeof(FixedTile));
+    if (!tiles) {
+        fprintf(stderr, "CRITICAL: unable to allocate enough memory: %zu bytes",
+                tiles_width * tiles_height * sizeof(FixedTile));
         return NULL;
     }
-    memset(buffer, 255, buffer_size);
 
-    self->tile_buffer = buffer;
+    // All tiles start out uniform. The float formats start out transparent,
+    // there is no float equivalent of the 0xffff fill of the 16 bit format.
+    FixedTile initial;
+    memset(&initial, 0, sizeof(initial));
+    initial.state = FIXED_TILE_UNIFORM;
+    memset(initial.pixel, (format == MYPAINT_TILE_FORMAT_RGBA16) ? 255 : 0, sizeof(initial.pixel));
+    initial.newer = initial.older = -1;
+    for (int i = 0; i < tiles_width * tiles_height; i++) {
+        tiles[i] = initial;
+    }
+
+    self->tiles = tiles;
     self->tile_size = tile_size;
+    self->tile_pixels = tile_pixels;
+    self->pixel_bytes = tile_size / tile_pixels;
+    self->newest_raw = self->oldest_raw = -1;
+    self->raw_tiles_n = 0;
+    self->max_raw_tiles = DEFAULT_MAX_RAW_TILES;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cold_done, NULL);
     self->null_tile = (uint16_t *)malloc(tile_size);
     self->tiles_width = tiles_width;
     self->tiles_height = tiles_height;
@@ -137,9 +392,13 @@ void free_simple_tiledsurf(MyPaintSurface *surface)
 
     mypaint_tiled_surface_destroy(&self->parent);
 
-    free(self->tile_buffer);
+    for (int i = 0; i < self->tiles_width * self->tiles_height; i++) {
+        free(self->tiles[i].data);
+    }
+    free(self->tiles);
+    pthread_cond_destroy(&self->cold_done);
+    pthread_mutex_destroy(&self->mutex);
     free(self->null_tile);
 
     free(self);
 }
-
@@ -13,12 +13,28 @@ G_BEGIN_DECLS
  * Simple #MyPaintTiledSurface subclass that implements a fixed sized #MyPaintSurface.
  * Only intended for testing and trivial use-cases, and to serve as an example of
  * how to implement a tiled surface subclass.
+ *
+ * Tiles are allocated when first used. Tiles which have not been used
+ * recently are compressed, see mypaint_fixed_tiled_surface_set_max_raw_tiles().
  */
 typedef struct _MyPaintFixedTiledSurface MyPaintFixedTiledSurface;
 
 MyPaintFixedTiledSurface *
 mypaint_fixed_tiled_surface_new(int width, int height);
 
+MyPaintFixedTiledSurface *
+mypaint_fixed_tiled_surface_new_with_tile_size(int width, int height, int tile_size);
+
+MyPaintFixedTiledSurface *
+mypaint_fixed_tiled_surface_new_with_format(int width, int height, int tile_size,
+                                            MyPaintTileFormat format);
+
+void
+mypaint_fixed_tiled_surface_set_max_raw_tiles(MyPaintFixedTiledSurface *self, int max_tiles);
+
+size_t
+mypaint_fixed_tiled_surface_get_memory_usage(MyPaintFixedTiledSurface *self);
+
 int
 mypaint_fixed_tiled_surface_get_width(MyPaintFixedTiledSurface *self);
 
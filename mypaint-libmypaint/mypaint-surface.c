@@ -16,6 +16,7 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 
 #include "mypaint-surface.h"
 
@@ -38,6 +39,26 @@ mypaint_surface_draw_dab(MyPaintSurface *self,
                    opaque, hardness, alpha_eraser, aspect_ratio, angle, lock_alpha, colorize);
 }
 
+int
+mypaint_surface_draw_dabs(MyPaintSurface *self, const MyPaintDabs *dabs)
+{
+    if (self->draw_dabs) {
+        return self->draw_dabs(self, dabs);
+    }
+
+    assert(self->draw_dab);
+    int painted = 0;
+    for (int i = 0; i < dabs->count; i++) {
+        if (self->draw_dab(self, dabs->x[i], dabs->y[i], dabs->radius[i],
+                           dabs->color_r[i], dabs->color_g[i], dabs->color_b[i],
+                           dabs->opaque[i], dabs->hardness[i], dabs->alpha_eraser[i],
+                           dabs->aspect_ratio[i], dabs->angle[i],
+                           dabs->lock_alpha[i], dabs->colorize[i])) {
+            painted++;
+        }
+    }
+    return painted;
+}
 
 void
 mypaint_surface_get_color(MyPaintSurface *self,
@@ -54,11 +75,13 @@ mypaint_surface_get_color(MyPaintSurface *self,
  * mypaint_surface_init: (skip)
  *
  * Initialize the surface. The reference count will be set to 1.
+ * The optional draw_dabs function is unset, so call this before setting it.
  * Note: Only intended to be called from subclasses of #MyPaintSurface
  **/
 void
 mypaint_surface_init(MyPaintSurface *self)
 {
+    self->draw_dabs = NULL;
     self->refcount = 1;
 }
 
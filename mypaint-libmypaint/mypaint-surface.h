@@ -42,6 +42,32 @@ typedef int (*MyPaintSurfaceDrawDabFunction) (struct _MyPaintSurface *self,
                        float lock_alpha,
                        float colorize);
 
+/**
+  * MyPaintDabs:
+  *
+  * A batch of dabs, as structure of arrays. Each array has @count entries,
+  * and the parameters of the dab i are the entries at i, with the same
+  * meaning as the parameters of mypaint_surface_draw_dab().
+  */
+typedef struct {
+    int count;
+    const float *x;
+    const float *y;
+    const float *radius;
+    const float *color_r;
+    const float *color_g;
+    const float *color_b;
+    const float *opaque;
+    const float *hardness;
+    const float *alpha_eraser;
+    const float *aspect_ratio;
+    const float *angle;
+    const float *lock_alpha;
+    const float *colorize;
+} MyPaintDabs;
+
+typedef int (*MyPaintSurfaceDrawDabsFunction) (struct _MyPaintSurface *self, const MyPaintDabs *dabs);
+
 typedef void (*MyPaintSurfaceDestroyFunction) (struct _MyPaintSurface *self);
 
 typedef void (*MyPaintSurfaceSavePngFunction) (struct _MyPaintSurface *self, const char *path, int x, int y, int width, int height);
@@ -64,6 +90,7 @@ struct _MyPaintSurface {
     MyPaintSurfaceDestroyFunction destroy;
     MyPaintSurfaceSavePngFunction save_png;
     int refcount;
+    MyPaintSurfaceDrawDabsFunction draw_dabs;
 };
 
 /**
@@ -83,6 +110,16 @@ mypaint_surface_draw_dab(MyPaintSurface *self,
                        float colorize
                        );
 
+/**
+  * mypaint_surface_draw_dabs:
+  *
+  * Draw a batch of dabs onto the surface, in order.
+  * Surfaces which do not implement draw_dabs get one draw_dab call per dab.
+  *
+  * Returns: the number of dabs which modified the surface
+  */
+int
+mypaint_surface_draw_dabs(MyPaintSurface *self, const MyPaintDabs *dabs);
 
 void
 mypaint_surface_get_color(MyPaintSurface *self,
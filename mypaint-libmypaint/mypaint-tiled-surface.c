@@ -17,6 +17,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #ifdef _OPENMP
@@ -28,11 +29,120 @@
 #include "helpers.h"
 #include "brushmodes.h"
 #include "operationqueue.h"
+#include "dabmaskcache.h"
+#include "tilescheduler.h"
+#include "tileworker.h"
+#include "dabmask.h"
+#include "simd.h"
+#include "surfacestats.h"
+#include "dirtyrects.h"
+#include "floattile.h"
+#include "symmetry.h"
 
 #define M_PI 3.14159265358979323846
 
+// Quantization of the dab geometry used as key for the dab mask cache.
+// Coarser steps give more cache hits, but dabs are moved/resized more.
+#define DAB_MASK_CACHE_RADIUS_STEPS 256 // per unit of log(radius), ~0.4%
+#define DAB_MASK_CACHE_HARDNESS_STEPS 256
+#define DAB_MASK_CACHE_ASPECT_RATIO_STEPS 64
+#define DAB_MASK_CACHE_ANGLE_STEPS 2 // per degree
+#define DAB_MASK_CACHE_SUBPIXEL_STEPS 4 // per pixel
+// Masks bigger than this fraction of the cache size are never cached
+#define DAB_MASK_CACHE_MAX_ENTRY_FRACTION 4
+
+// Memory of the masks which are reused without quantization, see ExactDab
+#define EXACT_MASK_CACHE_BYTES (4*1024*1024)
+
+// get_color() only allocates memory for the sums of more tiles than this
+#define GET_COLOR_STACK_TILES 16
+
+// Longest skip of a run length encoded mask entry, skip*4 has to fit into 16 bits
+#define DAB_MASK_RLE_MAX_SKIP ((1<<16)/4 - 1)
+
+// Dabs rendered into a mipmap level are at least this big, with their opacity
+// reduced to keep the coverage, instead of vanishing when zoomed out far
+#define MIPMAP_MIN_RADIUS 1.0f
+// With mipmap painting, the level 0 operations are processed anyway when
+// this many are pending, to bound the memory of long sessions
+#define MIPMAP_MAX_DEFERRED_OPERATIONS (256*1024)
+
+// Rectangles kept for mypaint_tiled_surface_get_dirty_rects(), more are merged
+#define DIRTY_RECTS_MAX 32
+
 void process_tile(MyPaintTiledSurface *self, int tx, int ty);
 
+// Callbacks for the tile scheduler
+static void
+process_tile_index(void *user_data, TileIndex index)
+{
+    process_tile((MyPaintTiledSurface *)user_data, index.x, index.y);
+}
+
+static int
+tile_weight(void *user_data, TileIndex index)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)user_data;
+    return operation_queue_get_operation_count(self->operation_queue, index);
+}
+
+static void process_tile_from_queue(MyPaintTiledSurface *self, OperationQueue *queue,
+                                    int mipmap_level, int tx, int ty);
+
+// Callbacks for the tile scheduler, with mipmap painting
+static void
+process_mipmap_tile_index(void *user_data, TileIndex index)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)user_data;
+    process_tile_from_queue(self, self->mipmap_operation_queue, self->mipmap_painting_level,
+                            index.x, index.y);
+}
+
+static int
+mipmap_tile_weight(void *user_data, TileIndex index)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)user_data;
+    return operation_queue_get_operation_count(self->mipmap_operation_queue, index);
+}
+
+// Callbacks for the tile worker, which processes the operations
+// queued before mypaint_tiled_surface_end_atomic_async()
+static void
+process_async_tile_index(void *user_data, TileIndex index)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)user_data;
+    process_tile_from_queue(self, self->async_operation_queue, self->async_mipmap_level,
+                            index.x, index.y);
+}
+
+static int
+async_tile_weight(void *user_data, TileIndex index)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)user_data;
+    return operation_queue_get_operation_count(self->async_operation_queue, index);
+}
+
+// Wait for the background processing started by end_atomic_async to finish
+static void
+finish_async(MyPaintTiledSurface *self)
+{
+    tile_worker_wait_all(self->tile_worker);
+    operation_queue_clear_dirty_tiles(self->async_operation_queue);
+}
+
+// Process the operations queued for level 0
+static void
+process_dirty_tiles(MyPaintTiledSurface *self)
+{
+    TileIndex *tiles;
+    int tiles_n = operation_queue_get_dirty_tiles(self->operation_queue, &tiles);
+
+    tile_scheduler_run(self->tile_scheduler, tiles, tiles_n, self->threadsafe_tile_requests && tiles_n > 3,
+                       tile_weight, process_tile_index, self);
+
+    operation_queue_clear_dirty_tiles(self->operation_queue);
+}
+
 static void
 begin_atomic_default(MyPaintSurface *surface)
 {
@@ -60,6 +170,10 @@ mypaint_tiled_surface_begin_atomic(MyPaintTiledSurface *self)
     self->dirty_bbox.width = 0;
     self->dirty_bbox.y = 0;
     self->dirty_bbox.x = 0;
+    dirty_rects_clear(self->dirty_rects);
+#ifdef HAVE_SURFACE_STATS
+    surface_stats_reset(self->stats);
+#endif
 }
 
 /**
@@ -73,20 +187,206 @@ mypaint_tiled_surface_begin_atomic(MyPaintTiledSurface *self)
 void
 mypaint_tiled_surface_end_atomic(MyPaintTiledSurface *self, MyPaintRectangle *roi)
 {
-    // Process tiles
-    TileIndex *tiles;
-    int tiles_n = operation_queue_get_dirty_tiles(self->operation_queue, &tiles);
+    // Operations on the same tiles must be applied in order
+    finish_async(self);
 
-    #pragma omp parallel for schedule(static) if(self->threadsafe_tile_requests && tiles_n > 3)
-    for (int i = 0; i < tiles_n; i++) {
-        process_tile(self, tiles[i].x, tiles[i].y);
+    if (self->mipmap_painting_level > 0) {
+        // Only the mipmap level is rendered, level 0 later
+        TileIndex *tiles;
+        int tiles_n = operation_queue_get_dirty_tiles(self->mipmap_operation_queue, &tiles);
+
+        tile_scheduler_run(self->tile_scheduler, tiles, tiles_n, self->threadsafe_tile_requests && tiles_n > 3,
+                           mipmap_tile_weight, process_mipmap_tile_index, self);
+
+        operation_queue_clear_dirty_tiles(self->mipmap_operation_queue);
+
+        if (self->deferred_operations > MIPMAP_MAX_DEFERRED_OPERATIONS) {
+            mypaint_tiled_surface_finalize_tiles(self, NULL);
+        }
+    } else {
+        process_dirty_tiles(self);
     }
 
-    operation_queue_clear_dirty_tiles(self->operation_queue);
+    if (roi) {
+        *roi = self->dirty_bbox;
+    }
+}
+
+/**
+ * mypaint_tiled_surface_get_dirty_rects:
+ *
+ * @rects: (out caller-allocates) (array length=max_rects): Filled in with the rectangles
+ * @max_rects: Size of @rects
+ *
+ * Rectangles which together cover the area changed since the last begin_atomic,
+ * like the bounding box returned by end_atomic, but without most of the
+ * unchanged area between distant dabs, e.g. with symmetry.
+ * Overlapping dabs are merged into one rectangle, and if more than @max_rects
+ * would be needed, the rectangles closest to each other are merged.
+ * Valid after mypaint_tiled_surface_end_atomic() and mypaint_tiled_surface_end_atomic_async(),
+ * until the next begin_atomic.
+ *
+ * Returns: The number of rectangles, at most @max_rects.
+ */
+int
+mypaint_tiled_surface_get_dirty_rects(MyPaintTiledSurface *self, MyPaintRectangle *rects, int max_rects)
+{
+    return dirty_rects_get(self->dirty_rects, rects, max_rects);
+}
+
+/**
+ * mypaint_tiled_surface_end_atomic_async:
+ *
+ * @roi: (out) (allow-none): Area that will be changed, same as for mypaint_tiled_surface_end_atomic()
+ *
+ * Like mypaint_tiled_surface_end_atomic(), but processes the queued dabs
+ * on a background thread and returns right away, so that the next dabs
+ * can be queued while the tiles are being rendered.
+ * If a previous call is still being processed, waits for it first.
+ *
+ * Tiles must not be read before they are done, see mypaint_tiled_surface_wait()
+ * and mypaint_tiled_surface_wait_for_tile(). get_color() waits by itself.
+ * Tile requests from the background thread happen concurrently with tile requests
+ * of get_color(), for different tiles if the surface supports threadsafe tile requests.
+ * If it does not, get_color() waits for all tiles to be done.
+ *
+ * Returns: Handle for mypaint_tiled_surface_wait() and mypaint_tiled_surface_is_done().
+ */
+int
+mypaint_tiled_surface_end_atomic_async(MyPaintTiledSurface *self, MyPaintRectangle *roi)
+{
+    finish_async(self);
+
+    if (self->deferred_operations > MIPMAP_MAX_DEFERRED_OPERATIONS) {
+        mypaint_tiled_surface_finalize_tiles(self, NULL);
+    }
+
+    // New operations go to the other queue while this one is processed.
+    // With mipmap painting, that is the queue of the mipmap level.
+    OperationQueue **queue_pointer = (self->mipmap_painting_level > 0) ? &self->mipmap_operation_queue
+                                                                       : &self->operation_queue;
+    TileIndex *tiles;
+    int tiles_n = operation_queue_get_dirty_tiles(*queue_pointer, &tiles);
+
+    OperationQueue *queue = self->async_operation_queue;
+    self->async_operation_queue = *queue_pointer;
+    *queue_pointer = queue;
+    self->async_mipmap_level = self->mipmap_painting_level;
+
+    const int handle = tile_worker_start(self->tile_worker, self->tile_scheduler, tiles, tiles_n,
+                                         self->threadsafe_tile_requests && tiles_n > 3,
+                                         async_tile_weight, process_async_tile_index, self);
 
     if (roi) {
         *roi = self->dirty_bbox;
     }
+    return handle;
+}
+
+/**
+ * mypaint_tiled_surface_is_done:
+ *
+ * @handle: Handle returned by mypaint_tiled_surface_end_atomic_async()
+ *
+ * Returns: TRUE if all tiles of @handle have been processed.
+ */
+gboolean
+mypaint_tiled_surface_is_done(MyPaintTiledSurface *self, int handle)
+{
+    return tile_worker_is_done(self->tile_worker, handle);
+}
+
+/**
+ * mypaint_tiled_surface_wait:
+ *
+ * @handle: Handle returned by mypaint_tiled_surface_end_atomic_async()
+ *
+ * Wait until all tiles of @handle have been processed.
+ */
+void
+mypaint_tiled_surface_wait(MyPaintTiledSurface *self, int handle)
+{
+    tile_worker_wait(self->tile_worker, handle);
+}
+
+/**
+ * mypaint_tiled_surface_wait_for_tile:
+ *
+ * Wait until the tile (tx, ty) has been processed by the background thread,
+ * if it is part of the running mypaint_tiled_surface_end_atomic_async() call.
+ */
+void
+mypaint_tiled_surface_wait_for_tile(MyPaintTiledSurface *self, int tx, int ty)
+{
+    const TileIndex index = {tx, ty};
+    tile_worker_wait_for_tile(self->tile_worker, index);
+}
+
+/**
+ * mypaint_tiled_surface_set_mipmap_painting:
+ *
+ * @mipmap_level: The visible mipmap level, 0 to paint normally
+ * @roi: (out) (allow-none): Area of the level 0 tiles which were changed
+ *   by the pending operations, see mypaint_tiled_surface_finalize_tiles()
+ *
+ * Render dabs directly into the tiles of @mipmap_level, with their position
+ * and radius scaled down, instead of into level 0. This is meant for painting
+ * while zoomed out, where the rendering of the level 0 tiles and their downscaling
+ * would cost more than what is visible. The level 0 operations are kept, and
+ * only processed by mypaint_tiled_surface_finalize_tiles(), or by get_color()
+ * for the tiles it samples.
+ * The backend must handle tile requests with the #MyPaintTileRequest::mipmap_level,
+ * and must not regenerate the tiles of @mipmap_level from the pending level 0 tiles.
+ *
+ * The pending operations are finalized when the level changes.
+ * Must not be called within an atomic section.
+ */
+void
+mypaint_tiled_surface_set_mipmap_painting(MyPaintTiledSurface *self, int mipmap_level, MyPaintRectangle *roi)
+{
+    assert(mipmap_level >= 0 && mipmap_level <= MYPAINT_MAX_MIPMAP_LEVEL);
+
+    mypaint_tiled_surface_finalize_tiles(self, roi);
+    self->mipmap_painting_level = mipmap_level;
+}
+
+int
+mypaint_tiled_surface_get_mipmap_painting(MyPaintTiledSurface *self)
+{
+    return self->mipmap_painting_level;
+}
+
+// No level 0 operations are pending anymore
+static void
+clear_deferred(MyPaintTiledSurface *self)
+{
+    self->deferred_bbox.x = 0;
+    self->deferred_bbox.y = 0;
+    self->deferred_bbox.width = 0;
+    self->deferred_bbox.height = 0;
+    self->deferred_operations = 0;
+}
+
+/**
+ * mypaint_tiled_surface_finalize_tiles:
+ *
+ * @roi: (out) (allow-none): Area of the level 0 tiles which were changed
+ *
+ * Process the level 0 operations left pending by mipmap painting,
+ * see mypaint_tiled_surface_set_mipmap_painting().
+ * Must not be called within an atomic section.
+ */
+void
+mypaint_tiled_surface_finalize_tiles(MyPaintTiledSurface *self, MyPaintRectangle *roi)
+{
+    finish_async(self);
+
+    process_dirty_tiles(self);
+
+    if (roi) {
+        *roi = self->deferred_bbox;
+    }
+    clear_deferred(self);
 }
 
 /**
@@ -100,6 +400,7 @@ mypaint_tiled_surface_end_atomic(MyPaintTiledSurface *self, MyPaintRectangle *ro
 void mypaint_tiled_surface_tile_request_start(MyPaintTiledSurface *self, MyPaintTileRequest *request)
 {
     assert(self->tile_request_start);
+    SURFACE_STATS_ADD(self->stats, SURFACE_STAT_TILE_REQUESTS, 1);
     self->tile_request_start(self, request);
 }
 
@@ -129,8 +430,167 @@ void mypaint_tiled_surface_tile_request_end(MyPaintTiledSurface *self, MyPaintTi
 void
 mypaint_tiled_surface_set_symmetry_state(MyPaintTiledSurface *self, gboolean active, float center_x)
 {
-    self->surface_do_symmetry = active;
+    mypaint_tiled_surface_set_symmetry(self,
+                                       active ? MYPAINT_SYMMETRY_TYPE_VERTICAL : MYPAINT_SYMMETRY_TYPE_NONE,
+                                       center_x, 0.0f, 2);
+}
+
+/**
+ * mypaint_tiled_surface_set_symmetry:
+ *
+ * @type: Kind of symmetry, #MYPAINT_SYMMETRY_TYPE_NONE to disable.
+ * @center_x: X coordinate of the symmetry center.
+ * @center_y: Y coordinate of the symmetry center.
+ * @lines: Number of rotated copies for the rotational types, e.g. 8 for
+ *   a mandala. Ignored by the other types.
+ *
+ * Paint every dab several times, mirrored or rotated around the center.
+ * If the center is on a pixel corner or center, copies which are mirrored
+ * or rotated by multiples of 90 degrees are made of the mask of the dab,
+ * and are exact mirror images of it. This needs at least three such copies,
+ * e.g. #MYPAINT_SYMMETRY_TYPE_VERTHORZ. With the dab mask cache enabled,
+ * mirrored copies share their quantized masks instead, see
+ * mypaint_tiled_surface_set_dab_mask_cache_size().
+ */
+void
+mypaint_tiled_surface_set_symmetry(MyPaintTiledSurface *self, MyPaintSymmetryType type,
+                                   float center_x, float center_y, int lines)
+{
+    if (self->symmetry) {
+        symmetry_free(self->symmetry);
+        self->symmetry = NULL;
+    }
+    self->surface_do_symmetry = (type != MYPAINT_SYMMETRY_TYPE_NONE);
     self->surface_center_x = center_x;
+    if (!self->surface_do_symmetry) {
+        return;
+    }
+
+    self->symmetry = symmetry_new(type, center_x, center_y, lines);
+}
+
+/**
+ * mypaint_tiled_surface_set_dab_mask_cache_size:
+ *
+ * @max_bytes: Memory the cached masks may use. 0 disables the cache.
+ *
+ * Cache rendered dab masks, so that runs of dabs with the same geometry
+ * only need to be rasterized once. To make reuse possible, the dab geometry
+ * (radius, hardness, aspect ratio, angle and subpixel position) is quantized
+ * while the cache is enabled. The cache is disabled by default.
+ */
+void
+mypaint_tiled_surface_set_dab_mask_cache_size(MyPaintTiledSurface *self, size_t max_bytes)
+{
+    dab_mask_cache_set_max_bytes(self->dab_mask_cache, max_bytes);
+}
+
+/**
+ * mypaint_tiled_surface_get_dab_mask_cache_stats:
+ *
+ * @hits: (out) (allow-none): Number of masks that were found in the cache.
+ * @misses: (out) (allow-none): Number of masks that had to be rendered.
+ *
+ * Get the hit/miss counters of the dab mask cache.
+ */
+void
+mypaint_tiled_surface_get_dab_mask_cache_stats(MyPaintTiledSurface *self, int *hits, int *misses)
+{
+    dab_mask_cache_get_stats(self->dab_mask_cache, hits, misses, NULL, NULL);
+}
+
+/**
+ * mypaint_tiled_surface_set_tile_scheduler:
+ *
+ * Set how the processing of dirty tiles is distributed over the threads.
+ * The default is %MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST.
+ */
+void
+mypaint_tiled_surface_set_tile_scheduler(MyPaintTiledSurface *self, MyPaintTileScheduler scheduler)
+{
+    tile_scheduler_set_kind(self->tile_scheduler, scheduler);
+}
+
+/**
+ * mypaint_tiled_surface_set_threads:
+ *
+ * @threads: Number of threads, at most MYPAINT_MAX_THREADS. 0 uses the OpenMP default.
+ *
+ * Set the number of threads used for processing tiles of this surface.
+ * Only has an effect if the surface supports threadsafe tile requests.
+ */
+void
+mypaint_tiled_surface_set_threads(MyPaintTiledSurface *self, int threads)
+{
+    tile_scheduler_set_threads(self->tile_scheduler, threads);
+}
+
+/**
+ * mypaint_tiled_surface_get_thread_busy_times:
+ *
+ * @busy_times: (out): Array with room for MYPAINT_MAX_THREADS entries.
+ *
+ * Get the time in seconds that each thread spent processing tiles,
+ * since the surface was created or the times were reset.
+ * Large differences between the threads mean that the load was imbalanced.
+ *
+ * Returns: the number of threads.
+ */
+int
+mypaint_tiled_surface_get_thread_busy_times(MyPaintTiledSurface *self, double *busy_times)
+{
+    return tile_scheduler_get_busy_times(self->tile_scheduler, busy_times);
+}
+
+/**
+ * mypaint_tiled_surface_reset_thread_busy_times:
+ *
+ * Reset the times returned by mypaint_tiled_surface_get_thread_busy_times().
+ */
+void
+mypaint_tiled_surface_reset_thread_busy_times(MyPaintTiledSurface *self)
+{
+    tile_scheduler_reset_busy_times(self->tile_scheduler);
+}
+
+/**
+ * mypaint_tiled_surface_get_stats:
+ *
+ * @stats: (out): The counters since the last mypaint_tiled_surface_begin_atomic()
+ *
+ * Get the counters of the hot paths, to see where the time goes without a profiler.
+ * Only available when libmypaint was built with HAVE_SURFACE_STATS (enable_stats=true),
+ * otherwise the counters are not maintained and cost nothing.
+ * Work of an asynchronous end_atomic is counted as it happens,
+ * see mypaint_tiled_surface_wait() to get complete numbers.
+ *
+ * Returns: FALSE and zeroed @stats if the counters are not available.
+ */
+gboolean
+mypaint_tiled_surface_get_stats(MyPaintTiledSurface *self, MyPaintTiledSurfaceStats *stats)
+{
+    memset(stats, 0, sizeof(MyPaintTiledSurfaceStats));
+#ifdef HAVE_SURFACE_STATS
+    if (!self->stats) {
+        return FALSE;
+    }
+    uint64_t values[SURFACE_STATS_N];
+    surface_stats_get(self->stats, values);
+    stats->dabs_enqueued = values[SURFACE_STAT_DABS_ENQUEUED];
+    stats->ops_processed = values[SURFACE_STAT_OPS_PROCESSED];
+    stats->mask_pixels = values[SURFACE_STAT_MASK_PIXELS];
+    stats->mask_pixels_skipped = values[SURFACE_STAT_MASK_PIXELS_SKIPPED];
+    stats->tile_requests = values[SURFACE_STAT_TILE_REQUESTS];
+    stats->render_dab_mask_ns = values[SURFACE_STAT_RENDER_DAB_MASK_NS];
+    stats->process_op_ns = values[SURFACE_STAT_PROCESS_OP_NS];
+    stats->get_color_ns = values[SURFACE_STAT_GET_COLOR_NS];
+    stats->ops_culled_outside = values[SURFACE_STAT_OPS_CULLED_OUTSIDE];
+    stats->ops_culled_overdrawn = values[SURFACE_STAT_OPS_CULLED_OVERDRAWN];
+    stats->ops_merged = values[SURFACE_STAT_OPS_MERGED];
+    return TRUE;
+#else
+    return FALSE;
+#endif
 }
 
 /**
@@ -305,8 +765,22 @@ calculate_opa(float rr, float hardness,
     return opa;
 }
 
+// For a graphical explanation, see render_dab_mask()
+static inline void
+calculate_opa_segments(float hardness,
+                       float *segment1_offset, float *segment1_slope,
+                       float *segment2_offset, float *segment2_slope)
+{
+    *segment1_offset = 1.0f;
+    *segment1_slope  = -(1.0f/hardness - 1.0f);
+    *segment2_offset = hardness/(1.0f-hardness);
+    *segment2_slope  = -hardness/(1.0f-hardness);
+    // for hardness == 1.0, segment2 will never be used
+}
+
 // Must be threadsafe
 void render_dab_mask (uint16_t * mask,
+                        int tile_size,
                         float x, float y,
                         float radius,
                         float hardness,
@@ -336,11 +810,10 @@ void render_dab_mask (uint16_t * mask,
     // +-----------*> rr = (distance_from_center/radius)^2
     // 0           1
     //
-    float segment1_offset = 1.0f;
-    float segment1_slope  = -(1.0f/hardness - 1.0f);
-    float segment2_offset = hardness/(1.0f-hardness);
-    float segment2_slope  = -hardness/(1.0f-hardness);
-    // for hardness == 1.0, segment2 will never be used
+    float segment1_offset, segment1_slope;
+    float segment2_offset, segment2_slope;
+    calculate_opa_segments(hardness, &segment1_offset, &segment1_slope,
+                           &segment2_offset, &segment2_slope);
 
     float angle_rad=angle/360*2*M_PI;
     float cs=cos(angle_rad);
@@ -353,55 +826,50 @@ void render_dab_mask (uint16_t * mask,
     int y1 = floor (y + r_fringe);
     if (x0 < 0) x0 = 0;
     if (y0 < 0) y0 = 0;
-    if (x1 > MYPAINT_TILE_SIZE-1) x1 = MYPAINT_TILE_SIZE-1;
-    if (y1 > MYPAINT_TILE_SIZE-1) y1 = MYPAINT_TILE_SIZE-1;
+    if (x1 > tile_size-1) x1 = tile_size-1;
+    if (y1 > tile_size-1) y1 = tile_size-1;
     const float one_over_radius2 = 1.0f/(radius*radius);
 
-    // Pre-calculate rr and put it in the mask.
-    // This an optimization that makes use of auto-vectorization
-    // OPTIMIZE: if using floats for the brush engine, store these directly in the mask
-    float rr_mask[MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE+2*MYPAINT_TILE_SIZE];
-
+    float r_aa_start = 0.0f;
     if (radius < 3.0f)
     {
       const float aa_border = 1.0f;
-      float r_aa_start = ((radius>aa_border) ? (radius-aa_border) : 0);
+      r_aa_start = ((radius>aa_border) ? (radius-aa_border) : 0);
       r_aa_start *= r_aa_start / aspect_ratio;
+    }
 
-      for (int yp = y0; yp <= y1; yp++) {
+    // we do run length encoding: if opacity is zero, the next
+    // value in the mask is the number of pixels that can be skipped.
+    uint16_t * mask_p = mask;
+    int skip=0;
+
+    // Pre-calculate rr of a row and put it in a buffer.
+    // This an optimization that makes use of auto-vectorization
+    // OPTIMIZE: if using floats for the brush engine, store these directly in the mask
+    float rr_row[MYPAINT_MAX_TILE_SIZE];
+
+    skip += y0*tile_size;
+    for (int yp = y0; yp <= y1; yp++) {
+      if (radius < 3.0f) {
         for (int xp = x0; xp <= x1; xp++) {
-          const float rr = calculate_rr_antialiased(xp, yp,
+          rr_row[xp] = calculate_rr_antialiased(xp, yp,
                                   x, y, aspect_ratio,
                                   sn, cs, one_over_radius2,
                                   r_aa_start);
-          rr_mask[(yp*MYPAINT_TILE_SIZE)+xp] = rr;
         }
-      }
-    }
-    else
-    {
-      for (int yp = y0; yp <= y1; yp++) {
+      } else {
         for (int xp = x0; xp <= x1; xp++) {
-          const float rr = calculate_rr(xp, yp,
+          rr_row[xp] = calculate_rr(xp, yp,
                                   x, y, aspect_ratio,
                                   sn, cs, one_over_radius2);
-          rr_mask[(yp*MYPAINT_TILE_SIZE)+xp] = rr;
         }
       }
-    }
-
-    // we do run length encoding: if opacity is zero, the next
-    // value in the mask is the number of pixels that can be skipped.
-    uint16_t * mask_p = mask;
-    int skip=0;
 
-    skip += y0*MYPAINT_TILE_SIZE;
-    for (int yp = y0; yp <= y1; yp++) {
       skip += x0;
 
       int xp;
       for (xp = x0; xp <= x1; xp++) {
-        const float rr = rr_mask[(yp*MYPAINT_TILE_SIZE)+xp];
+        const float rr = rr_row[xp];
         const float opa = calculate_opa(rr, hardness,
                                   segment1_offset, segment1_slope,
                                   segment2_offset, segment2_slope);
@@ -409,109 +877,1165 @@ void render_dab_mask (uint16_t * mask,
         if (!opa_) {
           skip++;
         } else {
-          if (skip) {
+          // big tiles can have skips which do not fit into one entry
+          while (skip) {
+            const int n = MIN(skip, DAB_MASK_RLE_MAX_SKIP);
             *mask_p++ = 0;
-            *mask_p++ = skip*4;
-            skip = 0;
+            *mask_p++ = n*4;
+            skip -= n;
           }
           *mask_p++ = opa_;
         }
       }
-      skip += MYPAINT_TILE_SIZE-xp;
+      skip += tile_size-xp;
     }
     *mask_p++ = 0;
     *mask_p++ = 0;
   }
 
-// Must be threadsafe
-void
-process_op(uint16_t *rgba_p, uint16_t *mask,
-           int tx, int ty, OperationDataDrawDab *op)
+// Parameters of the opacity calculation for one dab, see render_dab_mask()
+typedef struct {
+    float x;
+    float y;
+    float aspect_ratio;
+    float sn;
+    float cs;
+    float one_over_radius2;
+    float r_aa_start;
+    float rad_area_1;
+    float hardness;
+    float segment1_offset;
+    float segment1_slope;
+    float segment2_offset;
+    float segment2_slope;
+} DabShape;
+
+// Set the span of row @y to the pixels x0 <= x < x1, minus zeros at both ends
+static inline void
+dab_mask_set_span(DabMask *mask, int y, int x0, int x1)
 {
+    const uint16_t *row = mask->opa + y*mask->size;
+    while (x0 < x1 && !row[x0]) x0++;
+    while (x1 > x0 && !row[x1-1]) x1--;
+    mask->x0[y] = x0;
+    mask->x1[y] = x1;
+}
 
-    // first, we calculate the mask (opacity for each pixel)
-    render_dab_mask(mask,
-                    op->x - tx*MYPAINT_TILE_SIZE,
-                    op->y - ty*MYPAINT_TILE_SIZE,
-                    op->radius,
-                    op->hardness,
-                    op->aspect_ratio, op->angle
-                    );
+// Set the rows y0 <= y < y1 of @mask, minus empty rows at both ends.
+// The spans of the rows must have been set already.
+static inline void
+dab_mask_set_rows(DabMask *mask, int y0, int y1)
+{
+    while (y0 < y1 && mask->x0[y0] == mask->x1[y0]) y0++;
+    while (y1 > y0 && mask->x0[y1-1] == mask->x1[y1-1]) y1--;
+    mask->y0 = y0;
+    mask->y1 = y1;
+}
 
-    // second, we use the mask to stamp a dab for each activated blend mode
+// Renders the pixels x0 <= xp < x1 of row yp, exactly like render_dab_mask(),
+// and sets the span of the row.
+typedef void (*RenderDabRowFunction) (DabMask *mask, int yp, int x0, int x1, const DabShape *s);
 
-    if (op->normal) {
-      if (op->color_a == 1.0) {
-        draw_dab_pixels_BlendMode_Normal(mask, rgba_p,
-                                         op->color_r, op->color_g, op->color_b, op->normal*op->opaque*(1<<15));
-      } else {
-        // normal case for brushes that use smudging (eg. watercolor)
-        draw_dab_pixels_BlendMode_Normal_and_Eraser(mask, rgba_p,
-                                                    op->color_r, op->color_g, op->color_b, op->color_a*(1<<15), op->normal*op->opaque*(1<<15));
-      }
+static void
+render_dab_row(DabMask *mask, int yp, int x0, int x1, const DabShape *s)
+{
+    uint16_t *row = mask->opa + yp*mask->size;
+    for (int xp = x0; xp < x1; xp++) {
+        const float rr = calculate_rr(xp, yp, s->x, s->y, s->aspect_ratio,
+                                      s->sn, s->cs, s->one_over_radius2);
+        const float opa = calculate_opa(rr, s->hardness,
+                                        s->segment1_offset, s->segment1_slope,
+                                        s->segment2_offset, s->segment2_slope);
+        row[xp] = opa * (1<<15);
     }
+    dab_mask_set_span(mask, yp, x0, x1);
+}
 
-    if (op->lock_alpha) {
-      draw_dab_pixels_BlendMode_LockAlpha(mask, rgba_p,
-                                          op->color_r, op->color_g, op->color_b, op->lock_alpha*op->opaque*(1<<15));
-    }
-    if (op->colorize) {
-      draw_dab_pixels_BlendMode_Color(mask, rgba_p,
-                                      op->color_r, op->color_g, op->color_b,
-                                      op->colorize*op->opaque*(1<<15));
+static void
+render_dab_row_antialiased(DabMask *mask, int yp, int x0, int x1, const DabShape *s)
+{
+    uint16_t *row = mask->opa + yp*mask->size;
+    for (int xp = x0; xp < x1; xp++) {
+        const float rr = calculate_rr_antialiased(xp, yp, s->x, s->y, s->aspect_ratio,
+                                                  s->sn, s->cs, s->one_over_radius2,
+                                                  s->r_aa_start);
+        const float opa = calculate_opa(rr, s->hardness,
+                                        s->segment1_offset, s->segment1_slope,
+                                        s->segment2_offset, s->segment2_slope);
+        row[xp] = opa * (1<<15);
     }
+    dab_mask_set_span(mask, yp, x0, x1);
 }
 
-// Must be threadsafe
-void
-process_tile(MyPaintTiledSurface *self, int tx, int ty)
+#ifdef SIMD_X86
+// The SIMD versions do the same float operations in the same order as
+// calculate_rr(), calculate_rr_antialiased() and calculate_opa(), so the
+// results are bit-exact. Branches are replaced by computing both sides and
+// selecting. (No FMA: contracting a*b+c would change the rounding.)
+
+// select(mask, a, b) = mask ? a : b
+SIMD_TARGET("sse2") static inline __m128
+select_sse2(__m128 mask, __m128 a, __m128 b)
 {
-    TileIndex tile_index = {tx, ty};
-    OperationDataDrawDab *op = operation_queue_pop(self->operation_queue, tile_index);
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Pixel xp+i in lane i
+SIMD_TARGET("sse2") static inline __m128
+pixel_index_sse2(int xp)
+{
+    return _mm_add_ps(_mm_set1_ps(xp), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+}
+
+SIMD_TARGET("sse2") static inline __m128
+calculate_rr_sse2(int xp, int yp, const DabShape *s)
+{
+    const float yy = (yp + 0.5f - s->y);
+    const __m128 xx = _mm_sub_ps(_mm_add_ps(pixel_index_sse2(xp), _mm_set1_ps(0.5f)), _mm_set1_ps(s->x));
+    const __m128 yyr = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(yy*s->cs), _mm_mul_ps(xx, _mm_set1_ps(s->sn))),
+                                  _mm_set1_ps(s->aspect_ratio));
+    const __m128 xxr = _mm_add_ps(_mm_set1_ps(yy*s->sn), _mm_mul_ps(xx, _mm_set1_ps(s->cs)));
+    return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(yyr, yyr), _mm_mul_ps(xxr, xxr)), _mm_set1_ps(s->one_over_radius2));
+}
+
+SIMD_TARGET("sse2") static inline __m128
+calculate_r_sample_sse2(__m128 x, __m128 y, const DabShape *s)
+{
+    const __m128 sn = _mm_set1_ps(s->sn);
+    const __m128 cs = _mm_set1_ps(s->cs);
+    const __m128 yyr = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(y, cs), _mm_mul_ps(x, sn)), _mm_set1_ps(s->aspect_ratio));
+    const __m128 xxr = _mm_add_ps(_mm_mul_ps(y, sn), _mm_mul_ps(x, cs));
+    return _mm_add_ps(_mm_mul_ps(yyr, yyr), _mm_mul_ps(xxr, xxr));
+}
+
+SIMD_TARGET("sse2") static inline __m128
+calculate_rr_antialiased_sse2(int xp, int yp, const DabShape *s)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sn = _mm_set1_ps(s->sn);
+    const __m128 cs = _mm_set1_ps(s->cs);
+    const __m128 one_over_radius2 = _mm_set1_ps(s->one_over_radius2);
+
+    const __m128 pixel_right = _mm_sub_ps(_mm_set1_ps(s->x), pixel_index_sse2(xp));
+    const __m128 pixel_bottom = _mm_set1_ps(s->y - (float)yp);
+    const __m128 pixel_center_x = _mm_sub_ps(pixel_right, half);
+    const __m128 pixel_center_y = _mm_sub_ps(pixel_bottom, half);
+    const __m128 pixel_left = _mm_sub_ps(pixel_right, one);
+    const __m128 pixel_top = _mm_sub_ps(pixel_bottom, one);
+
+    // closest_point_to_line()
+    const float l2 = s->cs*s->cs + s->sn*s->sn;
+    const __m128 ltp_dot = _mm_add_ps(_mm_mul_ps(pixel_center_x, cs), _mm_mul_ps(pixel_center_y, sn));
+    const __m128 t = _mm_div_ps(ltp_dot, _mm_set1_ps(l2));
+    __m128 nearest_x = _mm_mul_ps(cs, t);
+    __m128 nearest_y = _mm_mul_ps(sn, t);
+    // CLAMP()
+    nearest_x = select_sse2(_mm_cmpgt_ps(nearest_x, pixel_right), pixel_right,
+                            select_sse2(_mm_cmplt_ps(nearest_x, pixel_left), pixel_left, nearest_x));
+    nearest_y = select_sse2(_mm_cmpgt_ps(nearest_y, pixel_bottom), pixel_bottom,
+                            select_sse2(_mm_cmplt_ps(nearest_y, pixel_top), pixel_top, nearest_y));
+
+    // Dab's center is inside pixel?
+    const __m128 center_inside = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(pixel_left, zero), _mm_cmpgt_ps(pixel_right, zero)),
+                                            _mm_and_ps(_mm_cmplt_ps(pixel_top, zero), _mm_cmpgt_ps(pixel_bottom, zero)));
+    nearest_x = _mm_andnot_ps(center_inside, nearest_x);
+    nearest_y = _mm_andnot_ps(center_inside, nearest_y);
+    const __m128 rr_near = _mm_andnot_ps(center_inside,
+                                         _mm_mul_ps(calculate_r_sample_sse2(nearest_x, nearest_y, s), one_over_radius2));
+
+    // sign_point_in_line(pixel_center, cs, -sn)
+    const __m128 center_sign = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(pixel_center_x, cs), sn),
+                                          _mm_mul_ps(cs, _mm_add_ps(pixel_center_y, sn)));
+    const __m128 below = _mm_cmplt_ps(center_sign, zero);
+    const __m128 sn_rad = _mm_set1_ps(s->sn*s->rad_area_1);
+    const __m128 cs_rad = _mm_set1_ps(s->cs*s->rad_area_1);
+    const __m128 farthest_x = select_sse2(below, _mm_sub_ps(nearest_x, sn_rad), _mm_add_ps(nearest_x, sn_rad));
+    const __m128 farthest_y = select_sse2(below, _mm_add_ps(nearest_y, cs_rad), _mm_sub_ps(nearest_y, cs_rad));
+
+    const __m128 r_far = calculate_r_sample_sse2(farthest_x, farthest_y, s);
+    const __m128 rr_far = _mm_mul_ps(r_far, one_over_radius2);
+
+    const __m128 rr_simple = _mm_mul_ps(_mm_add_ps(rr_far, rr_near), half);
+    const __m128 visibility_near = _mm_div_ps(_mm_sub_ps(one, rr_near),
+                                              _mm_add_ps(one, _mm_sub_ps(rr_far, rr_near)));
+    const __m128 rr_aa = _mm_sub_ps(one, visibility_near);
+
+    __m128 rr = select_sse2(_mm_cmplt_ps(r_far, _mm_set1_ps(s->r_aa_start)), rr_simple, rr_aa);
+    rr = select_sse2(_mm_cmpgt_ps(rr_near, one), rr_near, rr);
+    return rr;
+}
+
+SIMD_TARGET("sse2") static inline __m128
+calculate_opa_sse2(__m128 rr, const DabShape *s)
+{
+    const __m128 segment1 = _mm_cmple_ps(rr, _mm_set1_ps(s->hardness));
+    const __m128 fac = select_sse2(segment1, _mm_set1_ps(s->segment1_slope), _mm_set1_ps(s->segment2_slope));
+    __m128 opa = select_sse2(segment1, _mm_set1_ps(s->segment1_offset), _mm_set1_ps(s->segment2_offset));
+    opa = _mm_add_ps(opa, _mm_mul_ps(rr, fac));
+    return _mm_andnot_ps(_mm_cmpgt_ps(rr, _mm_set1_ps(1.0f)), opa);
+}
+
+// Store the fix15 opacity of the pixels xp..xp+3 and extend the span by the
+// nonzero ones inside of x0 <= x < x1.
+SIMD_TARGET("sse2") static inline void
+store_opa_sse2(uint16_t *row, int xp, int x0, int x1, __m128 opa, int *span_x0, int *span_x1)
+{
+    // truncate to 16 bits like the scalar float to uint16_t conversion
+    __m128i opa_ = _mm_cvttps_epi32(_mm_mul_ps(opa, _mm_set1_ps(1<<15)));
+    opa_ = _mm_srai_epi32(_mm_slli_epi32(opa_, 16), 16);
+    opa_ = _mm_packs_epi32(opa_, opa_);
+    _mm_storel_epi64((__m128i *)(row + xp), opa_);
+
+    // two bits per pixel
+    const unsigned int inside = (0xffu << 2*(MAX(x0, xp) - xp)) & (0xffu >> 2*MAX(0, xp + 4 - x1));
+    const unsigned int nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi16(opa_, _mm_setzero_si128())) & inside & 0xffu;
+    if (nonzero) {
+        *span_x0 = MIN(*span_x0, xp + __builtin_ctz(nonzero)/2);
+        *span_x1 = MAX(*span_x1, xp + (31 - __builtin_clz(nonzero))/2 + 1);
+    }
+}
+
+SIMD_TARGET("avx2") static inline __m256
+select_avx2(__m256 mask, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+SIMD_TARGET("avx2") static inline __m256
+pixel_index_avx2(int xp)
+{
+    return _mm256_add_ps(_mm256_set1_ps(xp), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+}
+
+SIMD_TARGET("avx2") static inline __m256
+calculate_rr_avx2(int xp, int yp, const DabShape *s)
+{
+    const float yy = (yp + 0.5f - s->y);
+    const __m256 xx = _mm256_sub_ps(_mm256_add_ps(pixel_index_avx2(xp), _mm256_set1_ps(0.5f)), _mm256_set1_ps(s->x));
+    const __m256 yyr = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(yy*s->cs), _mm256_mul_ps(xx, _mm256_set1_ps(s->sn))),
+                                     _mm256_set1_ps(s->aspect_ratio));
+    const __m256 xxr = _mm256_add_ps(_mm256_set1_ps(yy*s->sn), _mm256_mul_ps(xx, _mm256_set1_ps(s->cs)));
+    return _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(yyr, yyr), _mm256_mul_ps(xxr, xxr)), _mm256_set1_ps(s->one_over_radius2));
+}
+
+SIMD_TARGET("avx2") static inline __m256
+calculate_r_sample_avx2(__m256 x, __m256 y, const DabShape *s)
+{
+    const __m256 sn = _mm256_set1_ps(s->sn);
+    const __m256 cs = _mm256_set1_ps(s->cs);
+    const __m256 yyr = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(y, cs), _mm256_mul_ps(x, sn)), _mm256_set1_ps(s->aspect_ratio));
+    const __m256 xxr = _mm256_add_ps(_mm256_mul_ps(y, sn), _mm256_mul_ps(x, cs));
+    return _mm256_add_ps(_mm256_mul_ps(yyr, yyr), _mm256_mul_ps(xxr, xxr));
+}
+
+SIMD_TARGET("avx2") static inline __m256
+calculate_rr_antialiased_avx2(int xp, int yp, const DabShape *s)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 sn = _mm256_set1_ps(s->sn);
+    const __m256 cs = _mm256_set1_ps(s->cs);
+    const __m256 one_over_radius2 = _mm256_set1_ps(s->one_over_radius2);
+
+    const __m256 pixel_right = _mm256_sub_ps(_mm256_set1_ps(s->x), pixel_index_avx2(xp));
+    const __m256 pixel_bottom = _mm256_set1_ps(s->y - (float)yp);
+    const __m256 pixel_center_x = _mm256_sub_ps(pixel_right, half);
+    const __m256 pixel_center_y = _mm256_sub_ps(pixel_bottom, half);
+    const __m256 pixel_left = _mm256_sub_ps(pixel_right, one);
+    const __m256 pixel_top = _mm256_sub_ps(pixel_bottom, one);
+
+    const float l2 = s->cs*s->cs + s->sn*s->sn;
+    const __m256 ltp_dot = _mm256_add_ps(_mm256_mul_ps(pixel_center_x, cs), _mm256_mul_ps(pixel_center_y, sn));
+    const __m256 t = _mm256_div_ps(ltp_dot, _mm256_set1_ps(l2));
+    __m256 nearest_x = _mm256_mul_ps(cs, t);
+    __m256 nearest_y = _mm256_mul_ps(sn, t);
+    nearest_x = select_avx2(_mm256_cmp_ps(nearest_x, pixel_right, _CMP_GT_OQ), pixel_right,
+                            select_avx2(_mm256_cmp_ps(nearest_x, pixel_left, _CMP_LT_OQ), pixel_left, nearest_x));
+    nearest_y = select_avx2(_mm256_cmp_ps(nearest_y, pixel_bottom, _CMP_GT_OQ), pixel_bottom,
+                            select_avx2(_mm256_cmp_ps(nearest_y, pixel_top, _CMP_LT_OQ), pixel_top, nearest_y));
+
+    const __m256 center_inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(pixel_left, zero, _CMP_LT_OQ),
+                                                             _mm256_cmp_ps(pixel_right, zero, _CMP_GT_OQ)),
+                                               _mm256_and_ps(_mm256_cmp_ps(pixel_top, zero, _CMP_LT_OQ),
+                                                             _mm256_cmp_ps(pixel_bottom, zero, _CMP_GT_OQ)));
+    nearest_x = _mm256_andnot_ps(center_inside, nearest_x);
+    nearest_y = _mm256_andnot_ps(center_inside, nearest_y);
+    const __m256 rr_near = _mm256_andnot_ps(center_inside,
+                                            _mm256_mul_ps(calculate_r_sample_avx2(nearest_x, nearest_y, s), one_over_radius2));
+
+    const __m256 center_sign = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(pixel_center_x, cs), sn),
+                                             _mm256_mul_ps(cs, _mm256_add_ps(pixel_center_y, sn)));
+    const __m256 below = _mm256_cmp_ps(center_sign, zero, _CMP_LT_OQ);
+    const __m256 sn_rad = _mm256_set1_ps(s->sn*s->rad_area_1);
+    const __m256 cs_rad = _mm256_set1_ps(s->cs*s->rad_area_1);
+    const __m256 farthest_x = select_avx2(below, _mm256_sub_ps(nearest_x, sn_rad), _mm256_add_ps(nearest_x, sn_rad));
+    const __m256 farthest_y = select_avx2(below, _mm256_add_ps(nearest_y, cs_rad), _mm256_sub_ps(nearest_y, cs_rad));
+
+    const __m256 r_far = calculate_r_sample_avx2(farthest_x, farthest_y, s);
+    const __m256 rr_far = _mm256_mul_ps(r_far, one_over_radius2);
+
+    const __m256 rr_simple = _mm256_mul_ps(_mm256_add_ps(rr_far, rr_near), half);
+    const __m256 visibility_near = _mm256_div_ps(_mm256_sub_ps(one, rr_near),
+                                                 _mm256_add_ps(one, _mm256_sub_ps(rr_far, rr_near)));
+    const __m256 rr_aa = _mm256_sub_ps(one, visibility_near);
+
+    __m256 rr = select_avx2(_mm256_cmp_ps(r_far, _mm256_set1_ps(s->r_aa_start), _CMP_LT_OQ), rr_simple, rr_aa);
+    rr = select_avx2(_mm256_cmp_ps(rr_near, one, _CMP_GT_OQ), rr_near, rr);
+    return rr;
+}
+
+SIMD_TARGET("avx2") static inline __m256
+calculate_opa_avx2(__m256 rr, const DabShape *s)
+{
+    const __m256 segment1 = _mm256_cmp_ps(rr, _mm256_set1_ps(s->hardness), _CMP_LE_OQ);
+    const __m256 fac = select_avx2(segment1, _mm256_set1_ps(s->segment1_slope), _mm256_set1_ps(s->segment2_slope));
+    __m256 opa = select_avx2(segment1, _mm256_set1_ps(s->segment1_offset), _mm256_set1_ps(s->segment2_offset));
+    opa = _mm256_add_ps(opa, _mm256_mul_ps(rr, fac));
+    return _mm256_andnot_ps(_mm256_cmp_ps(rr, _mm256_set1_ps(1.0f), _CMP_GT_OQ), opa);
+}
+
+SIMD_TARGET("avx2") static inline void
+store_opa_avx2(uint16_t *row, int xp, int x0, int x1, __m256 opa, int *span_x0, int *span_x1)
+{
+    __m256i opa_ = _mm256_cvttps_epi32(_mm256_mul_ps(opa, _mm256_set1_ps(1<<15)));
+    opa_ = _mm256_srai_epi32(_mm256_slli_epi32(opa_, 16), 16);
+    const __m128i opa_packed = _mm_packs_epi32(_mm256_castsi256_si128(opa_), _mm256_extracti128_si256(opa_, 1));
+    _mm_storeu_si128((__m128i *)(row + xp), opa_packed);
+
+    const unsigned int inside = (0xffffu << 2*(MAX(x0, xp) - xp)) & (0xffffu >> 2*MAX(0, xp + 8 - x1));
+    const unsigned int nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi16(opa_packed, _mm_setzero_si128())) & inside & 0xffffu;
+    if (nonzero) {
+        *span_x0 = MIN(*span_x0, xp + __builtin_ctz(nonzero)/2);
+        *span_x1 = MAX(*span_x1, xp + (31 - __builtin_clz(nonzero))/2 + 1);
+    }
+}
+
+// The last vector of a row may reach past x1, or be moved back to stay inside
+// the tile, writing to pixels outside of the span. Those are undefined in a DabMask.
+#define DEFINE_RENDER_DAB_ROW_SIMD(name, isa, width, calculate_rr_isa) \
+    SIMD_TARGET(#isa) static void \
+    name(DabMask *mask, int yp, int x0, int x1, const DabShape *s) \
+    { \
+        uint16_t *row = mask->opa + yp*mask->size; \
+        int span_x0 = x1; \
+        int span_x1 = x0; \
+        for (int x = x0; x < x1; x += width) { \
+            const int xp = MIN(x, mask->size-width); \
+            const __typeof__(calculate_rr_isa(xp, yp, s)) rr = calculate_rr_isa(xp, yp, s); \
+            store_opa_##isa(row, xp, x0, x1, calculate_opa_##isa(rr, s), &span_x0, &span_x1); \
+        } \
+        mask->x0[yp] = span_x0; \
+        mask->x1[yp] = MAX(span_x0, span_x1); \
+    }
+
+DEFINE_RENDER_DAB_ROW_SIMD(render_dab_row_sse2, sse2, 4, calculate_rr_sse2)
+DEFINE_RENDER_DAB_ROW_SIMD(render_dab_row_antialiased_sse2, sse2, 4, calculate_rr_antialiased_sse2)
+DEFINE_RENDER_DAB_ROW_SIMD(render_dab_row_avx2, avx2, 8, calculate_rr_avx2)
+DEFINE_RENDER_DAB_ROW_SIMD(render_dab_row_antialiased_avx2, avx2, 8, calculate_rr_antialiased_avx2)
+
+#endif // SIMD_X86
+
+// Same as render_dab_mask(), but renders a dense DabMask instead of
+// run length encoding. The coverage values are exactly the same.
+void render_dab_mask_spans (DabMask * mask,
+                            float x, float y,
+                            float radius,
+                            float hardness,
+                            float aspect_ratio, float angle
+                            )
+{
+    hardness = CLAMP(hardness, 0.0, 1.0);
+    if (aspect_ratio<1.0) aspect_ratio=1.0;
+    assert(hardness != 0.0); // assured by caller
+
+    DabShape s;
+    s.x = x;
+    s.y = y;
+    s.aspect_ratio = aspect_ratio;
+    s.hardness = hardness;
+    calculate_opa_segments(hardness, &s.segment1_offset, &s.segment1_slope,
+                           &s.segment2_offset, &s.segment2_slope);
+
+    float angle_rad=angle/360*2*M_PI;
+    s.cs=cos(angle_rad);
+    s.sn=sin(angle_rad);
+
+    const float r_fringe = radius + 1.0f; // +1.0 should not be required, only to be sure
+    int x0 = floor (x - r_fringe);
+    int y0 = floor (y - r_fringe);
+    int x1 = floor (x + r_fringe);
+    int y1 = floor (y + r_fringe);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > mask->size-1) x1 = mask->size-1;
+    if (y1 > mask->size-1) y1 = mask->size-1;
+    s.one_over_radius2 = 1.0f/(radius*radius);
+
+    const gboolean antialiased = (radius < 3.0f);
+    if (antialiased) {
+      const float aa_border = 1.0f;
+      s.r_aa_start = ((radius>aa_border) ? (radius-aa_border) : 0);
+      s.r_aa_start *= s.r_aa_start / aspect_ratio;
+      s.rad_area_1 = sqrtf( 1.0f / M_PI ); // see calculate_rr_antialiased()
+    }
+
+    RenderDabRowFunction render_row = antialiased ? render_dab_row_antialiased : render_dab_row;
+#ifdef SIMD_X86
+    switch (simd_level_get()) {
+    case SIMD_LEVEL_AVX2:
+      render_row = antialiased ? render_dab_row_antialiased_avx2 : render_dab_row_avx2;
+      break;
+    case SIMD_LEVEL_SSE2:
+      render_row = antialiased ? render_dab_row_antialiased_sse2 : render_dab_row_sse2;
+      break;
+    default:
+      break;
+    }
+#endif
+
+    if (x0 > x1 || y0 > y1) {
+      mask->y0 = mask->y1 = 0;
+      return;
+    }
+
+    for (int yp = y0; yp <= y1; yp++) {
+      render_row(mask, yp, x0, x1+1, &s);
+    }
+    dab_mask_set_rows(mask, y0, y1+1);
+}
+
+// Dab geometry snapped to the grid of the dab mask cache
+typedef struct {
+    DabMaskCacheKey key;
+    float radius;
+    float hardness;
+    float aspect_ratio;
+    float angle;
+    int origin_x; // position of the mask's top-left pixel on the surface
+    int origin_y;
+    float center_x; // dab center, relative to the mask's top-left pixel
+    float center_y;
+    int size; // width and height of the mask
+} QuantizedDab;
+
+static inline void
+quantize_position(float pos, int steps, int *pixel, int *subpixel)
+{
+    int p = floor(pos);
+    int s = roundf((pos - p) * steps);
+    if (s == steps) {
+        p += 1;
+        s = 0;
+    }
+    *pixel = p;
+    *subpixel = s;
+}
+
+static void
+quantize_dab(const OperationDataDrawDab *op, QuantizedDab *q)
+{
+    DabMaskCacheKey *key = &q->key;
+
+    key->radius = roundf(logf(op->radius) * DAB_MASK_CACHE_RADIUS_STEPS);
+    q->radius = expf((float)key->radius / DAB_MASK_CACHE_RADIUS_STEPS);
+    // decided on the exact radius, like render_dab_mask() does
+    key->antialiased = (op->radius < 3.0f);
+
+    key->hardness = roundf(op->hardness * DAB_MASK_CACHE_HARDNESS_STEPS);
+    if (key->hardness == 0) key->hardness = 1; // zero hardness is never drawn
+    q->hardness = (float)key->hardness / DAB_MASK_CACHE_HARDNESS_STEPS;
+
+    key->aspect_ratio = roundf(op->aspect_ratio * DAB_MASK_CACHE_ASPECT_RATIO_STEPS);
+    if (key->aspect_ratio < DAB_MASK_CACHE_ASPECT_RATIO_STEPS) key->aspect_ratio = DAB_MASK_CACHE_ASPECT_RATIO_STEPS;
+    q->aspect_ratio = (float)key->aspect_ratio / DAB_MASK_CACHE_ASPECT_RATIO_STEPS;
+
+    if (key->aspect_ratio == DAB_MASK_CACHE_ASPECT_RATIO_STEPS) {
+        // round dab, the angle makes no difference
+        key->angle = 0;
+    } else {
+        // an ellipse looks the same when rotated by 180 degrees
+        float angle = fmodf(op->angle, 180.0f);
+        if (angle < 0.0f) angle += 180.0f;
+        key->angle = roundf(angle * DAB_MASK_CACHE_ANGLE_STEPS);
+        key->angle %= 180 * DAB_MASK_CACHE_ANGLE_STEPS;
+    }
+    q->angle = (float)key->angle / DAB_MASK_CACHE_ANGLE_STEPS;
+
+    int pixel_x, pixel_y;
+    quantize_position(op->x, DAB_MASK_CACHE_SUBPIXEL_STEPS, &pixel_x, &key->subpixel_x);
+    quantize_position(op->y, DAB_MASK_CACHE_SUBPIXEL_STEPS, &pixel_y, &key->subpixel_y);
+
+    const int r_fringe = ceilf(q->radius + 1.0f);
+    q->size = 2*r_fringe + 1;
+    q->origin_x = pixel_x - r_fringe;
+    q->origin_y = pixel_y - r_fringe;
+    q->center_x = r_fringe + (float)key->subpixel_x / DAB_MASK_CACHE_SUBPIXEL_STEPS;
+    q->center_y = r_fringe + (float)key->subpixel_y / DAB_MASK_CACHE_SUBPIXEL_STEPS;
+}
+
+// Render the complete mask of a quantized dab, not clipped to a tile.
+// Same calculation as render_dab_mask(), without run length encoding.
+// Returns a (q->size x q->size) buffer allocated with malloc().
+static uint16_t *
+render_dab_mask_untiled(const QuantizedDab *q)
+{
+    float segment1_offset, segment1_slope;
+    float segment2_offset, segment2_slope;
+    calculate_opa_segments(q->hardness, &segment1_offset, &segment1_slope,
+                           &segment2_offset, &segment2_slope);
+
+    const float angle_rad = q->angle/360*2*M_PI;
+    const float cs = cos(angle_rad);
+    const float sn = sin(angle_rad);
+    const float one_over_radius2 = 1.0f/(q->radius*q->radius);
+
+    const float aa_border = 1.0f;
+    float r_aa_start = ((q->radius>aa_border) ? (q->radius-aa_border) : 0);
+    r_aa_start *= r_aa_start / q->aspect_ratio;
+
+    uint16_t *mask = (uint16_t *)malloc(q->size*q->size*sizeof(uint16_t));
+
+    for (int yp = 0; yp < q->size; yp++) {
+      for (int xp = 0; xp < q->size; xp++) {
+        const float rr = q->key.antialiased
+            ? calculate_rr_antialiased(xp, yp, q->center_x, q->center_y, q->aspect_ratio,
+                                       sn, cs, one_over_radius2, r_aa_start)
+            : calculate_rr(xp, yp, q->center_x, q->center_y, q->aspect_ratio,
+                           sn, cs, one_over_radius2);
+        const float opa = calculate_opa(rr, q->hardness,
+                                        segment1_offset, segment1_slope,
+                                        segment2_offset, segment2_slope);
+        mask[yp*q->size + xp] = opa * (1<<15);
+      }
+    }
+    return mask;
+}
+
+// Copy the part of a cached dab mask that falls into a tile.
+// @offset_x, @offset_y: position of the mask's top-left pixel relative to the tile.
+static void
+dab_mask_from_cache_entry(DabMask *mask, const DabMaskCacheEntry *entry,
+                          int offset_x, int offset_y)
+{
+    const int x0 = MAX(0, offset_x);
+    const int y0 = MAX(0, offset_y);
+    const int x1 = MIN(mask->size, offset_x + entry->size);
+    const int y1 = MIN(mask->size, offset_y + entry->size);
+
+    if (x0 >= x1 || y0 >= y1) {
+        mask->y0 = mask->y1 = 0;
+        return;
+    }
+
+    for (int yp = y0; yp < y1; yp++) {
+        const uint16_t *src = entry->mask + (yp - offset_y)*entry->size + (x0 - offset_x);
+        memcpy(mask->opa + yp*mask->size + x0, src, (x1 - x0)*sizeof(uint16_t));
+        dab_mask_set_span(mask, yp, x0, x1);
+    }
+    dab_mask_set_rows(mask, y0, y1);
+}
+
+// Symmetries of the mask grid, applied in this order
+#define MASK_TRANSPOSE 1
+#define MASK_FLIP_X 2
+#define MASK_FLIP_Y 4
+
+// Key of the dab mirrored by @transform (MASK_* flags)
+static void
+transform_mask_key(const DabMaskCacheKey *key, int transform, DabMaskCacheKey *out)
+{
+    const int half_turn = 180 * DAB_MASK_CACHE_ANGLE_STEPS;
+    const gboolean round = (key->aspect_ratio == DAB_MASK_CACHE_ASPECT_RATIO_STEPS);
+    *out = *key;
+    if (transform & MASK_TRANSPOSE) {
+        out->subpixel_x = key->subpixel_y;
+        out->subpixel_y = key->subpixel_x;
+        if (!round) out->angle = (half_turn/2 - out->angle + half_turn) % half_turn;
+    }
+    if (transform & MASK_FLIP_X) {
+        out->subpixel_x = (DAB_MASK_CACHE_SUBPIXEL_STEPS - out->subpixel_x) % DAB_MASK_CACHE_SUBPIXEL_STEPS;
+        if (!round) out->angle = (half_turn - out->angle) % half_turn;
+    }
+    if (transform & MASK_FLIP_Y) {
+        out->subpixel_y = (DAB_MASK_CACHE_SUBPIXEL_STEPS - out->subpixel_y) % DAB_MASK_CACHE_SUBPIXEL_STEPS;
+        if (!round) out->angle = (half_turn - out->angle) % half_turn;
+    }
+}
+
+// Dabs which are mirror images of each other, or rotated by multiples of
+// 90 degrees (e.g. symmetric copies), share one canonical mask.
+// Returns the transform from @key to its canonical key @canonical.
+static int
+canonical_mask_key(const DabMaskCacheKey *key, DabMaskCacheKey *canonical)
+{
+    int best = 0;
+    *canonical = *key;
+    if (key->antialiased) {
+        // the antialiased masks are not exactly symmetric
+        return 0;
+    }
+    for (int transform = 1; transform < 8; transform++) {
+        DabMaskCacheKey k;
+        transform_mask_key(key, transform, &k);
+        if (k.subpixel_x < canonical->subpixel_x
+            || (k.subpixel_x == canonical->subpixel_x
+                && (k.subpixel_y < canonical->subpixel_y
+                    || (k.subpixel_y == canonical->subpixel_y && k.angle < canonical->angle)))) {
+            *canonical = k;
+            best = transform;
+        }
+    }
+    return best;
+}
+
+// Like dab_mask_from_cache_entry(), for a dab that maps to the cached one
+// by @transform. @key: quantized key of the dab.
+// The mask is zero on its border, so pixels mirrored out of it are zero.
+static void
+dab_mask_from_cache_entry_transformed(DabMask *mask, const DabMaskCacheEntry *entry,
+                                      int offset_x, int offset_y,
+                                      int transform, const DabMaskCacheKey *key)
+{
+    const int x0 = MAX(0, offset_x);
+    const int y0 = MAX(0, offset_y);
+    const int x1 = MIN(mask->size, offset_x + entry->size);
+    const int y1 = MIN(mask->size, offset_y + entry->size);
+
+    if (x0 >= x1 || y0 >= y1) {
+        mask->y0 = mask->y1 = 0;
+        return;
+    }
+
+    // Mirroring a dab at subpixel 0 onto itself moves it by one pixel
+    const gboolean transpose = (transform & MASK_TRANSPOSE) != 0;
+    const int shift_x = (transpose ? key->subpixel_y : key->subpixel_x) != 0;
+    const int shift_y = (transpose ? key->subpixel_x : key->subpixel_y) != 0;
+    const int last = entry->size - 2;
+
+    for (int yp = y0; yp < y1; yp++) {
+        uint16_t *dst = mask->opa + yp*mask->size;
+        for (int xp = x0; xp < x1; xp++) {
+            int u = xp - offset_x;
+            int v = yp - offset_y;
+            if (transpose) {
+                const int t = u;
+                u = v;
+                v = t;
+            }
+            if (transform & MASK_FLIP_X) u = last + shift_x - u;
+            if (transform & MASK_FLIP_Y) v = last + shift_y - v;
+            dst[xp] = (u >= 0 && v >= 0) ? entry->mask[v*entry->size + u] : 0;
+        }
+        dab_mask_set_span(mask, yp, x0, x1);
+    }
+    dab_mask_set_rows(mask, y0, y1);
+}
+
+// Calculate the mask of @op for tile (@tx, @ty), through the dab mask cache
+// Returns FALSE if the dab is not suitable for caching.
+static gboolean
+render_dab_mask_cached(DabMaskCache *cache, DabMask *mask,
+                       int tx, int ty, OperationDataDrawDab *op)
+{
+    QuantizedDab q;
+    quantize_dab(op, &q);
+
+    const size_t max_entry_bytes = dab_mask_cache_get_max_bytes(cache) / DAB_MASK_CACHE_MAX_ENTRY_FRACTION;
+    if ((size_t)q.size*q.size*sizeof(uint16_t) > max_entry_bytes) {
+        return FALSE;
+    }
+
+    // Same radius, so the same size and origin
+    QuantizedDab canonical = q;
+    const int transform = canonical_mask_key(&q.key, &canonical.key);
+    const int r_fringe = (q.size - 1) / 2;
+    canonical.angle = (float)canonical.key.angle / DAB_MASK_CACHE_ANGLE_STEPS;
+    canonical.center_x = r_fringe + (float)canonical.key.subpixel_x / DAB_MASK_CACHE_SUBPIXEL_STEPS;
+    canonical.center_y = r_fringe + (float)canonical.key.subpixel_y / DAB_MASK_CACHE_SUBPIXEL_STEPS;
+
+    DabMaskCacheEntry *entry = dab_mask_cache_lookup(cache, &canonical.key);
+    if (!entry) {
+        entry = dab_mask_cache_insert(cache, &canonical.key, render_dab_mask_untiled(&canonical), canonical.size);
+    }
+
+    if (transform) {
+        dab_mask_from_cache_entry_transformed(mask, entry,
+                                              q.origin_x - tx*mask->size,
+                                              q.origin_y - ty*mask->size,
+                                              transform, &q.key);
+    } else {
+        dab_mask_from_cache_entry(mask, entry,
+                                  q.origin_x - tx*mask->size,
+                                  q.origin_y - ty*mask->size);
+    }
+
+    dab_mask_cache_release(cache, entry);
+    return TRUE;
+}
+
+// A dab on its own pixel grid, for the exact mask cache. Unlike QuantizedDab,
+// nothing is rounded: the key holds the bits of the dab parameters and of the
+// center relative to the grid, so dabs with equal keys have identical masks.
+typedef struct {
+    DabMaskCacheKey key;
+    float x; // dab center, relative to the grid's top-left pixel
+    float y;
+    float radius;
+    float hardness;
+    float aspect_ratio;
+    float angle;
+    int origin_x; // position of the grid's top-left pixel on the surface
+    int origin_y;
+    int size; // width and height of the grid
+} ExactDab;
+
+static inline int
+float_bits(float f)
+{
+    int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static void
+exact_dab_init(ExactDab *e, float x, float y, float radius,
+               float hardness, float aspect_ratio, float angle)
+{
+    const int r_fringe = ceilf(radius + 1.0f);
+    // at least one vector of the SIMD row renderers
+    e->size = MAX(2*r_fringe + 1, 8);
+    e->origin_x = (int)floorf(x) - r_fringe;
+    e->origin_y = (int)floorf(y) - r_fringe;
+    e->x = x - e->origin_x;
+    e->y = y - e->origin_y;
+    e->radius = radius;
+    e->hardness = hardness;
+    e->aspect_ratio = aspect_ratio;
+    e->angle = angle;
+
+    e->key.radius = float_bits(radius);
+    e->key.hardness = float_bits(hardness);
+    e->key.aspect_ratio = float_bits(aspect_ratio);
+    e->key.angle = float_bits(angle);
+    e->key.subpixel_x = float_bits(e->x);
+    e->key.subpixel_y = float_bits(e->y);
+    e->key.antialiased = (radius < 3.0f);
+}
+
+// TRUE if the mask of @e, moved to the tile at (@tile_x, @tile_y), is identical
+// to the mask render_dab_mask_spans() renders for the dab at (@x, @y) in the tile.
+// Both calculate each pixel from its distance to the center relative to their
+// grid. If both relative centers are exact, these distances are the same values.
+static gboolean
+exact_dab_matches_tile(const ExactDab *e, float x, float y, int tile_x, int tile_y)
+{
+    return ((double)e->x == (double)x - e->origin_x
+            && (double)e->y == (double)y - e->origin_y
+            && (double)(x - tile_x) == (double)x - tile_x
+            && (double)(y - tile_y) == (double)y - tile_y);
+}
+
+// Pixels of the rows and columns of an exact mask which are inside of the dab,
+// row_x0[y] <= x < row_x1[y] and col_y0[x] <= y < col_y1[x]. Stored behind the
+// pixels by render_exact_dab_mask(), so that copies can skip the empty corners.
+typedef struct {
+    int *row_x0;
+    int *row_x1;
+    int *col_y0;
+    int *col_y1;
+} ExactMaskSpans;
+
+// The pixels rounded up to an even number, to align the spans
+#define EXACT_MASK_SPANS_OFFSET(size) (((size)*(size) + 1) & ~1)
+
+static void
+exact_mask_spans(uint16_t *pixels, int size, ExactMaskSpans *spans)
+{
+    int *block = (int *)(pixels + EXACT_MASK_SPANS_OFFSET(size));
+    spans->row_x0 = block;
+    spans->row_x1 = block + size;
+    spans->col_y0 = block + 2*size;
+    spans->col_y1 = block + 3*size;
+}
+
+// DabMaskCacheRenderFunction for an ExactDab
+static uint16_t *
+render_exact_dab_mask(void *user_data, int *size)
+{
+    const ExactDab *e = (const ExactDab *)user_data;
+    const int n = e->size;
+    DabMask *mask = dab_mask_new(n);
+    uint16_t *pixels = (uint16_t *)malloc(EXACT_MASK_SPANS_OFFSET(n)*sizeof(uint16_t) + 4*n*sizeof(int));
+    if (!mask || !pixels) {
+        dab_mask_free(mask);
+        free(pixels);
+        return NULL;
+    }
+
+    render_dab_mask_spans(mask, e->x, e->y, e->radius, e->hardness, e->aspect_ratio, e->angle);
+
+    // The pixels outside of the spans are undefined, the grid has zeros there
+    ExactMaskSpans spans;
+    exact_mask_spans(pixels, n, &spans);
+    memset(pixels, 0, n*n*sizeof(uint16_t));
+    for (int xp = 0; xp < n; xp++) {
+        spans.col_y0[xp] = n;
+        spans.col_y1[xp] = 0;
+    }
+    for (int yp = 0; yp < n; yp++) {
+        const gboolean empty = (yp < mask->y0 || yp >= mask->y1);
+        const int x0 = empty ? 0 : mask->x0[yp];
+        const int x1 = empty ? 0 : mask->x1[yp];
+        memcpy(pixels + yp*n + x0, mask->opa + yp*n + x0, (x1 - x0)*sizeof(uint16_t));
+        spans.row_x0[yp] = x0;
+        spans.row_x1[yp] = x1;
+        for (int xp = x0; xp < x1; xp++) {
+            spans.col_y0[xp] = MIN(spans.col_y0[xp], yp);
+            spans.col_y1[xp] = yp + 1;
+        }
+    }
+    for (int xp = 0; xp < n; xp++) {
+        if (spans.col_y0[xp] >= spans.col_y1[xp]) {
+            spans.col_y0[xp] = spans.col_y1[xp] = 0;
+        }
+    }
+    dab_mask_free(mask);
+
+    *size = n;
+    return pixels;
+}
+
+// The mask of @e from the exact mask cache, rendered if missing.
+// Returns NULL if the dab is too big for the cache or the mask could not be rendered,
+// otherwise the entry must be released with dab_mask_cache_release().
+static DabMaskCacheEntry *
+exact_dab_lookup(DabMaskCache *cache, ExactDab *e)
+{
+    const size_t max_entry_bytes = dab_mask_cache_get_max_bytes(cache) / DAB_MASK_CACHE_MAX_ENTRY_FRACTION;
+    if ((size_t)e->size*e->size*sizeof(uint16_t) > max_entry_bytes) {
+        return NULL;
+    }
+    return dab_mask_cache_lookup_or_render(cache, &e->key, render_exact_dab_mask, e);
+}
+
+// Calculate the mask of @e for the tile at (@tile_x, @tile_y), through the exact mask cache
+// Returns FALSE if the dab is too big for the cache or the mask could not be rendered.
+static gboolean
+render_dab_mask_exact(DabMaskCache *cache, DabMask *mask, int tile_x, int tile_y, ExactDab *e)
+{
+    DabMaskCacheEntry *entry = exact_dab_lookup(cache, e);
+    if (!entry) {
+        return FALSE;
+    }
+    dab_mask_from_cache_entry(mask, entry, e->origin_x - tile_x, e->origin_y - tile_y);
+    dab_mask_cache_release(cache, entry);
+    return TRUE;
+}
+
+// Area changed by @op
+static MyPaintRectangle
+dab_op_rect(const OperationDataDrawDab *op)
+{
+    MyPaintRectangle rect;
+    float r_fringe = op->radius + 1.0f; // +1.0 should not be required, only to be sure
+    rect.x = floor (op->x - r_fringe);
+    rect.y = floor (op->y - r_fringe);
+    rect.width = floor (op->x + r_fringe) - rect.x + 1;
+    rect.height = floor (op->y + r_fringe) - rect.y + 1;
+    return rect;
+}
+
+// Narrows the pixels @start <= xp < @end of a row, which walk a mask coordinate
+// from @g at @x0 in steps of @dg (-1 or 1), to those where it is in @lo..@hi-1.
+static inline void
+clip_mask_walk(int g, int dg, int lo, int hi, int x0, int *start, int *end)
+{
+    if (dg > 0) {
+        *start = MAX(*start, x0 + lo - g);
+        *end = MIN(*end, x0 + hi - g);
+    } else {
+        *start = MAX(*start, x0 + g - hi + 1);
+        *end = MIN(*end, x0 + g - lo + 1);
+    }
+}
+
+// Calculate the mask of the symmetric copy @op for the tile at (@tile_x, @tile_y),
+// from the mask of the first dab in the exact mask cache. The first dab itself
+// gets the same mask as from render_dab_mask_spans(), and each copy its exact
+// mirror image or rotation.
+// Returns FALSE if the mask could not be shared.
+static gboolean
+render_dab_mask_shared(DabMaskCache *cache, DabMask *mask, int tile_x, int tile_y,
+                       const OperationDataDrawDab *op)
+{
+    ExactDab e;
+    exact_dab_init(&e, op->mask_x, op->mask_y, op->radius, op->hardness, op->aspect_ratio, op->mask_angle);
+
+    // The tiles are processed one after the other, each with all dabs of the
+    // batch. Masks much bigger than a tile would be evicted before the next
+    // tile, and then rendered again for each tile.
+    if (e.size > mask->size) {
+        return FALSE;
+    }
+
+    const gboolean first = (op->mask_xx == 1 && op->mask_yy == 1 && op->mask_dx == 0 && op->mask_dy == 0);
+    if (first && !exact_dab_matches_tile(&e, op->x, op->y, tile_x, tile_y)) {
+        return FALSE;
+    }
+
+    DabMaskCacheEntry *entry = exact_dab_lookup(cache, &e);
+    if (!entry) {
+        return FALSE;
+    }
+    const int n = entry->size;
+    ExactMaskSpans spans;
+    exact_mask_spans(entry->mask, n, &spans);
+
+    // The pixels of the copy within its own bounds
+    const MyPaintRectangle rect = dab_op_rect(op);
+    const int x0 = MAX(0, rect.x - tile_x);
+    const int y0 = MAX(0, rect.y - tile_y);
+    const int x1 = MIN(mask->size, rect.x + rect.width - tile_x);
+    const int y1 = MIN(mask->size, rect.y + rect.height - tile_y);
+
+    if (x0 >= x1 || y0 >= y1) {
+        mask->y0 = mask->y1 = 0;
+        dab_mask_cache_release(cache, entry);
+        return TRUE;
+    }
+
+    // Along a row of the copy, the mask is walked along a row, or along a column
+    // if the copy is rotated by 90 degrees
+    const gboolean columns = (op->mask_xx == 0);
+    const int step = op->mask_xx + op->mask_yx*n;
+    for (int yp = y0; yp < y1; yp++) {
+        // Position in the mask of the first pixel of the row
+        const int gx = op->mask_xx*(tile_x + x0) + op->mask_xy*(tile_y + yp) + op->mask_dx - e.origin_x;
+        const int gy = op->mask_yx*(tile_x + x0) + op->mask_yy*(tile_y + yp) + op->mask_dy - e.origin_y;
+        int start = x0;
+        int end = x1;
+        if (columns) {
+            if (gx >= 0 && gx < n) {
+                clip_mask_walk(gy, op->mask_yx, spans.col_y0[gx], spans.col_y1[gx], x0, &start, &end);
+            } else {
+                end = start;
+            }
+        } else {
+            if (gy >= 0 && gy < n) {
+                clip_mask_walk(gx, op->mask_xx, spans.row_x0[gy], spans.row_x1[gy], x0, &start, &end);
+            } else {
+                end = start;
+            }
+        }
+        if (start >= end) {
+            mask->x0[yp] = mask->x1[yp] = x0;
+            continue;
+        }
+
+        uint16_t *row = mask->opa + yp*mask->size;
+        const uint16_t *src = entry->mask + (gy + op->mask_yx*(start - x0))*n
+                                          + (gx + op->mask_xx*(start - x0));
+        if (step == 1) {
+            memcpy(row + start, src, (end - start)*sizeof(uint16_t));
+        } else if (step == -1) {
+            for (int xp = start; xp < end; xp++) {
+                row[xp] = src[start - xp];
+            }
+        } else {
+            for (int xp = start; xp < end; xp++) {
+                row[xp] = *src;
+                src += step;
+            }
+        }
+        dab_mask_set_span(mask, yp, start, end);
+    }
+    dab_mask_set_rows(mask, y0, y1);
+
+    dab_mask_cache_release(cache, entry);
+    return TRUE;
+}
+
+#ifdef HAVE_SURFACE_STATS
+// Counts the pixels inside and outside of the spans of @mask
+static void
+count_mask_pixels(SurfaceStats *stats, const DabMask *mask)
+{
+    uint64_t pixels = 0;
+    for (int yp = mask->y0; yp < mask->y1; yp++) {
+        pixels += mask->x1[yp] - mask->x0[yp];
+    }
+    surface_stats_add(stats, SURFACE_STAT_MASK_PIXELS, pixels);
+    surface_stats_add(stats, SURFACE_STAT_MASK_PIXELS_SKIPPED, mask->size*mask->size - pixels);
+}
+#define SURFACE_STATS_COUNT_MASK_PIXELS(stats, mask) count_mask_pixels((stats), (mask))
+#else
+#define SURFACE_STATS_COUNT_MASK_PIXELS(stats, mask)
+#endif
+
+// Blends @op into the fix15 tile @rgba_p, using the rendered @mask
+static void
+draw_dab_spans_op(const DabMask *mask, uint16_t *rgba_p, const OperationDataDrawDab *op)
+{
+    if (op->normal) {
+      if (op->color_a == 1.0) {
+        draw_dab_spans_BlendMode_Normal(mask, rgba_p,
+                                        op->color_r, op->color_g, op->color_b, op->normal*op->opaque*(1<<15));
+      } else {
+        // normal case for brushes that use smudging (eg. watercolor)
+        draw_dab_spans_BlendMode_Normal_and_Eraser(mask, rgba_p,
+                                                   op->color_r, op->color_g, op->color_b, op->color_a*(1<<15), op->normal*op->opaque*(1<<15));
+      }
+    }
+
+    if (op->lock_alpha) {
+      draw_dab_spans_BlendMode_LockAlpha(mask, rgba_p,
+                                         op->color_r, op->color_g, op->color_b, op->lock_alpha*op->opaque*(1<<15));
+    }
+    if (op->colorize) {
+      draw_dab_spans_BlendMode_Color(mask, rgba_p,
+                                     op->color_r, op->color_g, op->color_b,
+                                     op->colorize*op->opaque*(1<<15));
+    }
+}
+
+// Float version of draw_dab_spans_op()
+static void
+draw_dab_spans_float_op(const DabMask *mask, void *rgba_p, MyPaintTileFormat format,
+                        const OperationDataDrawDab *op)
+{
+    FloatDabColor color;
+    color.color[0] = srgb_to_linear(op->color_r / (float)(1<<15));
+    color.color[1] = srgb_to_linear(op->color_g / (float)(1<<15));
+    color.color[2] = srgb_to_linear(op->color_b / (float)(1<<15));
+    color.color[3] = 1.0f;
+    color.color_a = op->color_a;
+
+    if (op->normal) {
+      color.opacity = op->normal*op->opaque;
+      draw_dab_spans_float(mask, rgba_p, format,
+                           (op->color_a == 1.0) ? FLOAT_BLEND_NORMAL : FLOAT_BLEND_NORMAL_AND_ERASER,
+                           &color);
+    }
+    if (op->lock_alpha) {
+      color.opacity = op->lock_alpha*op->opaque;
+      draw_dab_spans_float(mask, rgba_p, format, FLOAT_BLEND_LOCK_ALPHA, &color);
+    }
+    if (op->colorize) {
+      color.opacity = op->colorize*op->opaque;
+      draw_dab_spans_float(mask, rgba_p, format, FLOAT_BLEND_COLOR, &color);
+    }
+}
+
+// Must be threadsafe
+void
+process_op(void *rgba_p, MyPaintTileFormat format, DabMask *mask,
+           int tx, int ty, OperationDataDrawDab *op,
+           DabMaskCache *cache, DabMaskCache *exact_cache, SurfaceStats *stats)
+{
+    SURFACE_STATS_TIMER_START(op_start);
+
+    // first, we calculate the mask (opacity for each pixel)
+    SURFACE_STATS_TIMER_START(mask_start);
+    gboolean rendered = FALSE;
+    if (cache) {
+        rendered = render_dab_mask_cached(cache, mask, tx, ty, op);
+    } else if (op->mask_xx || op->mask_xy) {
+        rendered = render_dab_mask_shared(exact_cache, mask, tx*mask->size, ty*mask->size, op);
+    }
+    if (!rendered) {
+        render_dab_mask_spans(mask,
+                              op->x - tx*mask->size,
+                              op->y - ty*mask->size,
+                              op->radius,
+                              op->hardness,
+                              op->aspect_ratio, op->angle
+                              );
+    }
+    SURFACE_STATS_TIMER_END(stats, SURFACE_STAT_RENDER_DAB_MASK_NS, mask_start);
+    SURFACE_STATS_COUNT_MASK_PIXELS(stats, mask);
+
+    // second, we use the mask to stamp a dab for each activated blend mode
+
+    if (format == MYPAINT_TILE_FORMAT_RGBA16) {
+      draw_dab_spans_op(mask, rgba_p, op);
+    } else {
+      draw_dab_spans_float_op(mask, rgba_p, format, op);
+    }
+
+    SURFACE_STATS_ADD(stats, SURFACE_STAT_OPS_PROCESSED, 1);
+    SURFACE_STATS_TIMER_END(stats, SURFACE_STAT_PROCESS_OP_NS, op_start);
+}
+
+// Process the operations queued in @queue for tile (tx, ty) of @mipmap_level
+// Must be threadsafe
+static void
+process_tile_from_queue(MyPaintTiledSurface *self, OperationQueue *queue,
+                        int mipmap_level, int tx, int ty)
+{
+    TileIndex tile_index = {tx, ty};
+
+    OperationQueueCulled culled;
+    operation_queue_cull(queue, tile_index, self->tile_size, &culled);
+    SURFACE_STATS_ADD(self->stats, SURFACE_STAT_OPS_CULLED_OUTSIDE, culled.outside);
+    SURFACE_STATS_ADD(self->stats, SURFACE_STAT_OPS_CULLED_OVERDRAWN, culled.overdrawn);
+    SURFACE_STATS_ADD(self->stats, SURFACE_STAT_OPS_MERGED, culled.merged);
+
+    OperationDataDrawDab *op = operation_queue_pop(queue, tile_index);
     if (!op) {
         return;
     }
 
     MyPaintTileRequest request_data;
-    const int mipmap_level = 0;
     mypaint_tile_request_init(&request_data, mipmap_level, tx, ty, FALSE);
 
     mypaint_tiled_surface_tile_request_start(self, &request_data);
-    uint16_t * rgba_p = request_data.buffer;
+    void * rgba_p = request_data.buffer;
     if (!rgba_p) {
         printf("Warning: Unable to get tile!\n");
         return;
     }
 
-    uint16_t mask[MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE+2*MYPAINT_TILE_SIZE];
+    DabMask *mask = dab_mask_pool_acquire(self->dab_mask_pool);
+    if (!mask) {
+        printf("Warning: Unable to allocate the dab mask, skipping the dabs of the tile!\n");
+        while (operation_queue_pop(queue, tile_index)) {
+        }
+        mypaint_tiled_surface_tile_request_end(self, &request_data);
+        return;
+    }
+    DabMaskCache *cache = (dab_mask_cache_get_max_bytes(self->dab_mask_cache) > 0) ? self->dab_mask_cache : NULL;
 
     while (op) {
-        process_op(rgba_p, mask, tile_index.x, tile_index.y, op);
-        free(op);
-        op = operation_queue_pop(self->operation_queue, tile_index);
+        process_op(rgba_p, self->tile_format, mask, tile_index.x, tile_index.y, op,
+                   cache, self->exact_mask_cache, self->stats);
+        op = operation_queue_pop(queue, tile_index);
     }
 
+    dab_mask_pool_release(self->dab_mask_pool, mask);
+
     mypaint_tiled_surface_tile_request_end(self, &request_data);
 }
 
-// OPTIMIZE: send a list of the exact changed rects instead of a bounding box
-// to minimize the area being composited? Profile to see the effect first.
+// Must be threadsafe
 void
-update_dirty_bbox(MyPaintTiledSurface *self, OperationDataDrawDab *op)
+process_tile(MyPaintTiledSurface *self, int tx, int ty)
 {
-    int bb_x, bb_y, bb_w, bb_h;
-    float r_fringe = op->radius + 1.0f; // +1.0 should not be required, only to be sure
-    bb_x = floor (op->x - r_fringe);
-    bb_y = floor (op->y - r_fringe);
-    bb_w = floor (op->x + r_fringe) - bb_x + 1;
-    bb_h = floor (op->y + r_fringe) - bb_y + 1;
+    process_tile_from_queue(self, self->operation_queue, 0, tx, ty);
+}
 
-    mypaint_rectangle_expand_to_include_point(&self->dirty_bbox, bb_x, bb_y);
-    mypaint_rectangle_expand_to_include_point(&self->dirty_bbox, bb_x+bb_w-1, bb_y+bb_h-1);
+void
+update_dirty_bbox(MyPaintRectangle *bbox, const MyPaintRectangle *rect)
+{
+    mypaint_rectangle_expand_to_include_point(bbox, rect->x, rect->y);
+    mypaint_rectangle_expand_to_include_point(bbox, rect->x+rect->width-1, rect->y+rect->height-1);
 }
 
-// returns TRUE if the surface was modified
-gboolean draw_dab_internal (MyPaintTiledSurface *self, float x, float y,
+// Fills in @op for a dab, clamping its parameters.
+// Returns FALSE if the dab would not change any pixel.
+gboolean prepare_dab_op (OperationDataDrawDab *op, float x, float y,
                float radius,
                float color_r, float color_g, float color_b,
                float opaque, float hardness,
@@ -520,11 +2044,7 @@ gboolean draw_dab_internal (MyPaintTiledSurface *self, float x, float y,
                float lock_alpha,
                float colorize
                )
-
 {
-    OperationDataDrawDab op_struct;
-    OperationDataDrawDab *op = &op_struct;
-
     op->x = x;
     op->y = y;
     op->radius = radius;
@@ -556,26 +2076,115 @@ gboolean draw_dab_internal (MyPaintTiledSurface *self, float x, float y,
 
     if (op->aspect_ratio<1.0f) op->aspect_ratio=1.0f;
 
-    // Determine the tiles influenced by operation, and queue it for processing for each tile
-    float r_fringe = radius + 1.0f; // +1.0 should not be required, only to be sure
-      
-    int tx1 = floor(floor(x - r_fringe) / MYPAINT_TILE_SIZE);
-    int tx2 = floor(floor(x + r_fringe) / MYPAINT_TILE_SIZE);
-    int ty1 = floor(floor(y - r_fringe) / MYPAINT_TILE_SIZE);
-    int ty2 = floor(floor(y + r_fringe) / MYPAINT_TILE_SIZE);
+    // Own mask, see queue_dab_with_copies()
+    op->mask_x = op->mask_y = op->mask_angle = 0.0f;
+    op->mask_dx = op->mask_dy = 0;
+    op->mask_xx = op->mask_xy = op->mask_yx = op->mask_yy = 0;
+
+    return TRUE;
+}
+
+// Adds @op to @queue for each tile influenced by it
+// Returns the number of tiles
+static int
+queue_dab_op_into(MyPaintTiledSurface *self, OperationQueue *queue, const OperationDataDrawDab *op)
+{
+    float r_fringe = op->radius + 1.0f; // +1.0 should not be required, only to be sure
+
+    int tx1 = floor(floor(op->x - r_fringe) / self->tile_size);
+    int tx2 = floor(floor(op->x + r_fringe) / self->tile_size);
+    int ty1 = floor(floor(op->y - r_fringe) / self->tile_size);
+    int ty2 = floor(floor(op->y + r_fringe) / self->tile_size);
 
     for (int ty = ty1; ty <= ty2; ty++) {
         for (int tx = tx1; tx <= tx2; tx++) {
             const TileIndex tile_index = {tx, ty};
-            OperationDataDrawDab *op_copy = (OperationDataDrawDab *)malloc(sizeof(OperationDataDrawDab));
-            *op_copy = *op;
-            operation_queue_add(self->operation_queue, tile_index, op_copy);
+            operation_queue_add(queue, tile_index, op);
         }
     }
+    return (tx2 - tx1 + 1)*(ty2 - ty1 + 1);
+}
 
-    update_dirty_bbox(self, op);
+// Same dab as @op, in the pixels of @mipmap_level
+static void
+scale_dab_op(OperationDataDrawDab *op, int mipmap_level)
+{
+    const float scale = 1.0f / (1 << mipmap_level);
+    op->x *= scale;
+    op->y *= scale;
+    op->radius *= scale;
+    op->mask_xx = op->mask_xy = op->mask_yx = op->mask_yy = 0; // the pixels of the copies do not map
+    if (op->radius < MIPMAP_MIN_RADIUS) {
+        const float coverage = op->radius / MIPMAP_MIN_RADIUS;
+        op->opaque *= coverage*coverage;
+        op->radius = MIPMAP_MIN_RADIUS;
+    }
+}
 
-    return TRUE;
+// Queues @op for processing for each tile influenced by it
+void queue_dab_op (MyPaintTiledSurface *self, const OperationDataDrawDab *op)
+{
+    const int tiles_n = queue_dab_op_into(self, self->operation_queue, op);
+    const MyPaintRectangle rect = dab_op_rect(op);
+    // The copy of the mipmap level is not counted, it is the same dab
+    SURFACE_STATS_ADD(self->stats, SURFACE_STAT_DABS_ENQUEUED, tiles_n);
+
+    if (self->mipmap_painting_level > 0) {
+        OperationDataDrawDab scaled = *op;
+        scale_dab_op(&scaled, self->mipmap_painting_level);
+        queue_dab_op_into(self, self->mipmap_operation_queue, &scaled);
+
+        self->deferred_operations += tiles_n;
+        update_dirty_bbox(&self->deferred_bbox, &rect);
+    }
+
+    update_dirty_bbox(&self->dirty_bbox, &rect);
+    dirty_rects_add(self->dirty_rects, &rect);
+}
+
+// Queues the dab and its symmetric copies, one after the other.
+// Returns TRUE if the surface was modified.
+static gboolean
+queue_dab_with_copies(MyPaintTiledSurface *self, float x, float y,
+                      float radius,
+                      float color_r, float color_g, float color_b,
+                      float opaque, float hardness,
+                      float color_a,
+                      float aspect_ratio, float angle,
+                      float lock_alpha,
+                      float colorize)
+{
+  OperationDataDrawDab op;
+  gboolean surface_modified = FALSE;
+  const int copies = self->symmetry ? symmetry_get_copies(self->symmetry) : 1;
+
+  for (int c = 0; c < copies; c++) {
+      float copy_x = x, copy_y = y, copy_angle = angle;
+      if (c > 0) {
+          symmetry_apply(self->symmetry, c, x, y, angle, &copy_x, &copy_y, &copy_angle);
+      }
+      if (prepare_dab_op(&op, copy_x, copy_y, radius, color_r, color_g, color_b,
+                         opaque, hardness, color_a, aspect_ratio, copy_angle,
+                         lock_alpha, colorize)) {
+          SymmetryMaskMap map;
+          if (self->symmetry && symmetry_get_mask_map(self->symmetry, c, &map)) {
+              // The copies are made of the mask of the first dab
+              op.mask_x = x;
+              op.mask_y = y;
+              op.mask_angle = angle;
+              op.mask_dx = map.dx;
+              op.mask_dy = map.dy;
+              op.mask_xx = map.xx;
+              op.mask_xy = map.xy;
+              op.mask_yx = map.yx;
+              op.mask_yy = map.yy;
+          }
+          queue_dab_op(self, &op);
+          surface_modified = TRUE;
+      }
+  }
+
+  return surface_modified;
 }
 
 // returns TRUE if the surface was modified
@@ -590,37 +2199,39 @@ int draw_dab (MyPaintSurface *surface, float x, float y,
 {
   MyPaintTiledSurface *self = (MyPaintTiledSurface *)surface;
 
-  gboolean surface_modified = FALSE;
-
-  // Normal pass
-  if (draw_dab_internal(self, x, y, radius, color_r, color_g, color_b,
-                        opaque, hardness, color_a, aspect_ratio, angle,
-                        lock_alpha, colorize)) {
-      surface_modified = TRUE;
-  }
-
-  // Symmetry pass
-  if(self->surface_do_symmetry) {
-    const float symm_x = self->surface_center_x + (self->surface_center_x - x);
+  return queue_dab_with_copies(self, x, y, radius, color_r, color_g, color_b,
+                               opaque, hardness, color_a, aspect_ratio, angle,
+                               lock_alpha, colorize);
+}
 
-    if (draw_dab_internal(self, symm_x, y, radius, color_r, color_g, color_b,
-                           opaque, hardness, color_a, aspect_ratio, -angle,
-                           lock_alpha, colorize)) {
-        surface_modified = TRUE;
+// Returns the number of dabs which modified the surface.
+// Like draw_dab() for each dab, but without the call overhead per dab.
+int draw_dabs (MyPaintSurface *surface, const MyPaintDabs *dabs)
+{
+    MyPaintTiledSurface *self = (MyPaintTiledSurface *)surface;
+    int painted = 0;
+
+    for (int i = 0; i < dabs->count; i++) {
+        // The copies right after the dab, so that the order per tile is as with draw_dab()
+        if (queue_dab_with_copies(self, dabs->x[i], dabs->y[i], dabs->radius[i],
+                                  dabs->color_r[i], dabs->color_g[i], dabs->color_b[i],
+                                  dabs->opaque[i], dabs->hardness[i], dabs->alpha_eraser[i],
+                                  dabs->aspect_ratio[i], dabs->angle[i],
+                                  dabs->lock_alpha[i], dabs->colorize[i])) {
+            painted++;
+        }
     }
 
-  }
-
-  return surface_modified;
+    return painted;
 }
 
-
 void get_color (MyPaintSurface *surface, float x, float y,
                   float radius,
                   float * color_r, float * color_g, float * color_b, float * color_a
                   )
 {
     MyPaintTiledSurface *self = (MyPaintTiledSurface *)surface;
+    SURFACE_STATS_TIMER_START(get_color_start);
 
     if (radius < 1.0f) radius = 1.0f;
     const float hardness = 0.5f;
@@ -639,53 +2250,146 @@ void get_color (MyPaintSurface *surface, float x, float y,
 
     float r_fringe = radius + 1.0f; // +1 should not be required, only to be sure
 
-    int tx1 = floor(floor(x - r_fringe) / MYPAINT_TILE_SIZE);
-    int tx2 = floor(floor(x + r_fringe) / MYPAINT_TILE_SIZE);
-    int ty1 = floor(floor(y - r_fringe) / MYPAINT_TILE_SIZE);
-    int ty2 = floor(floor(y + r_fringe) / MYPAINT_TILE_SIZE);
-    int tiles_n = (tx2 - tx1) * (ty2 - ty1);
+    int tx1 = floor(floor(x - r_fringe) / self->tile_size);
+    int tx2 = floor(floor(x + r_fringe) / self->tile_size);
+    int ty1 = floor(floor(y - r_fringe) / self->tile_size);
+    int ty2 = floor(floor(y + r_fringe) / self->tile_size);
+    const int tiles_w = tx2 - tx1 + 1;
+    const int tiles_n = tiles_w * (ty2 - ty1 + 1);
 
-    #pragma omp parallel for schedule(static) if(self->threadsafe_tile_requests && tiles_n > 3)
-    for (int ty = ty1; ty <= ty2; ty++) {
-      for (int tx = tx1; tx <= tx2; tx++) {
+    if (!self->threadsafe_tile_requests) {
+        // Tile requests must not overlap with the ones of the background thread
+        tile_worker_wait_all(self->tile_worker);
+    }
+
+    // The sampling dab, drawn through the dab mask cache if it is enabled
+    OperationDataDrawDab op;
+    op.x = x;
+    op.y = y;
+    op.radius = radius;
+    op.hardness = hardness;
+    op.aspect_ratio = aspect_ratio;
+    op.angle = angle;
+    DabMaskCache *cache = (dab_mask_cache_get_max_bytes(self->dab_mask_cache) > 0) ? self->dab_mask_cache : NULL;
+
+    // Otherwise, the sampling mask only depends on the radius and the subpixel
+    // position, and is reused from the exact mask cache where it is identical
+    ExactDab sample;
+    exact_dab_init(&sample, x, y, radius, hardness, aspect_ratio, angle);
+
+    // Sums per tile, added up in tile order below so that the
+    // result does not depend on the number of threads.
+    // The integer sums of fix15 tiles are exact as doubles.
+    double tile_sums_stack[GET_COLOR_STACK_TILES][5];
+    double (*tile_sums)[5] = (tiles_n <= GET_COLOR_STACK_TILES) ? tile_sums_stack
+                                                               : malloc(tiles_n*sizeof(tile_sums[0]));
+    if (!tile_sums) {
+      printf("Warning: Unable to allocate the color sums!\n");
+      *color_a = 0.0f;
+      return;
+    }
+
+    // Level 0 operations deferred by mipmap painting, flushed below
+    int flushed = 0;
+
+    #pragma omp parallel if(self->threadsafe_tile_requests && tiles_n > 3)
+    {
+      DabMask *mask = dab_mask_pool_acquire(self->dab_mask_pool);
+      if (!mask) {
+        printf("Warning: Unable to allocate the dab mask, not sampling some tiles!\n");
+      }
+
+      #pragma omp for schedule(static) reduction(+:flushed)
+      for (int i = 0; i < tiles_n; i++) {
+        const int tx = tx1 + i % tiles_w;
+        const int ty = ty1 + i / tiles_w;
+        double *sums = tile_sums[i];
+        sums[0] = sums[1] = sums[2] = sums[3] = sums[4] = 0.0;
+
+        // Operations from before end_atomic_async come first
+        mypaint_tiled_surface_wait_for_tile(self, tx, ty);
 
         // Flush queued draw_dab operations
+        if (self->mipmap_painting_level > 0) {
+          const TileIndex index = {tx, ty};
+          flushed += operation_queue_get_operation_count(self->operation_queue, index);
+        }
         process_tile(self, tx, ty);
 
+        if (!mask) {
+          continue;
+        }
+
         MyPaintTileRequest request_data;
         const int mipmap_level = 0;
         mypaint_tile_request_init(&request_data, mipmap_level, tx, ty, TRUE);
 
         mypaint_tiled_surface_tile_request_start(self, &request_data);
-        uint16_t * rgba_p = request_data.buffer;
+        void * rgba_p = request_data.buffer;
         if (!rgba_p) {
           printf("Warning: Unable to get tile!\n");
-          break;
+          continue;
         }
 
         // first, we calculate the mask (opacity for each pixel)
-        uint16_t mask[MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE+2*MYPAINT_TILE_SIZE];
-
-        render_dab_mask(mask,
-                        x - tx*MYPAINT_TILE_SIZE,
-                        y - ty*MYPAINT_TILE_SIZE,
-                        radius,
-                        hardness,
-                        aspect_ratio, angle
-                        );
-
-        // TODO: try atomic operations instead
-        #pragma omp critical
-        {
-        get_color_pixels_accumulate (mask, rgba_p,
-                                     &sum_weight, &sum_r, &sum_g, &sum_b, &sum_a);
+        const int tile_x = tx*self->tile_size;
+        const int tile_y = ty*self->tile_size;
+        gboolean rendered = FALSE;
+        if (cache) {
+          rendered = render_dab_mask_cached(cache, mask, tx, ty, &op);
+        } else if (exact_dab_matches_tile(&sample, x, y, tile_x, tile_y)) {
+          rendered = render_dab_mask_exact(self->exact_mask_cache, mask, tile_x, tile_y, &sample);
+        }
+        if (!rendered) {
+          render_dab_mask_spans(mask,
+                                x - tile_x,
+                                y - tile_y,
+                                radius,
+                                hardness,
+                                aspect_ratio, angle
+                                );
+        }
+
+        if (self->tile_format == MYPAINT_TILE_FORMAT_RGBA16) {
+          uint32_t int_sums[5] = {0, 0, 0, 0, 0};
+          get_color_spans_accumulate(mask, rgba_p, int_sums);
+          for (int j = 0; j < 5; j++) {
+            sums[j] = int_sums[j];
+          }
+        } else {
+          get_color_spans_accumulate_float(mask, rgba_p, self->tile_format, sums);
         }
 
         mypaint_tiled_surface_tile_request_end(self, &request_data);
       }
+
+      dab_mask_pool_release(self->dab_mask_pool, mask);
     }
 
-    assert(sum_weight > 0.0f);
+    if (flushed > 0) {
+      self->deferred_operations -= flushed;
+      if (self->deferred_operations <= 0) {
+        clear_deferred(self);
+      }
+    }
+
+    // convert integer to float outside the performance critical loop
+    for (int i = 0; i < tiles_n; i++) {
+      sum_weight += (float)tile_sums[i][0];
+      sum_r += (float)tile_sums[i][1];
+      sum_g += (float)tile_sums[i][2];
+      sum_b += (float)tile_sums[i][3];
+      sum_a += (float)tile_sums[i][4];
+    }
+    if (tile_sums != tile_sums_stack) {
+      free(tile_sums);
+    }
+
+    if (sum_weight == 0.0f) {
+      // None of the tiles could be sampled
+      *color_a = 0.0f;
+      return;
+    }
     sum_a /= sum_weight;
     sum_r /= sum_weight;
     sum_g /= sum_weight;
@@ -697,6 +2401,11 @@ void get_color (MyPaintSurface *surface, float x, float y,
       *color_r = sum_r / sum_a;
       *color_g = sum_g / sum_a;
       *color_b = sum_b / sum_a;
+      if (self->tile_format != MYPAINT_TILE_FORMAT_RGBA16) {
+        *color_r = linear_to_srgb(*color_r);
+        *color_g = linear_to_srgb(*color_g);
+        *color_b = linear_to_srgb(*color_b);
+      }
     } else {
       // it is all transparent, so don't care about the colors
       // (let's make them ugly so bugs will be visible)
@@ -710,12 +2419,15 @@ void get_color (MyPaintSurface *surface, float x, float y,
     *color_g = CLAMP(*color_g, 0.0f, 1.0f);
     *color_b = CLAMP(*color_b, 0.0f, 1.0f);
     *color_a = CLAMP(*color_a, 0.0f, 1.0f);
+
+    SURFACE_STATS_TIMER_END(self->stats, SURFACE_STAT_GET_COLOR_NS, get_color_start);
 }
 
 /**
  * mypaint_tiled_surface_init: (skip)
  *
  * Initialize the surface, passing in implementations of the tile backend.
+ * Uses tiles of MYPAINT_TILE_SIZE, see mypaint_tiled_surface_init_with_tile_size()
  * Note: Only intended to be called from subclasses of #MyPaintTiledSurface
  **/
 void
@@ -723,8 +2435,79 @@ mypaint_tiled_surface_init(MyPaintTiledSurface *self,
                            MyPaintTileRequestStartFunction tile_request_start,
                            MyPaintTileRequestEndFunction tile_request_end)
 {
+    mypaint_tiled_surface_init_with_tile_size(self, tile_request_start, tile_request_end,
+                                              MYPAINT_TILE_SIZE);
+}
+
+/**
+ * mypaint_tiled_surface_tile_size_is_supported:
+ *
+ * Returns: TRUE if @tile_size can be used with mypaint_tiled_surface_init_with_tile_size(),
+ * that is a power of two from MYPAINT_MIN_TILE_SIZE to MYPAINT_MAX_TILE_SIZE.
+ */
+gboolean
+mypaint_tiled_surface_tile_size_is_supported(int tile_size)
+{
+    return tile_size >= MYPAINT_MIN_TILE_SIZE && tile_size <= MYPAINT_MAX_TILE_SIZE
+        && (tile_size & (tile_size - 1)) == 0;
+}
+
+/**
+ * mypaint_tiled_surface_set_tile_format: (skip)
+ *
+ * Select the pixel format of the tiles, see #MyPaintTileFormat.
+ * The backend must hand out tiles of this format, of
+ * mypaint_tile_format_get_tile_bytes() each.
+ * Only to be called right after initializing the surface, before any dabs are drawn.
+ * Note: Only intended to be called from subclasses of #MyPaintTiledSurface
+ */
+void
+mypaint_tiled_surface_set_tile_format(MyPaintTiledSurface *self, MyPaintTileFormat format)
+{
+    assert(format >= MYPAINT_TILE_FORMAT_RGBA16 && format <= MYPAINT_TILE_FORMAT_RGBA_FLOAT16);
+    self->tile_format = format;
+}
+
+MyPaintTileFormat
+mypaint_tiled_surface_get_tile_format(MyPaintTiledSurface *self)
+{
+    return self->tile_format;
+}
+
+/**
+ * mypaint_tile_format_get_tile_bytes:
+ *
+ * Returns: The size of a tile of @tile_size x @tile_size pixels of @format, in bytes.
+ */
+size_t
+mypaint_tile_format_get_tile_bytes(MyPaintTileFormat format, int tile_size)
+{
+    return tile_size*tile_size*tile_format_get_pixel_bytes(format);
+}
+
+/**
+ * mypaint_tiled_surface_init_with_tile_size: (skip)
+ *
+ * @tile_size: Width and height of the tiles in pixels,
+ * see mypaint_tiled_surface_tile_size_is_supported()
+ *
+ * Initialize the surface, passing in implementations of the tile backend.
+ * The tile buffers handed out by the backend must be @tile_size x @tile_size pixels.
+ * Smaller tiles are processed in parallel more often,
+ * bigger ones have less per-tile overhead.
+ * Note: Only intended to be called from subclasses of #MyPaintTiledSurface
+ **/
+void
+mypaint_tiled_surface_init_with_tile_size(MyPaintTiledSurface *self,
+                                          MyPaintTileRequestStartFunction tile_request_start,
+                                          MyPaintTileRequestEndFunction tile_request_end,
+                                          int tile_size)
+{
+    assert(mypaint_tiled_surface_tile_size_is_supported(tile_size));
+
     mypaint_surface_init(&self->parent);
     self->parent.draw_dab = draw_dab;
+    self->parent.draw_dabs = draw_dabs;
     self->parent.get_color = get_color;
     self->parent.begin_atomic = begin_atomic_default;
     self->parent.end_atomic = end_atomic_default;
@@ -732,16 +2515,34 @@ mypaint_tiled_surface_init(MyPaintTiledSurface *self,
     self->tile_request_end = tile_request_end;
     self->tile_request_start = tile_request_start;
 
-    self->tile_size = MYPAINT_TILE_SIZE;
+    self->tile_size = tile_size;
+    self->tile_format = MYPAINT_TILE_FORMAT_RGBA16;
     self->threadsafe_tile_requests = FALSE;
 
     self->dirty_bbox.x = 0;
     self->dirty_bbox.y = 0;
     self->dirty_bbox.width = 0;
     self->dirty_bbox.height = 0;
+    self->dirty_rects = dirty_rects_new(DIRTY_RECTS_MAX);
     self->surface_do_symmetry = FALSE;
     self->surface_center_x = 0.0f;
+    self->symmetry = NULL;
     self->operation_queue = operation_queue_new();
+    self->async_operation_queue = operation_queue_new();
+    self->dab_mask_cache = dab_mask_cache_new(0);
+    self->dab_mask_pool = dab_mask_pool_new(tile_size);
+    self->exact_mask_cache = dab_mask_cache_new(EXACT_MASK_CACHE_BYTES);
+    self->tile_scheduler = tile_scheduler_new();
+    self->tile_worker = tile_worker_new();
+    self->mipmap_painting_level = 0;
+    self->mipmap_operation_queue = operation_queue_new();
+    self->async_mipmap_level = 0;
+    clear_deferred(self);
+#ifdef HAVE_SURFACE_STATS
+    self->stats = surface_stats_new();
+#else
+    self->stats = NULL;
+#endif
 }
 
 /**
@@ -754,5 +2555,19 @@ mypaint_tiled_surface_init(MyPaintTiledSurface *self,
 void
 mypaint_tiled_surface_destroy(MyPaintTiledSurface *self)
 {
+    tile_worker_free(self->tile_worker);
     operation_queue_free(self->operation_queue);
+    operation_queue_free(self->async_operation_queue);
+    operation_queue_free(self->mipmap_operation_queue);
+    dab_mask_cache_free(self->dab_mask_cache);
+    dab_mask_pool_free(self->dab_mask_pool);
+    dab_mask_cache_free(self->exact_mask_cache);
+    tile_scheduler_free(self->tile_scheduler);
+    dirty_rects_free(self->dirty_rects);
+    if (self->symmetry) {
+        symmetry_free(self->symmetry);
+    }
+#ifdef HAVE_SURFACE_STATS
+    surface_stats_free(self->stats);
+#endif
 }
@@ -2,6 +2,7 @@
 #define MYPAINTTILEDSURFACE_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <mypaint-surface.h>
 #include <mypaint-config.h>
 
@@ -10,11 +11,51 @@ G_BEGIN_DECLS
 struct _MyPaintTiledSurface;
 typedef struct _MyPaintTiledSurface MyPaintTiledSurface;
 
+/**
+  * MyPaintTileFormat:
+  * @MYPAINT_TILE_FORMAT_RGBA16: 15 bit fixed point in #guint16, 1<<15 is 1.0.
+  *   The default.
+  * @MYPAINT_TILE_FORMAT_RGBA_FLOAT32: 32 bit floats in linear light, 1.0 is 1.0.
+  *   The buffer of a tile request points to floats then.
+  * @MYPAINT_TILE_FORMAT_RGBA_FLOAT16: IEEE half floats in #guint16, in linear light.
+  *
+  * Pixel format of the tiles, see mypaint_tiled_surface_set_tile_format().
+  * The pixels are always RGBA with premultiplied alpha.
+  * The dab colors are converted from sRGB to linear light for the float
+  * formats, and sampled colors back to sRGB.
+  */
+typedef enum {
+    MYPAINT_TILE_FORMAT_RGBA16,
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT32,
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT16
+} MyPaintTileFormat;
+
+/**
+  * MyPaintSymmetryType:
+  * @MYPAINT_SYMMETRY_TYPE_NONE: No symmetry.
+  * @MYPAINT_SYMMETRY_TYPE_VERTICAL: Mirrored across the vertical axis through the center.
+  * @MYPAINT_SYMMETRY_TYPE_HORIZONTAL: Mirrored across the horizontal axis through the center.
+  * @MYPAINT_SYMMETRY_TYPE_VERTHORZ: Mirrored across both axes, four copies.
+  * @MYPAINT_SYMMETRY_TYPE_ROTATIONAL: Rotated around the center, one copy per line.
+  * @MYPAINT_SYMMETRY_TYPE_SNOWFLAKE: Rotated around the center, and each rotated
+  *   copy also mirrored, two copies per line.
+  *
+  * Copies of each dab, see mypaint_tiled_surface_set_symmetry().
+  */
+typedef enum {
+    MYPAINT_SYMMETRY_TYPE_NONE,
+    MYPAINT_SYMMETRY_TYPE_VERTICAL,
+    MYPAINT_SYMMETRY_TYPE_HORIZONTAL,
+    MYPAINT_SYMMETRY_TYPE_VERTHORZ,
+    MYPAINT_SYMMETRY_TYPE_ROTATIONAL,
+    MYPAINT_SYMMETRY_TYPE_SNOWFLAKE
+} MyPaintSymmetryType;
+
 typedef struct {
     int tx;
     int ty;
     gboolean readonly;
-    guint16 *buffer;
+    guint16 *buffer; /* see MyPaintTileFormat */
     gpointer context; /* Only to be used by the surface implemenations. */
     int thread_id;
     int mipmap_level;
@@ -28,6 +69,59 @@ typedef void (*MyPaintTileRequestStartFunction) (struct _MyPaintTiledSurface *se
 typedef void (*MyPaintTileRequestEndFunction) (struct _MyPaintTiledSurface *self, MyPaintTileRequest *request);
 typedef void (*MyPaintTiledSurfaceAreaChanged) (struct _MyPaintTiledSurface *self, int bb_x, int bb_y, int bb_w, int bb_h);
 
+/**
+  * MyPaintTileScheduler:
+  * @MYPAINT_TILE_SCHEDULER_STATIC: Split the dirty tiles evenly between the threads.
+  * @MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST: Process the tiles with the most queued
+  *   dabs first, handing out tiles to threads as they become idle.
+  *
+  * How the processing of dirty tiles is distributed over the threads
+  * in mypaint_tiled_surface_end_atomic().
+  */
+typedef enum {
+    MYPAINT_TILE_SCHEDULER_STATIC,
+    MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST
+} MyPaintTileScheduler;
+
+/**
+  * MyPaintTiledSurfaceStats:
+  * @dabs_enqueued: Dab operations queued for a tile, one per tile a dab touches.
+  * @ops_processed: Dab operations blended into a tile.
+  * @mask_pixels: Pixels covered by the spans of the masks of the processed operations.
+  * @mask_pixels_skipped: Pixels of the tiles outside of those spans,
+  *   which were not touched. Relative to @mask_pixels this is the share of
+  *   the work saved by only processing the spans.
+  * @tile_requests: Calls to mypaint_tiled_surface_tile_request_start().
+  * @render_dab_mask_ns: Time spent rendering the masks of the processed
+  *   operations, in nanoseconds.
+  * @process_op_ns: Time spent processing dab operations, including
+  *   @render_dab_mask_ns, in nanoseconds.
+  * @get_color_ns: Time spent in #MyPaintSurface::get_color, in nanoseconds,
+  *   including the processing of the operations queued for the sampled tiles.
+  * @ops_culled_outside: Dab operations dropped before processing, because
+  *   the dab does not reach into the tile.
+  * @ops_culled_overdrawn: Dab operations dropped before processing, because
+  *   a later opaque dab sets all of their pixels.
+  * @ops_merged: Dab operations dropped before processing, because they are
+  *   the same as the next one, and an opaque dab makes no difference twice.
+  *
+  * Counters of the hot paths, see mypaint_tiled_surface_get_stats().
+  * The times are summed up over all threads.
+  */
+typedef struct {
+    uint64_t dabs_enqueued;
+    uint64_t ops_processed;
+    uint64_t mask_pixels;
+    uint64_t mask_pixels_skipped;
+    uint64_t tile_requests;
+    uint64_t render_dab_mask_ns;
+    uint64_t process_op_ns;
+    uint64_t get_color_ns;
+    uint64_t ops_culled_outside;
+    uint64_t ops_culled_overdrawn;
+    uint64_t ops_merged;
+} MyPaintTiledSurfaceStats;
+
 /**
   * MyPaintTiledSurface:
   *
@@ -45,7 +139,22 @@ struct _MyPaintTiledSurface {
     struct _OperationQueue *operation_queue;
     MyPaintRectangle dirty_bbox;
     gboolean threadsafe_tile_requests;
-    int tile_size;
+    int tile_size; /* width and height of the tiles, in pixels */
+    MyPaintTileFormat tile_format;
+    struct _DabMaskCache *dab_mask_cache;
+    struct _TileScheduler *tile_scheduler;
+    struct _OperationQueue *async_operation_queue; /* being processed by tile_worker */
+    struct _TileWorker *tile_worker;
+    struct _SurfaceStats *stats; /* NULL unless built with HAVE_SURFACE_STATS */
+    int mipmap_painting_level; /* 0, or the level that dabs are rendered into */
+    struct _OperationQueue *mipmap_operation_queue;
+    int async_mipmap_level; /* of the tiles in async_operation_queue */
+    MyPaintRectangle deferred_bbox; /* of the pending level 0 operations */
+    int deferred_operations;
+    struct _DirtyRects *dirty_rects; /* the area of dirty_bbox, in more detail */
+    struct _Symmetry *symmetry; /* NULL without symmetry */
+    struct _DabMaskPool *dab_mask_pool;
+    struct _DabMaskCache *exact_mask_cache; /* masks reused without quantization */
 };
 
 void
@@ -53,19 +162,68 @@ mypaint_tiled_surface_init(MyPaintTiledSurface *self,
                            MyPaintTileRequestStartFunction tile_request_start,
                            MyPaintTileRequestEndFunction tile_request_end);
 
+void
+mypaint_tiled_surface_init_with_tile_size(MyPaintTiledSurface *self,
+                                          MyPaintTileRequestStartFunction tile_request_start,
+                                          MyPaintTileRequestEndFunction tile_request_end,
+                                          int tile_size);
+
+gboolean
+mypaint_tiled_surface_tile_size_is_supported(int tile_size);
+
+void
+mypaint_tiled_surface_set_tile_format(MyPaintTiledSurface *self, MyPaintTileFormat format);
+MyPaintTileFormat
+mypaint_tiled_surface_get_tile_format(MyPaintTiledSurface *self);
+size_t
+mypaint_tile_format_get_tile_bytes(MyPaintTileFormat format, int tile_size);
+
 void
 mypaint_tiled_surface_destroy(MyPaintTiledSurface *self);
 
 void
 mypaint_tiled_surface_set_symmetry_state(MyPaintTiledSurface *self, gboolean active, float center_x);
+void
+mypaint_tiled_surface_set_symmetry(MyPaintTiledSurface *self, MyPaintSymmetryType type,
+                                   float center_x, float center_y, int lines);
 float
 mypaint_tiled_surface_get_alpha (MyPaintTiledSurface *self, float x, float y, float radius);
 
 void mypaint_tiled_surface_tile_request_start(MyPaintTiledSurface *self, MyPaintTileRequest *request);
 void mypaint_tiled_surface_tile_request_end(MyPaintTiledSurface *self, MyPaintTileRequest *request);
 
+void
+mypaint_tiled_surface_set_dab_mask_cache_size(MyPaintTiledSurface *self, size_t max_bytes);
+void
+mypaint_tiled_surface_get_dab_mask_cache_stats(MyPaintTiledSurface *self, int *hits, int *misses);
+
+void
+mypaint_tiled_surface_set_tile_scheduler(MyPaintTiledSurface *self, MyPaintTileScheduler scheduler);
+void
+mypaint_tiled_surface_set_threads(MyPaintTiledSurface *self, int threads);
+int
+mypaint_tiled_surface_get_thread_busy_times(MyPaintTiledSurface *self, double *busy_times);
+void
+mypaint_tiled_surface_reset_thread_busy_times(MyPaintTiledSurface *self);
+
+gboolean
+mypaint_tiled_surface_get_stats(MyPaintTiledSurface *self, MyPaintTiledSurfaceStats *stats);
+
+void
+mypaint_tiled_surface_set_mipmap_painting(MyPaintTiledSurface *self, int mipmap_level, MyPaintRectangle *roi);
+int
+mypaint_tiled_surface_get_mipmap_painting(MyPaintTiledSurface *self);
+void
+mypaint_tiled_surface_finalize_tiles(MyPaintTiledSurface *self, MyPaintRectangle *roi);
+
 void mypaint_tiled_surface_begin_atomic(MyPaintTiledSurface *self);
 void mypaint_tiled_surface_end_atomic(MyPaintTiledSurface *self, MyPaintRectangle *roi);
+int mypaint_tiled_surface_get_dirty_rects(MyPaintTiledSurface *self, MyPaintRectangle *rects, int max_rects);
+
+int mypaint_tiled_surface_end_atomic_async(MyPaintTiledSurface *self, MyPaintRectangle *roi);
+gboolean mypaint_tiled_surface_is_done(MyPaintTiledSurface *self, int handle);
+void mypaint_tiled_surface_wait(MyPaintTiledSurface *self, int handle);
+void mypaint_tiled_surface_wait_for_tile(MyPaintTiledSurface *self, int tx, int ty);
 
 G_END_DECLS
 
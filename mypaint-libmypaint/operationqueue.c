@@ -16,70 +16,127 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 
 #include <mypaint-glib-compat.h>
 #include "operationqueue.h"
-#include "fifo.h"
+#include "helpers.h"
+
+#define M_PI 3.14159265358979323846
+
+/* Operations are stored by value in fixed size chunks. Each tile has a chain
+ * of chunks, the chunks come from a pool owned by the queue. Chunks are only
+ * returned to the pool (in bulk) when the dirty tiles are cleared, or when
+ * an operation is added to a tile whose queue was drained.
+ * Once the pool has grown to fit the largest atomic section,
+ * queueing operations does not allocate memory anymore. */
+
+#define OPERATION_CHUNK_SIZE 32
+
+typedef struct _OperationChunk OperationChunk;
+
+struct _OperationChunk {
+    OperationChunk *next;
+    int length;
+    OperationDataDrawDab ops[OPERATION_CHUNK_SIZE];
+};
+
+typedef struct {
+    OperationChunk *first;
+    OperationChunk *last;
+    OperationChunk *read_chunk; // next operation to pop
+    int read_pos;
+    OperationChunk *spare; // emptied by operation_queue_cull(), back to the pool on reset
+    int cover_skips; // operation_queue_cull() calls left without cover map, it did not pay off
+    gboolean dirty; // in the list of dirty tiles
+} TileOperations;
 
 struct _OperationQueue {
     TileMap *tile_map;
 
     TileIndex *dirty_tiles;
     int dirty_tiles_n;
+    int dirty_tiles_size;
+
+    OperationChunk *free_chunks;
+    int allocations;
+
+    struct _CullScratch *cull_scratch; // not in use, see operation_queue_cull()
+    pthread_mutex_t cull_scratch_mutex;
 };
 
-/* For use with queue_delete */
-void
-operation_delete_func(void *user_data) {
-    if (user_data) {
-        free(user_data);
+static void
+free_chunk_list(OperationChunk *chunk)
+{
+    while (chunk) {
+        OperationChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
 }
 
-
+/* For use with tile_map_free */
 void
-free_fifo(void *item) {
-    Fifo *op_queue = item;
-    if (op_queue) {
-        fifo_free(op_queue, operation_delete_func);
+free_tile_operations(void *item) {
+    TileOperations *tile = item;
+    if (tile) {
+        free_chunk_list(tile->first);
+        free(tile);
     }
 }
 
-gboolean
-operation_queue_resize(OperationQueue *self, int new_size)
+static OperationChunk *
+chunk_new(OperationQueue *self)
 {
-    if (new_size == 0) {
-        if (self->tile_map) {
-            assert(self->dirty_tiles);
-
-            tile_map_free(self->tile_map, TRUE);
-            self->tile_map = NULL;
-            free(self->dirty_tiles);
-            self->dirty_tiles = NULL;
-            self->dirty_tiles_n = 0;
-        }
-        return TRUE;
+    OperationChunk *chunk = self->free_chunks;
+    if (chunk) {
+        self->free_chunks = chunk->next;
     } else {
-        TileMap *new_tile_map = tile_map_new(new_size, sizeof(Fifo *), free_fifo);
-        const int new_map_size = new_size*2*new_size*2;
-        TileIndex *new_dirty_tiles = (TileIndex *)malloc(new_map_size*sizeof(TileIndex));
-
-        if (self->tile_map) {
-            tile_map_copy_to(self->tile_map, new_tile_map);
-            for(int i = 0; i < self->dirty_tiles_n; i++) {
-                new_dirty_tiles[i] = self->dirty_tiles[i];
-            }
-
-            tile_map_free(self->tile_map, FALSE);
-            free(self->dirty_tiles);
-        }
+        chunk = (OperationChunk *)malloc(sizeof(OperationChunk));
+        self->allocations++;
+    }
+    chunk->next = NULL;
+    chunk->length = 0;
+    return chunk;
+}
 
-        self->tile_map = new_tile_map;
-        self->dirty_tiles = new_dirty_tiles;
+static gboolean
+tile_operations_empty(const TileOperations *tile)
+{
+    return !tile->read_chunk || tile->read_pos >= tile->read_chunk->length;
+}
 
-        return FALSE;
+// Give the chunks of @tile back to the pool of @self
+static void
+tile_operations_reset(OperationQueue *self, TileOperations *tile)
+{
+    if (tile->first) {
+        tile->last->next = self->free_chunks;
+        self->free_chunks = tile->first;
     }
+    if (tile->spare) {
+        OperationChunk *spare_last = tile->spare;
+        while (spare_last->next) {
+            spare_last = spare_last->next;
+        }
+        spare_last->next = self->free_chunks;
+        self->free_chunks = tile->spare;
+    }
+    tile->spare = NULL;
+    tile->first = NULL;
+    tile->last = NULL;
+    tile->read_chunk = NULL;
+    tile->read_pos = 0;
+}
+
+static TileOperations *
+get_tile_operations(OperationQueue *self, TileIndex index)
+{
+    void **item = tile_map_get(self->tile_map, index);
+    return item ? (TileOperations *)*item : NULL;
 }
 
 OperationQueue *
@@ -87,58 +144,42 @@ operation_queue_new(void)
 {
     OperationQueue *self = (OperationQueue *)malloc(sizeof(OperationQueue));
 
-    self->tile_map = NULL;
+    self->tile_map = tile_map_new(free_tile_operations);
     self->dirty_tiles_n = 0;
-    self->dirty_tiles = NULL;
-
-#ifdef HEAVY_DEBUG
-    operation_queue_resize(self, 1);
-#else
-    operation_queue_resize(self, 10);
-#endif
+    self->dirty_tiles_size = 64;
+    self->dirty_tiles = (TileIndex *)malloc(self->dirty_tiles_size*sizeof(TileIndex));
+    self->free_chunks = NULL;
+    self->allocations = 1;
+    self->cull_scratch = NULL;
+    pthread_mutex_init(&self->cull_scratch_mutex, NULL);
 
     return self;
 }
 
+static void free_cull_scratch_list(struct _CullScratch *scratch);
+
 void
 operation_queue_free(OperationQueue *self)
 {
-    operation_queue_resize(self, 0); // free the tile map data
+    tile_map_free(self->tile_map, TRUE);
+    free(self->dirty_tiles);
+    free_chunk_list(self->free_chunks);
+    free_cull_scratch_list(self->cull_scratch);
+    pthread_mutex_destroy(&self->cull_scratch_mutex);
 
     free(self);
 }
 
+/* Number of memory allocations done by the queue since it was created.
+ * Intended for tests and benchmarks. */
 int
-tile_equal(TileIndex a, TileIndex b)
+operation_queue_get_allocations(OperationQueue *self)
 {
-    return (a.x == b.x && a.y == b.y);
+    return self->allocations + self->tile_map->allocations;
 }
 
-size_t
-remove_duplicate_tiles(TileIndex *array, size_t length)
-{
-    if (length < 2) {
-        // There cannot be any duplicates
-        return length;
-    }
-
-    size_t new_length = 1;
-    size_t i, j;
-
-    for (i = 1; i < length; i++) {
-        for (j = 0; j < new_length; j++) {
-            if (tile_equal(array[j], array[i])) {
-                break;
-            }
-        }
-        if (j == new_length) {
-            array[new_length++] = array[i];
-        }
-    }
-    return new_length;
-}
-
-/* Returns all tiles that are have operations queued
+/* Returns all tiles that are have operations queued, each tile once,
+ * sorted by row and then by column.
  * The consumer that actually does the processing should iterate over this list
  * of tiles, and use operation_queue_pop() to pop all the operations.
  *
@@ -146,7 +187,7 @@ remove_duplicate_tiles(TileIndex *array, size_t length)
 int
 operation_queue_get_dirty_tiles(OperationQueue *self, TileIndex** tiles_out)
 {
-    self->dirty_tiles_n = remove_duplicate_tiles(self->dirty_tiles, self->dirty_tiles_n);
+    qsort(self->dirty_tiles, self->dirty_tiles_n, sizeof(TileIndex), tile_index_compare);
 
     *tiles_out = self->dirty_tiles;
     return self->dirty_tiles_n;
@@ -154,96 +195,478 @@ operation_queue_get_dirty_tiles(OperationQueue *self, TileIndex** tiles_out)
 
 /* Clears the list of dirty tiles
  * Consumers should call this after having processed all the tiles.
+ * Operations that were not popped are dropped, and the memory for the
+ * operations of all dirty tiles goes back to the pool.
  *
  * Concurrency: This function is not thread-safe on the same @self instance. */
 void
 operation_queue_clear_dirty_tiles(OperationQueue *self)
 {
+    for (int i = 0; i < self->dirty_tiles_n; i++) {
+        TileOperations *tile = get_tile_operations(self, self->dirty_tiles[i]);
+        tile_operations_reset(self, tile);
+        tile->dirty = FALSE;
+    }
+
     // operation_queue_add will overwrite the invalid tiles as new dirty tiles comes in
     self->dirty_tiles_n = 0;
 }
 
 /* Add an operation to the queue for tile @index
+ * The operation is copied into the queue.
  * Note: if an operation affects more than one tile, it must be added once per tile.
  *
  * Concurrency: This function is not thread-safe on the same @self instance. */
 void
-operation_queue_add(OperationQueue *self, TileIndex index, OperationDataDrawDab *op)
+operation_queue_add(OperationQueue *self, TileIndex index, const OperationDataDrawDab *op)
 {
-    while (!tile_map_contains(self->tile_map, index)) {
-#ifdef HEAVY_DEBUG
-        operation_queue_resize(self, self->tile_map->size+1);
-#else
-        operation_queue_resize(self, self->tile_map->size*2);
-#endif
-    }
-
-    Fifo **queue_pointer = (Fifo **)tile_map_get(self->tile_map, index);
-    Fifo *op_queue = *queue_pointer;
+    TileOperations **tile_pointer = (TileOperations **)tile_map_insert(self->tile_map, index);
+    TileOperations *tile = *tile_pointer;
 
-    if (op_queue == NULL) {
+    if (tile == NULL) {
         // Lazy initialization
-        op_queue = fifo_new();
-        *queue_pointer = op_queue;
+        tile = (TileOperations *)malloc(sizeof(TileOperations));
+        self->allocations++;
+        tile->first = NULL;
+        tile->spare = NULL;
+        tile->cover_skips = 0;
+        tile->dirty = FALSE;
+        tile_operations_reset(self, tile);
+        *tile_pointer = tile;
+    }
+
+    if (tile_operations_empty(tile)) {
+        // Drained by operation_queue_pop(), outside of an atomic section
+        tile_operations_reset(self, tile);
     }
 
-    if (fifo_peek_first(op_queue) == NULL) {
+    if (!tile->dirty) {
         // Critical section, not thread-safe
-       if (!(self->dirty_tiles_n < self->tile_map->size*2*self->tile_map->size*2)) {
-           // Prune duplicate tiles that cause us to almost exceed max
-           self->dirty_tiles_n = remove_duplicate_tiles(self->dirty_tiles, self->dirty_tiles_n);
-       }
-       assert(self->dirty_tiles_n < self->tile_map->size*2*self->tile_map->size*2);
-       self->dirty_tiles[self->dirty_tiles_n++] = index;
+        if (self->dirty_tiles_n == self->dirty_tiles_size) {
+            self->dirty_tiles_size *= 2;
+            self->dirty_tiles = (TileIndex *)realloc(self->dirty_tiles, self->dirty_tiles_size*sizeof(TileIndex));
+            self->allocations++;
+        }
+        self->dirty_tiles[self->dirty_tiles_n++] = index;
+        tile->dirty = TRUE;
     }
-    fifo_push(op_queue, (void *)op);
+
+    if (!tile->last || tile->last->length == OPERATION_CHUNK_SIZE) {
+        OperationChunk *chunk = chunk_new(self);
+        if (tile->last) {
+            tile->last->next = chunk;
+        } else {
+            tile->first = chunk;
+            tile->read_chunk = chunk;
+            tile->read_pos = 0;
+        }
+        tile->last = chunk;
+    }
+    tile->last->ops[tile->last->length++] = *op;
 }
 
 /* Pop an operation off the queue for tile @index
- * The user of this function is reponsible for freeing the result using free()
+ * The result is owned by the queue, and stays valid until the next
+ * operation_queue_add() or operation_queue_clear_dirty_tiles().
  *
  * Concurrency: This function is reentrant (and lock-free) on different @index */
 OperationDataDrawDab *
 operation_queue_pop(OperationQueue *self, TileIndex index)
 {
-    OperationDataDrawDab *op = NULL;
+    TileOperations *tile = get_tile_operations(self, index);
 
-    if (!tile_map_contains(self->tile_map, index)) {
+    if (!tile || tile_operations_empty(tile)) {
         return NULL;
     }
 
-    Fifo **queue_pointer = (Fifo **)tile_map_get(self->tile_map, index);
-    Fifo *op_queue = *queue_pointer;
-
-    if (!op_queue) {
-        return NULL;
+    OperationDataDrawDab *op = &tile->read_chunk->ops[tile->read_pos++];
+    if (tile->read_pos == OPERATION_CHUNK_SIZE && tile->read_chunk->next) {
+        tile->read_chunk = tile->read_chunk->next;
+        tile->read_pos = 0;
     }
+    return op;
+}
 
-    op = (OperationDataDrawDab *)fifo_pop(op_queue);
-    if (!op) {
-        // Queue empty
-        fifo_free(op_queue, operation_delete_func);
-        *queue_pointer = NULL;
+/* Number of operations queued for tile @index, which have not been popped yet
+ *
+ * Concurrency: This function is reentrant (and lock-free) on different @index */
+int
+operation_queue_get_operation_count(OperationQueue *self, TileIndex index)
+{
+    TileOperations *tile = get_tile_operations(self, index);
+
+    if (!tile || tile_operations_empty(tile)) {
+        return 0;
     }
-    return op;
+    int count = -tile->read_pos;
+    for (OperationChunk *chunk = tile->read_chunk; chunk; chunk = chunk->next) {
+        count += chunk->length;
+    }
+    return count;
 }
 
 OperationDataDrawDab *
 operation_queue_peek_first(OperationQueue *self, TileIndex index) {
-    if (!tile_map_contains(self->tile_map, index)) {
+    TileOperations *tile = get_tile_operations(self, index);
+
+    if (!tile || tile_operations_empty(tile)) {
         return NULL;
     }
-
-    Fifo *op_queue = (Fifo *)*tile_map_get(self->tile_map, index);
-    return (!op_queue) ? NULL : (OperationDataDrawDab *)fifo_peek_first(op_queue);
+    return &tile->read_chunk->ops[tile->read_pos];
 }
 
 OperationDataDrawDab *
 operation_queue_peek_last(OperationQueue *self, TileIndex index) {
-    if (!tile_map_contains(self->tile_map, index)) {
+    TileOperations *tile = get_tile_operations(self, index);
+
+    if (!tile || tile_operations_empty(tile)) {
         return NULL;
     }
+    return &tile->last->ops[tile->last->length-1];
+}
+
+
+/* Culling of the operations of a tile, before it is processed.
+ *
+ * Only operations which make no difference to the pixels are removed:
+ * A dab with full opacity, hardness 1.0 and no antialiasing in Normal mode
+ * sets the pixels of its mask either to its color, or leaves them alone.
+ * Going backwards through the operations, the pixels set by such dabs are
+ * marked in a bitmap of the tile. An operation which only touches marked
+ * pixels is overwritten later and can be dropped, and so can a copy of an
+ * opaque dab right before it.
+ * The geometry is conservative, also for the quantized dabs of the
+ * dab mask cache. */
+
+#define COVER_WORD_BITS 64
+#define COVER_PROBE_OPS 32 // fewer operations say little about the next ones
+#define COVER_SKIPS 3 // calls without cover map after less than 1/4 of the operations were covered
+#define COVER_WORDS_MAX (MYPAINT_MAX_TILE_SIZE*MYPAINT_MAX_TILE_SIZE/COVER_WORD_BITS)
+
+// Pixels which are set by a later opaque dab, one bit per pixel
+typedef struct {
+    int tile_size;
+    int row_words;
+    uint64_t bits[COVER_WORDS_MAX];
+} CoverMap;
+
+// Buffers of one operation_queue_cull() call. Kept by the queue and reused
+// by the next calls, the ops array only ever grows.
+typedef struct _CullScratch {
+    struct _CullScratch *next;
+    const OperationDataDrawDab **ops;
+    int ops_size;
+    CoverMap map;
+} CullScratch;
+
+static void
+free_cull_scratch_list(CullScratch *scratch)
+{
+    while (scratch) {
+        CullScratch *next = scratch->next;
+        free(scratch->ops);
+        free(scratch);
+        scratch = next;
+    }
+}
+
+static CullScratch *
+cull_scratch_acquire(OperationQueue *self, int ops_n)
+{
+    pthread_mutex_lock(&self->cull_scratch_mutex);
+    CullScratch *scratch = self->cull_scratch;
+    if (scratch) {
+        self->cull_scratch = scratch->next;
+    } else {
+        self->allocations++;
+    }
+    pthread_mutex_unlock(&self->cull_scratch_mutex);
+
+    if (!scratch) {
+        scratch = (CullScratch *)malloc(sizeof(CullScratch));
+        scratch->ops = NULL;
+        scratch->ops_size = 0;
+    }
+    if (scratch->ops_size < ops_n) {
+        scratch->ops_size = MAX(ops_n, 2*scratch->ops_size);
+        scratch->ops = (const OperationDataDrawDab **)realloc(scratch->ops, scratch->ops_size*sizeof(scratch->ops[0]));
+    }
+    return scratch;
+}
+
+static void
+cull_scratch_release(OperationQueue *self, CullScratch *scratch)
+{
+    pthread_mutex_lock(&self->cull_scratch_mutex);
+    scratch->next = self->cull_scratch;
+    self->cull_scratch = scratch;
+    pthread_mutex_unlock(&self->cull_scratch_mutex);
+}
+
+// Pixel columns x0 <= x <= x1 of row y of a tile whose pixel squares
+// intersect the given circle. Returns FALSE if there are none.
+static gboolean
+circle_row_span(float cx, float cy, float radius, int y, int tile_size, int *x0, int *x1)
+{
+    const float dy = MAX(0.0f, MAX(y - cy, cy - (y + 1))); // nearest edge of the row
+    if (dy >= radius) {
+        return FALSE;
+    }
+    const float half = sqrtf(radius*radius - dy*dy);
+    *x0 = MAX((int)floorf(cx - half), 0);
+    *x1 = MIN((int)floorf(cx + half), tile_size - 1);
+    return *x0 <= *x1;
+}
+
+// Bits x0..x1 of word w of a row
+static uint64_t
+span_word_mask(int x0, int x1, int w)
+{
+    const int first = MAX(x0 - w*COVER_WORD_BITS, 0);
+    const int last = MIN(x1 - w*COVER_WORD_BITS, COVER_WORD_BITS - 1);
+    if (first > last) {
+        return 0;
+    }
+    const uint64_t upto_last = (last == COVER_WORD_BITS - 1) ? ~(uint64_t)0 : ((uint64_t)1 << (last + 1)) - 1;
+    return upto_last & ~(((uint64_t)1 << first) - 1);
+}
+
+// Pixels the mask of an operation may touch, relative to its tile: the
+// pixels of the bounding box of the ellipse which intersect the circle
+// around it
+typedef struct {
+    float cx, cy;
+    float radius;
+    int x0, y0, x1, y1;
+} Footprint;
+
+// The footprint of @op in the tile at (@ox, @oy), with room for the quantized
+// radius, angle and subpixel position of the dab mask cache.
+// Returns FALSE if it misses the tile.
+static gboolean
+op_footprint(const OperationDataDrawDab *op, float ox, float oy, int tile_size, Footprint *fp)
+{
+    const float angle_rad = op->angle/360*2*M_PI;
+    const float cs = cosf(angle_rad);
+    const float sn = sinf(angle_rad);
+    const float a = op->radius; // along the angle
+    const float b = op->radius / op->aspect_ratio; // aspect_ratio >= 1, see prepare_dab_op()
+    const float hx = sqrtf(a*a*cs*cs + b*b*sn*sn)*1.02f + 1.0f;
+    const float hy = sqrtf(a*a*sn*sn + b*b*cs*cs)*1.02f + 1.0f;
+    fp->cx = op->x - ox;
+    fp->cy = op->y - oy;
+    fp->radius = op->radius*1.02f + 1.0f;
+    fp->x0 = MAX(0, (int)floorf(fp->cx - hx));
+    fp->y0 = MAX(0, (int)floorf(fp->cy - hy));
+    fp->x1 = MIN(tile_size - 1, (int)floorf(fp->cx + hx));
+    fp->y1 = MIN(tile_size - 1, (int)floorf(fp->cy + hy));
+    return fp->x0 <= fp->x1 && fp->y0 <= fp->y1;
+}
+
+// TRUE if @op sets each pixel either to its color or leaves it unchanged
+static gboolean
+op_is_opaque(const OperationDataDrawDab *op)
+{
+    return op->normal == 1.0f && op->opaque == 1.0f && op->color_a == 1.0f
+        && op->lock_alpha == 0.0f && op->colorize == 0.0f
+        && op->hardness == 1.0f
+        && op->radius >= 4.0f; // antialiased below 3.0, also when quantized
+}
+
+// TRUE if the pixels of @fp in row @y are marked in @map
+static gboolean
+cover_map_covers_row(const CoverMap *map, const Footprint *fp, int y)
+{
+    int x0, x1;
+    if (!circle_row_span(fp->cx, fp->cy, fp->radius, y, map->tile_size, &x0, &x1)) {
+        return TRUE;
+    }
+    x0 = MAX(x0, fp->x0);
+    x1 = MIN(x1, fp->x1);
+    const uint64_t *row = &map->bits[y*map->row_words];
+    for (int w = x0/COVER_WORD_BITS; w <= x1/COVER_WORD_BITS; w++) {
+        const uint64_t mask = span_word_mask(x0, x1, w);
+        if ((row[w] & mask) != mask) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// TRUE if all pixels of @fp are marked in @map
+static gboolean
+cover_map_covers(const CoverMap *map, const Footprint *fp)
+{
+    // The widest row first, it is the most likely one to stick out
+    const int mid = CLAMP((int)floorf(fp->cy), fp->y0, fp->y1);
+    if (!cover_map_covers_row(map, fp, mid)) {
+        return FALSE;
+    }
+    for (int y = fp->y0; y <= fp->y1; y++) {
+        if (y != mid && !cover_map_covers_row(map, fp, y)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
 
-    Fifo *op_queue = (Fifo *)*tile_map_get(self->tile_map, index);
-    return (!op_queue) ? NULL : (OperationDataDrawDab *)fifo_peek_last(op_queue);
+// Marks the pixels the opaque @op sets to its color, for sure: the pixels
+// within the circle inside of the ellipse, minus the quantization of the
+// dab mask cache
+static void
+cover_map_add(CoverMap *map, const OperationDataDrawDab *op, float ox, float oy)
+{
+    const float radius = op->radius / op->aspect_ratio * 0.98f - 0.5f;
+    if (radius <= 0.0f) {
+        return;
+    }
+    const float cx = op->x - ox;
+    const float cy = op->y - oy;
+    const float radius2 = radius*radius;
+    const int y_mid = (int)floorf(cy);
+
+    // Outwards from the middle row, down and then up. The spans only get
+    // narrower, so their ends can be moved inwards instead of using sqrt.
+    for (int dir = 1; dir >= -1; dir -= 2) {
+        int left = (int)floorf(cx - radius);       // first pixel
+        int right = (int)floorf(cx + radius) + 1;  // right edge of the last pixel
+        for (int y = (dir > 0) ? y_mid : y_mid - 1; ; y += dir) {
+            const float dy = (dir > 0) ? y + 1 - cy : cy - y; // farthest edge of the row
+            const float half2 = radius2 - dy*dy;
+            if (half2 <= 0.0f || (dir > 0 && y >= map->tile_size) || (dir < 0 && y < 0)) {
+                break;
+            }
+            while (left < cx && (cx - left)*(cx - left) > half2) {
+                left++;
+            }
+            while (right > cx && (right - cx)*(right - cx) > half2) {
+                right--;
+            }
+            const int x0 = MAX(left, 0);
+            const int x1 = MIN(right - 1, map->tile_size - 1);
+            if (y < 0 || y >= map->tile_size || x0 > x1) {
+                continue;
+            }
+            uint64_t *row = &map->bits[y*map->row_words];
+            for (int w = x0/COVER_WORD_BITS; w <= x1/COVER_WORD_BITS; w++) {
+                row[w] |= span_word_mask(x0, x1, w);
+            }
+        }
+    }
+}
+
+// TRUE if the pixels @op sets are mostly marked by @marked already: the
+// next dab of a stroke is often only a small step away. Skipping it only
+// makes the map smaller than it could be.
+static gboolean
+near_marked_op(const OperationDataDrawDab *op, const OperationDataDrawDab *marked)
+{
+    const float dx = op->x - marked->x;
+    const float dy = op->y - marked->y;
+    const float step = 0.25f * op->radius / op->aspect_ratio;
+    return dx*dx + dy*dy < step*step
+        && op->radius / op->aspect_ratio <= 1.1f * marked->radius / marked->aspect_ratio;
+}
+
+/* Removes the operations of tile @index which make no difference to its
+ * pixels, and the ones whose mask does not reach into the tile.
+ * Called right before the operations are popped, see the comment above.
+ * @culled: (out): Number of removed operations
+ *
+ * Concurrency: This function is reentrant on different @index */
+void
+operation_queue_cull(OperationQueue *self, TileIndex index, int tile_size,
+                     OperationQueueCulled *culled)
+{
+    memset(culled, 0, sizeof(OperationQueueCulled));
+
+    const int ops_n = operation_queue_get_operation_count(self, index);
+    if (ops_n == 0) {
+        return;
+    }
+    TileOperations *tile = get_tile_operations(self, index);
+
+    CullScratch *scratch = cull_scratch_acquire(self, ops_n);
+    const OperationDataDrawDab **ops = scratch->ops;
+    OperationChunk *chunk = tile->read_chunk;
+    int pos = tile->read_pos;
+    for (int i = 0; i < ops_n; i++) {
+        if (pos == OPERATION_CHUNK_SIZE) {
+            chunk = chunk->next;
+            pos = 0;
+        }
+        ops[i] = &chunk->ops[pos++];
+    }
+
+    // Backwards, so that the pixels set by later dabs are known.
+    // Whether a tile gets overdrawn a lot is a property of the brush and
+    // stroke, so the cover map is only used while it pays off.
+    const gboolean use_map = (tile->cover_skips == 0);
+    if (!use_map) {
+        tile->cover_skips--;
+    }
+    const float ox = (float)index.x * tile_size;
+    const float oy = (float)index.y * tile_size;
+    CoverMap *map = NULL;
+    const OperationDataDrawDab *marked = NULL; // last operation added to the map
+    const OperationDataDrawDab *next = NULL; // next operation which is kept
+    for (int i = ops_n - 1; i >= 0; i--) {
+        const OperationDataDrawDab *op = ops[i];
+        Footprint fp;
+        if (!op_footprint(op, ox, oy, tile_size, &fp)) {
+            culled->outside++;
+            ops[i] = NULL;
+            continue;
+        }
+        if (map && cover_map_covers(map, &fp)) {
+            culled->overdrawn++;
+            ops[i] = NULL;
+            continue;
+        }
+        const gboolean opaque = op_is_opaque(op);
+        if (opaque && next && memcmp(op, next, sizeof(OperationDataDrawDab)) == 0) {
+            culled->merged++;
+            ops[i] = NULL;
+            continue;
+        }
+        if (opaque && use_map && !(marked && near_marked_op(op, marked))) {
+            if (!map) {
+                // Only the rows of the tile
+                map = &scratch->map;
+                map->tile_size = tile_size;
+                map->row_words = (tile_size + COVER_WORD_BITS - 1) / COVER_WORD_BITS;
+                memset(map->bits, 0, tile_size*map->row_words*sizeof(uint64_t));
+            }
+            cover_map_add(map, op, ox, oy);
+            marked = op;
+        }
+        next = op;
+    }
+    if (use_map && ops_n >= COVER_PROBE_OPS && (culled->overdrawn + culled->merged)*4 < ops_n) {
+        tile->cover_skips = COVER_SKIPS;
+    }
+
+    if (culled->outside + culled->overdrawn + culled->merged > 0) {
+        // Moving the kept operations to the front, the emptied chunks at the end become spare
+        chunk = tile->read_chunk;
+        pos = tile->read_pos;
+        for (int i = 0; i < ops_n; i++) {
+            if (!ops[i]) {
+                continue;
+            }
+            if (pos == OPERATION_CHUNK_SIZE) {
+                chunk = chunk->next;
+                pos = 0;
+            }
+            chunk->ops[pos++] = *ops[i];
+        }
+        chunk->length = pos;
+        if (chunk->next) {
+            tile->last->next = tile->spare;
+            tile->spare = chunk->next;
+            chunk->next = NULL;
+        }
+        tile->last = chunk;
+    }
+    cull_scratch_release(self, scratch);
 }
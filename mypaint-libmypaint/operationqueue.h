@@ -19,6 +19,19 @@ typedef struct {
     float normal;
     float lock_alpha;
     float colorize;
+    // Symmetric copies reuse the mask of the first dab, which is at
+    // (mask_x, mask_y) with mask_angle: pixel (px, py) of this dab is pixel
+    // (mask_xx*px + mask_xy*py + mask_dx, mask_yx*px + mask_yy*py + mask_dy)
+    // of that mask. The matrix is all zero if the dab has its own mask.
+    float mask_x;
+    float mask_y;
+    float mask_angle;
+    int mask_dx;
+    int mask_dy;
+    int8_t mask_xx;
+    int8_t mask_xy;
+    int8_t mask_yx;
+    int8_t mask_yy;
 } OperationDataDrawDab;
 
 typedef struct _OperationQueue OperationQueue;
@@ -29,10 +42,24 @@ void operation_queue_free(OperationQueue *self);
 int operation_queue_get_dirty_tiles(OperationQueue *self, TileIndex** tiles_out);
 void operation_queue_clear_dirty_tiles(OperationQueue *self);
 
-void operation_queue_add(OperationQueue *self, TileIndex index, OperationDataDrawDab *op);
+void operation_queue_add(OperationQueue *self, TileIndex index, const OperationDataDrawDab *op);
 OperationDataDrawDab *operation_queue_pop(OperationQueue *self, TileIndex index);
 
+int operation_queue_get_operation_count(OperationQueue *self, TileIndex index);
+
 OperationDataDrawDab *operation_queue_peek_first(OperationQueue *self, TileIndex index);
 OperationDataDrawDab *operation_queue_peek_last(OperationQueue *self, TileIndex index);
 
+int operation_queue_get_allocations(OperationQueue *self);
+
+// Operations removed by operation_queue_cull()
+typedef struct {
+    int outside;   // the mask does not reach into the tile
+    int overdrawn; // every pixel is overwritten by a later opaque dab
+    int merged;    // same as the next dab, which has no effect twice
+} OperationQueueCulled;
+
+void operation_queue_cull(OperationQueue *self, TileIndex index, int tile_size,
+                          OperationQueueCulled *culled);
+
 #endif // OPERATIONQUEUE_H
@@ -0,0 +1,118 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "rng-counter.h"
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al. 2011).
+//
+// A random number is a pure function of the seed and its position, so the
+// numbers of a dab do not depend on how many were drawn before it. The
+// position is given as a stream (what the number is used for), an index
+// (eg. the dab) and a draw (the n-th number of the same purpose and index).
+// Seeding is free, and the numbers can be generated in any order or in bulk.
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+struct _RngCounter {
+    uint32_t key[2];
+};
+
+RngCounter *
+rng_counter_new(uint64_t seed)
+{
+    RngCounter *self = (RngCounter *)malloc(sizeof(RngCounter));
+    rng_counter_set_seed(self, seed);
+    return self;
+}
+
+void
+rng_counter_free(RngCounter *self)
+{
+    free(self);
+}
+
+void
+rng_counter_set_seed(RngCounter *self, uint64_t seed)
+{
+    self->key[0] = (uint32_t)seed;
+    self->key[1] = (uint32_t)(seed >> 32);
+}
+
+void
+rng_counter_philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int i = 0; i < PHILOX_ROUNDS; i++) {
+        const uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        const uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+static inline void
+counter_block(const RngCounter *self, uint32_t stream, uint64_t index, uint32_t draw, uint32_t out[4])
+{
+    const uint32_t counter[4] = {(uint32_t)index, (uint32_t)(index >> 32), stream, draw};
+    rng_counter_philox(counter, self->key, out);
+}
+
+// Uniform in [0, 1), with 24 bits
+static inline float
+bits_to_float(uint32_t bits)
+{
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Approximately gaussian with sigma 1, like the old rand_gauss()
+static inline float
+bits_to_gauss(const uint32_t bits[4])
+{
+    const float sum = bits_to_float(bits[0]) + bits_to_float(bits[1]) + bits_to_float(bits[2]) + bits_to_float(bits[3]);
+    return sum * 1.73205080757f - 3.46410161514f;
+}
+
+// Uniform in [0, 1), with 53 bits
+double
+rng_counter_double(const RngCounter *self, uint32_t stream, uint64_t index, uint32_t draw)
+{
+    uint32_t bits[4];
+    counter_block(self, stream, index, draw, bits);
+    return ((bits[0] >> 5) * 67108864.0 + (bits[1] >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+float
+rng_counter_gauss(const RngCounter *self, uint32_t stream, uint64_t index, uint32_t draw)
+{
+    uint32_t bits[4];
+    counter_block(self, stream, index, draw, bits);
+    return bits_to_gauss(bits);
+}
@@ -0,0 +1,39 @@
+#ifndef RNGCOUNTER_H
+#define RNGCOUNTER_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include <mypaint-glib-compat.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RngCounter RngCounter;
+
+RngCounter *rng_counter_new(uint64_t seed);
+void rng_counter_free(RngCounter *self);
+
+void rng_counter_set_seed(RngCounter *self, uint64_t seed);
+
+void rng_counter_philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+double rng_counter_double(const RngCounter *self, uint32_t stream, uint64_t index, uint32_t draw);
+float rng_counter_gauss(const RngCounter *self, uint32_t stream, uint64_t index, uint32_t draw);
+
+G_END_DECLS
+
+#endif // RNGCOUNTER_H
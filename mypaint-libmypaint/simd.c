@@ -0,0 +1,98 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "simd.h"
+
+// Selection of the SIMD kernels used for dab rendering.
+//
+// The best instruction set supported by the CPU is detected at runtime.
+// Setting the environment variable MYPAINT_SIMD to "none", "sse2" or "avx2"
+// limits the selection, for benchmarking and for comparing against
+// the scalar reference code.
+//
+// Concurrency: simd_level_get() may be called from any thread, the level
+// is initialized from the environment exactly once.
+// simd_level_set() must not be called while tiles are being processed.
+
+static SimdLevel simd_level = SIMD_LEVEL_NONE;
+static pthread_once_t simd_level_once = PTHREAD_ONCE_INIT;
+
+static const char *simd_level_names[] = {"none", "sse2", "avx2"};
+
+const char *
+simd_level_name(SimdLevel level)
+{
+    return simd_level_names[level];
+}
+
+SimdLevel
+simd_level_supported(void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    // The float16 tile conversions use F16C along with AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+        return SIMD_LEVEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_LEVEL_SSE2;
+    }
+#endif
+    return SIMD_LEVEL_NONE;
+}
+
+static SimdLevel
+simd_level_from_environment(void)
+{
+    SimdLevel level = simd_level_supported();
+    const char *requested = getenv("MYPAINT_SIMD");
+
+    if (requested) {
+        for (int i = SIMD_LEVEL_NONE; i <= SIMD_LEVEL_AVX2; i++) {
+            if (strcmp(requested, simd_level_names[i]) == 0) {
+                return (i < (int)level) ? (SimdLevel)i : level;
+            }
+        }
+    }
+    return level;
+}
+
+static void
+simd_level_init(void)
+{
+    simd_level = simd_level_from_environment();
+}
+
+SimdLevel
+simd_level_get(void)
+{
+    pthread_once(&simd_level_once, simd_level_init);
+    return simd_level;
+}
+
+/* Select the kernels to use. Levels not supported by the CPU fall back
+ * to the best supported one. */
+void
+simd_level_set(SimdLevel level)
+{
+    const SimdLevel supported = simd_level_supported();
+    // Initialize first, so that a later simd_level_get() does not overwrite the level
+    pthread_once(&simd_level_once, simd_level_init);
+    simd_level = (level > supported) ? supported : level;
+}
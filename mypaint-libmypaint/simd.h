@@ -0,0 +1,39 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// SIMD kernels are compiled with per-function target attributes,
+// so the library itself does not need to be built with -msse2/-mavx2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+typedef enum {
+    SIMD_LEVEL_NONE = 0,
+    SIMD_LEVEL_SSE2,
+    SIMD_LEVEL_AVX2
+} SimdLevel;
+
+SimdLevel simd_level_supported(void);
+SimdLevel simd_level_get(void);
+void simd_level_set(SimdLevel level);
+
+const char *simd_level_name(SimdLevel level);
+
+#endif // SIMD_H
@@ -0,0 +1,133 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_SURFACE_STATS
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "surfacestats.h"
+
+// Each thread counts into its own slot, so that the counters of the
+// different threads are not on the same cache line. Threads beyond
+// the last slot share slots with others.
+#define SURFACE_STATS_SLOTS 64
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    uint64_t values[SURFACE_STATS_N];
+} __attribute__((aligned(CACHE_LINE_SIZE))) Slot;
+
+struct _SurfaceStats {
+    Slot slots[SURFACE_STATS_SLOTS];
+    // Totals at the last reset, subtracted in surface_stats_get()
+    uint64_t baseline[SURFACE_STATS_N];
+};
+
+// Process-wide, so that a thread uses the same slot for every surface
+static int threads_n = 0;
+static __thread int thread_slot = -1;
+
+static inline int
+get_thread_slot(void)
+{
+    if (thread_slot < 0) {
+        thread_slot = __atomic_fetch_add(&threads_n, 1, __ATOMIC_RELAXED) % SURFACE_STATS_SLOTS;
+    }
+    return thread_slot;
+}
+
+SurfaceStats *
+surface_stats_new(void)
+{
+    void *block = NULL;
+    if (posix_memalign(&block, CACHE_LINE_SIZE, sizeof(SurfaceStats)) != 0) {
+        return NULL;
+    }
+    SurfaceStats *self = (SurfaceStats *)block;
+    for (int s = 0; s < SURFACE_STATS_SLOTS; s++) {
+        for (int i = 0; i < SURFACE_STATS_N; i++) {
+            self->slots[s].values[i] = 0;
+        }
+    }
+    for (int i = 0; i < SURFACE_STATS_N; i++) {
+        self->baseline[i] = 0;
+    }
+    return self;
+}
+
+void
+surface_stats_free(SurfaceStats *self)
+{
+    free(self);
+}
+
+/* Add @value to the counter @stat of the calling thread
+ *
+ * Concurrency: This function is thread-safe on the same @self instance. */
+void
+surface_stats_add(SurfaceStats *self, SurfaceStat stat, uint64_t value)
+{
+    // Uncontended unless threads share a slot, the cache line stays local
+    __atomic_fetch_add(&self->slots[get_thread_slot()].values[stat], value, __ATOMIC_RELAXED);
+}
+
+// Monotonic time in nanoseconds
+uint64_t
+surface_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sum_slots(SurfaceStats *self, uint64_t *totals)
+{
+    for (int i = 0; i < SURFACE_STATS_N; i++) {
+        totals[i] = 0;
+    }
+    for (int s = 0; s < SURFACE_STATS_SLOTS; s++) {
+        for (int i = 0; i < SURFACE_STATS_N; i++) {
+            totals[i] += __atomic_load_n(&self->slots[s].values[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Start counting from zero again
+ * The slots are not cleared, so threads which are still counting
+ * need not be stopped.
+ *
+ * Concurrency: This function is not thread-safe on the same @self instance,
+ * with respect to itself and surface_stats_get(). */
+void
+surface_stats_reset(SurfaceStats *self)
+{
+    sum_slots(self, self->baseline);
+}
+
+/* Get the counters since the last reset, SURFACE_STATS_N values
+ *
+ * Concurrency: See surface_stats_reset() */
+void
+surface_stats_get(SurfaceStats *self, uint64_t *values_out)
+{
+    sum_slots(self, values_out);
+    for (int i = 0; i < SURFACE_STATS_N; i++) {
+        values_out[i] -= self->baseline[i];
+    }
+}
+
+#endif // HAVE_SURFACE_STATS
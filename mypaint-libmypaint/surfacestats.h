@@ -0,0 +1,76 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SURFACESTATS_H
+#define SURFACESTATS_H
+
+#include <stdint.h>
+
+// Counters of the hot paths of a MyPaintTiledSurface,
+// see mypaint_tiled_surface_get_stats().
+//
+// Only built with HAVE_SURFACE_STATS. Otherwise the SURFACE_STATS_*
+// macros expand to nothing, and the surface has no SurfaceStats.
+typedef enum {
+    SURFACE_STAT_DABS_ENQUEUED,
+    SURFACE_STAT_OPS_PROCESSED,
+    SURFACE_STAT_MASK_PIXELS,
+    SURFACE_STAT_MASK_PIXELS_SKIPPED,
+    SURFACE_STAT_TILE_REQUESTS,
+    SURFACE_STAT_RENDER_DAB_MASK_NS,
+    SURFACE_STAT_PROCESS_OP_NS,
+    SURFACE_STAT_GET_COLOR_NS,
+    SURFACE_STAT_OPS_CULLED_OUTSIDE,
+    SURFACE_STAT_OPS_CULLED_OVERDRAWN,
+    SURFACE_STAT_OPS_MERGED,
+    SURFACE_STATS_N
+} SurfaceStat;
+
+typedef struct _SurfaceStats SurfaceStats;
+
+#ifdef HAVE_SURFACE_STATS
+
+SurfaceStats *
+surface_stats_new(void);
+
+void
+surface_stats_free(SurfaceStats *self);
+
+void
+surface_stats_add(SurfaceStats *self, SurfaceStat stat, uint64_t value);
+
+uint64_t
+surface_stats_now(void);
+
+void
+surface_stats_reset(SurfaceStats *self);
+
+void
+surface_stats_get(SurfaceStats *self, uint64_t *values_out);
+
+#define SURFACE_STATS_ADD(stats, stat, value) surface_stats_add((stats), (stat), (value))
+#define SURFACE_STATS_TIMER_START(timer) const uint64_t timer = surface_stats_now()
+#define SURFACE_STATS_TIMER_END(stats, stat, timer) \
+    surface_stats_add((stats), (stat), surface_stats_now() - (timer))
+
+#else
+
+#define SURFACE_STATS_ADD(stats, stat, value)
+#define SURFACE_STATS_TIMER_START(timer)
+#define SURFACE_STATS_TIMER_END(stats, stat, timer)
+
+#endif // HAVE_SURFACE_STATS
+
+#endif // SURFACESTATS_H
@@ -0,0 +1,214 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "symmetry.h"
+#include "helpers.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The copies of each dab painted with symmetry. A copy is the dab rotated
+// around the center, optionally mirrored across the vertical axis first.
+//
+// Copies which only mirror or rotate by multiples of 90 degrees use exact
+// matrices. If the center also maps pixels onto pixels, such a copy is the
+// mask of the dab with its pixels moved, see symmetry_get_mask_map().
+//
+// Concurrency: not threadsafe.
+
+typedef struct {
+    float xx, xy; // x_out - center_x = xx*dx + xy*dy
+    float yx, yy;
+    float angle_sign; // angle_out = angle_sign*angle + angle_offset, in degrees
+    float angle_offset;
+} SymmetryCopy;
+
+struct _Symmetry {
+    float center_x;
+    float center_y;
+    SymmetryCopy *copies;
+    SymmetryMaskMap *mask_maps;
+    gboolean *mask_mapped; // mask_maps[i] is valid
+    int copies_n;
+};
+
+// Rotation by @degrees, with exact zeros and ones for multiples of 90 degrees
+static SymmetryCopy
+rotation_copy(double degrees)
+{
+    SymmetryCopy copy;
+    const double quarters = degrees / 90.0;
+    float cs, sn;
+    if (quarters == floor(quarters)) {
+        static const float cs_table[4] = {1.0f, 0.0f, -1.0f, 0.0f};
+        static const float sn_table[4] = {0.0f, 1.0f, 0.0f, -1.0f};
+        const int q = ((int)quarters % 4 + 4) % 4;
+        cs = cs_table[q];
+        sn = sn_table[q];
+    } else {
+        cs = cos(degrees/180.0*M_PI);
+        sn = sin(degrees/180.0*M_PI);
+    }
+    copy.xx = cs;
+    copy.xy = -sn;
+    copy.yx = sn;
+    copy.yy = cs;
+    copy.angle_sign = 1.0f;
+    copy.angle_offset = degrees;
+    return copy;
+}
+
+// @copy after mirroring across the vertical axis
+static SymmetryCopy
+mirrored_copy(SymmetryCopy copy)
+{
+    copy.xx = -copy.xx;
+    copy.yx = -copy.yx;
+    copy.angle_sign = -copy.angle_sign;
+    return copy;
+}
+
+// Computes the pixel map of @copy, if it moves whole pixels onto whole pixels:
+// with the matrix M of the copy and the center C, pixel P of the dab lands on
+// pixel M*P + T of the copy, where T = M*(0.5 - C) + C - 0.5 must be integer.
+// The map is the inverse, P = M'*(P' - T) with M' the transpose of M.
+static gboolean
+mask_map_init(const SymmetryCopy *copy, float center_x, float center_y, SymmetryMaskMap *map)
+{
+    const float m[4] = {copy->xx, copy->xy, copy->yx, copy->yy};
+    for (int i = 0; i < 4; i++) {
+        if (m[i] != 0.0f && m[i] != 1.0f && m[i] != -1.0f) {
+            return FALSE;
+        }
+    }
+    const double tx = copy->xx*(0.5 - center_x) + copy->xy*(0.5 - center_y) + center_x - 0.5;
+    const double ty = copy->yx*(0.5 - center_x) + copy->yy*(0.5 - center_y) + center_y - 0.5;
+    if (tx != floor(tx) || ty != floor(ty)) {
+        return FALSE;
+    }
+    map->xx = copy->xx;
+    map->xy = copy->yx;
+    map->yx = copy->xy;
+    map->yy = copy->yy;
+    map->dx = -(map->xx*(int)tx + map->xy*(int)ty);
+    map->dy = -(map->yx*(int)tx + map->yy*(int)ty);
+    return TRUE;
+}
+
+/* @lines: number of rotated copies for the rotational types, at least 1 */
+Symmetry *
+symmetry_new(MyPaintSymmetryType type, float center_x, float center_y, int lines)
+{
+    Symmetry *self = (Symmetry *)malloc(sizeof(Symmetry));
+    self->center_x = center_x;
+    self->center_y = center_y;
+
+    lines = MAX(lines, 1);
+    self->copies = (SymmetryCopy *)malloc(2*MAX(lines, 2)*sizeof(SymmetryCopy));
+    self->copies_n = 0;
+
+    const SymmetryCopy identity = rotation_copy(0.0);
+    self->copies[self->copies_n++] = identity;
+
+    switch (type) {
+    case MYPAINT_SYMMETRY_TYPE_VERTICAL:
+        self->copies[self->copies_n++] = mirrored_copy(identity);
+        break;
+    case MYPAINT_SYMMETRY_TYPE_HORIZONTAL:
+        self->copies[self->copies_n++] = mirrored_copy(rotation_copy(180.0));
+        break;
+    case MYPAINT_SYMMETRY_TYPE_VERTHORZ:
+        self->copies[self->copies_n++] = mirrored_copy(identity);
+        self->copies[self->copies_n++] = mirrored_copy(rotation_copy(180.0));
+        self->copies[self->copies_n++] = rotation_copy(180.0);
+        break;
+    case MYPAINT_SYMMETRY_TYPE_ROTATIONAL:
+    case MYPAINT_SYMMETRY_TYPE_SNOWFLAKE:
+        for (int i = 1; i < lines; i++) {
+            self->copies[self->copies_n++] = rotation_copy(360.0 * i / lines);
+        }
+        if (type == MYPAINT_SYMMETRY_TYPE_SNOWFLAKE) {
+            for (int i = 0; i < lines; i++) {
+                self->copies[self->copies_n++] = mirrored_copy(rotation_copy(360.0 * i / lines));
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    // Copying a mask is not much faster than rendering it, so sharing it
+    // only pays off if at least two more copies use the mask of the dab
+    self->mask_maps = (SymmetryMaskMap *)malloc(self->copies_n*sizeof(SymmetryMaskMap));
+    self->mask_mapped = (gboolean *)malloc(self->copies_n*sizeof(gboolean));
+    int mapped = 0;
+    for (int i = 0; i < self->copies_n; i++) {
+        self->mask_mapped[i] = mask_map_init(&self->copies[i], center_x, center_y, &self->mask_maps[i]);
+        mapped += self->mask_mapped[i];
+    }
+    if (mapped < 3) {
+        memset(self->mask_mapped, 0, self->copies_n*sizeof(gboolean));
+    }
+    return self;
+}
+
+void
+symmetry_free(Symmetry *self)
+{
+    free(self->copies);
+    free(self->mask_maps);
+    free(self->mask_mapped);
+    free(self);
+}
+
+/* Number of dabs painted for each dab, including the dab itself */
+int
+symmetry_get_copies(const Symmetry *self)
+{
+    return self->copies_n;
+}
+
+/* Position and angle of copy @copy of a dab, copy 0 is the dab itself */
+void
+symmetry_apply(const Symmetry *self, int copy, float x, float y, float angle,
+               float *x_out, float *y_out, float *angle_out)
+{
+    const SymmetryCopy *c = &self->copies[copy];
+    const float dx = x - self->center_x;
+    const float dy = y - self->center_y;
+
+    // Untouched coordinates stay exactly the same
+    *x_out = (c->xx == 1.0f && c->xy == 0.0f) ? x : self->center_x + (c->xx*dx + c->xy*dy);
+    *y_out = (c->yy == 1.0f && c->yx == 0.0f) ? y : self->center_y + (c->yx*dx + c->yy*dy);
+    *angle_out = (c->angle_offset == 0.0f) ? c->angle_sign*angle : c->angle_sign*angle + c->angle_offset;
+}
+
+/* Where the pixels of copy @copy come from in the mask of the dab.
+ * Returns FALSE if the copy does not map pixels onto pixels, or if too few
+ * copies do, then each copy needs a mask of its own. */
+gboolean
+symmetry_get_mask_map(const Symmetry *self, int copy, SymmetryMaskMap *map)
+{
+    if (!self->mask_mapped[copy]) {
+        return FALSE;
+    }
+    *map = self->mask_maps[copy];
+    return TRUE;
+}
@@ -0,0 +1,44 @@
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+#include <mypaint-tiled-surface.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Symmetry Symmetry;
+
+/* Pixel (px, py) of a copy is pixel (xx*px + xy*py + dx, yx*px + yy*py + dy)
+ * of the dab, see symmetry_get_mask_map() */
+typedef struct {
+    int xx, xy;
+    int yx, yy;
+    int dx, dy;
+} SymmetryMaskMap;
+
+Symmetry *symmetry_new(MyPaintSymmetryType type, float center_x, float center_y, int lines);
+void symmetry_free(Symmetry *self);
+
+int symmetry_get_copies(const Symmetry *self);
+void symmetry_apply(const Symmetry *self, int copy, float x, float y, float angle,
+                    float *x_out, float *y_out, float *angle_out);
+gboolean symmetry_get_mask_map(const Symmetry *self, int copy, SymmetryMaskMap *map);
+
+G_END_DECLS
+
+#endif // SYMMETRY_H
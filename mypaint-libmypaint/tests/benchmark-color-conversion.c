@@ -0,0 +1,116 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Converts rows of random colors with the functions of colorconv.h, at
+ * each SIMD level, and with the single color functions of helpers.h as
+ * the baseline. Prints millions of colors per second:
+ *
+ *   ./benchmark-color-conversion [ROW_LENGTH] [ROWS]
+ *
+ * The default rows of 256 colors are the size of the color selectors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "colorconv.h"
+#include "helpers.h"
+#include "simd.h"
+
+#include "mypaint-benchmark.h"
+
+typedef void (*ConvertFunction) (float *, float *, float *);
+typedef void (*ConvertNFunction) (const float *, const float *, const float *,
+                                  float *, float *, float *, int);
+
+typedef struct {
+    const char *name;
+    ConvertFunction convert;
+    ConvertNFunction convert_n;
+} Conversion;
+
+static const Conversion conversions[] = {
+    {"rgb_to_hsv", rgb_to_hsv_float, color_rgb_to_hsv_n},
+    {"hsv_to_rgb", hsv_to_rgb_float, color_hsv_to_rgb_n},
+    {"rgb_to_hsl", rgb_to_hsl_float, color_rgb_to_hsl_n},
+    {"hsl_to_rgb", hsl_to_rgb_float, color_hsl_to_rgb_n},
+};
+
+static double
+mcolors_per_second(int colors, double seconds)
+{
+    return colors / seconds / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+    const int length = (argc > 1) ? atoi(argv[1]) : 256;
+    const int rows = (argc > 2) ? atoi(argv[2]) : 4096;
+    if (length <= 0 || rows <= 0) {
+        fprintf(stderr, "Usage: %s [ROW_LENGTH] [ROWS]\n", argv[0]);
+        return 1;
+    }
+
+    float *in[3], *out[3];
+    for (int c = 0; c < 3; c++) {
+        in[c] = (float *)malloc(length*sizeof(float));
+        out[c] = (float *)malloc(length*sizeof(float));
+        for (int i = 0; i < length; i++) {
+            in[c][i] = rand() / (float)RAND_MAX;
+        }
+    }
+
+    const SimdLevel supported = simd_level_supported();
+    printf("%-12s %10s", "Mcolors/s", "scalar");
+    for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+        printf(" %10s", simd_level_name((SimdLevel)level));
+    }
+    printf("\n");
+
+    for (int k = 0; k < sizeof(conversions)/sizeof(conversions[0]); k++) {
+        const Conversion *conversion = &conversions[k];
+        printf("%-12s", conversion->name);
+
+        // One call per color, as the brush and the color selectors did
+        double start = mypaint_benchmark_get_time();
+        for (int row = 0; row < rows; row++) {
+            for (int i = 0; i < length; i++) {
+                out[0][i] = in[0][i];
+                out[1][i] = in[1][i];
+                out[2][i] = in[2][i];
+                conversion->convert(&out[0][i], &out[1][i], &out[2][i]);
+            }
+        }
+        printf(" %10.1f", mcolors_per_second(rows*length, mypaint_benchmark_get_time() - start));
+
+        for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+            simd_level_set((SimdLevel)level);
+            start = mypaint_benchmark_get_time();
+            for (int row = 0; row < rows; row++) {
+                conversion->convert_n(in[0], in[1], in[2], out[0], out[1], out[2], length);
+            }
+            printf(" %10.1f", mcolors_per_second(rows*length, mypaint_benchmark_get_time() - start));
+        }
+        printf("\n");
+    }
+    simd_level_set(supported);
+
+    for (int c = 0; c < 3; c++) {
+        free(in[c]);
+        free(out[c]);
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Replays every event file in events/ with every brush in brushes/ on a
+ * MyPaintFixedTiledSurface, for each combination of thread count and tile
+ * size, and writes the results as JSON. Run it from the tests directory:
+ *
+ *   ./benchmark-suite [--threads 1,2,4] [--tile-sizes 64,128,256]
+ *                     [--iterations N] [--batch-ms MS] [--output results.json]
+ *
+ * Event files are either text (.dat) or binary (.mpev, see convert-events).
+ * With --batch-ms, the events of MS milliseconds are played per transaction.
+ *
+ * Each combination runs in its own process, so that the peak memory use
+ * (peak_rss_kb) belongs to that combination alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "operationqueue.h"
+#include "mypaint-utils-stroke-player.h"
+#include "mypaint-benchmark.h"
+#include "testutils.h"
+
+#define SURFACE_SIZE 1000
+#define MAX_FILES 64
+#define MAX_CONFIGS 16
+#define PATH_LENGTH 256
+
+typedef struct {
+    int events;
+    int dabs;
+    int atomics;
+    long long ops; // dab operations queued for the dirty tiles, summed up
+    long long dirty_tiles;
+    double wall_ms;
+    double stroke_to_ms; // brush dynamics, queueing and get_color
+    double queue_ms; // within stroke_to: binning dabs into the tile queues
+    double end_atomic_ms; // rendering the queued dabs into the tiles
+    double tile_request_ms; // summed up over all threads
+    long peak_rss_kb;
+    gboolean brush_loaded;
+    gboolean have_stats; // libmypaint built with HAVE_SURFACE_STATS
+    double mask_ms; // rendering dab masks, summed up over all threads
+    double blend_ms; // processing dab operations, except for their masks
+} Result;
+
+// The benchmark measures one surface at a time, so the wrapped vfuncs
+// and their accumulators are global
+static MyPaintSurfaceDrawDabsFunction wrapped_draw_dabs = NULL;
+static MyPaintTileRequestStartFunction wrapped_tile_request_start = NULL;
+static MyPaintTileRequestEndFunction wrapped_tile_request_end = NULL;
+static Result *current = NULL;
+
+// Seconds of events per transaction, 0 for one event per transaction
+static double batch_duration = 0.0;
+
+static int
+timed_draw_dabs(MyPaintSurface *self, const MyPaintDabs *dabs)
+{
+    const double start = mypaint_benchmark_get_time();
+    const int painted = wrapped_draw_dabs(self, dabs);
+    current->queue_ms += (mypaint_benchmark_get_time() - start)*1000.0;
+    current->dabs += dabs->count;
+    return painted;
+}
+
+static void
+timed_tile_request_start(MyPaintTiledSurface *self, MyPaintTileRequest *request)
+{
+    const double start = mypaint_benchmark_get_time();
+    wrapped_tile_request_start(self, request);
+    const double spent = (mypaint_benchmark_get_time() - start)*1000.0;
+    #pragma omp atomic
+    current->tile_request_ms += spent;
+}
+
+static void
+timed_tile_request_end(MyPaintTiledSurface *self, MyPaintTileRequest *request)
+{
+    const double start = mypaint_benchmark_get_time();
+    wrapped_tile_request_end(self, request);
+    const double spent = (mypaint_benchmark_get_time() - start)*1000.0;
+    #pragma omp atomic
+    current->tile_request_ms += spent;
+}
+
+static void
+count_queued_ops(MyPaintTiledSurface *surface, Result *result)
+{
+    TileIndex *tiles = NULL;
+    const int tiles_n = operation_queue_get_dirty_tiles(surface->operation_queue, &tiles);
+    for (int i = 0; i < tiles_n; i++) {
+        result->ops += operation_queue_get_operation_count(surface->operation_queue, tiles[i]);
+    }
+    result->dirty_tiles += tiles_n;
+}
+
+static void
+run(const char *brush_path, const char *events_path, int threads, int tile_size, int iterations, Result *result)
+{
+    char *brush_data = read_file(brush_path);
+    assert(brush_data);
+
+    MyPaintFixedTiledSurface *fixed = mypaint_fixed_tiled_surface_new_with_tile_size(SURFACE_SIZE, SURFACE_SIZE, tile_size);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)fixed;
+    MyPaintSurface *surface = (MyPaintSurface *)fixed;
+    MyPaintBrush *brush = mypaint_brush_new();
+    MyPaintUtilsStrokePlayer *player = mypaint_utils_stroke_player_new();
+
+    memset(result, 0, sizeof(Result));
+    current = result;
+    // Without json-c, the default brush is measured instead
+    result->brush_loaded = mypaint_brush_from_string(brush, brush_data);
+    if (!result->brush_loaded) {
+        mypaint_brush_from_defaults(brush);
+    }
+
+    mypaint_tiled_surface_set_threads(tiled, threads);
+    wrapped_draw_dabs = surface->draw_dabs;
+    surface->draw_dabs = timed_draw_dabs;
+    wrapped_tile_request_start = tiled->tile_request_start;
+    wrapped_tile_request_end = tiled->tile_request_end;
+    tiled->tile_request_start = timed_tile_request_start;
+    tiled->tile_request_end = timed_tile_request_end;
+
+    mypaint_utils_stroke_player_set_brush(player, brush);
+    mypaint_utils_stroke_player_set_surface(player, surface);
+    if (!mypaint_utils_stroke_player_load_file(player, events_path)) {
+        exit(1);
+    }
+    mypaint_utils_stroke_player_set_batch_duration(player, batch_duration);
+    mypaint_utils_stroke_player_set_transactions_on_stroke_to(player, FALSE);
+
+    const double wall_start = mypaint_benchmark_get_time();
+    for (int i = 0; i < iterations; i++) {
+        gboolean more_events = TRUE;
+        while (more_events) {
+            mypaint_surface_begin_atomic(surface);
+
+            const double stroke_start = mypaint_benchmark_get_time();
+            more_events = mypaint_utils_stroke_player_iterate(player);
+            const double stroke_end = mypaint_benchmark_get_time();
+            count_queued_ops(tiled, result);
+            const double end_atomic_start = mypaint_benchmark_get_time();
+            mypaint_surface_end_atomic(surface, NULL);
+            const double end_atomic_end = mypaint_benchmark_get_time();
+
+            // Reset by begin_atomic, so collected per transaction
+            MyPaintTiledSurfaceStats stats;
+            result->have_stats = mypaint_tiled_surface_get_stats(tiled, &stats);
+            result->mask_ms += stats.render_dab_mask_ns / 1e6;
+            result->blend_ms += (stats.process_op_ns - stats.render_dab_mask_ns) / 1e6;
+
+            result->stroke_to_ms += (stroke_end - stroke_start)*1000.0;
+            result->end_atomic_ms += (end_atomic_end - end_atomic_start)*1000.0;
+            result->atomics++;
+        }
+    }
+    result->wall_ms = (mypaint_benchmark_get_time() - wall_start)*1000.0;
+    result->events = iterations * mypaint_utils_stroke_player_get_events_n(player);
+
+    mypaint_utils_stroke_player_free(player);
+    mypaint_brush_unref(brush);
+    mypaint_surface_unref(surface);
+    free(brush_data);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_rss_kb = usage.ru_maxrss;
+    current = NULL;
+}
+
+// Runs in a child process, which passes the result back through a pipe
+static gboolean
+run_isolated(const char *brush_path, const char *events_path, int threads, int tile_size, int iterations, Result *result)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return FALSE;
+    }
+
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return FALSE;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run(brush_path, events_path, threads, tile_size, iterations, result);
+        const gboolean written = (write(fds[1], result, sizeof(Result)) == sizeof(Result));
+        _exit(written ? 0 : 1);
+    }
+
+    close(fds[1]);
+    const gboolean received = (read(fds[0], result, sizeof(Result)) == sizeof(Result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int
+compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Sorted paths of the files in @dir with the @extension
+static int
+list_files(const char *dir, const char *extension, char **paths)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return 0;
+    }
+
+    int n = 0;
+    const size_t extension_length = strlen(extension);
+    for (struct dirent *entry = readdir(d); entry && n < MAX_FILES; entry = readdir(d)) {
+        const size_t length = strlen(entry->d_name);
+        if (length > extension_length && strcmp(entry->d_name + length - extension_length, extension) == 0) {
+            paths[n] = (char *)malloc(PATH_LENGTH);
+            snprintf(paths[n], PATH_LENGTH, "%s/%s", dir, entry->d_name);
+            n++;
+        }
+    }
+    closedir(d);
+
+    qsort(paths, n, sizeof(char *), compare_strings);
+    return n;
+}
+
+// Parses a comma separated list like "1,2,4"
+static int
+parse_list(const char *text, int *values)
+{
+    int n = 0;
+    const char *p = text;
+    while (*p && n < MAX_CONFIGS) {
+        values[n++] = atoi(p);
+        p = strchr(p, ',');
+        if (!p) {
+            break;
+        }
+        p++;
+    }
+    return n;
+}
+
+static void
+write_result(FILE *out, const char *brush_path, const char *events_path,
+             int threads, int tile_size, const Result *r, gboolean first)
+{
+    const double seconds = r->wall_ms / 1000.0;
+    fprintf(out, "%s    {\n", first ? "" : ",\n");
+    fprintf(out, "      \"brush\": \"%s\",\n", brush_path);
+    fprintf(out, "      \"brush_loaded\": %s,\n", r->brush_loaded ? "true" : "false");
+    fprintf(out, "      \"events_file\": \"%s\",\n", events_path);
+    fprintf(out, "      \"threads\": %d,\n", threads);
+    fprintf(out, "      \"tile_size\": %d,\n", tile_size);
+    fprintf(out, "      \"events\": %d,\n", r->events);
+    fprintf(out, "      \"dabs\": %d,\n", r->dabs);
+    fprintf(out, "      \"wall_ms\": %.3f,\n", r->wall_ms);
+    fprintf(out, "      \"dabs_per_sec\": %.1f,\n", seconds > 0.0 ? r->dabs / seconds : 0.0);
+    fprintf(out, "      \"ops_per_tile\": %.3f,\n", r->dirty_tiles ? (double)r->ops / r->dirty_tiles : 0.0);
+    fprintf(out, "      \"stages_ms\": {\n");
+    fprintf(out, "        \"stroke_to\": %.3f,\n", r->stroke_to_ms);
+    fprintf(out, "        \"queue\": %.3f,\n", r->queue_ms);
+    fprintf(out, "        \"end_atomic\": %.3f,\n", r->end_atomic_ms);
+    fprintf(out, "        \"tile_request\": %.3f,\n", r->tile_request_ms);
+    // Only measured by libmypaint built with HAVE_SURFACE_STATS
+    if (r->have_stats) {
+        fprintf(out, "        \"mask\": %.3f,\n", r->mask_ms);
+        fprintf(out, "        \"blend\": %.3f\n", r->blend_ms);
+    } else {
+        fprintf(out, "        \"mask\": null,\n");
+        fprintf(out, "        \"blend\": null\n");
+    }
+    fprintf(out, "      },\n");
+    fprintf(out, "      \"peak_rss_kb\": %ld\n", r->peak_rss_kb);
+    fprintf(out, "    }");
+}
+
+int
+main(int argc, char **argv)
+{
+    int threads[MAX_CONFIGS] = {1, 2, 4};
+    int threads_n = 3;
+    int tile_sizes[MAX_CONFIGS] = {64, 128, 256};
+    int tile_sizes_n = 3;
+    int iterations = 1;
+    const char *output_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const gboolean has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            threads_n = parse_list(argv[++i], threads);
+        } else if (strcmp(argv[i], "--tile-sizes") == 0 && has_value) {
+            tile_sizes_n = parse_list(argv[++i], tile_sizes);
+        } else if (strcmp(argv[i], "--iterations") == 0 && has_value) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--batch-ms") == 0 && has_value) {
+            batch_duration = atof(argv[++i]) / 1000.0;
+        } else {
+            fprintf(stderr, "Usage: %s [--threads 1,2,4] [--tile-sizes 64,128,256] [--iterations N] [--batch-ms MS] [--output FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < tile_sizes_n; i++) {
+        if (!mypaint_tiled_surface_tile_size_is_supported(tile_sizes[i])) {
+            fprintf(stderr, "Unsupported tile size %d\n", tile_sizes[i]);
+            return 1;
+        }
+    }
+
+    char *brushes[MAX_FILES];
+    char *event_files[2*MAX_FILES]; // text and binary
+    const int brushes_n = list_files("brushes", ".myb", brushes);
+    int event_files_n = list_files("events", ".dat", event_files);
+    event_files_n += list_files("events", ".mpev", event_files + event_files_n);
+    if (brushes_n == 0 || event_files_n == 0) {
+        fprintf(stderr, "No brushes or events found, run from the tests directory\n");
+        return 1;
+    }
+
+    FILE *out = output_path ? fopen(output_path, "w") : stdout;
+    if (!out) {
+        perror(output_path);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"fixed_tiled_surface\",\n");
+    fprintf(out, "  \"iterations\": %d,\n", iterations);
+    fprintf(out, "  \"batch_ms\": %.3f,\n", batch_duration*1000.0);
+    fprintf(out, "  \"results\": [\n");
+
+    int failures = 0;
+    gboolean first = TRUE;
+    for (int e = 0; e < event_files_n; e++) {
+        for (int b = 0; b < brushes_n; b++) {
+            for (int t = 0; t < threads_n; t++) {
+                for (int s = 0; s < tile_sizes_n; s++) {
+                    Result result;
+                    if (!run_isolated(brushes[b], event_files[e], threads[t], tile_sizes[s], iterations, &result)) {
+                        fprintf(stderr, "%s with %s, %d threads, tile size %d: failed\n",
+                                brushes[b], event_files[e], threads[t], tile_sizes[s]);
+                        failures++;
+                        continue;
+                    }
+                    write_result(out, brushes[b], event_files[e], threads[t], tile_sizes[s], &result, first);
+                    first = FALSE;
+                    fflush(out);
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    for (int i = 0; i < brushes_n; i++) {
+        free(brushes[i]);
+    }
+    for (int i = 0; i < event_files_n; i++) {
+        free(event_files[i]);
+    }
+    return failures ? 1 : 0;
+}
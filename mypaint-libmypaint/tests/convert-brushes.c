@@ -0,0 +1,134 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Builds a brush pack from the .myb files of brush directories, which
+ * mypaint_brush_pack_open() loads without parsing them. Each brush is
+ * named after its directory and file, e.g. "classic/pencil":
+ *
+ *   ./convert-brushes brushes.mpbp ../../mypaint-mypaint/brushes/classic ../../mypaint-mypaint/brushes/deevad
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-brush-pack.h>
+
+#include "testutils.h"
+
+#define BRUSH_SUFFIX ".myb"
+
+typedef struct {
+    MyPaintBrush **brushes;
+    char **names;
+    int brushes_n;
+    int brushes_max;
+} BrushList;
+
+static gboolean
+add_brush(BrushList *list, const char *dir_name, const char *dir_path, const char *file_name)
+{
+    const size_t stem_length = strlen(file_name) - strlen(BRUSH_SUFFIX);
+    char *path = (char *)malloc(strlen(dir_path) + strlen(file_name) + 2);
+    sprintf(path, "%s/%s", dir_path, file_name);
+    char *json = read_file(path);
+
+    MyPaintBrush *brush = mypaint_brush_new();
+    const gboolean loaded = json && mypaint_brush_from_string(brush, json);
+    free(json);
+    if (!loaded) {
+        fprintf(stderr, "Error: Unable to load brush '%s'\n", path);
+        mypaint_brush_unref(brush);
+        free(path);
+        return FALSE;
+    }
+    free(path);
+
+    if (list->brushes_n == list->brushes_max) {
+        list->brushes_max = 2*list->brushes_max + 16;
+        list->brushes = (MyPaintBrush **)realloc(list->brushes, list->brushes_max*sizeof(MyPaintBrush *));
+        list->names = (char **)realloc(list->names, list->brushes_max*sizeof(char *));
+    }
+    char *name = (char *)malloc(strlen(dir_name) + stem_length + 2);
+    sprintf(name, "%s/%.*s", dir_name, (int)stem_length, file_name);
+    list->brushes[list->brushes_n] = brush;
+    list->names[list->brushes_n] = name;
+    list->brushes_n++;
+    return TRUE;
+}
+
+static gboolean
+add_directory(BrushList *list, const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(stderr, "Error: Unable to read directory '%s'\n", dir_path);
+        return FALSE;
+    }
+
+    // The last path component, without trailing slashes
+    char *dir_name = strdup(dir_path);
+    size_t length = strlen(dir_name);
+    while (length > 1 && dir_name[length-1] == '/') {
+        dir_name[--length] = '\0';
+    }
+    const char *slash = strrchr(dir_name, '/');
+    const char *base_name = slash ? slash + 1 : dir_name;
+
+    gboolean added = TRUE;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        const size_t name_length = strlen(entry->d_name);
+        if (name_length > strlen(BRUSH_SUFFIX)
+            && strcmp(entry->d_name + name_length - strlen(BRUSH_SUFFIX), BRUSH_SUFFIX) == 0) {
+            added &= add_brush(list, base_name, dir_path, entry->d_name);
+        }
+    }
+    closedir(dir);
+    free(dir_name);
+    return added;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s OUTPUT.mpbp BRUSHDIR...\n", argv[0]);
+        return 1;
+    }
+
+    BrushList list = {NULL, NULL, 0, 0};
+    gboolean converted = TRUE;
+    for (int i = 2; i < argc; i++) {
+        converted &= add_directory(&list, argv[i]);
+    }
+    converted = converted
+                && mypaint_brush_pack_save(argv[1], list.brushes, (const char **)list.names, list.brushes_n);
+    if (converted) {
+        printf("%s: %d brushes\n", argv[1], list.brushes_n);
+    }
+
+    for (int i = 0; i < list.brushes_n; i++) {
+        mypaint_brush_unref(list.brushes[i]);
+        free(list.names[i]);
+    }
+    free(list.brushes);
+    free(list.names);
+
+    return converted ? 0 : 1;
+}
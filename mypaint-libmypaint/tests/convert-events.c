@@ -0,0 +1,45 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Converts a text stroke events file (time x y pressure per line) to the
+ * binary format, which mypaint_utils_stroke_player_load_file() maps into
+ * memory instead of parsing it:
+ *
+ *   ./convert-events events/painting30sec.dat events/painting30sec.mpev
+ */
+
+#include <stdio.h>
+
+#include "mypaint-utils-stroke-player.h"
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s INPUT.dat OUTPUT.mpev\n", argv[0]);
+        return 1;
+    }
+
+    MyPaintUtilsStrokePlayer *player = mypaint_utils_stroke_player_new();
+    gboolean converted = mypaint_utils_stroke_player_load_file(player, argv[1])
+                         && mypaint_utils_stroke_player_save_binary(player, argv[2]);
+    if (converted) {
+        printf("%s: %d events\n", argv[2], mypaint_utils_stroke_player_get_events_n(player));
+    }
+    mypaint_utils_stroke_player_free(player);
+
+    return converted ? 0 : 1;
+}
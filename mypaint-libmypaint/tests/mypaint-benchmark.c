@@ -92,3 +92,11 @@ int mypaint_benchmark_end(void)
     assert(time_spent*1000 < INT_MAX);
     return (int)(time_spent*1000);
 }
+
+/**
+ * returns the current wall clock time, in seconds
+ */
+double mypaint_benchmark_get_time(void)
+{
+    return get_time();
+}
@@ -20,4 +20,6 @@
 void mypaint_benchmark_start(const char *name);
 int mypaint_benchmark_end(void);
 
+double mypaint_benchmark_get_time(void);
+
 #endif // MYPAINTBENCHMARK_H
@@ -17,40 +17,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "mypaint-utils-stroke-player.h"
 
-int lines_in_string(const char *str) {
-    int lines = 0;
-    while (*str) {
-        if (*str == '\n') {
-            lines++;
-        }
-        str++;
-    }
-    return lines;
-}
-
-typedef struct {
-    gboolean valid;
-    float time;
-    float x;
-    float y;
-    float pressure;
-    float xtilt;
-    float ytilt;
-} MotionEvent;
-
 struct _MyPaintUtilsStrokePlayer {
     MyPaintSurface *surface;
     MyPaintBrush *brush;
-    MotionEvent *events;
+    const MyPaintUtilsStrokeEvent *events; // either parsed_events or in mapping
+    MyPaintUtilsStrokeEvent *parsed_events;
+    void *mapping;
+    size_t mapping_size;
     int current_event_index;
     int number_of_events;
     gboolean transaction_on_stroke; /* If MyPaintBrush::stroke_to should be done between MyPaintSurface::begin_atomic() end_atomic() calls.*/
     float scale;
+    double batch_duration; /* Seconds of events per iteration, 0 for one event per iteration */
 };
 
 MyPaintUtilsStrokePlayer *
@@ -61,20 +48,36 @@ mypaint_utils_stroke_player_new(void)
     self->surface = NULL;
     self->brush = NULL;
     self->events = NULL;
+    self->parsed_events = NULL;
+    self->mapping = NULL;
+    self->mapping_size = 0;
     self->number_of_events = 0;
     self->current_event_index = 0;
     self->transaction_on_stroke = TRUE;
     self->scale = 1.0;
+    self->batch_duration = 0.0;
 
     return self;
 }
 
+static void
+clear_events(MyPaintUtilsStrokePlayer *self)
+{
+    free(self->parsed_events);
+    if (self->mapping) {
+        munmap(self->mapping, self->mapping_size);
+    }
+    self->events = NULL;
+    self->parsed_events = NULL;
+    self->mapping = NULL;
+    self->mapping_size = 0;
+    self->number_of_events = 0;
+}
+
 void
 mypaint_utils_stroke_player_free(MyPaintUtilsStrokePlayer *self)
 {
-    if (self->events) {
-        free(self->events);
-    }
+    clear_events(self);
     free(self);
 }
 
@@ -89,66 +92,204 @@ void mypaint_utils_stroke_player_set_surface(MyPaintUtilsStrokePlayer *self, MyP
     self->surface = surface;
 }
 
+/* Parse the text format, one event per line: time x y pressure
+ * Lines which cannot be parsed are skipped. */
 void
 mypaint_utils_stroke_player_set_source_data(MyPaintUtilsStrokePlayer *self, const char *data)
 {
-    self->number_of_events = lines_in_string(data);
-    self->events = (MotionEvent *)malloc(sizeof(MotionEvent) * self->number_of_events);
+    clear_events(self);
 
-    char * data_copy = strdup(data);
+    int lines = 0;
+    for (const char *c = data; *c; c++) {
+        lines += (*c == '\n');
+    }
+    self->parsed_events = (MyPaintUtilsStrokeEvent *)malloc(sizeof(MyPaintUtilsStrokeEvent) * (lines + 1));
 
-    assert(data_copy);
+    // strtod() instead of sscanf(), which is several times slower
+    const char *line = data;
+    while (*line) {
+        const char *line_end = strchr(line, '\n');
+        if (!line_end) {
+            line_end = line + strlen(line);
+        }
+        if (line_end > line) {
+            MyPaintUtilsStrokeEvent *event = &self->parsed_events[self->number_of_events];
+            char *end[4];
+            event->time = strtod(line, &end[0]);
+            event->x = strtof(end[0], &end[1]);
+            event->y = strtof(end[1], &end[2]);
+            event->pressure = strtof(end[2], &end[3]);
+            event->xtilt = 0.0;
+            event->ytilt = 0.0;
+            event->reserved = 0.0;
 
-    char * line = strtok(data_copy, "\n");;
-    for (int i=0; i<self->number_of_events; i++) {
-        MotionEvent *event = &self->events[i];
+            if (end[0] == line || end[1] == end[0] || end[2] == end[1] || end[3] == end[2] || end[3] > line_end) {
+                fprintf(stderr, "Error: Unable to parse line '%.*s'\n", (int)(line_end - line), line);
+            } else {
+                self->number_of_events++;
+            }
+        }
+        line = *line_end ? line_end + 1 : line_end;
+    }
+    self->events = self->parsed_events;
 
-        int matches = sscanf(line, "%f %f %f %f",
-                             &event->time, &event->x, &event->y, &event->pressure);
-        if (matches != 4) {
-            event->valid = FALSE;
-            fprintf(stderr, "Error: Unable to parse line '%s'\n", line);
-        } else {
-            event->valid = TRUE;
+    mypaint_utils_stroke_player_reset(self);
+}
+
+static gboolean
+is_binary_events(const void *data, size_t size)
+{
+    return size >= sizeof(MyPaintUtilsStrokeEventsHeader)
+        && memcmp(data, MYPAINT_UTILS_STROKE_EVENTS_MAGIC, 4) == 0;
+}
+
+/**
+ * mypaint_utils_stroke_player_load_file:
+ *
+ * Load the events of @path, in the binary format or the text format.
+ * Binary files are memory mapped and used as they are.
+ *
+ * Returns: FALSE if the file could not be read or is invalid.
+ */
+gboolean
+mypaint_utils_stroke_player_load_file(MyPaintUtilsStrokePlayer *self, const char *path)
+{
+    clear_events(self);
+
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: Unable to open '%s'\n", path);
+        if (fd >= 0) {
+            close(fd);
         }
-        event->xtilt = 0.0;
-        event->ytilt = 0.0;
+        return FALSE;
+    }
+
+    const size_t size = st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map '%s'\n", path);
+        return FALSE;
+    }
+
+    if (!is_binary_events(mapping, size)) {
+        // The text parser needs a terminating zero
+        char *text = (char *)malloc(size + 1);
+        memcpy(text, mapping, size);
+        text[size] = '\0';
+        munmap(mapping, size);
+        mypaint_utils_stroke_player_set_source_data(self, text);
+        free(text);
+        return TRUE;
+    }
 
-        line = strtok(NULL, "\n");
+    const MyPaintUtilsStrokeEventsHeader *header = (const MyPaintUtilsStrokeEventsHeader *)mapping;
+    const size_t records_size = size - sizeof(MyPaintUtilsStrokeEventsHeader);
+    if (header->version != MYPAINT_UTILS_STROKE_EVENTS_VERSION
+        || header->record_size != sizeof(MyPaintUtilsStrokeEvent)
+        || header->events_n > records_size / sizeof(MyPaintUtilsStrokeEvent)
+        || header->events_n > INT32_MAX) {
+        fprintf(stderr, "Error: '%s' has an unsupported version, byte order or size\n", path);
+        munmap(mapping, size);
+        return FALSE;
     }
+    // Read sequentially, once per iteration
+    posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
 
-    free(data_copy);
+    self->mapping = mapping;
+    self->mapping_size = size;
+    self->events = (const MyPaintUtilsStrokeEvent *)(header + 1);
+    self->number_of_events = header->events_n;
 
     mypaint_utils_stroke_player_reset(self);
+    return TRUE;
 }
 
+/**
+ * mypaint_utils_stroke_player_save_binary:
+ *
+ * Write the loaded events to @path in the binary format.
+ * Converts a text events file when used after mypaint_utils_stroke_player_load_file().
+ *
+ * Returns: FALSE if the file could not be written.
+ */
 gboolean
-mypaint_utils_stroke_player_iterate(MyPaintUtilsStrokePlayer *self)
+mypaint_utils_stroke_player_save_binary(MyPaintUtilsStrokePlayer *self, const char *path)
 {
-    const MotionEvent *event = &self->events[self->current_event_index];
-    const int last_event_index = self->current_event_index-1;
-    float last_event_time = 0.0;
-    if (last_event_index >= 0) {
-        const MotionEvent *last_event = &self->events[last_event_index];
-        last_event_time = last_event->time;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to write '%s'\n", path);
+        return FALSE;
     }
+
+    MyPaintUtilsStrokeEventsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MYPAINT_UTILS_STROKE_EVENTS_MAGIC, 4);
+    header.version = MYPAINT_UTILS_STROKE_EVENTS_VERSION;
+    header.record_size = sizeof(MyPaintUtilsStrokeEvent);
+    header.events_n = self->number_of_events;
+
+    gboolean written = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (self->number_of_events > 0) {
+        written &= fwrite(self->events, sizeof(MyPaintUtilsStrokeEvent), self->number_of_events, file)
+                   == (size_t)self->number_of_events;
+    }
+    written &= (fclose(file) == 0);
+    return written;
+}
+
+int
+mypaint_utils_stroke_player_get_events_n(MyPaintUtilsStrokePlayer *self)
+{
+    return self->number_of_events;
+}
+
+static void
+stroke_to_event(MyPaintUtilsStrokePlayer *self, int index)
+{
+    const MyPaintUtilsStrokeEvent *event = &self->events[index];
+    const double last_event_time = (index > 0) ? self->events[index-1].time : 0.0;
     const float dtime = event->time - last_event_time;
 
-    if (event->valid) {
-        if (self->transaction_on_stroke) {
-            mypaint_surface_begin_atomic(self->surface);
-        }
+    mypaint_brush_stroke_to(self->brush, self->surface,
+                            event->x*self->scale, event->y*self->scale,
+                            event->pressure,
+                            event->xtilt, event->ytilt, dtime);
+}
 
-        mypaint_brush_stroke_to(self->brush, self->surface,
-                                event->x*self->scale, event->y*self->scale,
-                                event->pressure,
-                                event->xtilt, event->ytilt, dtime);
+/* Play the next event, or with a batch duration the events of the next
+ * batch_duration seconds, like an application does once per frame.
+ *
+ * Returns: FALSE after the last event, the player starts over then. */
+gboolean
+mypaint_utils_stroke_player_iterate(MyPaintUtilsStrokePlayer *self)
+{
+    if (self->number_of_events == 0) {
+        return FALSE;
+    }
 
-        if (self->transaction_on_stroke) {
-            mypaint_surface_end_atomic(self->surface, NULL);
+    int batch_end = self->current_event_index + 1;
+    if (self->batch_duration > 0.0) {
+        const double end_time = self->events[self->current_event_index].time + self->batch_duration;
+        while (batch_end < self->number_of_events && self->events[batch_end].time < end_time) {
+            batch_end++;
         }
     }
-    self->current_event_index++;
+
+    if (self->transaction_on_stroke) {
+        mypaint_surface_begin_atomic(self->surface);
+    }
+
+    for (int i = self->current_event_index; i < batch_end; i++) {
+        stroke_to_event(self, i);
+    }
+
+    if (self->transaction_on_stroke) {
+        mypaint_surface_end_atomic(self->surface, NULL);
+    }
+    self->current_event_index = batch_end;
 
     if (self->current_event_index < self->number_of_events) {
         return TRUE;
@@ -183,3 +324,16 @@ mypaint_utils_stroke_player_set_scale(MyPaintUtilsStrokePlayer *self, float scal
 {
     self->scale = scale;
 }
+
+/**
+ * mypaint_utils_stroke_player_set_batch_duration:
+ *
+ * Let mypaint_utils_stroke_player_iterate() play all events within @seconds
+ * of recorded time, in one transaction if transactions_on_stroke_to is set.
+ * 0 (the default) plays one event per iteration.
+ */
+void
+mypaint_utils_stroke_player_set_batch_duration(MyPaintUtilsStrokePlayer *self, double seconds)
+{
+    self->batch_duration = seconds;
+}
@@ -17,9 +17,36 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
+
 #include <mypaint-brush.h>
 #include <mypaint-surface.h>
 
+/* Binary stroke event files: a MyPaintUtilsStrokeEventsHeader, followed by
+ * events_n MyPaintUtilsStrokeEvent records, all in host byte order.
+ * They are memory mapped instead of parsed, see mypaint_utils_stroke_player_load_file(),
+ * and written from the text format by mypaint_utils_stroke_player_save_binary(). */
+#define MYPAINT_UTILS_STROKE_EVENTS_MAGIC "MPEV"
+#define MYPAINT_UTILS_STROKE_EVENTS_VERSION 1
+
+typedef struct {
+    char magic[4]; // MYPAINT_UTILS_STROKE_EVENTS_MAGIC
+    uint32_t version; // also tells apart files written with the other byte order
+    uint32_t record_size; // sizeof(MyPaintUtilsStrokeEvent)
+    uint32_t reserved;
+    uint64_t events_n;
+} MyPaintUtilsStrokeEventsHeader;
+
+typedef struct {
+    double time; // seconds, double so that hours long sessions keep their precision
+    float x;
+    float y;
+    float pressure;
+    float xtilt;
+    float ytilt;
+    float reserved; // pads the record to 32 bytes
+} MyPaintUtilsStrokeEvent;
+
 typedef struct _MyPaintUtilsStrokePlayer MyPaintUtilsStrokePlayer;
 
 MyPaintUtilsStrokePlayer *
@@ -37,6 +64,15 @@ mypaint_utils_stroke_player_set_surface(MyPaintUtilsStrokePlayer *self, MyPaintS
 void
 mypaint_utils_stroke_player_set_source_data(MyPaintUtilsStrokePlayer *self, const char *data);
 
+gboolean
+mypaint_utils_stroke_player_load_file(MyPaintUtilsStrokePlayer *self, const char *path);
+
+gboolean
+mypaint_utils_stroke_player_save_binary(MyPaintUtilsStrokePlayer *self, const char *path);
+
+int
+mypaint_utils_stroke_player_get_events_n(MyPaintUtilsStrokePlayer *self);
+
 gboolean
 mypaint_utils_stroke_player_iterate(MyPaintUtilsStrokePlayer *self);
 
@@ -52,4 +88,7 @@ mypaint_utils_stroke_player_set_transactions_on_stroke_to(MyPaintUtilsStrokePlay
 void
 mypaint_utils_stroke_player_set_scale(MyPaintUtilsStrokePlayer *self, float scale);
 
+void
+mypaint_utils_stroke_player_set_batch_duration(MyPaintUtilsStrokePlayer *self, double seconds);
+
 #endif // MYPAINTUTILSSTROKEPLAYER_H
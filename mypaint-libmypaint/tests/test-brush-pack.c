@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-brush-pack.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "brushprogram.h"
+#include "testutils.h"
+
+#define PACK_FILE "test-brush-pack.mpbp"
+#define BRUSHES 3
+#define SURFACE_SIZE 256
+
+// The defaults, with a few random curves
+static MyPaintBrush *
+random_brush(void)
+{
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    for (int s = 0; s < MYPAINT_BRUSH_SETTINGS_COUNT; s++) {
+        if (rand() % 4) {
+            continue;
+        }
+        const int input = rand() % MYPAINT_BRUSH_INPUTS_COUNT;
+        const int n = 2 + rand() % 7;
+        mypaint_brush_set_mapping_n(brush, s, input, n);
+        float x = random_float(-1.0f, 0.0f);
+        for (int p = 0; p < n; p++) {
+            x += random_float(0.0f, 0.5f);
+            mypaint_brush_set_mapping_point(brush, s, input, p, x, random_float(-0.1f, 0.1f));
+        }
+    }
+    return brush;
+}
+
+static int
+brushes_equal(MyPaintBrush *a, MyPaintBrush *b)
+{
+    int equal = 1;
+    for (int s = 0; s < MYPAINT_BRUSH_SETTINGS_COUNT; s++) {
+        equal &= (mypaint_brush_get_base_value(a, s) == mypaint_brush_get_base_value(b, s));
+        for (int i = 0; i < MYPAINT_BRUSH_INPUTS_COUNT; i++) {
+            const int n = mypaint_brush_get_mapping_n(a, s, i);
+            equal &= (n == mypaint_brush_get_mapping_n(b, s, i));
+            for (int p = 0; p < n && equal; p++) {
+                float ax, ay, bx, by;
+                mypaint_brush_get_mapping_point(a, s, i, p, &ax, &ay);
+                mypaint_brush_get_mapping_point(b, s, i, p, &bx, &by);
+                equal &= (ax == bx && ay == by);
+            }
+        }
+    }
+    return equal;
+}
+
+static MyPaintFixedTiledSurface *
+paint_stroke(MyPaintBrush *brush)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    mypaint_brush_reset(brush);
+    mypaint_brush_new_stroke(brush);
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    for (int i = 0; i < 50; i++) {
+        mypaint_brush_stroke_to(brush, (MyPaintSurface *)surface, 40.0f + 3.0f*i, 60.0f + 2.0f*i,
+                                0.2f + 0.015f*i, 0.0f, 0.0f, 0.01);
+    }
+    mypaint_surface_end_atomic((MyPaintSurface *)surface, NULL);
+    return surface;
+}
+
+int
+test_brush_pack_round_trip(void *user_data)
+{
+    const char *names[BRUSHES] = {"tanda/round", "classic/pencil", "deevad/ink"};
+    MyPaintBrush *brushes[BRUSHES];
+    int passed = 1;
+
+    srand(1357);
+    for (int i = 0; i < BRUSHES; i++) {
+        brushes[i] = random_brush();
+    }
+    passed &= expect_true(mypaint_brush_pack_save(PACK_FILE, brushes, names, BRUSHES), "pack written");
+
+    MyPaintBrushPack *pack = mypaint_brush_pack_open(PACK_FILE);
+    passed &= expect_true(pack != NULL, "pack opened");
+    if (!pack) {
+        return 0;
+    }
+    passed &= expect_int(BRUSHES, mypaint_brush_pack_get_brushes_n(pack), "brushes in the pack");
+    passed &= expect_true(strcmp(mypaint_brush_pack_get_name(pack, 0), "classic/pencil") == 0, "sorted by name");
+    passed &= expect_int(-1, mypaint_brush_pack_find(pack, "classic/missing"), "unknown brush");
+
+    for (int i = 0; i < BRUSHES; i++) {
+        const int index = mypaint_brush_pack_find(pack, names[i]);
+        passed &= expect_true(index >= 0, "brush found by name");
+        MyPaintBrush *brush = mypaint_brush_pack_get_brush(pack, index);
+        passed &= expect_true(brush && brushes_equal(brush, brushes[i]), "same settings and dynamics");
+        passed &= expect_true(brush == mypaint_brush_pack_get_brush(pack, index), "brush is built once");
+    }
+
+    mypaint_brush_pack_close(pack);
+    for (int i = 0; i < BRUSHES; i++) {
+        mypaint_brush_unref(brushes[i]);
+    }
+    remove(PACK_FILE);
+    return passed;
+}
+
+// The defaults, with the radius depending on the pressure
+static MyPaintBrush *
+pressure_brush(void)
+{
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, 1.5f);
+    mypaint_brush_set_mapping_n(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, MYPAINT_BRUSH_INPUT_PRESSURE, 3);
+    mypaint_brush_set_mapping_point(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, MYPAINT_BRUSH_INPUT_PRESSURE, 0, 0.0f, -0.5f);
+    mypaint_brush_set_mapping_point(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, MYPAINT_BRUSH_INPUT_PRESSURE, 1, 0.5f, 0.2f);
+    mypaint_brush_set_mapping_point(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, MYPAINT_BRUSH_INPUT_PRESSURE, 2, 1.0f, 0.8f);
+    return brush;
+}
+
+// The stored program paints exactly like the compiled mappings
+int
+test_brush_pack_same_strokes(void *user_data)
+{
+    const char *names[1] = {"classic/pressure"};
+    MyPaintBrush *original = pressure_brush();
+
+    int passed = expect_true(mypaint_brush_pack_save(PACK_FILE, &original, names, 1), "pack written");
+    MyPaintBrushPack *pack = mypaint_brush_pack_open(PACK_FILE);
+    MyPaintBrush *loaded = mypaint_brush_new();
+    passed &= expect_true(pack && mypaint_brush_pack_load_brush(pack, 0, loaded), "brush loaded");
+
+    MyPaintFixedTiledSurface *expected = paint_stroke(original);
+    MyPaintFixedTiledSurface *actual = paint_stroke(loaded);
+    passed &= expect_true(surfaces_equal((MyPaintTiledSurface *)expected, (MyPaintTiledSurface *)actual,
+                                         SURFACE_SIZE, SURFACE_SIZE), "same stroke");
+
+    mypaint_surface_unref((MyPaintSurface *)expected);
+    mypaint_surface_unref((MyPaintSurface *)actual);
+    mypaint_brush_unref(original);
+    mypaint_brush_unref(loaded);
+    if (pack) {
+        mypaint_brush_pack_close(pack);
+    }
+    remove(PACK_FILE);
+    return passed;
+}
+
+int
+test_brush_pack_invalid(void *user_data)
+{
+    const char *names[2] = {"classic/twice", "classic/twice"};
+    MyPaintBrush *brushes[2] = {mypaint_brush_new(), mypaint_brush_new()};
+    int passed = expect_true(!mypaint_brush_pack_save(PACK_FILE, brushes, names, 2), "duplicate names");
+
+    // Cut off at the end
+    passed &= expect_true(mypaint_brush_pack_save(PACK_FILE, brushes, names, 1), "pack written");
+    char *data = (char *)malloc(1024);
+    FILE *file = fopen(PACK_FILE, "rb");
+    const size_t size = fread(data, 1, 1024, file);
+    fclose(file);
+    file = fopen(PACK_FILE, "wb");
+    fwrite(data, 1, size - 20, file);
+    fclose(file);
+    passed &= expect_true(mypaint_brush_pack_open(PACK_FILE) == NULL, "truncated pack");
+
+    // Another version
+    data[4] += 1;
+    file = fopen(PACK_FILE, "wb");
+    fwrite(data, 1, size, file);
+    fclose(file);
+    passed &= expect_true(mypaint_brush_pack_open(PACK_FILE) == NULL, "unknown version");
+
+    free(data);
+
+    // A failed save keeps the previous pack
+    passed &= expect_true(mypaint_brush_pack_save(PACK_FILE, brushes, names, 1), "pack written again");
+    mkdir(PACK_FILE ".tmp", 0700); // the temporary file cannot be created
+    passed &= expect_true(!mypaint_brush_pack_save(PACK_FILE, brushes, names, 1), "unwritable");
+    rmdir(PACK_FILE ".tmp");
+    MyPaintBrushPack *pack = mypaint_brush_pack_open(PACK_FILE);
+    passed &= expect_true(pack && mypaint_brush_pack_get_brushes_n(pack) == 1, "previous pack intact");
+    if (pack) {
+        mypaint_brush_pack_close(pack);
+    }
+
+    mypaint_brush_unref(brushes[0]);
+    mypaint_brush_unref(brushes[1]);
+    remove(PACK_FILE);
+    return passed;
+}
+
+// Writes @data to the pack file, with @curve at @curve_offset
+static void
+write_pack_with_curve(const char *data, size_t size, size_t curve_offset, const BrushProgramCurve *curve)
+{
+    FILE *file = fopen(PACK_FILE, "wb");
+    fwrite(data, 1, curve_offset, file);
+    fwrite(curve, sizeof(BrushProgramCurve), 1, file);
+    fwrite(data + curve_offset + sizeof(BrushProgramCurve), 1, size - curve_offset - sizeof(BrushProgramCurve), file);
+    fclose(file);
+}
+
+static gboolean
+load_pack_brush(MyPaintBrush *brush)
+{
+    MyPaintBrushPack *pack = mypaint_brush_pack_open(PACK_FILE);
+    if (!pack) {
+        return FALSE;
+    }
+    const gboolean loaded = mypaint_brush_pack_load_brush(pack, 0, brush);
+    mypaint_brush_pack_close(pack);
+    return loaded;
+}
+
+// The x values of the curves must be usable for the interpolation,
+// the widths stored with them are not trusted
+int
+test_brush_pack_corrupt_curve(void *user_data)
+{
+    const char *names[1] = {"classic/pressure"};
+    MyPaintBrush *original = pressure_brush();
+    MyPaintBrush *loaded = mypaint_brush_new();
+    int passed = expect_true(mypaint_brush_pack_save(PACK_FILE, &original, names, 1), "pack written");
+
+    char *data = (char *)malloc(4096);
+    FILE *file = fopen(PACK_FILE, "rb");
+    const size_t size = fread(data, 1, 4096, file);
+    fclose(file);
+
+    // The only curve, found by its x values
+    const float xvalues[3] = {0.0f, 0.5f, 1.0f};
+    size_t curve_offset = 0;
+    while (curve_offset + sizeof(BrushProgramCurve) < size
+           && memcmp(data + curve_offset + offsetof(BrushProgramCurve, xvalues), xvalues, sizeof(xvalues)) != 0) {
+        curve_offset++;
+    }
+    passed &= expect_true(curve_offset + sizeof(BrushProgramCurve) < size, "curve found");
+    BrushProgramCurve curve;
+    memcpy(&curve, data + curve_offset, sizeof(curve));
+
+    BrushProgramCurve corrupt = curve;
+    corrupt.xvalues[2] = 0.25f;
+    write_pack_with_curve(data, size, curve_offset, &corrupt);
+    passed &= expect_true(!load_pack_brush(loaded), "decreasing x values");
+
+    corrupt = curve;
+    corrupt.xvalues[1] = NAN;
+    write_pack_with_curve(data, size, curve_offset, &corrupt);
+    passed &= expect_true(!load_pack_brush(loaded), "x value is not a number");
+
+    corrupt = curve;
+    corrupt.yvalues[0] = INFINITY;
+    write_pack_with_curve(data, size, curve_offset, &corrupt);
+    passed &= expect_true(!load_pack_brush(loaded), "infinite y value");
+
+    corrupt = curve;
+    corrupt.widths[1] = 0.0f;
+    corrupt.widths[2] = -3.0f;
+    write_pack_with_curve(data, size, curve_offset, &corrupt);
+    passed &= expect_true(load_pack_brush(loaded), "brush with wrong widths loaded");
+    MyPaintFixedTiledSurface *expected = paint_stroke(original);
+    MyPaintFixedTiledSurface *actual = paint_stroke(loaded);
+    passed &= expect_true(surfaces_equal((MyPaintTiledSurface *)expected, (MyPaintTiledSurface *)actual,
+                                         SURFACE_SIZE, SURFACE_SIZE), "widths calculated from the x values");
+
+    mypaint_surface_unref((MyPaintSurface *)expected);
+    mypaint_surface_unref((MyPaintSurface *)actual);
+    free(data);
+    mypaint_brush_unref(original);
+    mypaint_brush_unref(loaded);
+    remove(PACK_FILE);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/brush_pack/round_trip", test_brush_pack_round_trip, NULL},
+        {"/brush_pack/same_strokes", test_brush_pack_same_strokes, NULL},
+        {"/brush_pack/invalid", test_brush_pack_invalid, NULL},
+        {"/brush_pack/corrupt_curve", test_brush_pack_corrupt_curve, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "brushprogram.h"
+#include "testutils.h"
+
+#define SETTINGS 20
+#define INPUTS 9
+#define EVALUATIONS 1000
+
+// Some constant settings, the others with a few random curves
+static void
+random_mappings(Mapping **settings)
+{
+    for (int i = 0; i < SETTINGS; i++) {
+        settings[i] = mapping_new(INPUTS);
+        mapping_set_base_value(settings[i], random_float(-2.0f, 2.0f));
+        if (i % 3 == 0) {
+            continue;
+        }
+        for (int j = 0; j < INPUTS; j++) {
+            if (rand() % 3) {
+                continue;
+            }
+            const int n = 2 + rand() % 7;
+            mapping_set_n(settings[i], j, n);
+            float x = random_float(-1.0f, 0.0f);
+            for (int p = 0; p < n; p++) {
+                // Also vertical steps, where two points have the same x
+                x += (rand() % 4) ? random_float(0.0f, 0.5f) : 0.0f;
+                mapping_set_point(settings[i], j, p, x, random_float(-1.0f, 1.0f));
+            }
+        }
+    }
+}
+
+int
+test_brush_program_matches_mapping(void *user_data)
+{
+    Mapping *settings[SETTINGS];
+    BrushProgram *program = brush_program_new(SETTINGS, INPUTS);
+    float inputs[INPUTS];
+    float values[SETTINGS];
+
+    srand(2468);
+    random_mappings(settings);
+    brush_program_compile(program, settings);
+
+    int curves = 0;
+    int inputs_used = 1;
+    for (int i = 0; i < SETTINGS; i++) {
+        curves += mapping_get_inputs_used_n(settings[i]);
+    }
+    for (int j = 0; j < INPUTS; j++) {
+        gboolean used = FALSE;
+        for (int i = 0; i < SETTINGS; i++) {
+            used |= (mapping_get_n(settings[i], j) != 0);
+        }
+        inputs_used &= (used == brush_program_uses_input(program, j));
+    }
+    int passed = expect_int(curves, brush_program_get_curves_n(program), "curves in the program");
+    passed &= expect_true(inputs_used, "inputs used by the program");
+
+    int identical = 1;
+    for (int e = 0; e < EVALUATIONS; e++) {
+        // Also inputs outside of the curves
+        for (int j = 0; j < INPUTS; j++) {
+            inputs[j] = random_float(-2.0f, 4.0f);
+        }
+        brush_program_evaluate(program, inputs, values);
+        for (int i = 0; i < SETTINGS; i++) {
+            identical &= (values[i] == mapping_calculate(settings[i], inputs));
+        }
+    }
+    passed &= expect_true(identical, "program calculates exactly the same values as the mappings");
+
+    // Recompiling picks up changes
+    mapping_set_base_value(settings[0], 42.0f);
+    mapping_set_n(settings[1], 0, 0);
+    brush_program_compile(program, settings);
+    brush_program_evaluate(program, inputs, values);
+    passed &= expect_true(values[0] == 42.0f, "changed base value");
+    passed &= expect_true(values[1] == mapping_calculate(settings[1], inputs), "removed curve");
+
+    for (int i = 0; i < SETTINGS; i++) {
+        mapping_free(settings[i]);
+    }
+    brush_program_free(program);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/brush_program/matches_mapping", test_brush_program_matches_mapping, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
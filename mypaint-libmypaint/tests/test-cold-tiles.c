@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mypaint-surface.h>
+#include <mypaint-fixed-tiled-surface.h>
+#include "tilecodec.h"
+
+#include "testutils.h"
+
+#define SURFACE_SIZE (8*MYPAINT_TILE_SIZE)
+#define TILE_PIXELS (MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE)
+
+int
+test_cold_tiles_codec_roundtrip(void *user_data)
+{
+    const int pixel_sizes[] = {8, 16};
+    int passed = 1;
+
+    srand(1234);
+    for (int p = 0; p < 2; p++) {
+        const int pixel_bytes = pixel_sizes[p];
+        const size_t bytes = TILE_PIXELS*pixel_bytes;
+        uint8_t *src = (uint8_t *)malloc(bytes);
+        uint8_t *dst = (uint8_t *)malloc(bytes);
+        uint8_t *compressed = (uint8_t *)malloc(tile_codec_max_bytes(MYPAINT_TILE_SIZE, pixel_bytes));
+
+        // Runs of random length, from all different to all the same pixels
+        for (int max_run = 1; max_run <= TILE_PIXELS; max_run *= 4) {
+            int i = 0;
+            while (i < TILE_PIXELS) {
+                const int n = 1 + rand() % max_run;
+                uint8_t pixel[TILE_CODEC_MAX_PIXEL_BYTES];
+                for (int b = 0; b < pixel_bytes; b++) {
+                    pixel[b] = rand() % 4; // also equal neighbours by chance
+                }
+                for (int j = i; j < i + n && j < TILE_PIXELS; j++) {
+                    memcpy(src + j*pixel_bytes, pixel, pixel_bytes);
+                }
+                i += n;
+            }
+            const size_t compressed_bytes = tile_codec_compress(src, MYPAINT_TILE_SIZE, pixel_bytes, compressed);
+            memset(dst, 0xaa, bytes);
+            tile_codec_decompress(compressed, compressed_bytes, MYPAINT_TILE_SIZE, pixel_bytes, dst);
+            passed &= expect_true(memcmp(src, dst, bytes) == 0, "decompressed tile is the original");
+            passed &= expect_true(compressed_bytes <= tile_codec_max_bytes(MYPAINT_TILE_SIZE, pixel_bytes),
+                                  "compressed size within bound");
+        }
+
+        uint8_t pixel[TILE_CODEC_MAX_PIXEL_BYTES] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+        tile_codec_fill(src, TILE_PIXELS, pixel_bytes, pixel);
+        passed &= expect_true(tile_codec_is_uniform(src, TILE_PIXELS, pixel_bytes), "filled tile is uniform");
+        passed &= expect_true(memcmp(src + (TILE_PIXELS-1)*pixel_bytes, pixel, pixel_bytes) == 0,
+                              "last pixel filled");
+        src[bytes/2] ^= 1;
+        passed &= expect_true(!tile_codec_is_uniform(src, TILE_PIXELS, pixel_bytes), "changed tile is not uniform");
+
+        free(src);
+        free(dst);
+        free(compressed);
+    }
+    return passed;
+}
+
+static void
+paint_stroke(MyPaintSurface *surface)
+{
+    mypaint_surface_begin_atomic(surface);
+    for (int i = 0; i < 400; i++) {
+        const float x = 30.0f + i * (SURFACE_SIZE - 60.0f) / 400;
+        const float y = SURFACE_SIZE/2 + (SURFACE_SIZE/3) * sinf(i * 0.03f);
+        mypaint_surface_draw_dab(surface, x, y, 6.0f + 4.0f * sinf(i * 0.1f),
+                                 0.2f, 0.5f, 0.9f, 0.5f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    }
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+// Painting with all but two tiles compressed gives the same result
+int
+test_cold_tiles_painting(void *user_data)
+{
+    MyPaintFixedTiledSurface *reference = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *compressed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    int passed = 1;
+
+    mypaint_fixed_tiled_surface_set_max_raw_tiles(compressed, 2);
+    paint_stroke((MyPaintSurface *)reference);
+    paint_stroke((MyPaintSurface *)compressed);
+    paint_stroke((MyPaintSurface *)reference);
+    paint_stroke((MyPaintSurface *)compressed);
+
+    passed &= expect_true(surfaces_equal((MyPaintTiledSurface *)reference, (MyPaintTiledSurface *)compressed,
+                                         SURFACE_SIZE, SURFACE_SIZE),
+                          "same pixels with compressed tiles");
+
+    const size_t reference_bytes = mypaint_fixed_tiled_surface_get_memory_usage(reference);
+    mypaint_fixed_tiled_surface_set_max_raw_tiles(compressed, 0);
+    const size_t compressed_bytes = mypaint_fixed_tiled_surface_get_memory_usage(compressed);
+    passed &= expect_true(compressed_bytes < reference_bytes / 4, "compressed tiles use less memory");
+
+    mypaint_surface_unref((MyPaintSurface *)reference);
+    mypaint_surface_unref((MyPaintSurface *)compressed);
+    return passed;
+}
+
+// Same with the tiles processed by several threads, which compress
+// the tiles of each other while they paint
+int
+test_cold_tiles_threadsafe(void *user_data)
+{
+    MyPaintFixedTiledSurface *reference = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *compressed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    int passed = 1;
+
+    ((MyPaintTiledSurface *)compressed)->threadsafe_tile_requests = TRUE;
+    mypaint_fixed_tiled_surface_set_max_raw_tiles(compressed, 1);
+    for (int i = 0; i < 3; i++) {
+        paint_stroke((MyPaintSurface *)reference);
+        paint_stroke((MyPaintSurface *)compressed);
+    }
+
+    passed &= expect_true(surfaces_equal((MyPaintTiledSurface *)reference, (MyPaintTiledSurface *)compressed,
+                                         SURFACE_SIZE, SURFACE_SIZE),
+                          "same pixels with compressed tiles");
+
+    mypaint_surface_unref((MyPaintSurface *)reference);
+    mypaint_surface_unref((MyPaintSurface *)compressed);
+    return passed;
+}
+
+// A big surface does not allocate its tiles up front, and reading
+// untouched tiles does not allocate them either
+int
+test_cold_tiles_lazy(void *user_data)
+{
+    const int size = 16384;
+    MyPaintFixedTiledSurface *fixed = mypaint_fixed_tiled_surface_new(size, size);
+    const size_t initial_bytes = mypaint_fixed_tiled_surface_get_memory_usage(fixed);
+    int passed = expect_true(initial_bytes < 8*1024*1024, "16k x 16k surface needs less than 8 MiB");
+
+    MyPaintTileRequest request;
+    mypaint_tile_request_init(&request, 0, 10, 10, TRUE);
+    mypaint_tiled_surface_tile_request_start((MyPaintTiledSurface *)fixed, &request);
+    const uint16_t *rgba = request.buffer;
+    passed &= expect_int(0xffff, rgba[0], "initial value of untouched tile");
+    mypaint_tiled_surface_tile_request_end((MyPaintTiledSurface *)fixed, &request);
+    passed &= expect_true(mypaint_fixed_tiled_surface_get_memory_usage(fixed) == initial_bytes,
+                          "reading does not allocate");
+
+    float r, g, b, a;
+    mypaint_surface_get_color((MyPaintSurface *)fixed, 5000.0f, 5000.0f, 100.0f, &r, &g, &b, &a);
+    passed &= expect_true(mypaint_fixed_tiled_surface_get_memory_usage(fixed) == initial_bytes,
+                          "color sampling does not allocate");
+
+    mypaint_surface_unref((MyPaintSurface *)fixed);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/cold_tiles/codec_roundtrip", test_cold_tiles_codec_roundtrip, NULL},
+        {"/cold_tiles/painting", test_cold_tiles_painting, NULL},
+        {"/cold_tiles/threadsafe", test_cold_tiles_threadsafe, NULL},
+        {"/cold_tiles/lazy", test_cold_tiles_lazy, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
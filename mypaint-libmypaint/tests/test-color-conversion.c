@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colorconv.h"
+#include "helpers.h"
+#include "simd.h"
+
+#include "testutils.h"
+
+// Not a multiple of the vector widths, for the scalar tail
+#define COLORS 1003
+
+typedef void (*ConvertFunction) (float *, float *, float *);
+typedef void (*ConvertNFunction) (const float *, const float *, const float *,
+                                  float *, float *, float *, int);
+
+// Mostly in range, with the special cases of the conversions mixed in
+static float
+random_channel(void)
+{
+    static const float special[] = {
+        0.0f, -0.0f, 1.0f, 0.5f, 1.0f/3.0f, 2.0f/3.0f, 1.0001f, -0.0001f,
+        0.0001f, 0.00010001f, 0.99999994f, -1.0f, 2.5f, 1e-30f, 12345.678f, -3e9f
+    };
+    switch (rand() % 4) {
+    case 0:
+        return special[rand() % (sizeof(special)/sizeof(special[0]))];
+    case 1:
+        return random_float(-0.2f, 1.2f);
+    default:
+        return random_float(0.0f, 1.0f);
+    }
+}
+
+static void
+random_colors(float *a, float *b, float *c)
+{
+    for (int i = 0; i < COLORS; i++) {
+        a[i] = random_channel();
+        b[i] = random_channel();
+        c[i] = random_channel();
+        switch (rand() % 8) {
+        case 0: // gray
+            b[i] = c[i] = a[i];
+            break;
+        case 1: // two equal channels
+            c[i] = b[i];
+            break;
+        case 2: // almost gray, around the threshold of rgb_to_hsv_float()
+            b[i] = a[i] + 0.0001f*(1.0f + random_float(-0.001f, 0.001f));
+            c[i] = a[i];
+            break;
+        }
+    }
+}
+
+static int
+check_conversion(ConvertFunction convert, ConvertNFunction convert_n, const char *name)
+{
+    float *in[3], *expected[3], *actual[3];
+    for (int c = 0; c < 3; c++) {
+        in[c] = (float *)malloc(COLORS*sizeof(float));
+        expected[c] = (float *)malloc(COLORS*sizeof(float));
+        actual[c] = (float *)malloc(COLORS*sizeof(float));
+    }
+    random_colors(in[0], in[1], in[2]);
+    for (int i = 0; i < COLORS; i++) {
+        float c0 = in[0][i], c1 = in[1][i], c2 = in[2][i];
+        convert(&c0, &c1, &c2);
+        expected[0][i] = c0;
+        expected[1][i] = c1;
+        expected[2][i] = c2;
+    }
+
+    const SimdLevel supported = simd_level_supported();
+    int passed = 1;
+    for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+        simd_level_set((SimdLevel)level);
+        convert_n(in[0], in[1], in[2], actual[0], actual[1], actual[2], COLORS);
+        for (int c = 0; c < 3; c++) {
+            if (memcmp(expected[c], actual[c], COLORS*sizeof(float)) != 0) {
+                fprintf(stderr, "%s (%s): channel %d differs\n", name, simd_level_name((SimdLevel)level), c);
+                passed = 0;
+            }
+        }
+        // In place
+        for (int c = 0; c < 3; c++) {
+            memcpy(actual[c], in[c], COLORS*sizeof(float));
+        }
+        convert_n(actual[0], actual[1], actual[2], actual[0], actual[1], actual[2], COLORS);
+        for (int c = 0; c < 3; c++) {
+            if (memcmp(expected[c], actual[c], COLORS*sizeof(float)) != 0) {
+                fprintf(stderr, "%s (%s): channel %d differs in place\n", name, simd_level_name((SimdLevel)level), c);
+                passed = 0;
+            }
+        }
+    }
+    simd_level_set(supported);
+
+    for (int c = 0; c < 3; c++) {
+        free(in[c]);
+        free(expected[c]);
+        free(actual[c]);
+    }
+    return passed;
+}
+
+int
+test_color_conversion_rgb_to_hsv(void *user_data)
+{
+    srand(4242);
+    return expect_true(check_conversion(rgb_to_hsv_float, color_rgb_to_hsv_n, "rgb_to_hsv"),
+                       "same as rgb_to_hsv_float()");
+}
+
+int
+test_color_conversion_hsv_to_rgb(void *user_data)
+{
+    srand(4243);
+    return expect_true(check_conversion(hsv_to_rgb_float, color_hsv_to_rgb_n, "hsv_to_rgb"),
+                       "same as hsv_to_rgb_float()");
+}
+
+int
+test_color_conversion_rgb_to_hsl(void *user_data)
+{
+    srand(4244);
+    return expect_true(check_conversion(rgb_to_hsl_float, color_rgb_to_hsl_n, "rgb_to_hsl"),
+                       "same as rgb_to_hsl_float()");
+}
+
+int
+test_color_conversion_hsl_to_rgb(void *user_data)
+{
+    srand(4245);
+    return expect_true(check_conversion(hsl_to_rgb_float, color_hsl_to_rgb_n, "hsl_to_rgb"),
+                       "same as hsl_to_rgb_float()");
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/color_conversion/rgb_to_hsv", test_color_conversion_rgb_to_hsv, NULL},
+        {"/color_conversion/hsv_to_rgb", test_color_conversion_hsv_to_rgb, NULL},
+        {"/color_conversion/rgb_to_hsl", test_color_conversion_rgb_to_hsl, NULL},
+        {"/color_conversion/hsl_to_rgb", test_color_conversion_hsl_to_rgb, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
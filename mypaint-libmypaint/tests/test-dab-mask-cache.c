@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mypaint-fixed-tiled-surface.h>
+#include <dabmaskcache.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE 256
+
+static void
+draw_dab(MyPaintSurface *surface, float x, float y, float radius)
+{
+    mypaint_surface_begin_atomic(surface);
+    mypaint_surface_draw_dab(surface, x, y, radius,
+                             0.2f, 0.4f, 0.6f, 0.8f, 0.7f,
+                             1.0f, 1.5f, 30.0f, 0.0f, 0.0f);
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+// Largest difference of any channel in any pixel of the two surfaces
+static int
+max_difference(MyPaintTiledSurface *a, MyPaintTiledSurface *b)
+{
+    const int tiles = SURFACE_SIZE/MYPAINT_TILE_SIZE;
+    int max_diff = 0;
+
+    for (int ty = 0; ty < tiles; ty++) {
+        for (int tx = 0; tx < tiles; tx++) {
+            MyPaintTileRequest request_a;
+            MyPaintTileRequest request_b;
+            mypaint_tile_request_init(&request_a, 0, tx, ty, TRUE);
+            mypaint_tile_request_init(&request_b, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(a, &request_a);
+            mypaint_tiled_surface_tile_request_start(b, &request_b);
+
+            for (int i = 0; i < MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE*4; i++) {
+                const int diff = abs((int)request_a.buffer[i] - (int)request_b.buffer[i]);
+                if (diff > max_diff) {
+                    max_diff = diff;
+                }
+            }
+
+            mypaint_tiled_surface_tile_request_end(a, &request_a);
+            mypaint_tiled_surface_tile_request_end(b, &request_b);
+        }
+    }
+    return max_diff;
+}
+
+int
+test_dab_mask_cache_disabled(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    int hits = -1;
+    int misses = -1;
+
+    draw_dab((MyPaintSurface *)surface, 100.0f, 100.0f, 10.0f);
+    draw_dab((MyPaintSurface *)surface, 120.0f, 100.0f, 10.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+
+    int passed = expect_int(0, hits, "hits") & expect_int(0, misses, "misses");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+test_dab_mask_cache_hits(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    int hits = 0;
+    int misses = 0;
+
+    mypaint_tiled_surface_set_dab_mask_cache_size(tiled, 1024*1024);
+
+    // Same geometry and subpixel position, so only the first dab is rendered.
+    // The dabs overlap several tiles, each tile looks up the mask once.
+    draw_dab((MyPaintSurface *)surface, 64.25f, 64.5f, 10.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    int passed = expect_int(1, misses, "misses after first dab");
+    passed &= expect_int(3, hits, "hits after first dab");
+
+    draw_dab((MyPaintSurface *)surface, 170.25f, 120.5f, 10.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    passed &= expect_int(1, misses, "misses after second dab");
+    passed &= expect_true(hits > 3, "hits after second dab");
+
+    // A different radius needs a new mask
+    draw_dab((MyPaintSurface *)surface, 170.25f, 120.5f, 20.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    passed &= expect_int(2, misses, "misses after third dab");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+test_dab_mask_cache_matches_uncached(void *user_data)
+{
+    MyPaintFixedTiledSurface *cached = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *uncached = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+
+    mypaint_tiled_surface_set_dab_mask_cache_size((MyPaintTiledSurface *)cached, 1024*1024);
+
+    for (int i = 0; i < 40; i++) {
+        const float x = 40.0f + i*4.37f;
+        const float y = 60.0f + i*3.11f;
+        const float radius = 3.0f + (i % 7)*2.3f;
+        draw_dab((MyPaintSurface *)cached, x, y, radius);
+        draw_dab((MyPaintSurface *)uncached, x, y, radius);
+    }
+
+    // Quantizing the dab geometry moves edges by a fraction of a pixel at most
+    const int max_diff = max_difference((MyPaintTiledSurface *)cached, (MyPaintTiledSurface *)uncached);
+    int passed = expect_true(max_diff < (1<<15)/4, "cached dabs close to uncached dabs");
+
+    mypaint_surface_unref((MyPaintSurface *)cached);
+    mypaint_surface_unref((MyPaintSurface *)uncached);
+    return passed;
+}
+
+int
+test_dab_mask_cache_memory_limit(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    int hits = 0;
+    int misses = 0;
+
+    // Room for a few small masks only. Bigger dabs bypass the cache.
+    mypaint_tiled_surface_set_dab_mask_cache_size(tiled, 4*1024);
+
+    draw_dab((MyPaintSurface *)surface, 100.0f, 100.0f, 60.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    int passed = expect_int(0, hits + misses, "big dab bypasses cache");
+
+    for (int i = 0; i < 20; i++) {
+        draw_dab((MyPaintSurface *)surface, 30.0f, 30.0f, 2.0f + i*0.2f);
+    }
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    passed &= expect_int(20, misses, "misses for distinct small dabs");
+
+    // The oldest masks were evicted to stay within the limit
+    draw_dab((MyPaintSurface *)surface, 30.0f, 30.0f, 2.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    passed &= expect_int(21, misses, "miss for evicted dab");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+test_dab_mask_cache_get_color(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    float first[4];
+    float color[4];
+    int hits = 0;
+    int misses = 0;
+
+    draw_dab((MyPaintSurface *)surface, 64.0f, 64.0f, 30.0f);
+
+    // The sampling mask is rendered once and reused for each tile and call,
+    // without the (disabled) quantizing cache
+    mypaint_surface_get_color((MyPaintSurface *)surface, 64.25f, 64.5f, 10.0f,
+                              &first[0], &first[1], &first[2], &first[3]);
+    for (int i = 0; i < 3; i++) {
+        mypaint_surface_get_color((MyPaintSurface *)surface, 64.25f, 64.5f, 10.0f,
+                                  &color[0], &color[1], &color[2], &color[3]);
+    }
+    dab_mask_cache_get_stats(tiled->exact_mask_cache, &hits, &misses, NULL, NULL);
+    int passed = expect_int(1, misses, "misses after repeated get_color");
+    passed &= expect_int(15, hits, "hits after repeated get_color");
+    passed &= expect_true(memcmp(first, color, sizeof(first)) == 0, "same color from reused mask");
+
+    // Same subpixel offset elsewhere on the surface
+    mypaint_surface_get_color((MyPaintSurface *)surface, 170.25f, 120.5f, 10.0f,
+                              &color[0], &color[1], &color[2], &color[3]);
+    dab_mask_cache_get_stats(tiled->exact_mask_cache, &hits, &misses, NULL, NULL);
+    passed &= expect_int(1, misses, "misses after moved get_color");
+
+    // Another subpixel offset needs a new mask
+    mypaint_surface_get_color((MyPaintSurface *)surface, 64.75f, 64.5f, 10.0f,
+                              &color[0], &color[1], &color[2], &color[3]);
+    dab_mask_cache_get_stats(tiled->exact_mask_cache, &hits, &misses, NULL, NULL);
+    passed &= expect_int(2, misses, "misses after new subpixel offset");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/dab_mask_cache/disabled", test_dab_mask_cache_disabled, NULL},
+        {"/dab_mask_cache/hits", test_dab_mask_cache_hits, NULL},
+        {"/dab_mask_cache/matches_uncached", test_dab_mask_cache_matches_uncached, NULL},
+        {"/dab_mask_cache/memory_limit", test_dab_mask_cache_memory_limit, NULL},
+        {"/dab_mask_cache/get_color", test_dab_mask_cache_get_color, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mypaint-tiled-surface.h"
+#include "tiled-surface-private.h"
+#include "brushmodes.h"
+#include "simd.h"
+
+#include "testutils.h"
+
+#define DABS 300
+
+static const int tile_sizes[] = {32, 64, 128, 256};
+
+typedef struct {
+    float x;
+    float y;
+    float radius;
+    float hardness;
+    float aspect_ratio;
+    float angle;
+} Dab;
+
+static void
+random_dab(Dab *dab, int tile_size)
+{
+    dab->radius = random_float(0.5f, 40.0f);
+    // Also dabs which are partially outside of the tile
+    dab->x = random_float(-dab->radius, tile_size + dab->radius);
+    dab->y = random_float(-dab->radius, tile_size + dab->radius);
+    dab->hardness = random_float(0.0f, 1.0f);
+    dab->aspect_ratio = random_float(1.0f, 5.0f);
+    dab->angle = random_float(0.0f, 180.0f);
+}
+
+static void
+random_tile(uint16_t *rgba, int pixels)
+{
+    for (int i = 0; i < pixels*4; i++) {
+        // Mostly valid fix15 values, sometimes out of range ones
+        rgba[i] = (rand() % 8) ? rand() % ((1<<15) + 1) : rand() % (1<<16);
+    }
+}
+
+// Blends the dab with both the run length encoded and the span mask
+// and checks that the results are identical.
+static int
+check_dab(const Dab *dab, const uint16_t *original, int tile_size, const char *level_name)
+{
+    const size_t tile_bytes = tile_size*tile_size*4*sizeof(uint16_t);
+    uint16_t *rle_mask = (uint16_t *)malloc(DAB_MASK_RLE_SIZE(tile_size)*sizeof(uint16_t));
+    DabMask *mask = dab_mask_new(tile_size);
+    uint16_t *expected = (uint16_t *)malloc(tile_bytes);
+    uint16_t *actual = (uint16_t *)malloc(tile_bytes);
+
+    const uint16_t r = rand() % ((1<<15) + 1);
+    const uint16_t g = rand() % ((1<<15) + 1);
+    const uint16_t b = rand() % ((1<<15) + 1);
+    const uint16_t a = rand() % ((1<<15) + 1);
+    const uint16_t opacity = rand() % ((1<<15) + 1);
+
+    render_dab_mask(rle_mask, tile_size, dab->x, dab->y, dab->radius, dab->hardness, dab->aspect_ratio, dab->angle);
+    render_dab_mask_spans(mask, dab->x, dab->y, dab->radius, dab->hardness, dab->aspect_ratio, dab->angle);
+
+    int passed = 1;
+    for (int mode = 0; mode < 4; mode++) {
+        memcpy(expected, original, tile_bytes);
+        memcpy(actual, original, tile_bytes);
+
+        switch (mode) {
+        case 0:
+            draw_dab_pixels_BlendMode_Normal(rle_mask, expected, r, g, b, opacity);
+            draw_dab_spans_BlendMode_Normal(mask, actual, r, g, b, opacity);
+            break;
+        case 1:
+            draw_dab_pixels_BlendMode_Normal_and_Eraser(rle_mask, expected, r, g, b, a, opacity);
+            draw_dab_spans_BlendMode_Normal_and_Eraser(mask, actual, r, g, b, a, opacity);
+            break;
+        case 2:
+            draw_dab_pixels_BlendMode_LockAlpha(rle_mask, expected, r, g, b, opacity);
+            draw_dab_spans_BlendMode_LockAlpha(mask, actual, r, g, b, opacity);
+            break;
+        case 3:
+            draw_dab_pixels_BlendMode_Color(rle_mask, expected, r, g, b, opacity);
+            draw_dab_spans_BlendMode_Color(mask, actual, r, g, b, opacity);
+            break;
+        }
+
+        if (memcmp(expected, actual, tile_bytes) != 0) {
+            fprintf(stderr, "%s, tile size %d: blend mode %d differs for dab x=%f y=%f radius=%f hardness=%f aspect_ratio=%f angle=%f\n",
+                    level_name, tile_size, mode, dab->x, dab->y, dab->radius, dab->hardness, dab->aspect_ratio, dab->angle);
+            passed = 0;
+        }
+    }
+
+    // Color sampling, as done by get_color()
+    float expected_sums[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    uint32_t actual_sums[5] = {0, 0, 0, 0, 0};
+    get_color_pixels_accumulate(rle_mask, (uint16_t *)original, &expected_sums[0],
+                                &expected_sums[1], &expected_sums[2], &expected_sums[3], &expected_sums[4]);
+    get_color_spans_accumulate(mask, original, actual_sums);
+    for (int i = 0; i < 5; i++) {
+        if (expected_sums[i] != (float)actual_sums[i]) {
+            fprintf(stderr, "%s, tile size %d: color sum %d differs for dab x=%f y=%f radius=%f\n",
+                    level_name, tile_size, i, dab->x, dab->y, dab->radius);
+            passed = 0;
+        }
+    }
+
+    free(rle_mask);
+    dab_mask_free(mask);
+    free(expected);
+    free(actual);
+    return passed;
+}
+
+int
+test_dab_mask_matches_rle(void *user_data)
+{
+    const SimdLevel supported = simd_level_supported();
+    int passed = 1;
+
+    for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+        simd_level_set((SimdLevel)level);
+        srand(1234);
+        for (int t = 0; t < sizeof(tile_sizes)/sizeof(tile_sizes[0]); t++) {
+            const int tile_size = tile_sizes[t];
+            uint16_t *tile = (uint16_t *)malloc(tile_size*tile_size*4*sizeof(uint16_t));
+            random_tile(tile, tile_size*tile_size);
+            for (int i = 0; i < DABS; i++) {
+                Dab dab;
+                random_dab(&dab, tile_size);
+                passed &= check_dab(&dab, tile, tile_size, simd_level_name((SimdLevel)level));
+            }
+            free(tile);
+        }
+    }
+    simd_level_set(supported);
+
+    return expect_true(passed, "span masks blend and sample identically to run length encoded masks");
+}
+
+int
+test_dab_mask_outside_tile(void *user_data)
+{
+    DabMask *mask = dab_mask_new(MYPAINT_TILE_SIZE);
+
+    render_dab_mask_spans(mask, -50.0f, 20.0f, 10.0f, 0.5f, 1.0f, 0.0f);
+    int passed = expect_true(mask->y0 >= mask->y1, "dab left of tile is empty");
+
+    render_dab_mask_spans(mask, 20.0f, MYPAINT_TILE_SIZE + 50.0f, 10.0f, 0.5f, 1.0f, 0.0f);
+    passed &= expect_true(mask->y0 >= mask->y1, "dab below tile is empty");
+
+    dab_mask_free(mask);
+    return passed;
+}
+
+// In big tiles, the skip to the first row of a dab does not fit into one
+// run length encoded entry
+int
+test_dab_mask_rle_long_skip(void *user_data)
+{
+    const int tile_size = MYPAINT_MAX_TILE_SIZE;
+    uint16_t *rle_mask = (uint16_t *)malloc(DAB_MASK_RLE_SIZE(tile_size)*sizeof(uint16_t));
+    uint16_t *rgba = (uint16_t *)calloc(tile_size*tile_size*4, sizeof(uint16_t));
+
+    render_dab_mask(rle_mask, tile_size, 200.5f, 240.5f, 5.0f, 1.0f, 1.0f, 0.0f);
+    draw_dab_pixels_BlendMode_Normal(rle_mask, rgba, 1<<15, 0, 0, 1<<15);
+
+    const uint16_t *center = rgba + (240*tile_size + 200)*4;
+    int passed = expect_int(1<<15, center[0], "red at the dab center");
+    passed &= expect_int(1<<15, center[3], "alpha at the dab center");
+    passed &= expect_int(0, rgba[(240*tile_size + 180)*4 + 3], "alpha next to the dab");
+
+    free(rle_mask);
+    free(rgba);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/dab_mask/matches_rle", test_dab_mask_matches_rle, NULL},
+        {"/dab_mask/outside_tile", test_dab_mask_outside_tile, NULL},
+        {"/dab_mask/rle_long_skip", test_dab_mask_rle_long_skip, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
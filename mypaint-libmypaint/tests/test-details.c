@@ -22,11 +22,20 @@ int main(int argc, char *argv[])
 
     const int iterations = 1000000;
 
-    uint16_t buffer[MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE+2*MYPAINT_TILE_SIZE];
+    uint16_t buffer[DAB_MASK_RLE_SIZE(MYPAINT_TILE_SIZE)];
     mypaint_benchmark_start("render_dab_mask");
     for (int i=0; i < iterations; i++) {
-        render_dab_mask(buffer, x, y, radius, hardness, aspect_ratio, angle);
+        render_dab_mask(buffer, MYPAINT_TILE_SIZE, x, y, radius, hardness, aspect_ratio, angle);
     }
     const int duration = mypaint_benchmark_end();
     printf("render_dab_mask: %d ms\n", duration);
+
+    DabMask *mask = dab_mask_new(MYPAINT_TILE_SIZE);
+    mypaint_benchmark_start("render_dab_mask_spans");
+    for (int i=0; i < iterations; i++) {
+        render_dab_mask_spans(mask, x, y, radius, hardness, aspect_ratio, angle);
+    }
+    const int duration_spans = mypaint_benchmark_end();
+    printf("render_dab_mask_spans: %d ms\n", duration_spans);
+    dab_mask_free(mask);
 }
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <mypaint-surface.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE (16*MYPAINT_TILE_SIZE)
+#define MAX_RECTS 64
+
+static void
+dab(MyPaintSurface *surface, float x, float y, float radius)
+{
+    mypaint_surface_draw_dab(surface, x, y, radius, 1.0f, 0.0f, 0.0f,
+                             1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+}
+
+static gboolean
+rect_contains(const MyPaintRectangle *outer, const MyPaintRectangle *inner)
+{
+    return inner->x >= outer->x && inner->y >= outer->y
+        && inner->x + inner->width <= outer->x + outer->width
+        && inner->y + inner->height <= outer->y + outer->height;
+}
+
+// TRUE if the area of the dab at (x, y) is within one of @rects
+static gboolean
+rects_cover_dab(const MyPaintRectangle *rects, int rects_n, float x, float y, float radius)
+{
+    const float r_fringe = radius + 1.0f;
+    MyPaintRectangle dab_rect;
+    dab_rect.x = floor(x - r_fringe);
+    dab_rect.y = floor(y - r_fringe);
+    dab_rect.width = floor(x + r_fringe) - dab_rect.x + 1;
+    dab_rect.height = floor(y + r_fringe) - dab_rect.y + 1;
+    for (int i = 0; i < rects_n; i++) {
+        if (rect_contains(&rects[i], &dab_rect)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int
+test_dirty_rects_distant_dabs(void *user_data)
+{
+    MyPaintFixedTiledSurface *fixed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintSurface *surface = (MyPaintSurface *)fixed;
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)fixed;
+    MyPaintRectangle rects[MAX_RECTS];
+    MyPaintRectangle roi;
+    int passed = 1;
+
+    // Two short strokes in opposite corners, like with symmetry
+    mypaint_surface_begin_atomic(surface);
+    for (int i = 0; i < 10; i++) {
+        dab(surface, 50.0f + 3*i, 50.0f, 10.0f);
+        dab(surface, SURFACE_SIZE - 50.0f - 3*i, SURFACE_SIZE - 50.0f, 10.0f);
+    }
+    mypaint_surface_end_atomic(surface, &roi);
+
+    int rects_n = mypaint_tiled_surface_get_dirty_rects(tiled, rects, MAX_RECTS);
+    passed &= expect_int(2, rects_n, "one rectangle per stroke");
+    int64_t area = 0;
+    gboolean within_roi = TRUE;
+    for (int i = 0; i < rects_n; i++) {
+        area += (int64_t)rects[i].width * rects[i].height;
+        within_roi &= rect_contains(&roi, &rects[i]);
+    }
+    passed &= expect_true(within_roi, "rectangles are within the bounding box");
+    passed &= expect_true(area < 2*60*30, "only the area of the strokes");
+
+    // Merged down to the bounding box
+    rects_n = mypaint_tiled_surface_get_dirty_rects(tiled, rects, 1);
+    passed &= expect_int(1, rects_n, "merged into one rectangle");
+    passed &= expect_true(rects[0].x == roi.x && rects[0].y == roi.y
+                          && rects[0].width == roi.width && rects[0].height == roi.height,
+                          "one rectangle is the bounding box");
+
+    // Cleared by begin_atomic
+    mypaint_surface_begin_atomic(surface);
+    mypaint_surface_end_atomic(surface, &roi);
+    passed &= expect_int(0, mypaint_tiled_surface_get_dirty_rects(tiled, rects, MAX_RECTS), "no rectangles");
+
+    mypaint_surface_unref(surface);
+    return passed;
+}
+
+int
+test_dirty_rects_bounded(void *user_data)
+{
+    MyPaintFixedTiledSurface *fixed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintSurface *surface = (MyPaintSurface *)fixed;
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)fixed;
+    MyPaintRectangle rects[MAX_RECTS];
+    float xs[1000], ys[1000], radii[1000];
+    int passed = 1;
+
+    // Random dabs, and a diagonal stroke across the surface
+    srand(4321);
+    mypaint_surface_begin_atomic(surface);
+    for (int i = 0; i < 1000; i++) {
+        if (i < 500) {
+            xs[i] = SURFACE_SIZE * (rand() / (float)RAND_MAX);
+            ys[i] = SURFACE_SIZE * (rand() / (float)RAND_MAX);
+            radii[i] = 1.0f + 20.0f * (rand() / (float)RAND_MAX);
+        } else {
+            xs[i] = ys[i] = (i - 500) * SURFACE_SIZE / 500.0f;
+            radii[i] = 8.0f;
+        }
+        dab(surface, xs[i], ys[i], radii[i]);
+    }
+    mypaint_surface_end_atomic(surface, NULL);
+
+    const int rects_n = mypaint_tiled_surface_get_dirty_rects(tiled, rects, MAX_RECTS);
+    passed &= expect_true(rects_n > 1 && rects_n <= 32, "bounded number of rectangles");
+    gboolean covered = TRUE;
+    for (int i = 0; i < 1000; i++) {
+        covered &= rects_cover_dab(rects, rects_n, xs[i], ys[i], radii[i]);
+    }
+    passed &= expect_true(covered, "every dab is within a rectangle");
+
+    mypaint_surface_unref(surface);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/dirty_rects/distant_dabs", test_dirty_rects_distant_dabs, NULL},
+        {"/dirty_rects/bounded", test_dirty_rects_bounded, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
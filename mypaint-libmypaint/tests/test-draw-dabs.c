@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mypaint-surface.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE (4*MYPAINT_TILE_SIZE)
+#define IMAGE_BYTES (SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t))
+#define DABS 200
+
+typedef struct {
+    float x[DABS];
+    float y[DABS];
+    float radius[DABS];
+    float color_r[DABS];
+    float color_g[DABS];
+    float color_b[DABS];
+    float opaque[DABS];
+    float hardness[DABS];
+    float alpha_eraser[DABS];
+    float aspect_ratio[DABS];
+    float angle[DABS];
+    float lock_alpha[DABS];
+    float colorize[DABS];
+} DabArrays;
+
+static void
+random_dabs(DabArrays *arrays, MyPaintDabs *dabs)
+{
+    for (int i = 0; i < DABS; i++) {
+        arrays->x[i] = random_float(-20.0f, SURFACE_SIZE + 20.0f);
+        arrays->y[i] = random_float(-20.0f, SURFACE_SIZE + 20.0f);
+        arrays->radius[i] = random_float(0.0f, 40.0f);
+        arrays->color_r[i] = random_float(0.0f, 1.0f);
+        arrays->color_g[i] = random_float(0.0f, 1.0f);
+        arrays->color_b[i] = random_float(0.0f, 1.0f);
+        // Also some dabs which are skipped
+        arrays->opaque[i] = (rand() % 10) ? random_float(0.0f, 1.0f) : 0.0f;
+        arrays->hardness[i] = random_float(0.0f, 1.0f);
+        arrays->alpha_eraser[i] = random_float(0.0f, 1.0f);
+        arrays->aspect_ratio[i] = random_float(1.0f, 4.0f);
+        arrays->angle[i] = random_float(0.0f, 180.0f);
+        arrays->lock_alpha[i] = (rand() % 4) ? 0.0f : random_float(0.0f, 1.0f);
+        arrays->colorize[i] = (rand() % 4) ? 0.0f : random_float(0.0f, 1.0f);
+    }
+
+    const MyPaintDabs batch = {
+        DABS,
+        arrays->x, arrays->y, arrays->radius,
+        arrays->color_r, arrays->color_g, arrays->color_b,
+        arrays->opaque, arrays->hardness, arrays->alpha_eraser,
+        arrays->aspect_ratio, arrays->angle,
+        arrays->lock_alpha, arrays->colorize
+    };
+    *dabs = batch;
+}
+
+// A surface which only implements draw_dab, and records the calls
+typedef struct {
+    MyPaintSurface parent;
+    int calls;
+    int in_order;
+} RecordingSurface;
+
+static int
+recording_draw_dab(MyPaintSurface *surface, float x, float y, float radius,
+                   float color_r, float color_g, float color_b,
+                   float opaque, float hardness, float alpha_eraser,
+                   float aspect_ratio, float angle, float lock_alpha, float colorize)
+{
+    RecordingSurface *self = (RecordingSurface *)surface;
+    self->in_order &= (x == (float)self->calls);
+    self->calls++;
+    return radius > 1.0f;
+}
+
+int
+test_draw_dabs_fallback(void *user_data)
+{
+    RecordingSurface surface;
+    mypaint_surface_init(&surface.parent);
+    surface.parent.draw_dab = recording_draw_dab;
+    surface.calls = 0;
+    surface.in_order = TRUE;
+
+    DabArrays arrays;
+    MyPaintDabs dabs;
+    random_dabs(&arrays, &dabs);
+    int expected_painted = 0;
+    for (int i = 0; i < DABS; i++) {
+        arrays.x[i] = i;
+        expected_painted += (arrays.radius[i] > 1.0f);
+    }
+
+    const int painted = mypaint_surface_draw_dabs(&surface.parent, &dabs);
+    int passed = expect_int(DABS, surface.calls, "draw_dab calls");
+    passed &= expect_true(surface.in_order, "dabs are drawn in order");
+    passed &= expect_int(expected_painted, painted, "dabs which modified the surface");
+    return passed;
+}
+
+static uint16_t *
+paint(const MyPaintDabs *dabs, gboolean batched, gboolean symmetry, int *painted, MyPaintRectangle *roi)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    mypaint_tiled_surface_set_symmetry_state(tiled, symmetry, SURFACE_SIZE/3);
+
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    if (batched) {
+        *painted = mypaint_surface_draw_dabs((MyPaintSurface *)surface, dabs);
+    } else {
+        *painted = 0;
+        for (int i = 0; i < dabs->count; i++) {
+            *painted += mypaint_surface_draw_dab((MyPaintSurface *)surface,
+                                                 dabs->x[i], dabs->y[i], dabs->radius[i],
+                                                 dabs->color_r[i], dabs->color_g[i], dabs->color_b[i],
+                                                 dabs->opaque[i], dabs->hardness[i], dabs->alpha_eraser[i],
+                                                 dabs->aspect_ratio[i], dabs->angle[i],
+                                                 dabs->lock_alpha[i], dabs->colorize[i]);
+        }
+    }
+    mypaint_surface_end_atomic((MyPaintSurface *)surface, roi);
+
+    uint16_t *image = read_image(tiled, SURFACE_SIZE, SURFACE_SIZE);
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return image;
+}
+
+int
+test_draw_dabs_tiled_surface(void *user_data)
+{
+    DabArrays arrays;
+    MyPaintDabs dabs;
+    int passed = 1;
+
+    srand(4711);
+    random_dabs(&arrays, &dabs);
+
+    for (int symmetry = 0; symmetry <= 1; symmetry++) {
+        int expected_painted, painted;
+        MyPaintRectangle expected_roi, roi;
+        uint16_t *expected = paint(&dabs, FALSE, symmetry, &expected_painted, &expected_roi);
+        uint16_t *actual = paint(&dabs, TRUE, symmetry, &painted, &roi);
+
+        passed &= expect_true(expected_painted > 0 && expected_painted < DABS, "some dabs are skipped");
+        passed &= expect_int(expected_painted, painted, "dabs which modified the surface");
+        passed &= expect_true(memcmp(&expected_roi, &roi, sizeof(roi)) == 0, "same invalidated area");
+        passed &= expect_true(memcmp(expected, actual, IMAGE_BYTES) == 0, "batch paints the same as single dabs");
+
+        free(expected);
+        free(actual);
+    }
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/draw_dabs/fallback", test_draw_dabs_fallback, NULL},
+        {"/draw_dabs/tiled_surface", test_draw_dabs_tiled_surface, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
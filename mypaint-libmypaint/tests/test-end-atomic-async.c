@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE (10*MYPAINT_TILE_SIZE)
+#define IMAGE_BYTES (SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t))
+#define EVENTS 400
+#define EVENTS_PER_ATOMIC 8
+#define BATCHES (EVENTS/EVENTS_PER_ATOMIC)
+
+typedef enum {
+    END_ATOMIC_SYNC,
+    END_ATOMIC_ASYNC,
+    END_ATOMIC_ASYNC_THREADSAFE
+} EndAtomicMode;
+
+// Smudging, so that get_color() has to wait for the tiles being processed
+static MyPaintBrush *
+smudge_brush(void)
+{
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, log(12.0));
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_COLOR_S, 0.8);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_COLOR_V, 0.7);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_SMUDGE, 0.5);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_SMUDGE_LENGTH, 0.3);
+    return brush;
+}
+
+// A spiral which crosses its own path, staying inside of the surface
+static void
+event_position(int i, float *x, float *y)
+{
+    const float angle = i * 0.05f;
+    const float radius = 50.0f + i * 0.5f;
+    *x = SURFACE_SIZE/2 + radius*cosf(angle);
+    *y = SURFACE_SIZE/2 + radius*sinf(angle);
+}
+
+// With @samples, the color under the last dab is picked after each batch,
+// 4 values per batch, while the batch may still be processed.
+static uint16_t *
+paint(EndAtomicMode mode, size_t dab_mask_cache_bytes, float *samples)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    MyPaintBrush *brush = smudge_brush();
+
+    if (mode == END_ATOMIC_ASYNC_THREADSAFE) {
+        // Only the tile outside of the surface is shared, which is never painted on here
+        tiled->threadsafe_tile_requests = TRUE;
+    }
+    mypaint_tiled_surface_set_dab_mask_cache_size(tiled, dab_mask_cache_bytes);
+
+    mypaint_brush_reset(brush);
+    for (int i = 0; i < EVENTS; i += EVENTS_PER_ATOMIC) {
+        mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+        for (int j = i; j < i + EVENTS_PER_ATOMIC; j++) {
+            float x, y;
+            event_position(j, &x, &y);
+            mypaint_brush_stroke_to(brush, (MyPaintSurface *)surface, x, y, 0.8, 0.0, 0.0, 0.01);
+        }
+        if (mode == END_ATOMIC_SYNC) {
+            mypaint_surface_end_atomic((MyPaintSurface *)surface, NULL);
+        } else {
+            mypaint_tiled_surface_end_atomic_async(tiled, NULL);
+        }
+        if (samples) {
+            float x, y;
+            event_position(i + EVENTS_PER_ATOMIC - 1, &x, &y);
+            float *rgba = samples + 4*(i/EVENTS_PER_ATOMIC);
+            mypaint_surface_get_color((MyPaintSurface *)surface, x, y, 12.0f,
+                                      &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
+        }
+    }
+    // Wait for the last batch
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    mypaint_surface_end_atomic((MyPaintSurface *)surface, NULL);
+
+    // All tiles, one after the other
+    const int tiles = SURFACE_SIZE / MYPAINT_TILE_SIZE;
+    const size_t tile_bytes = MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE*4*sizeof(uint16_t);
+    uint16_t *image = (uint16_t *)malloc(IMAGE_BYTES);
+    for (int ty = 0; ty < tiles; ty++) {
+        for (int tx = 0; tx < tiles; tx++) {
+            MyPaintTileRequest request;
+            mypaint_tile_request_init(&request, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(tiled, &request);
+            memcpy((char *)image + (ty*tiles + tx)*tile_bytes, request.buffer, tile_bytes);
+            mypaint_tiled_surface_tile_request_end(tiled, &request);
+        }
+    }
+
+    mypaint_brush_unref(brush);
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return image;
+}
+
+int
+test_end_atomic_async_same_result(void *user_data)
+{
+    uint16_t *expected = paint(END_ATOMIC_SYNC, 0, NULL);
+    uint16_t *async = paint(END_ATOMIC_ASYNC, 0, NULL);
+    uint16_t *async_threadsafe = paint(END_ATOMIC_ASYNC_THREADSAFE, 0, NULL);
+
+    int painted = 0;
+    for (int i = 0; i < SURFACE_SIZE*SURFACE_SIZE*4; i++) {
+        painted += (expected[i] != 0xffff);
+    }
+    int passed = expect_true(painted > 0, "stroke was painted");
+    passed &= expect_true(memcmp(expected, async, IMAGE_BYTES) == 0, "async paints the same as sync");
+    passed &= expect_true(memcmp(expected, async_threadsafe, IMAGE_BYTES) == 0, "async with threadsafe tile requests paints the same as sync");
+
+    free(expected);
+    free(async);
+    free(async_threadsafe);
+    return passed;
+}
+
+// get_color() and the tile worker share the dab mask cache.
+// Meant for builds without OpenMP too (scons enable_openmp=False),
+// best with -fsanitize=thread.
+int
+test_end_atomic_async_dab_mask_cache(void *user_data)
+{
+    float expected_samples[BATCHES*4];
+    float samples[BATCHES*4];
+    uint16_t *expected = paint(END_ATOMIC_SYNC, 1024*1024, expected_samples);
+    uint16_t *async = paint(END_ATOMIC_ASYNC_THREADSAFE, 1024*1024, samples);
+
+    int passed = expect_true(memcmp(expected, async, IMAGE_BYTES) == 0, "async paints the same as sync");
+    passed &= expect_true(memcmp(expected_samples, samples, sizeof(samples)) == 0,
+                          "colors picked during async processing are the same as sync");
+
+    free(expected);
+    free(async);
+    return passed;
+}
+
+int
+test_end_atomic_async_handles(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    MyPaintBrush *brush = smudge_brush();
+
+    mypaint_brush_reset(brush);
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    for (int i = 0; i < EVENTS; i++) {
+        float x, y;
+        event_position(i, &x, &y);
+        mypaint_brush_stroke_to(brush, (MyPaintSurface *)surface, x, y, 0.8, 0.0, 0.0, 0.01);
+    }
+
+    MyPaintRectangle roi;
+    const int first = mypaint_tiled_surface_end_atomic_async(tiled, &roi);
+    int passed = expect_true(roi.width > 0 && roi.height > 0, "changed area is known right away");
+
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    const int second = mypaint_tiled_surface_end_atomic_async(tiled, NULL);
+    passed &= expect_true(second > first, "handles increase");
+    passed &= expect_true(mypaint_tiled_surface_is_done(tiled, first), "previous batch is done when starting a new one");
+
+    mypaint_tiled_surface_wait(tiled, second);
+    passed &= expect_true(mypaint_tiled_surface_is_done(tiled, second), "batch is done after waiting");
+
+    mypaint_brush_unref(brush);
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/end_atomic_async/same_result", test_end_atomic_async_same_result, NULL},
+        {"/end_atomic_async/dab_mask_cache", test_end_atomic_async_dab_mask_cache, NULL},
+        {"/end_atomic_async/handles", test_end_atomic_async_handles, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
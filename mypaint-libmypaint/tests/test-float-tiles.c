@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mypaint-surface.h"
+#include "mypaint-fixed-tiled-surface.h"
+#include "tiled-surface-private.h"
+#include "floattile.h"
+#include "simd.h"
+
+#include "testutils.h"
+
+#define DABS 200
+#define SURFACE_SIZE (2*MYPAINT_TILE_SIZE)
+
+static const MyPaintTileFormat float_formats[] = {
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT32,
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT16,
+};
+
+int
+test_float_tiles_half_roundtrip(void *user_data)
+{
+    int passed = 1;
+
+    // Every finite half survives the conversion to float and back
+    int mismatches = 0;
+    for (int h = 0; h < (1<<16); h++) {
+        if ((h & 0x7c00) == 0x7c00) {
+            continue; // infinity and NaN
+        }
+        if (float_to_half(half_to_float(h)) != h) {
+            mismatches++;
+        }
+    }
+    passed &= expect_int(0, mismatches, "all finite halfs roundtrip");
+
+    passed &= expect_int(0x3c00, float_to_half(1.0f), "1.0");
+    passed &= expect_int(0x3c00, float_to_half(1.0f + 1.0f/2048), "tie rounds to even, down");
+    passed &= expect_int(0x3c02, float_to_half(1.0f + 3.0f/2048), "tie rounds to even, up");
+    passed &= expect_int(0x0001, float_to_half(ldexpf(1.0f, -24)), "smallest subnormal");
+    passed &= expect_int(0x0000, float_to_half(ldexpf(1.0f, -26)), "underflow to zero");
+    passed &= expect_int(0x7bff, float_to_half(65504.0f), "largest finite");
+    passed &= expect_int(0x7c00, float_to_half(65520.0f), "overflow to infinity");
+
+    // The array conversions match the scalar ones, also in the vector tail
+    float values[1001];
+    uint16_t halfs[1001];
+    float back[1001];
+    int array_mismatches = 0;
+    srand(1234);
+    for (int i = 0; i < 1001; i++) {
+        values[i] = random_float(-2.0f, 2.0f);
+    }
+    float_to_half_array(values, halfs, 1001);
+    half_to_float_array(halfs, back, 1001);
+    for (int i = 0; i < 1001; i++) {
+        if (halfs[i] != float_to_half(values[i]) || back[i] != half_to_float(halfs[i])) {
+            array_mismatches++;
+        }
+    }
+    passed &= expect_int(0, array_mismatches, "array conversions match scalar ones");
+
+    return passed;
+}
+
+static void
+random_float_tile(float *rgba, int pixels)
+{
+    for (int i = 0; i < pixels; i++) {
+        const float a = random_float(0.0f, 1.0f);
+        for (int c = 0; c < 3; c++) {
+            rgba[i*4+c] = random_float(0.0f, a); // premultiplied
+        }
+        rgba[i*4+3] = a;
+    }
+}
+
+// Blends random dabs into a random tile of @format at every SIMD level,
+// the results must be identical to the scalar ones.
+static int
+check_simd_levels(MyPaintTileFormat format)
+{
+    const int tile_size = MYPAINT_TILE_SIZE;
+    const size_t tile_bytes = mypaint_tile_format_get_tile_bytes(format, tile_size);
+    const SimdLevel supported = simd_level_supported();
+    DabMask *mask = dab_mask_new(tile_size);
+    float *original = (float *)malloc(tile_size*tile_size*4*sizeof(float));
+    void *initial = malloc(tile_bytes);
+    void *expected = malloc(tile_bytes);
+    void *actual = malloc(tile_bytes);
+    int passed = 1;
+
+    srand(4321);
+    random_float_tile(original, tile_size*tile_size);
+    if (format == MYPAINT_TILE_FORMAT_RGBA_FLOAT16) {
+        float_to_half_array(original, (uint16_t *)initial, tile_size*tile_size*4);
+    } else {
+        memcpy(initial, original, tile_bytes);
+    }
+
+    for (int i = 0; i < DABS; i++) {
+        const float radius = random_float(0.5f, 40.0f);
+        render_dab_mask_spans(mask, random_float(-radius, tile_size + radius),
+                              random_float(-radius, tile_size + radius), radius,
+                              random_float(0.0f, 1.0f), random_float(1.0f, 5.0f),
+                              random_float(0.0f, 180.0f));
+        FloatDabColor color;
+        for (int c = 0; c < 3; c++) {
+            color.color[c] = random_float(0.0f, 1.0f);
+        }
+        color.color[3] = 1.0f;
+        color.color_a = random_float(0.0f, 1.0f);
+        color.opacity = random_float(0.0f, 1.0f);
+
+        for (int mode = 0; mode < FLOAT_BLEND_MODES_COUNT; mode++) {
+            for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+                simd_level_set((SimdLevel)level);
+                void *result = (level == SIMD_LEVEL_NONE) ? expected : actual;
+                memcpy(result, initial, tile_bytes);
+                draw_dab_spans_float(mask, result, format, (FloatBlendMode)mode, &color);
+                if (level != SIMD_LEVEL_NONE && memcmp(expected, actual, tile_bytes) != 0) {
+                    fprintf(stderr, "%s: blend mode %d of format %d differs from the scalar result\n",
+                            simd_level_name((SimdLevel)level), mode, format);
+                    passed = 0;
+                }
+            }
+        }
+
+        double expected_sums[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+        for (int level = SIMD_LEVEL_NONE; level <= (int)supported; level++) {
+            simd_level_set((SimdLevel)level);
+            double sums[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+            get_color_spans_accumulate_float(mask, initial, format, sums);
+            for (int c = 0; c < 5; c++) {
+                if (level == SIMD_LEVEL_NONE) {
+                    expected_sums[c] = sums[c];
+                } else if (fabs(sums[c] - expected_sums[c]) > 1e-4 * (1.0 + fabs(expected_sums[c]))) {
+                    fprintf(stderr, "%s: color sum %d of format %d differs: %f, expected %f\n",
+                            simd_level_name((SimdLevel)level), c, format, sums[c], expected_sums[c]);
+                    passed = 0;
+                }
+            }
+        }
+    }
+    simd_level_set(supported);
+
+    dab_mask_free(mask);
+    free(original);
+    free(initial);
+    free(expected);
+    free(actual);
+    return passed;
+}
+
+int
+test_float_tiles_simd_levels(void *user_data)
+{
+    int passed = 1;
+    for (int f = 0; f < sizeof(float_formats)/sizeof(float_formats[0]); f++) {
+        passed &= check_simd_levels(float_formats[f]);
+    }
+    return expect_true(passed, "float kernels give the same results at all SIMD levels");
+}
+
+// Alpha of pixel (x, y) of a fixed tiled surface, as float
+static float
+pixel_alpha(MyPaintFixedTiledSurface *fixed, int x, int y)
+{
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)fixed;
+    const int tile_size = tiled->tile_size;
+    MyPaintTileRequest request;
+    mypaint_tile_request_init(&request, 0, x / tile_size, y / tile_size, TRUE);
+    mypaint_tiled_surface_tile_request_start(tiled, &request);
+    const int i = ((y % tile_size)*tile_size + x % tile_size)*4 + 3;
+    float alpha = 0.0f;
+    switch (mypaint_tiled_surface_get_tile_format(tiled)) {
+    case MYPAINT_TILE_FORMAT_RGBA16:
+        alpha = ((uint16_t *)request.buffer)[i] / (float)(1<<15);
+        break;
+    case MYPAINT_TILE_FORMAT_RGBA_FLOAT32:
+        alpha = ((float *)request.buffer)[i];
+        break;
+    case MYPAINT_TILE_FORMAT_RGBA_FLOAT16:
+        alpha = half_to_float(((uint16_t *)request.buffer)[i]);
+        break;
+    }
+    mypaint_tiled_surface_tile_request_end(tiled, &request);
+    return alpha;
+}
+
+static void
+paint_stroke(MyPaintSurface *surface)
+{
+    srand(99);
+    mypaint_surface_begin_atomic(surface);
+    for (int i = 0; i < 100; i++) {
+        const float x = 20.0f + i * (SURFACE_SIZE - 40.0f) / 100;
+        const float y = SURFACE_SIZE/2 + 30.0f * sinf(i * 0.1f);
+        mypaint_surface_draw_dab(surface, x, y, random_float(2.0f, 15.0f),
+                                 0.8f, 0.3f, 0.1f, random_float(0.1f, 0.5f),
+                                 random_float(0.2f, 1.0f), 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    }
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+// The coverage of a stroke does not depend on the tile format,
+// apart from rounding. Colors differ, since float tiles blend in linear light.
+int
+test_float_tiles_alpha_matches_fix15(void *user_data)
+{
+    MyPaintFixedTiledSurface *surfaces[3];
+    surfaces[0] = mypaint_fixed_tiled_surface_new_with_format(SURFACE_SIZE, SURFACE_SIZE, MYPAINT_TILE_SIZE,
+                                                              MYPAINT_TILE_FORMAT_RGBA16);
+    for (int f = 0; f < 2; f++) {
+        surfaces[f+1] = mypaint_fixed_tiled_surface_new_with_format(SURFACE_SIZE, SURFACE_SIZE, MYPAINT_TILE_SIZE,
+                                                                    float_formats[f]);
+    }
+    // The fix15 surface starts out filled with 0xffff, clear it
+    for (int ty = 0; ty < SURFACE_SIZE/MYPAINT_TILE_SIZE; ty++) {
+        for (int tx = 0; tx < SURFACE_SIZE/MYPAINT_TILE_SIZE; tx++) {
+            MyPaintTileRequest request;
+            mypaint_tile_request_init(&request, 0, tx, ty, FALSE);
+            mypaint_tiled_surface_tile_request_start((MyPaintTiledSurface *)surfaces[0], &request);
+            memset(request.buffer, 0, MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE*4*sizeof(uint16_t));
+            mypaint_tiled_surface_tile_request_end((MyPaintTiledSurface *)surfaces[0], &request);
+        }
+    }
+
+    for (int s = 0; s < 3; s++) {
+        paint_stroke((MyPaintSurface *)surfaces[s]);
+    }
+
+    float max_diff32 = 0.0f, max_diff16 = 0.0f;
+    for (int y = 0; y < SURFACE_SIZE; y++) {
+        for (int x = 0; x < SURFACE_SIZE; x++) {
+            const float a = pixel_alpha(surfaces[0], x, y);
+            max_diff32 = fmaxf(max_diff32, fabsf(pixel_alpha(surfaces[1], x, y) - a));
+            max_diff16 = fmaxf(max_diff16, fabsf(pixel_alpha(surfaces[2], x, y) - a));
+        }
+    }
+    int passed = expect_true(max_diff32 < 0.002f, "float32 alpha matches fix15");
+    passed &= expect_true(max_diff16 < 0.004f, "float16 alpha matches fix15");
+
+    for (int s = 0; s < 3; s++) {
+        mypaint_surface_unref((MyPaintSurface *)surfaces[s]);
+    }
+    return passed;
+}
+
+// get_color() of an opaque dab returns its color, converted back from linear light
+int
+test_float_tiles_get_color(void *user_data)
+{
+    const MyPaintTileFormat formats[] = {
+        MYPAINT_TILE_FORMAT_RGBA16,
+        MYPAINT_TILE_FORMAT_RGBA_FLOAT32,
+        MYPAINT_TILE_FORMAT_RGBA_FLOAT16,
+    };
+    int passed = 1;
+
+    for (int f = 0; f < 3; f++) {
+        MyPaintFixedTiledSurface *fixed = mypaint_fixed_tiled_surface_new_with_format(
+            SURFACE_SIZE, SURFACE_SIZE, MYPAINT_TILE_SIZE, formats[f]);
+        MyPaintSurface *surface = (MyPaintSurface *)fixed;
+        float r, g, b, a;
+
+        mypaint_surface_begin_atomic(surface);
+        mypaint_surface_draw_dab(surface, 100.0f, 100.0f, 20.0f, 0.8f, 0.3f, 0.1f,
+                                 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+        mypaint_surface_end_atomic(surface, NULL);
+        mypaint_surface_get_color(surface, 100.0f, 100.0f, 5.0f, &r, &g, &b, &a);
+
+        char description[64];
+        snprintf(description, sizeof(description), "color of the dab, format %d", formats[f]);
+        passed &= expect_true(fabsf(r - 0.8f) < 0.002f && fabsf(g - 0.3f) < 0.002f
+                              && fabsf(b - 0.1f) < 0.002f && fabsf(a - 1.0f) < 0.002f, description);
+
+        mypaint_surface_unref(surface);
+    }
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/float_tiles/half_roundtrip", test_float_tiles_half_roundtrip, NULL},
+        {"/float_tiles/simd_levels", test_float_tiles_simd_levels, NULL},
+        {"/float_tiles/alpha_matches_fix15", test_float_tiles_alpha_matches_fix15, NULL},
+        {"/float_tiles/get_color", test_float_tiles_get_color, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mypaint-tiled-surface.h>
+
+#include "testutils.h"
+
+#define TILES 4 // per side, at level 0
+#define LEVELS 3
+#define SURFACE_SIZE (TILES*MYPAINT_TILE_SIZE)
+#define TILE_PIXELS (MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE)
+#define DABS 300
+
+// A surface with its own tiles for each mipmap level, which is all
+// mipmap painting needs from a backend
+typedef struct {
+    MyPaintTiledSurface parent;
+    uint16_t *levels[LEVELS]; // tiles of each level, one after the other
+    uint16_t *null_tile;
+} LevelsSurface;
+
+static void
+levels_tile_request_start(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *request)
+{
+    LevelsSurface *self = (LevelsSurface *)tiled_surface;
+    const int tiles = TILES >> request->mipmap_level;
+    if (request->tx < 0 || request->ty < 0 || request->tx >= tiles || request->ty >= tiles) {
+        request->buffer = self->null_tile;
+    } else {
+        request->buffer = self->levels[request->mipmap_level] + (request->ty*tiles + request->tx)*TILE_PIXELS*4;
+    }
+}
+
+static void
+levels_tile_request_end(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *request)
+{
+}
+
+static void
+levels_surface_free(MyPaintSurface *surface)
+{
+    LevelsSurface *self = (LevelsSurface *)surface;
+    mypaint_tiled_surface_destroy(&self->parent);
+    for (int l = 0; l < LEVELS; l++) {
+        free(self->levels[l]);
+    }
+    free(self->null_tile);
+    free(self);
+}
+
+static LevelsSurface *
+levels_surface_new(void)
+{
+    LevelsSurface *self = (LevelsSurface *)malloc(sizeof(LevelsSurface));
+    mypaint_tiled_surface_init(&self->parent, levels_tile_request_start, levels_tile_request_end);
+    self->parent.parent.destroy = levels_surface_free;
+    for (int l = 0; l < LEVELS; l++) {
+        const int tiles = TILES >> l;
+        self->levels[l] = (uint16_t *)calloc(tiles*tiles*TILE_PIXELS*4, sizeof(uint16_t));
+    }
+    self->null_tile = (uint16_t *)calloc(TILE_PIXELS*4, sizeof(uint16_t));
+    return self;
+}
+
+// Alpha of pixel (x, y) of @level
+static int
+alpha_at(LevelsSurface *self, int level, int x, int y)
+{
+    const int tiles = TILES >> level;
+    const int tx = x / MYPAINT_TILE_SIZE;
+    const int ty = y / MYPAINT_TILE_SIZE;
+    const uint16_t *tile = self->levels[level] + (ty*tiles + tx)*TILE_PIXELS*4;
+    return tile[((y % MYPAINT_TILE_SIZE)*MYPAINT_TILE_SIZE + x % MYPAINT_TILE_SIZE)*4 + 3];
+}
+
+static void
+paint(LevelsSurface *surface, gboolean async)
+{
+    MyPaintSurface *s = (MyPaintSurface *)surface;
+    srand(1234);
+    for (int stroke = 0; stroke < 3; stroke++) {
+        mypaint_surface_begin_atomic(s);
+        for (int i = 0; i < DABS/3; i++) {
+            const float x = 20.0f + (SURFACE_SIZE - 40.0f) * (rand() / (float)RAND_MAX);
+            const float y = 20.0f + (SURFACE_SIZE - 40.0f) * (rand() / (float)RAND_MAX);
+            const float radius = 1.0f + 15.0f * (rand() / (float)RAND_MAX);
+            mypaint_surface_draw_dab(s, x, y, radius, 0.2f, 0.4f, 0.8f,
+                                     0.5f, 0.7f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+        }
+        if (async) {
+            mypaint_tiled_surface_end_atomic_async(&surface->parent, NULL);
+        } else {
+            mypaint_surface_end_atomic(s, NULL);
+        }
+    }
+    mypaint_tiled_surface_finalize_tiles(&surface->parent, NULL);
+}
+
+static int
+test_mipmap_painting_levels(gboolean async)
+{
+    LevelsSurface *expected = levels_surface_new();
+    LevelsSurface *actual = levels_surface_new();
+    const size_t level0_bytes = TILES*TILES*TILE_PIXELS*4*sizeof(uint16_t);
+    int passed = 1;
+
+    paint(expected, FALSE);
+
+    // Paint at level 1, level 0 is only rendered by finalize_tiles
+    MyPaintRectangle roi;
+    mypaint_tiled_surface_set_mipmap_painting(&actual->parent, 1, NULL);
+    passed &= expect_int(1, mypaint_tiled_surface_get_mipmap_painting(&actual->parent), "mipmap painting level");
+    paint(actual, async);
+
+    // paint() finalizes, so paint again without
+    LevelsSurface *pending = levels_surface_new();
+    mypaint_tiled_surface_set_mipmap_painting(&pending->parent, 1, NULL);
+    mypaint_surface_begin_atomic((MyPaintSurface *)pending);
+    mypaint_surface_draw_dab((MyPaintSurface *)pending, 100.0f, 100.0f, 10.0f, 1.0f, 0.0f, 0.0f,
+                             1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    mypaint_surface_end_atomic((MyPaintSurface *)pending, NULL);
+    passed &= expect_int(0, alpha_at(pending, 0, 100, 100), "level 0 is pending");
+    passed &= expect_true(alpha_at(pending, 1, 50, 50) > 0, "level 1 is painted");
+    mypaint_tiled_surface_set_mipmap_painting(&pending->parent, 0, &roi);
+    passed &= expect_true(alpha_at(pending, 0, 100, 100) > 0, "level 0 is finalized when the level changes");
+    passed &= expect_true(roi.x <= 90 && roi.y <= 90 && roi.x + roi.width >= 110 && roi.y + roi.height >= 110,
+                          "area of the finalized operations");
+    mypaint_surface_unref((MyPaintSurface *)pending);
+
+    passed &= expect_true(memcmp(expected->levels[0], actual->levels[0], level0_bytes) == 0,
+                          "finalized level 0 is the same as without mipmap painting");
+
+    // Level 1 against level 0 downscaled 2x2, like tile_downscale_rgba16()
+    double alpha_sum = 0.0;
+    double difference_sum = 0.0;
+    for (int y = 0; y < SURFACE_SIZE/2; y++) {
+        for (int x = 0; x < SURFACE_SIZE/2; x++) {
+            const int downscaled = (alpha_at(expected, 0, 2*x, 2*y) + alpha_at(expected, 0, 2*x+1, 2*y)
+                                    + alpha_at(expected, 0, 2*x, 2*y+1) + alpha_at(expected, 0, 2*x+1, 2*y+1)) / 4;
+            alpha_sum += downscaled;
+            difference_sum += abs(alpha_at(actual, 1, x, y) - downscaled);
+        }
+    }
+    passed &= expect_true(alpha_sum > 0.0 && difference_sum < 0.05*alpha_sum,
+                          "level 1 painting is close to the downscaled level 0");
+
+    mypaint_surface_unref((MyPaintSurface *)expected);
+    mypaint_surface_unref((MyPaintSurface *)actual);
+    return passed;
+}
+
+int
+test_mipmap_painting_sync(void *user_data)
+{
+    return test_mipmap_painting_levels(FALSE);
+}
+
+int
+test_mipmap_painting_async(void *user_data)
+{
+    return test_mipmap_painting_levels(TRUE);
+}
+
+int
+test_mipmap_painting_get_color(void *user_data)
+{
+    LevelsSurface *surface = levels_surface_new();
+    MyPaintSurface *s = (MyPaintSurface *)surface;
+    int passed = 1;
+
+    mypaint_tiled_surface_set_mipmap_painting(&surface->parent, 2, NULL);
+    mypaint_surface_begin_atomic(s);
+    mypaint_surface_draw_dab(s, 70.0f, 70.0f, 20.0f, 1.0f, 0.0f, 0.0f,
+                             1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    mypaint_surface_end_atomic(s, NULL);
+
+    // Samples level 0, rendering the pending operations of the sampled tiles
+    float r, g, b, a;
+    mypaint_surface_get_color(s, 70.0f, 70.0f, 5.0f, &r, &g, &b, &a);
+    passed &= expect_true(a > 0.99f && r > 0.99f, "get_color sees the pending dabs");
+    passed &= expect_int(3, surface->parent.deferred_operations, "the other tiles are still pending");
+
+    // Sampling all tiles of the dab leaves nothing for finalize_tiles
+    MyPaintRectangle roi;
+    mypaint_surface_get_color(s, 64.0f, 64.0f, 40.0f, &r, &g, &b, &a);
+    passed &= expect_int(0, surface->parent.deferred_operations, "no pending operations");
+    mypaint_tiled_surface_finalize_tiles(&surface->parent, &roi);
+    passed &= expect_true(roi.width == 0 && roi.height == 0, "nothing left to finalize");
+
+    mypaint_surface_unref(s);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/mipmap_painting/sync", test_mipmap_painting_sync, NULL},
+        {"/mipmap_painting/async", test_mipmap_painting_async, NULL},
+        {"/mipmap_painting/get_color", test_mipmap_painting_get_color, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
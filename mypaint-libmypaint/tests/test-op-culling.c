@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mypaint-surface.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "operationqueue.h"
+#include "testutils.h"
+
+#define SURFACE_SIZE (3*MYPAINT_TILE_SIZE)
+#define DABS 600
+
+static const MyPaintTileFormat formats[] = {
+    MYPAINT_TILE_FORMAT_RGBA16,
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT32,
+    MYPAINT_TILE_FORMAT_RGBA_FLOAT16,
+};
+
+static OperationDataDrawDab
+opaque_op(float x, float y, float radius)
+{
+    OperationDataDrawDab op = {0};
+    op.x = x;
+    op.y = y;
+    op.radius = radius;
+    op.color_r = 1 << 15;
+    op.color_a = 1.0f;
+    op.opaque = 1.0f;
+    op.hardness = 1.0f;
+    op.aspect_ratio = 1.0f;
+    op.normal = 1.0f;
+    return op;
+}
+
+int
+test_op_culling_queue(void *user_data)
+{
+    OperationQueue *queue = operation_queue_new();
+    const int tile_size = MYPAINT_TILE_SIZE;
+    const TileIndex index = {1, 1};
+    const float center = 1.5f * tile_size;
+    OperationQueueCulled culled;
+    int passed = 1;
+
+    // More than one chunk: soft dabs, then a big opaque dab over all of them
+    for (int i = 0; i < 100; i++) {
+        OperationDataDrawDab op = opaque_op(center + (i % 10) - 5, center, 5.0f);
+        op.hardness = 0.5f;
+        operation_queue_add(queue, index, &op);
+    }
+    // Reaching into the corner of the tile, away from the opaque dab
+    OperationDataDrawDab corner = opaque_op(tile_size - 5.0f, tile_size - 5.0f, 6.0f);
+    operation_queue_add(queue, index, &corner);
+    // The same opaque dab twice
+    OperationDataDrawDab cover = opaque_op(center, center, 30.0f);
+    operation_queue_add(queue, index, &cover);
+    operation_queue_add(queue, index, &cover);
+    // A soft dab on top is kept, it blends with the opaque one
+    OperationDataDrawDab soft = opaque_op(center, center, 8.0f);
+    soft.opaque = 0.5f;
+    operation_queue_add(queue, index, &soft);
+
+    operation_queue_cull(queue, index, tile_size, &culled);
+    passed &= expect_int(100, culled.overdrawn, "soft dabs below the opaque dab");
+    passed &= expect_int(0, culled.outside, "dab which reaches into the tile");
+    passed &= expect_int(1, culled.merged, "repeated opaque dab");
+    passed &= expect_int(3, operation_queue_get_operation_count(queue, index), "kept operations");
+
+    OperationDataDrawDab *op = operation_queue_pop(queue, index);
+    passed &= expect_true(op && memcmp(op, &corner, sizeof(corner)) == 0, "corner dab first");
+    op = operation_queue_pop(queue, index);
+    passed &= expect_true(op && memcmp(op, &cover, sizeof(cover)) == 0, "opaque dab next");
+    op = operation_queue_pop(queue, index);
+    passed &= expect_true(op && memcmp(op, &soft, sizeof(soft)) == 0, "soft dab last");
+    passed &= expect_true(operation_queue_pop(queue, index) == NULL, "drained queue is empty");
+    operation_queue_clear_dirty_tiles(queue);
+
+    // A dab next to the tile, and one rotated away from it
+    OperationDataDrawDab next_to = opaque_op(tile_size - 8.0f, center, 6.0f);
+    operation_queue_add(queue, index, &next_to);
+    OperationDataDrawDab rotated = opaque_op(tile_size - 4.0f, center, 20.0f);
+    rotated.aspect_ratio = 10.0f;
+    rotated.angle = 90.0f;
+    operation_queue_add(queue, index, &rotated);
+    operation_queue_cull(queue, index, tile_size, &culled);
+    passed &= expect_int(2, culled.outside, "dabs outside of the tile");
+    passed &= expect_int(0, operation_queue_get_operation_count(queue, index), "nothing left");
+    operation_queue_clear_dirty_tiles(queue);
+
+    // The chunks freed by culling, and the buffers of culling, are used again
+    int allocations = 0;
+    for (int round = 0; round < 3; round++) {
+        if (round == 1) {
+            allocations = operation_queue_get_allocations(queue);
+        }
+        for (int i = 0; i < 300; i++) {
+            operation_queue_add(queue, index, &cover);
+        }
+        operation_queue_cull(queue, index, tile_size, &culled);
+        passed &= expect_int(299, culled.merged, "repeated opaque dabs");
+        while (operation_queue_pop(queue, index)) {}
+        operation_queue_clear_dirty_tiles(queue);
+    }
+    passed &= expect_int(allocations, operation_queue_get_allocations(queue), "chunks and cull buffers are reused");
+
+    operation_queue_free(queue);
+    return passed;
+}
+
+// Opaque and soft dabs piled up on each other, with some of them repeated
+static void
+paint_dabs(MyPaintSurface *surface, gboolean per_dab_atomic)
+{
+    srand(4242);
+    if (!per_dab_atomic) {
+        mypaint_surface_begin_atomic(surface);
+    }
+    float x = 0.0f, y = 0.0f, radius = 0.0f, hardness = 0.0f, opaque = 0.0f;
+    float r = 0.0f, g = 0.0f, b = 0.0f, aspect_ratio = 1.0f, angle = 0.0f;
+    for (int i = 0; i < DABS; i++) {
+        if (i % 3 != 2) {
+            const gboolean hard = rand() % 4 != 0;
+            x = random_float(0.0f, SURFACE_SIZE);
+            y = random_float(0.0f, SURFACE_SIZE);
+            radius = random_float(1.0f, 40.0f);
+            hardness = hard ? 1.0f : random_float(0.2f, 1.0f);
+            opaque = hard ? 1.0f : random_float(0.2f, 1.0f);
+            r = random_float(0.0f, 1.0f);
+            g = random_float(0.0f, 1.0f);
+            b = random_float(0.0f, 1.0f);
+            aspect_ratio = rand() % 2 ? 1.0f : random_float(1.0f, 5.0f);
+            angle = random_float(0.0f, 360.0f);
+        }
+        if (per_dab_atomic) {
+            mypaint_surface_begin_atomic(surface);
+        }
+        mypaint_surface_draw_dab(surface, x, y, radius, r, g, b, opaque, hardness,
+                                 1.0f, aspect_ratio, angle, 0.0f, 0.0f);
+        if (per_dab_atomic) {
+            mypaint_surface_end_atomic(surface, NULL);
+        }
+    }
+    if (!per_dab_atomic) {
+        mypaint_surface_end_atomic(surface, NULL);
+    }
+}
+
+// Culling makes no difference to the pixels: with one dab per atomic
+// section there is nothing to cull
+int
+test_op_culling_exact(void *user_data)
+{
+    int passed = 1;
+
+    for (int f = 0; f < (int)(sizeof(formats)/sizeof(formats[0])); f++) {
+        MyPaintFixedTiledSurface *culled = mypaint_fixed_tiled_surface_new_with_format(
+            SURFACE_SIZE, SURFACE_SIZE, MYPAINT_TILE_SIZE, formats[f]);
+        MyPaintFixedTiledSurface *reference = mypaint_fixed_tiled_surface_new_with_format(
+            SURFACE_SIZE, SURFACE_SIZE, MYPAINT_TILE_SIZE, formats[f]);
+
+        paint_dabs((MyPaintSurface *)culled, FALSE);
+        paint_dabs((MyPaintSurface *)reference, TRUE);
+
+        passed &= expect_true(surfaces_equal((MyPaintTiledSurface *)culled, (MyPaintTiledSurface *)reference,
+                                             SURFACE_SIZE, SURFACE_SIZE),
+                              "same pixels as without culling");
+
+#ifdef HAVE_SURFACE_STATS
+        MyPaintTiledSurfaceStats stats;
+        paint_dabs((MyPaintSurface *)culled, FALSE);
+        mypaint_tiled_surface_get_stats((MyPaintTiledSurface *)culled, &stats);
+        passed &= expect_true(stats.ops_culled_outside > 0, "operations outside of their tile");
+        passed &= expect_true(stats.ops_culled_overdrawn > 0, "overdrawn operations");
+        passed &= expect_true(stats.ops_merged > 0, "merged operations");
+        passed &= expect_int(stats.dabs_enqueued, stats.ops_processed + stats.ops_culled_outside
+                             + stats.ops_culled_overdrawn + stats.ops_merged,
+                             "every operation is processed or culled");
+#endif
+
+        mypaint_surface_unref((MyPaintSurface *)culled);
+        mypaint_surface_unref((MyPaintSurface *)reference);
+    }
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/op_culling/queue", test_op_culling_queue, NULL},
+        {"/op_culling/exact", test_op_culling_exact, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "operationqueue.h"
+#include "testutils.h"
+
+// More than fits into one chunk of the queue
+#define OPERATIONS 100
+
+#define LENGTH(array) (sizeof(array) / sizeof(array[0]))
+
+static void
+fill_queue(OperationQueue *queue, int tiles)
+{
+    for (int i = 0; i < OPERATIONS; i++) {
+        for (int t = 0; t < tiles; t++) {
+            const TileIndex index = {t, -t};
+            OperationDataDrawDab op = {0};
+            op.x = i;
+            op.y = t;
+            operation_queue_add(queue, index, &op);
+        }
+    }
+}
+
+int
+test_operation_queue_order(void *user_data)
+{
+    OperationQueue *queue = operation_queue_new();
+    const int tiles = 3;
+    int passed = 1;
+
+    fill_queue(queue, tiles);
+
+    TileIndex *dirty_tiles = NULL;
+    passed &= expect_int(tiles, operation_queue_get_dirty_tiles(queue, &dirty_tiles), "dirty tiles");
+
+    for (int t = 0; t < tiles; t++) {
+        const TileIndex index = {t, -t};
+        passed &= expect_int(0, (int)operation_queue_peek_first(queue, index)->x, "first operation");
+        passed &= expect_int(OPERATIONS - 1, (int)operation_queue_peek_last(queue, index)->x, "last operation");
+
+        int in_order = 1;
+        for (int i = 0; i < OPERATIONS; i++) {
+            OperationDataDrawDab *op = operation_queue_pop(queue, index);
+            in_order &= (op && op->x == i && op->y == t);
+        }
+        passed &= expect_true(in_order, "operations pop in the order they were added");
+        passed &= expect_true(operation_queue_pop(queue, index) == NULL, "drained queue is empty");
+        passed &= expect_true(operation_queue_peek_last(queue, index) == NULL, "drained queue has no last operation");
+    }
+
+    const TileIndex unused = {100, 100};
+    passed &= expect_true(operation_queue_pop(queue, unused) == NULL, "queue of unused tile is empty");
+
+    operation_queue_clear_dirty_tiles(queue);
+    passed &= expect_int(0, operation_queue_get_dirty_tiles(queue, &dirty_tiles), "dirty tiles after clear");
+
+    operation_queue_free(queue);
+    return passed;
+}
+
+// Memory use must not depend on how far apart the tiles are
+int
+test_operation_queue_distant_tiles(void *user_data)
+{
+    OperationQueue *queue = operation_queue_new();
+    const TileIndex tiles[] = {{0, 0}, {50000, -70000}, {-1000000, 1000000}};
+    OperationDataDrawDab op = {0};
+    int passed = 1;
+
+    for (int i = 0; i < LENGTH(tiles); i++) {
+        op.x = i;
+        operation_queue_add(queue, tiles[i], &op);
+    }
+    for (int i = 0; i < LENGTH(tiles); i++) {
+        OperationDataDrawDab *popped = operation_queue_pop(queue, tiles[i]);
+        passed &= expect_true(popped && popped->x == i, "operation of distant tile");
+    }
+    passed &= expect_true(operation_queue_get_allocations(queue) < 20, "allocations for distant tiles");
+
+    operation_queue_free(queue);
+    return passed;
+}
+
+int
+test_operation_queue_reuses_memory(void *user_data)
+{
+    OperationQueue *queue = operation_queue_new();
+    const int tiles = 5;
+
+    fill_queue(queue, tiles);
+    operation_queue_clear_dirty_tiles(queue);
+    const int allocations = operation_queue_get_allocations(queue);
+
+    for (int round = 0; round < 3; round++) {
+        fill_queue(queue, tiles);
+        for (int t = 0; t < tiles; t++) {
+            const TileIndex index = {t, -t};
+            while (operation_queue_pop(queue, index)) {}
+        }
+        operation_queue_clear_dirty_tiles(queue);
+    }
+
+    int passed = expect_int(allocations, operation_queue_get_allocations(queue), "allocations after the first round");
+
+    operation_queue_free(queue);
+    return passed;
+}
+
+int
+test_operation_queue_dirty_tiles(void *user_data)
+{
+    OperationQueue *queue = operation_queue_new();
+    const TileIndex added[] = {{3, 1}, {-2, 0}, {0, -4}, {1, 1}, {3, 1}, {-5, 1}, {0, -4}};
+    const TileIndex expected[] = {{0, -4}, {-2, 0}, {-5, 1}, {1, 1}, {3, 1}};
+    OperationDataDrawDab op = {0};
+
+    for (int i = 0; i < LENGTH(added); i++) {
+        operation_queue_add(queue, added[i], &op);
+    }
+    // A tile drained before the end of the atomic section (by get_color)
+    // which gets new operations is still only listed once
+    while (operation_queue_pop(queue, added[0])) {}
+    operation_queue_add(queue, added[0], &op);
+
+    TileIndex *dirty_tiles = NULL;
+    const int dirty_tiles_n = operation_queue_get_dirty_tiles(queue, &dirty_tiles);
+    int passed = expect_int(LENGTH(expected), dirty_tiles_n, "each dirty tile is listed once");
+
+    int sorted = 1;
+    for (int i = 0; i < dirty_tiles_n && i < LENGTH(expected); i++) {
+        sorted &= (dirty_tiles[i].x == expected[i].x && dirty_tiles[i].y == expected[i].y);
+    }
+    passed &= expect_true(sorted, "dirty tiles are sorted by row and column");
+
+    operation_queue_clear_dirty_tiles(queue);
+    operation_queue_add(queue, added[0], &op);
+    passed &= expect_int(1, operation_queue_get_dirty_tiles(queue, &dirty_tiles), "tile is dirty again after clear");
+
+    operation_queue_free(queue);
+    return passed;
+}
+
+static void
+stroke(MyPaintBrush *brush, MyPaintSurface *surface)
+{
+    mypaint_brush_reset(brush);
+    mypaint_surface_begin_atomic(surface);
+    for (int i = 0; i < 50; i++) {
+        mypaint_brush_stroke_to(brush, surface, 20 + i*2, 20 + i*2, 0.5, 0.0, 0.0, 0.02);
+    }
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+int
+test_operation_queue_surface(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(300, 300);
+    OperationQueue *queue = ((MyPaintTiledSurface *)surface)->operation_queue;
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, log(10.0));
+
+    const int initial_allocations = operation_queue_get_allocations(queue);
+    stroke(brush, (MyPaintSurface *)surface);
+    const int allocations = operation_queue_get_allocations(queue);
+    stroke(brush, (MyPaintSurface *)surface);
+
+    int passed = expect_true(allocations > initial_allocations, "first stroke was queued");
+    passed &= expect_int(allocations, operation_queue_get_allocations(queue), "allocations for the second stroke");
+
+    mypaint_brush_unref(brush);
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/operation_queue/order", test_operation_queue_order, NULL},
+        {"/operation_queue/dirty_tiles", test_operation_queue_dirty_tiles, NULL},
+        {"/operation_queue/distant_tiles", test_operation_queue_distant_tiles, NULL},
+        {"/operation_queue/reuses_memory", test_operation_queue_reuses_memory, NULL},
+        {"/operation_queue/surface", test_operation_queue_surface, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -1,9 +1,15 @@
 #include "rng-double.h"
+#include "rng-counter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <assert.h>
 
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
 #include "testutils.h"
 
 int
@@ -37,11 +43,174 @@ test_rng_double_smoke(void *user_data)
     return 1;
 }
 
+int
+test_rng_counter_philox(void *user_data)
+{
+    // Known answers from the Random123 distribution (kat_vectors)
+    const uint32_t zero[4] = {0, 0, 0, 0};
+    const uint32_t ones[4] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+    const uint32_t pi_counter[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+    const uint32_t pi_key[2] = {0xa4093822, 0x299f31d0};
+    uint32_t out[4];
+    int passed = 1;
+
+    rng_counter_philox(zero, zero, out);
+    passed &= expect_true(out[0] == 0x6627e8d5 && out[1] == 0xe169c58d
+                          && out[2] == 0xbc57ac4c && out[3] == 0x9b00dbd8, "zero counter and key");
+    rng_counter_philox(ones, ones, out);
+    passed &= expect_true(out[0] == 0x408f276d && out[1] == 0x41c83b0e
+                          && out[2] == 0xa20bc7c6 && out[3] == 0x6d5451fd, "all bits set");
+    rng_counter_philox(pi_counter, pi_key, out);
+    passed &= expect_true(out[0] == 0xd16cfe09 && out[1] == 0x94fdcceb
+                          && out[2] == 0x5001e420 && out[3] == 0x24126ea1, "digits of pi");
+    return passed;
+}
+
+int
+test_rng_counter_gauss(void *user_data)
+{
+    const int n = 10000;
+    float *gauss = (float *)malloc(n * sizeof(float));
+    RngCounter *rng = rng_counter_new(1234);
+    int passed = 1;
+
+    for (int i = 0; i < n; i++) {
+        gauss[i] = rng_counter_gauss(rng, 3, 1000 + i, 1);
+    }
+
+    gboolean same = TRUE;
+    double sum = 0.0, sum_sq = 0.0;
+    // Backwards, the order must not matter
+    for (int i = n-1; i >= 0; i--) {
+        same &= (gauss[i] == rng_counter_gauss(rng, 3, 1000 + i, 1));
+        sum += gauss[i];
+        sum_sq += gauss[i]*gauss[i];
+    }
+    passed &= expect_true(same, "same in any order");
+    const double mean = sum / n;
+    const double variance = sum_sq / n - mean*mean;
+    passed &= expect_true(fabs(mean) < 0.05, "mean is zero");
+    passed &= expect_true(fabs(variance - 1.0) < 0.05, "variance is one");
+
+    passed &= expect_true(rng_counter_gauss(rng, 3, 1000, 2) != gauss[0], "draws differ");
+    passed &= expect_true(rng_counter_gauss(rng, 4, 1000, 1) != gauss[0], "streams differ");
+    const double d = rng_counter_double(rng, 0, 0, 0);
+    rng_counter_set_seed(rng, 1235);
+    passed &= expect_true(rng_counter_double(rng, 0, 0, 0) != d, "seeds differ");
+    passed &= expect_true(d >= 0.0 && d < 1.0, "double in [0, 1)");
+
+    rng_counter_free(rng);
+    free(gauss);
+    return passed;
+}
+
+#define SURFACE_SIZE (4*MYPAINT_TILE_SIZE)
+#define IMAGE_BYTES (SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t))
+#define EVENTS 200
+
+// Jitter from all sources of randomness
+static MyPaintBrush *
+jitter_brush(void)
+{
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, log(4.0));
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_OFFSET_BY_RANDOM, 1.0);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_BY_RANDOM, 0.5);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_TRACKING_NOISE, 0.5);
+    mypaint_brush_set_mapping_n(brush, MYPAINT_BRUSH_SETTING_OPAQUE, MYPAINT_BRUSH_INPUT_RANDOM, 2);
+    mypaint_brush_set_mapping_point(brush, MYPAINT_BRUSH_SETTING_OPAQUE, MYPAINT_BRUSH_INPUT_RANDOM, 0, 0.0, -0.5);
+    mypaint_brush_set_mapping_point(brush, MYPAINT_BRUSH_SETTING_OPAQUE, MYPAINT_BRUSH_INPUT_RANDOM, 1, 1.0, 0.0);
+    return brush;
+}
+
+static void
+stroke(MyPaintBrush *brush, MyPaintSurface *surface, int first, int last)
+{
+    mypaint_surface_begin_atomic(surface);
+    for (int i = first; i < last; i++) {
+        const float x = SURFACE_SIZE/2 + 100*cosf(i * 0.05f);
+        const float y = SURFACE_SIZE/2 + 100*sinf(i * 0.03f);
+        mypaint_brush_stroke_to(brush, surface, x, y, 0.8, 0.0, 0.0, 0.01);
+    }
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+static void
+copy_pixels(MyPaintFixedTiledSurface *surface, uint16_t *image)
+{
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    const int tiles = SURFACE_SIZE / MYPAINT_TILE_SIZE;
+    const size_t tile_bytes = MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE*4*sizeof(uint16_t);
+    for (int ty = 0; ty < tiles; ty++) {
+        for (int tx = 0; tx < tiles; tx++) {
+            MyPaintTileRequest request;
+            mypaint_tile_request_init(&request, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(tiled, &request);
+            memcpy((char *)image + (ty*tiles + tx)*tile_bytes, request.buffer, tile_bytes);
+            mypaint_tiled_surface_tile_request_end(tiled, &request);
+        }
+    }
+}
+
+// The second half of a stroke replayed from the brush states
+// saved in the middle paints exactly the same, random jitter included.
+int
+test_rng_counter_stroke_replay(void *user_data)
+{
+    MyPaintFixedTiledSurface *first_half = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *second_half = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *replayed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    uint16_t *expected = (uint16_t *)malloc(IMAGE_BYTES);
+    uint16_t *actual = (uint16_t *)malloc(IMAGE_BYTES);
+    float states[MYPAINT_BRUSH_STATES_COUNT];
+    int passed = 1;
+
+    MyPaintBrush *brush = jitter_brush();
+    mypaint_brush_reset(brush);
+    stroke(brush, (MyPaintSurface *)first_half, 0, EVENTS/2);
+    for (int i = 0; i < MYPAINT_BRUSH_STATES_COUNT; i++) {
+        states[i] = mypaint_brush_get_state(brush, i);
+    }
+    stroke(brush, (MyPaintSurface *)second_half, EVENTS/2, EVENTS);
+    copy_pixels(second_half, expected);
+
+    MyPaintBrush *replay = jitter_brush();
+    // Take the pending reset, which would overwrite the states
+    stroke(replay, (MyPaintSurface *)replayed, 0, 1);
+    mypaint_surface_unref((MyPaintSurface *)replayed);
+    replayed = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    for (int i = 0; i < MYPAINT_BRUSH_STATES_COUNT; i++) {
+        mypaint_brush_set_state(replay, i, states[i]);
+    }
+    stroke(replay, (MyPaintSurface *)replayed, EVENTS/2, EVENTS);
+    copy_pixels(replayed, actual);
+
+    int painted = 0;
+    for (int i = 0; i < SURFACE_SIZE*SURFACE_SIZE*4; i++) {
+        painted += (expected[i] != 0xffff);
+    }
+    passed &= expect_true(painted > 0, "stroke was painted");
+    passed &= expect_true(memcmp(expected, actual, IMAGE_BYTES) == 0, "replay paints the same");
+
+    mypaint_brush_unref(brush);
+    mypaint_brush_unref(replay);
+    mypaint_surface_unref((MyPaintSurface *)first_half);
+    mypaint_surface_unref((MyPaintSurface *)second_half);
+    mypaint_surface_unref((MyPaintSurface *)replayed);
+    free(expected);
+    free(actual);
+    return passed;
+}
+
 int
 main(int argc, char **argv)
 {
     TestCase test_cases[] = {
-        {"/rng/double/smoke", test_rng_double_smoke, NULL}
+        {"/rng/double/smoke", test_rng_double_smoke, NULL},
+        {"/rng/counter/philox", test_rng_counter_philox, NULL},
+        {"/rng/counter/gauss", test_rng_counter_gauss, NULL},
+        {"/rng/counter/stroke_replay", test_rng_counter_stroke_replay, NULL}
     };
 
     return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), 0);
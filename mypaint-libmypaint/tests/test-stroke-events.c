@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "mypaint-utils-stroke-player.h"
+#include "testutils.h"
+
+#define SURFACE_SIZE (8*MYPAINT_TILE_SIZE)
+#define IMAGE_BYTES (SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t))
+#define EVENTS_TEXT "events/painting30sec.dat"
+#define EVENTS_BINARY "test-stroke-events.mpev"
+
+// Plays the events of @player with the default brush, returns the image
+// and the number of iterations
+static uint16_t *
+play(MyPaintUtilsStrokePlayer *player, double batch_duration, int *iterations)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+
+    mypaint_utils_stroke_player_set_brush(player, brush);
+    mypaint_utils_stroke_player_set_surface(player, (MyPaintSurface *)surface);
+    mypaint_utils_stroke_player_set_batch_duration(player, batch_duration);
+
+    *iterations = 1;
+    while (mypaint_utils_stroke_player_iterate(player)) {
+        (*iterations)++;
+    }
+
+    uint16_t *image = read_image((MyPaintTiledSurface *)surface, SURFACE_SIZE, SURFACE_SIZE);
+    mypaint_brush_unref(brush);
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return image;
+}
+
+int
+test_stroke_events_binary(void *user_data)
+{
+    MyPaintUtilsStrokePlayer *text = mypaint_utils_stroke_player_new();
+    MyPaintUtilsStrokePlayer *binary = mypaint_utils_stroke_player_new();
+    int passed = 1;
+
+    passed &= expect_true(mypaint_utils_stroke_player_load_file(text, EVENTS_TEXT), "text events loaded");
+    passed &= expect_true(mypaint_utils_stroke_player_save_binary(text, EVENTS_BINARY), "binary events saved");
+    passed &= expect_true(mypaint_utils_stroke_player_load_file(binary, EVENTS_BINARY), "binary events loaded");
+
+    const int events_n = mypaint_utils_stroke_player_get_events_n(text);
+    passed &= expect_true(events_n > 1000, "events in the text file");
+    passed &= expect_int(events_n, mypaint_utils_stroke_player_get_events_n(binary), "events in the binary file");
+
+    int text_iterations, binary_iterations, batch_iterations;
+    uint16_t *expected = play(text, 0.0, &text_iterations);
+    uint16_t *actual = play(binary, 0.0, &binary_iterations);
+    passed &= expect_int(events_n, text_iterations, "one event per iteration");
+    passed &= expect_int(events_n, binary_iterations, "one event per iteration from the binary file");
+    passed &= expect_true(memcmp(expected, actual, IMAGE_BYTES) == 0, "binary events paint the same");
+    free(actual);
+
+    // About 30 seconds of events in frames of 1/60 seconds
+    actual = play(binary, 1.0/60, &batch_iterations);
+    passed &= expect_true(batch_iterations > 1000 && batch_iterations < events_n, "events played in batches");
+    passed &= expect_true(memcmp(expected, actual, IMAGE_BYTES) == 0, "batches paint the same");
+    free(actual);
+    free(expected);
+
+    mypaint_utils_stroke_player_free(text);
+    mypaint_utils_stroke_player_free(binary);
+    remove(EVENTS_BINARY);
+    return passed;
+}
+
+int
+test_stroke_events_invalid(void *user_data)
+{
+    MyPaintUtilsStrokePlayer *player = mypaint_utils_stroke_player_new();
+    MyPaintUtilsStrokeEventsHeader header;
+    int passed = 1;
+
+    // A newer version, and more events than in the file
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MYPAINT_UTILS_STROKE_EVENTS_MAGIC, 4);
+    header.record_size = sizeof(MyPaintUtilsStrokeEvent);
+    header.version = MYPAINT_UTILS_STROKE_EVENTS_VERSION + 1;
+    header.events_n = 0;
+    FILE *file = fopen(EVENTS_BINARY, "wb");
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    passed &= expect_true(!mypaint_utils_stroke_player_load_file(player, EVENTS_BINARY), "unsupported version");
+
+    header.version = MYPAINT_UTILS_STROKE_EVENTS_VERSION;
+    header.events_n = 10;
+    file = fopen(EVENTS_BINARY, "wb");
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    passed &= expect_true(!mypaint_utils_stroke_player_load_file(player, EVENTS_BINARY), "truncated file");
+    passed &= expect_int(0, mypaint_utils_stroke_player_get_events_n(player), "no events");
+    passed &= expect_true(!mypaint_utils_stroke_player_iterate(player), "nothing to play");
+
+    mypaint_utils_stroke_player_free(player);
+    remove(EVENTS_BINARY);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/stroke_events/binary", test_stroke_events_binary, NULL},
+        {"/stroke_events/invalid", test_stroke_events_invalid, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
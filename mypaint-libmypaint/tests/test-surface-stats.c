@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mypaint-surface.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE (4*MYPAINT_TILE_SIZE)
+
+// Two dabs within one tile, and one across four tiles
+static void
+paint(MyPaintSurface *surface)
+{
+    const float tile = MYPAINT_TILE_SIZE;
+    mypaint_surface_begin_atomic(surface);
+    mypaint_surface_draw_dab(surface, tile/2, tile/2, 5.0f, 1.0f, 0.0f, 0.0f,
+                             1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    mypaint_surface_draw_dab(surface, tile/2 + 3.0f, tile/2, 5.0f, 1.0f, 0.0f, 0.0f,
+                             1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    mypaint_surface_draw_dab(surface, 2*tile, 2*tile, 10.0f, 0.0f, 0.0f, 1.0f,
+                             1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+int
+test_surface_stats_counters(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    MyPaintTiledSurfaceStats stats;
+    int passed = 1;
+
+    paint((MyPaintSurface *)surface);
+    const gboolean available = mypaint_tiled_surface_get_stats(tiled, &stats);
+
+#ifdef HAVE_SURFACE_STATS
+    passed &= expect_true(available, "counters are available");
+    passed &= expect_int(6, stats.dabs_enqueued, "dab operations queued");
+    passed &= expect_int(6, stats.ops_processed, "dab operations processed");
+    passed &= expect_int(5, stats.tile_requests, "tile requests");
+    passed &= expect_true(stats.mask_pixels > 0 && stats.mask_pixels < 6*MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE,
+                          "mask pixels");
+    passed &= expect_true(stats.mask_pixels + stats.mask_pixels_skipped == 6*MYPAINT_TILE_SIZE*MYPAINT_TILE_SIZE,
+                          "mask pixels add up to the processed tiles");
+    passed &= expect_true(stats.process_op_ns >= stats.render_dab_mask_ns, "mask time is part of the op time");
+    passed &= expect_true(stats.get_color_ns == 0, "no get_color");
+
+    // Reset by begin_atomic
+    float r, g, b, a;
+    mypaint_surface_begin_atomic((MyPaintSurface *)surface);
+    mypaint_surface_get_color((MyPaintSurface *)surface, MYPAINT_TILE_SIZE/2, MYPAINT_TILE_SIZE/2, 4.0f,
+                              &r, &g, &b, &a);
+    mypaint_surface_end_atomic((MyPaintSurface *)surface, NULL);
+    mypaint_tiled_surface_get_stats(tiled, &stats);
+    passed &= expect_int(0, stats.dabs_enqueued, "dab operations queued after reset");
+    passed &= expect_int(0, stats.ops_processed, "dab operations processed after reset");
+    passed &= expect_int(1, stats.tile_requests, "tile requests after reset");
+    passed &= expect_true(stats.get_color_ns > 0, "get_color time");
+#else
+    passed &= expect_true(!available, "counters are compiled out");
+    passed &= expect_true(stats.dabs_enqueued == 0 && stats.tile_requests == 0, "zeroed counters");
+#endif
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/surface_stats/counters", test_surface_stats_counters, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <mypaint-fixed-tiled-surface.h>
+#include <dabmaskcache.h>
+
+#include "testutils.h"
+
+#define SURFACE_SIZE 256
+#define CENTER (SURFACE_SIZE/2)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void
+draw_dab(MyPaintSurface *surface, float x, float y, float radius)
+{
+    mypaint_surface_begin_atomic(surface);
+    mypaint_surface_draw_dab(surface, x, y, radius,
+                             0.2f, 0.4f, 0.6f, 0.8f, 0.7f,
+                             1.0f, 1.5f, 30.0f, 0.0f, 0.0f);
+    mypaint_surface_end_atomic(surface, NULL);
+}
+
+static void
+get_pixel(MyPaintTiledSurface *surface, int x, int y, uint16_t pixel[4])
+{
+    MyPaintTileRequest request;
+    mypaint_tile_request_init(&request, 0, x / MYPAINT_TILE_SIZE, y / MYPAINT_TILE_SIZE, TRUE);
+    mypaint_tiled_surface_tile_request_start(surface, &request);
+    const int offset = ((y % MYPAINT_TILE_SIZE)*MYPAINT_TILE_SIZE + x % MYPAINT_TILE_SIZE)*4;
+    memcpy(pixel, request.buffer + offset, 4*sizeof(uint16_t));
+    mypaint_tiled_surface_tile_request_end(surface, &request);
+}
+
+// TRUE if the pixel differs from the unpainted corner of the surface
+static gboolean
+is_painted(MyPaintFixedTiledSurface *surface, float x, float y)
+{
+    uint16_t pixel[4], background[4];
+    get_pixel((MyPaintTiledSurface *)surface, 0, 0, background);
+    get_pixel((MyPaintTiledSurface *)surface, x, y, pixel);
+    return memcmp(pixel, background, sizeof(pixel)) != 0;
+}
+
+// Number of pixels that differ from their mirror image across both axes
+static int
+count_asymmetric_pixels(MyPaintTiledSurface *surface)
+{
+    int asymmetric = 0;
+    for (int y = 0; y < SURFACE_SIZE; y++) {
+        for (int x = 0; x < SURFACE_SIZE; x++) {
+            uint16_t pixel[4], mirror_x[4], mirror_y[4];
+            get_pixel(surface, x, y, pixel);
+            get_pixel(surface, SURFACE_SIZE-1 - x, y, mirror_x);
+            get_pixel(surface, x, SURFACE_SIZE-1 - y, mirror_y);
+            if (memcmp(pixel, mirror_x, sizeof(pixel)) != 0
+                || memcmp(pixel, mirror_y, sizeof(pixel)) != 0) {
+                asymmetric++;
+            }
+        }
+    }
+    return asymmetric;
+}
+
+int
+test_symmetry_shared_masks(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    int hits = 0;
+    int misses = 0;
+
+    mypaint_tiled_surface_set_dab_mask_cache_size(tiled, 4*1024*1024);
+    mypaint_tiled_surface_set_symmetry(tiled, MYPAINT_SYMMETRY_TYPE_VERTHORZ, CENTER, CENTER, 0);
+
+    // Four copies at different subpixel positions and angles, all mirror images
+    draw_dab((MyPaintSurface *)surface, 100.25f, 90.5f, 10.0f);
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    int passed = expect_int(1, misses, "one mask for the four copies");
+    passed &= expect_true(hits >= 3, "copies use the mask of the first one");
+    passed &= expect_int(0, count_asymmetric_pixels(tiled), "exact mirror images");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+test_symmetry_exact_masks(void *user_data)
+{
+    const MyPaintSymmetryType types[2] = {MYPAINT_SYMMETRY_TYPE_VERTHORZ, MYPAINT_SYMMETRY_TYPE_SNOWFLAKE};
+    const int copies[2] = {4, 8};
+    int passed = 1;
+
+    // Without the dab mask cache, the mirrored and 90 degree rotated copies
+    // still share the mask of the first one: one render per dab, whatever the
+    // number of copies.
+    for (int i = 0; i < 2; i++) {
+        MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+        MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+        int hits = 0;
+        int misses = 0;
+
+        mypaint_tiled_surface_set_symmetry(tiled, types[i], CENTER, CENTER, 4);
+        draw_dab((MyPaintSurface *)surface, 100.25f, 90.5f, 10.0f);
+        draw_dab((MyPaintSurface *)surface, 80.5f, 60.75f, 2.5f); // antialiased
+
+        dab_mask_cache_get_stats(tiled->exact_mask_cache, &hits, &misses, NULL, NULL);
+        passed &= expect_int(2, misses, "one mask per dab");
+        passed &= expect_true(hits >= 2*(copies[i] - 1), "copies use the mask of the first one");
+        passed &= expect_int(0, count_asymmetric_pixels(tiled), "exact mirror images");
+
+        mypaint_surface_unref((MyPaintSurface *)surface);
+    }
+    return passed;
+}
+
+int
+test_symmetry_rotational(void *user_data)
+{
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    const int lines = 16;
+    const float distance = 80.0f;
+    int hits = 0;
+    int misses = 0;
+    int passed = 1;
+
+    mypaint_tiled_surface_set_symmetry(tiled, MYPAINT_SYMMETRY_TYPE_ROTATIONAL, CENTER, CENTER, lines);
+    draw_dab((MyPaintSurface *)surface, CENTER + distance, CENTER, 6.0f);
+
+    for (int i = 0; i < lines; i++) {
+        const float on_line = 2*M_PI * i / lines;
+        const float between = 2*M_PI * (i + 0.5f) / lines;
+        passed &= expect_true(is_painted(surface, CENTER + distance*cos(on_line),
+                                         CENTER + distance*sin(on_line)), "copy on each line");
+        passed &= expect_true(!is_painted(surface, CENTER + distance*cos(between),
+                                          CENTER + distance*sin(between)), "nothing between the lines");
+    }
+    mypaint_tiled_surface_get_dab_mask_cache_stats(tiled, &hits, &misses);
+    passed &= expect_int(0, misses, "cache stays disabled");
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    return passed;
+}
+
+int
+test_symmetry_legacy_state(void *user_data)
+{
+    MyPaintFixedTiledSurface *legacy = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    MyPaintFixedTiledSurface *vertical = mypaint_fixed_tiled_surface_new(SURFACE_SIZE, SURFACE_SIZE);
+    int hits = 0;
+    int misses = 0;
+
+    mypaint_tiled_surface_set_symmetry_state((MyPaintTiledSurface *)legacy, TRUE, 110.0f);
+    mypaint_tiled_surface_set_symmetry((MyPaintTiledSurface *)vertical, MYPAINT_SYMMETRY_TYPE_VERTICAL,
+                                       110.0f, 50.0f, 0);
+    draw_dab((MyPaintSurface *)legacy, 60.3f, 70.7f, 12.0f);
+    draw_dab((MyPaintSurface *)vertical, 60.3f, 70.7f, 12.0f);
+
+    int passed = 1;
+    for (int y = 0; y < SURFACE_SIZE; y += 3) {
+        for (int x = 0; x < SURFACE_SIZE; x += 3) {
+            uint16_t a[4], b[4];
+            get_pixel((MyPaintTiledSurface *)legacy, x, y, a);
+            get_pixel((MyPaintTiledSurface *)vertical, x, y, b);
+            passed &= (memcmp(a, b, sizeof(a)) == 0);
+        }
+    }
+    passed = expect_true(passed, "same as the vertical symmetry type");
+    passed &= expect_true(is_painted(legacy, 159.7f, 70.7f), "mirrored dab");
+
+    // Enabling the cache is left to the caller
+    mypaint_tiled_surface_get_dab_mask_cache_stats((MyPaintTiledSurface *)legacy, &hits, &misses);
+    passed &= expect_int(0, misses, "cache stays disabled");
+
+    mypaint_tiled_surface_set_symmetry_state((MyPaintTiledSurface *)legacy, FALSE, 110.0f);
+    draw_dab((MyPaintSurface *)legacy, 60.3f, 170.7f, 12.0f);
+    passed &= expect_true(is_painted(legacy, 60.3f, 170.7f), "dab");
+    passed &= expect_true(!is_painted(legacy, 159.7f, 170.7f), "no copy when disabled");
+
+    mypaint_surface_unref((MyPaintSurface *)legacy);
+    mypaint_surface_unref((MyPaintSurface *)vertical);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/symmetry/shared_masks", test_symmetry_shared_masks, NULL},
+        {"/symmetry/exact_masks", test_symmetry_exact_masks, NULL},
+        {"/symmetry/rotational", test_symmetry_rotational, NULL},
+        {"/symmetry/legacy_state", test_symmetry_legacy_state, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tilemap.h"
+#include "testutils.h"
+
+#define TILES 5000
+
+static int items_freed = 0;
+
+static void
+free_item(void *item)
+{
+    if (item) {
+        items_freed++;
+        free(item);
+    }
+}
+
+static TileIndex
+random_tile(void)
+{
+    // Both small indices around the origin and very distant ones
+    const int range = (rand() % 2) ? 40 : 1000000;
+    const TileIndex index = {rand() % (2*range) - range, rand() % (2*range) - range};
+    return index;
+}
+
+int
+test_tile_map_insert_get(void *user_data)
+{
+    TileMap *map = tile_map_new(free_item);
+    TileIndex *tiles = (TileIndex *)malloc(TILES*sizeof(TileIndex));
+    int inserted = 0;
+
+    srand(4321);
+    for (int i = 0; i < TILES; i++) {
+        tiles[i] = random_tile();
+        void **item = tile_map_insert(map, tiles[i]);
+        if (!*item) {
+            TileIndex *copy = (TileIndex *)malloc(sizeof(TileIndex));
+            *copy = tiles[i];
+            *item = copy;
+            inserted++;
+        }
+    }
+
+    int found = 1;
+    for (int i = 0; i < TILES; i++) {
+        void **item = tile_map_get(map, tiles[i]);
+        const TileIndex *stored = item ? (TileIndex *)*item : NULL;
+        found &= (stored && stored->x == tiles[i].x && stored->y == tiles[i].y);
+    }
+    int passed = expect_true(found, "inserted tiles are found");
+
+    const TileIndex unused = {-3000000, 3000000};
+    passed &= expect_true(tile_map_get(map, unused) == NULL, "unused tile is not found");
+
+    tile_map_free(map, TRUE);
+    passed &= expect_int(inserted, items_freed, "items freed");
+
+    free(tiles);
+    return passed;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/tile_map/insert_get", test_tile_map_insert_get, NULL},
+    };
+
+    return test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tilescheduler.h"
+#include "mypaint-benchmark.h"
+#include "testutils.h"
+
+#define TILES 200
+
+typedef struct {
+    int processed[TILES];
+    int order[TILES]; // tile processed at each step, for a single thread
+    int steps;
+    int spin; // work per unit of weight
+} Work;
+
+static TileIndex tiles[TILES];
+
+static int
+tile_number(TileIndex index)
+{
+    return index.y*20 + index.x;
+}
+
+// Few heavy tiles at the end, as for a big dab at the end of a stroke
+static int
+weight(void *user_data, TileIndex index)
+{
+    const int n = tile_number(index);
+    return (n >= TILES - 10) ? 100 : n % 3;
+}
+
+static void
+process(void *user_data, TileIndex index)
+{
+    Work *work = (Work *)user_data;
+    const int n = tile_number(index);
+
+    volatile unsigned int sink = 0;
+    for (int i = 0; i < weight(NULL, index)*work->spin; i++) {
+        sink += i;
+    }
+
+    #pragma omp atomic
+    work->processed[n]++;
+
+    int step;
+    #pragma omp atomic capture
+    step = work->steps++;
+    work->order[step] = n;
+}
+
+static void
+init_tiles(void)
+{
+    for (int i = 0; i < TILES; i++) {
+        tiles[i].x = i % 20;
+        tiles[i].y = i / 20;
+    }
+}
+
+int
+test_tile_scheduler_all_tiles_once(void *user_data)
+{
+    TileScheduler *scheduler = tile_scheduler_new();
+    int passed = 1;
+
+    for (int kind = MYPAINT_TILE_SCHEDULER_STATIC; kind <= MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST; kind++) {
+        for (int threads = 1; threads <= 4; threads++) {
+            Work work = {{0}, {0}, 0, 10};
+            tile_scheduler_set_kind(scheduler, (MyPaintTileScheduler)kind);
+            tile_scheduler_set_threads(scheduler, threads);
+            tile_scheduler_run(scheduler, tiles, TILES, TRUE, weight, process, &work);
+
+            int once = 1;
+            for (int i = 0; i < TILES; i++) {
+                once &= (work.processed[i] == 1);
+            }
+            char description[100];
+            snprintf(description, sizeof(description), "scheduler %d with %d threads processes each tile once", kind, threads);
+            passed &= expect_true(once, description);
+        }
+    }
+
+    tile_scheduler_free(scheduler);
+    return passed;
+}
+
+int
+test_tile_scheduler_heaviest_first(void *user_data)
+{
+    TileScheduler *scheduler = tile_scheduler_new();
+    Work work = {{0}, {0}, 0, 0};
+
+    tile_scheduler_set_kind(scheduler, MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST);
+    tile_scheduler_run(scheduler, tiles, TILES, FALSE, weight, process, &work);
+
+    int sorted = 1;
+    for (int i = 1; i < TILES; i++) {
+        const int previous = work.order[i-1];
+        const int current = work.order[i];
+        const int previous_weight = weight(NULL, tiles[previous]);
+        const int current_weight = weight(NULL, tiles[current]);
+        // Equal weights keep the order they were given in
+        sorted &= (previous_weight > current_weight || (previous_weight == current_weight && previous < current));
+    }
+    int passed = expect_true(sorted, "tiles are processed heaviest first");
+
+    tile_scheduler_free(scheduler);
+    return passed;
+}
+
+int
+test_tile_scheduler_busy_times(void *user_data)
+{
+    TileScheduler *scheduler = tile_scheduler_new();
+    Work work = {{0}, {0}, 0, 1000};
+    double busy_times[MYPAINT_MAX_THREADS];
+
+    tile_scheduler_set_threads(scheduler, 2);
+    tile_scheduler_run(scheduler, tiles, TILES, FALSE, weight, process, &work);
+    int passed = expect_int(1, tile_scheduler_get_busy_times(scheduler, busy_times), "threads when not parallel");
+    passed &= expect_true(busy_times[0] > 0.0, "busy time of the only thread");
+
+    tile_scheduler_reset_busy_times(scheduler);
+    passed &= expect_int(0, tile_scheduler_get_busy_times(scheduler, busy_times), "threads after reset");
+
+    tile_scheduler_free(scheduler);
+    return passed;
+}
+
+typedef struct {
+    char *test_case_id;
+    MyPaintTileScheduler kind;
+} SchedulerBenchmarkData;
+
+int
+benchmark_tile_scheduler(void *user_data)
+{
+    SchedulerBenchmarkData *data = (SchedulerBenchmarkData *)user_data;
+    TileScheduler *scheduler = tile_scheduler_new();
+    Work work = {{0}, {0}, 0, 10000};
+    double busy_times[MYPAINT_MAX_THREADS];
+
+    tile_scheduler_set_kind(scheduler, data->kind);
+
+    mypaint_benchmark_start(data->test_case_id);
+    tile_scheduler_run(scheduler, tiles, TILES, TRUE, weight, process, &work);
+    const int result = mypaint_benchmark_end();
+
+    const int threads = tile_scheduler_get_busy_times(scheduler, busy_times);
+    for (int i = 0; i < threads; i++) {
+        fprintf(stderr, "%s: thread %d busy %.1f ms\n", data->test_case_id, i, busy_times[i]*1000.0);
+    }
+
+    tile_scheduler_free(scheduler);
+    return result;
+}
+
+int
+main(int argc, char **argv)
+{
+    init_tiles();
+
+    TestCase test_cases[] = {
+        {"/tile_scheduler/all_tiles_once", test_tile_scheduler_all_tiles_once, NULL},
+        {"/tile_scheduler/heaviest_first", test_tile_scheduler_heaviest_first, NULL},
+        {"/tile_scheduler/busy_times", test_tile_scheduler_busy_times, NULL},
+    };
+    int retval = test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+
+    SchedulerBenchmarkData data[] = {
+        {"scheduler/static", MYPAINT_TILE_SCHEDULER_STATIC},
+        {"scheduler/heaviest_first", MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST},
+    };
+
+    TestCase benchmarks[TEST_CASES_NUMBER(data)];
+    for (int i = 0; i < TEST_CASES_NUMBER(data); i++) {
+        benchmarks[i].id = data[i].test_case_id;
+        benchmarks[i].function = benchmark_tile_scheduler;
+        benchmarks[i].user_data = (void *)&data[i];
+    }
+    retval |= test_cases_run(argc, argv, benchmarks, TEST_CASES_NUMBER(benchmarks), TEST_CASE_BENCHMARK);
+
+    return retval;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <mypaint-brush.h>
+#include <mypaint-fixed-tiled-surface.h>
+
+#include "mypaint-utils-stroke-player.h"
+#include "mypaint-benchmark.h"
+#include "testutils.h"
+
+#define SURFACE_SIZE 1000
+
+static const int tile_sizes[] = {32, 64, 128, 256};
+
+#define TILE_SIZES_NUMBER (sizeof(tile_sizes) / sizeof(tile_sizes[0]))
+
+// Replay painting30sec.dat with @brush on a new fixed surface
+static MyPaintFixedTiledSurface *
+paint(int tile_size, MyPaintBrush *brush, float scale)
+{
+    char *event_data = read_file("events/painting30sec.dat");
+    assert(event_data);
+
+    MyPaintFixedTiledSurface *surface = mypaint_fixed_tiled_surface_new_with_tile_size(SURFACE_SIZE, SURFACE_SIZE, tile_size);
+    MyPaintUtilsStrokePlayer *player = mypaint_utils_stroke_player_new();
+
+    mypaint_brush_reset(brush);
+    mypaint_utils_stroke_player_set_brush(player, brush);
+    mypaint_utils_stroke_player_set_surface(player, (MyPaintSurface *)surface);
+    mypaint_utils_stroke_player_set_source_data(player, event_data);
+    mypaint_utils_stroke_player_set_scale(player, scale);
+    mypaint_utils_stroke_player_run_sync(player);
+
+    mypaint_utils_stroke_player_free(player);
+    free(event_data);
+
+    return surface;
+}
+
+static MyPaintBrush *
+brush_from_file(const char *brush_file, float brush_size)
+{
+    char *brush_data = read_file(brush_file);
+    assert(brush_data);
+
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_string(brush, brush_data);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, log(brush_size));
+
+    free(brush_data);
+    return brush;
+}
+
+// Copy the surface into a linear RGBA image, independent of the tile size
+static uint16_t *
+surface_to_image(MyPaintFixedTiledSurface *surface)
+{
+    MyPaintTiledSurface *tiled = (MyPaintTiledSurface *)surface;
+    const int tile_size = tiled->tile_size;
+    const int tiles = (SURFACE_SIZE + tile_size - 1) / tile_size;
+    uint16_t *image = (uint16_t *)malloc(SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t));
+
+    for (int ty = 0; ty < tiles; ty++) {
+        for (int tx = 0; tx < tiles; tx++) {
+            MyPaintTileRequest request;
+            mypaint_tile_request_init(&request, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(tiled, &request);
+
+            for (int y = 0; y < tile_size && ty*tile_size + y < SURFACE_SIZE; y++) {
+                const int width = (tx + 1)*tile_size <= SURFACE_SIZE ? tile_size : SURFACE_SIZE - tx*tile_size;
+                memcpy(image + ((ty*tile_size + y)*SURFACE_SIZE + tx*tile_size)*4,
+                       request.buffer + y*tile_size*4,
+                       width*4*sizeof(uint16_t));
+            }
+
+            mypaint_tiled_surface_tile_request_end(tiled, &request);
+        }
+    }
+    return image;
+}
+
+int
+test_tile_sizes_supported(void *user_data)
+{
+    int passed = 1;
+    for (int i = 0; i < TILE_SIZES_NUMBER; i++) {
+        passed &= expect_true(mypaint_tiled_surface_tile_size_is_supported(tile_sizes[i]), "supported tile size");
+    }
+    passed &= expect_true(!mypaint_tiled_surface_tile_size_is_supported(16), "too small tile size");
+    passed &= expect_true(!mypaint_tiled_surface_tile_size_is_supported(512), "too big tile size");
+    passed &= expect_true(!mypaint_tiled_surface_tile_size_is_supported(96), "tile size not a power of two");
+    return passed;
+}
+
+// The brush must not use smudging: get_color() sums up per tile,
+// so its result depends (by rounding) on the tile size.
+int
+test_tile_sizes_same_result(void *user_data)
+{
+    MyPaintBrush *brush = mypaint_brush_new();
+    mypaint_brush_from_defaults(brush);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_RADIUS_LOGARITHMIC, log(8.0));
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_HARDNESS, 0.6);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_COLOR_S, 0.8);
+    mypaint_brush_set_base_value(brush, MYPAINT_BRUSH_SETTING_COLOR_V, 0.6);
+
+    MyPaintFixedTiledSurface *reference_surface = paint(MYPAINT_TILE_SIZE, brush, 1.0);
+    uint16_t *reference = surface_to_image(reference_surface);
+    mypaint_surface_unref((MyPaintSurface *)reference_surface);
+
+    // The fixed surface starts out with all bits set
+    int painted = 0;
+    for (int i = 0; i < SURFACE_SIZE*SURFACE_SIZE*4; i++) {
+        if (reference[i] != 0xffff) {
+            painted++;
+        }
+    }
+    int passed = expect_true(painted > 0, "stroke was painted");
+
+    for (int i = 0; i < TILE_SIZES_NUMBER; i++) {
+        MyPaintFixedTiledSurface *surface = paint(tile_sizes[i], brush, 1.0);
+        uint16_t *image = surface_to_image(surface);
+
+        char description[100];
+        snprintf(description, sizeof(description), "tile size %d paints the same as %d", tile_sizes[i], MYPAINT_TILE_SIZE);
+        passed &= expect_true(memcmp(reference, image, SURFACE_SIZE*SURFACE_SIZE*4*sizeof(uint16_t)) == 0, description);
+
+        free(image);
+        mypaint_surface_unref((MyPaintSurface *)surface);
+    }
+
+    free(reference);
+    mypaint_brush_unref(brush);
+    return passed;
+}
+
+typedef struct {
+    char *test_case_id;
+    int tile_size;
+    const char *brush_file;
+    float brush_size;
+    float scale;
+} TileSizeBenchmarkData;
+
+int
+benchmark_tile_size(void *user_data)
+{
+    TileSizeBenchmarkData *data = (TileSizeBenchmarkData *)user_data;
+
+    MyPaintBrush *brush = brush_from_file(data->brush_file, data->brush_size);
+
+    mypaint_benchmark_start(data->test_case_id);
+    MyPaintFixedTiledSurface *surface = paint(data->tile_size, brush, data->scale);
+    const int result = mypaint_benchmark_end();
+
+    mypaint_surface_unref((MyPaintSurface *)surface);
+    mypaint_brush_unref(brush);
+    return result;
+}
+
+int
+main(int argc, char **argv)
+{
+    TestCase test_cases[] = {
+        {"/tile_sizes/supported", test_tile_sizes_supported, NULL},
+        {"/tile_sizes/same_result", test_tile_sizes_same_result, NULL},
+    };
+    int retval = test_cases_run(argc, argv, test_cases, TEST_CASES_NUMBER(test_cases), TEST_CASE_NORMAL);
+
+    // Sweep over the tile sizes, for tuning parallelism against per-tile overhead
+    TileSizeBenchmarkData data[] = {
+        {"32/charcoal/4", 32, "brushes/charcoal.myb", 4.0, 1.0},
+        {"64/charcoal/4", 64, "brushes/charcoal.myb", 4.0, 1.0},
+        {"128/charcoal/4", 128, "brushes/charcoal.myb", 4.0, 1.0},
+        {"256/charcoal/4", 256, "brushes/charcoal.myb", 4.0, 1.0},
+        {"32/modelling/32", 32, "brushes/modelling.myb", 32.0, 2.0},
+        {"64/modelling/32", 64, "brushes/modelling.myb", 32.0, 2.0},
+        {"128/modelling/32", 128, "brushes/modelling.myb", 32.0, 2.0},
+        {"256/modelling/32", 256, "brushes/modelling.myb", 32.0, 2.0},
+        {"32/bulk/128", 32, "brushes/bulk.myb", 128.0, 4.0},
+        {"64/bulk/128", 64, "brushes/bulk.myb", 128.0, 4.0},
+        {"128/bulk/128", 128, "brushes/bulk.myb", 128.0, 4.0},
+        {"256/bulk/128", 256, "brushes/bulk.myb", 128.0, 4.0},
+    };
+
+    TestCase benchmarks[TEST_CASES_NUMBER(data)];
+    for (int i = 0; i < TEST_CASES_NUMBER(data); i++) {
+        benchmarks[i].id = data[i].test_case_id;
+        benchmarks[i].function = benchmark_tile_size;
+        benchmarks[i].user_data = (void *)&data[i];
+    }
+    retval |= test_cases_run(argc, argv, benchmarks, TEST_CASES_NUMBER(benchmarks), TEST_CASE_BENCHMARK);
+
+    return retval;
+}
@@ -24,8 +24,9 @@ read_file(const char *path)
     file_size = ftell(file);
     rewind(file);
 
-    char *buffer = (char *)malloc(sizeof(char)*file_size);
+    char *buffer = (char *)malloc(sizeof(char)*(file_size + 1));
     size_t result = fread(buffer, 1, file_size, file);
+    buffer[result] = '\0';
 
     fclose(file);
 
@@ -67,6 +68,13 @@ expect_true(int actual, const char *description) {
     return passed;
 }
 
+// Uniformly distributed between @min and @max, from rand()
+float
+random_float(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
 int
 test_cases_run(int argc, char **argv, TestCase *tests, int tests_n, TestCaseType type)
 {
@@ -91,3 +99,48 @@ test_cases_run(int argc, char **argv, TestCase *tests, int tests_n, TestCaseType
 
     return (failures != 0);
 }
+
+// The tiles of the @width x @height pixels at the origin of @surface,
+// one tile after the other, row by row. Free with free().
+void *
+read_image(MyPaintTiledSurface *surface, int width, int height)
+{
+    const int tile_size = surface->tile_size;
+    const size_t tile_bytes = mypaint_tile_format_get_tile_bytes(mypaint_tiled_surface_get_tile_format(surface), tile_size);
+    const int tiles_w = (width + tile_size - 1) / tile_size;
+    const int tiles_h = (height + tile_size - 1) / tile_size;
+    char *image = (char *)malloc(tiles_w*tiles_h*tile_bytes);
+    for (int ty = 0; ty < tiles_h; ty++) {
+        for (int tx = 0; tx < tiles_w; tx++) {
+            MyPaintTileRequest request;
+            mypaint_tile_request_init(&request, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(surface, &request);
+            memcpy(image + (ty*tiles_w + tx)*tile_bytes, request.buffer, tile_bytes);
+            mypaint_tiled_surface_tile_request_end(surface, &request);
+        }
+    }
+    return image;
+}
+
+// Whether the @width x @height pixels at the origin are the same,
+// for surfaces with the same tile size and format
+int
+surfaces_equal(MyPaintTiledSurface *a, MyPaintTiledSurface *b, int width, int height)
+{
+    const int tile_size = a->tile_size;
+    const size_t tile_bytes = mypaint_tile_format_get_tile_bytes(mypaint_tiled_surface_get_tile_format(a), tile_size);
+    int equal = 1;
+    for (int ty = 0; ty < (height + tile_size - 1) / tile_size; ty++) {
+        for (int tx = 0; tx < (width + tile_size - 1) / tile_size; tx++) {
+            MyPaintTileRequest request_a, request_b;
+            mypaint_tile_request_init(&request_a, 0, tx, ty, TRUE);
+            mypaint_tile_request_init(&request_b, 0, tx, ty, TRUE);
+            mypaint_tiled_surface_tile_request_start(a, &request_a);
+            mypaint_tiled_surface_tile_request_start(b, &request_b);
+            equal &= (memcmp(request_a.buffer, request_b.buffer, tile_bytes) == 0);
+            mypaint_tiled_surface_tile_request_end(a, &request_a);
+            mypaint_tiled_surface_tile_request_end(b, &request_b);
+        }
+    }
+    return equal;
+}
@@ -1,6 +1,8 @@
 #ifndef TESTUTILS_H
 #define TESTUTILS_H
 
+#include <mypaint-tiled-surface.h>
+
 typedef int (*TestFunction) (void *user_data);
 
 typedef struct {
@@ -22,6 +24,11 @@ int expect_int(int expected, int actual, const char *description);
 int expect_float(float expected, float actual, const char *description);
 int expect_true(int actual, const char *description);
 
+float random_float(float min, float max);
+
+void *read_image(MyPaintTiledSurface *surface, int width, int height);
+int surfaces_equal(MyPaintTiledSurface *a, MyPaintTiledSurface *b, int width, int height);
+
 #define TEST_CASES_NUMBER(array) (sizeof(array) / sizeof(array[0]))
 
 #endif // TESTUTILS_H
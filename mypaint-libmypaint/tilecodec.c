@@ -0,0 +1,238 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tilecodec.h"
+
+// Lossless compression of tiles which are not in use.
+// Painted tiles are mostly areas of one color (often transparent), and
+// smooth gradients from soft dabs. Each 16 bit word of a pixel is stored as
+// the difference to its prediction from the pixels to the left and above
+// (left + above - above left, as the PNG gradient filter). Areas of one
+// color and linear gradients become zeros, soft dabs small numbers.
+//
+// The data starts with a byte for the method. For TILE_CODEC_STORED, the
+// pixels follow as they are. This is used when the compression does not
+// make the data smaller, as with the lower halves of float32 values.
+// Otherwise it is a sequence of runs, each starting with a 16 bit little
+// endian header: the number of pixels minus one in the lower 15 bits, and
+// the highest bit set for a repeat. A repeat is followed by the differences
+// of one pixel, a literal run by the ones of each pixel. The differences
+// are zigzag encoded (0, -1, 1, -2, ...) and stored with 7 bits per byte,
+// the highest bit set if more bytes follow.
+
+enum {
+    TILE_CODEC_STORED,
+    TILE_CODEC_GRADIENT
+};
+
+#define MAX_RUN (1<<15)
+#define REPEAT_BIT 0x8000
+
+// Prediction of word @i, from the words of the pixels before it
+static inline uint16_t
+predict(const uint16_t *p, int i, int words, int row_words)
+{
+    const int x = i % row_words;
+    const int left = (x >= words) ? p[i - words] : 0;
+    if (i < row_words) {
+        return left;
+    }
+    const int above = p[i - row_words];
+    if (x < words) {
+        return above;
+    }
+    return left + above - p[i - row_words - words];
+}
+
+static inline uint8_t *
+put_header(uint8_t *out, int n, gboolean repeat)
+{
+    const int header = (n - 1) | (repeat ? REPEAT_BIT : 0);
+    out[0] = header & 0xff;
+    out[1] = header >> 8;
+    return out + 2;
+}
+
+static inline uint8_t *
+put_residuals(uint8_t *out, const uint16_t *residuals, int words)
+{
+    for (int w = 0; w < words; w++) {
+        uint16_t v = residuals[w];
+        while (v >= 0x80) {
+            *out++ = (v & 0x7f) | 0x80;
+            v >>= 7;
+        }
+        *out++ = v;
+    }
+    return out;
+}
+
+static inline const uint8_t *
+get_residuals(const uint8_t *in, uint16_t *residuals, int words)
+{
+    for (int w = 0; w < words; w++) {
+        uint16_t v = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            v |= (*in++ & 0x7f) << shift;
+            shift += 7;
+        }
+        residuals[w] = v | (*in++ << shift);
+    }
+    return in;
+}
+
+static inline gboolean
+same_residuals(const uint16_t *residuals, int a, int b, int words)
+{
+    return memcmp(residuals + a*words, residuals + b*words, words*sizeof(uint16_t)) == 0;
+}
+
+// Size of the buffer passed to tile_codec_compress(). The encoding stops
+// once it is larger than the pixels, the last run may go beyond that.
+size_t
+tile_codec_max_bytes(int tile_size, int pixel_bytes)
+{
+    return 1 + (size_t)tile_size*tile_size*pixel_bytes + 2 + 2*pixel_bytes;
+}
+
+// Compresses the square tile @src of @tile_size pixels per side.
+// Returns the size of the compressed data written to @dst.
+size_t
+tile_codec_compress(const uint8_t *src_bytes, int tile_size, int pixel_bytes, uint8_t *dst)
+{
+    assert(pixel_bytes <= TILE_CODEC_MAX_PIXEL_BYTES && pixel_bytes % 2 == 0);
+    const uint16_t *src = (const uint16_t *)src_bytes;
+    const int pixels = tile_size*tile_size;
+    const int words = pixel_bytes / 2;
+    const int row_words = tile_size*words;
+    const size_t stored_bytes = 1 + (size_t)pixels*pixel_bytes;
+
+    uint16_t *residuals = (uint16_t *)malloc((size_t)pixels*pixel_bytes);
+    for (int i = 0; i < pixels*words; i++) {
+        const int16_t d = (int16_t)(src[i] - predict(src, i, words, row_words));
+        residuals[i] = (uint16_t)((d << 1) ^ (d >> 15));
+    }
+
+    uint8_t *out = dst;
+    *out++ = TILE_CODEC_GRADIENT;
+    int i = 0;
+    while (i < pixels && (size_t)(out - dst) < stored_bytes) {
+        int n = 1;
+        while (i + n < pixels && n < MAX_RUN && same_residuals(residuals, i, i + n, words)) {
+            n++;
+        }
+        if (n > 1) {
+            out = put_header(out, n, TRUE);
+            out = put_residuals(out, residuals + i*words, words);
+        } else {
+            // Up to where the next repeat starts
+            uint8_t *header = out;
+            out = put_residuals(out + 2, residuals + i*words, words);
+            while (i + n < pixels && n < MAX_RUN && (size_t)(out - dst) < stored_bytes
+                   && !(i + n + 1 < pixels && same_residuals(residuals, i + n, i + n + 1, words))) {
+                out = put_residuals(out, residuals + (i + n)*words, words);
+                n++;
+            }
+            put_header(header, n, FALSE);
+        }
+        i += n;
+    }
+    free(residuals);
+
+    if ((size_t)(out - dst) >= stored_bytes) {
+        dst[0] = TILE_CODEC_STORED;
+        memcpy(dst + 1, src_bytes, (size_t)pixels*pixel_bytes);
+        return stored_bytes;
+    }
+    return out - dst;
+}
+
+void
+tile_codec_decompress(const uint8_t *src, size_t src_bytes, int tile_size, int pixel_bytes,
+                      uint8_t *dst_bytes)
+{
+    if (src[0] == TILE_CODEC_STORED) {
+        memcpy(dst_bytes, src + 1, src_bytes - 1);
+        return;
+    }
+
+    const int words = pixel_bytes / 2;
+    const int row_words = tile_size*words;
+    uint16_t *dst = (uint16_t *)dst_bytes;
+
+    // The residuals first, then the predictions are added in place
+    uint16_t *out = dst;
+    const uint8_t *end = src + src_bytes;
+    src++;
+    while (src < end) {
+        const int header = src[0] | (src[1] << 8);
+        const int n = (header & ~REPEAT_BIT) + 1;
+        src += 2;
+        if (header & REPEAT_BIT) {
+            src = get_residuals(src, out, words);
+            for (int i = 1; i < n; i++) {
+                memcpy(out + i*words, out, words*sizeof(uint16_t));
+            }
+            out += n*words;
+        } else {
+            for (int i = 0; i < n; i++) {
+                src = get_residuals(src, out, words);
+                out += words;
+            }
+        }
+    }
+
+    for (int i = 0; i < tile_size*row_words; i++) {
+        const uint16_t v = dst[i];
+        const int16_t d = (int16_t)((v >> 1) ^ -(v & 1));
+        dst[i] = predict(dst, i, words, row_words) + d;
+    }
+}
+
+// TRUE if all pixels of @src are the same
+gboolean
+tile_codec_is_uniform(const uint8_t *src, int pixels, int pixel_bytes)
+{
+    // Comparing with the pixels one before, the whole buffer at once
+    return memcmp(src, src + pixel_bytes, (size_t)(pixels - 1)*pixel_bytes) == 0;
+}
+
+// Sets all @pixels of @dst to @pixel
+void
+tile_codec_fill(uint8_t *dst, int pixels, int pixel_bytes, const uint8_t *pixel)
+{
+    gboolean same_bytes = TRUE;
+    for (int b = 1; b < pixel_bytes; b++) {
+        same_bytes &= (pixel[b] == pixel[0]);
+    }
+    if (same_bytes) {
+        memset(dst, pixel[0], (size_t)pixels*pixel_bytes);
+        return;
+    }
+    // Doubling the filled part
+    memcpy(dst, pixel, pixel_bytes);
+    size_t filled = pixel_bytes;
+    const size_t total = (size_t)pixels*pixel_bytes;
+    while (filled < total) {
+        const size_t n = (filled < total - filled) ? filled : total - filled;
+        memcpy(dst + filled, dst, n);
+        filled += n;
+    }
+}
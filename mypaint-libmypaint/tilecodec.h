@@ -0,0 +1,38 @@
+#ifndef TILECODEC_H
+#define TILECODEC_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mypaint-glib-compat.h>
+
+G_BEGIN_DECLS
+
+// Largest pixel size the codec handles, float32 RGBA
+#define TILE_CODEC_MAX_PIXEL_BYTES 16
+
+size_t tile_codec_max_bytes(int tile_size, int pixel_bytes);
+size_t tile_codec_compress(const uint8_t *src, int tile_size, int pixel_bytes, uint8_t *dst);
+void tile_codec_decompress(const uint8_t *src, size_t src_bytes, int tile_size, int pixel_bytes,
+                           uint8_t *dst);
+
+gboolean tile_codec_is_uniform(const uint8_t *src, int pixels, int pixel_bytes);
+void tile_codec_fill(uint8_t *dst, int pixels, int pixel_bytes, const uint8_t *pixel);
+
+G_END_DECLS
+
+#endif // TILECODEC_H
@@ -1,8 +1,19 @@
+#include "dabmask.h"
 
+// Size of a run length encoded dab mask buffer for one tile, in uint16_t
+#define DAB_MASK_RLE_SIZE(tile_size) ((tile_size)*(tile_size)+2*(tile_size))
 
 void render_dab_mask (uint16_t * mask,
+                        int tile_size,
                         float x, float y,
                         float radius,
                         float hardness,
                         float aspect_ratio, float angle
                         );
+
+void render_dab_mask_spans (DabMask * mask,
+                            float x, float y,
+                            float radius,
+                            float hardness,
+                            float aspect_ratio, float angle
+                            );
@@ -15,23 +15,58 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include "tilemap.h"
 
+struct _TileMapBlock {
+    TileIndex index; // in units of blocks
+    void *items[TILE_MAP_BLOCK_SIZE*TILE_MAP_BLOCK_SIZE];
+};
+
+#define TILE_MAP_INITIAL_BLOCKS 16
+
+// Rounds towards negative infinity, unlike the / operator
+static inline int
+floor_div(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static inline unsigned int
+block_hash(TileIndex block_index)
+{
+    uint32_t hash = (uint32_t)block_index.x * 0x9E3779B1u + (uint32_t)block_index.y * 0x85EBCA77u;
+    return hash ^ (hash >> 15);
+}
+
+/* Orders tiles by row, and then by column. For use with qsort() and bsearch() */
+int
+tile_index_compare(const void *a, const void *b)
+{
+    const TileIndex *tile_a = (const TileIndex *)a;
+    const TileIndex *tile_b = (const TileIndex *)b;
+
+    if (tile_a->y != tile_b->y) {
+        return (tile_a->y < tile_b->y) ? -1 : 1;
+    }
+    if (tile_a->x != tile_b->x) {
+        return (tile_a->x < tile_b->x) ? -1 : 1;
+    }
+    return 0;
+}
+
 TileMap *
-tile_map_new(int size, size_t item_size, TileMapItemFreeFunc item_free_func)
+tile_map_new(TileMapItemFreeFunc item_free_func)
 {
     TileMap *self = (TileMap *)malloc(sizeof(TileMap));
 
-    self->size = size;
-    self->item_size = item_size;
+    self->blocks_size = TILE_MAP_INITIAL_BLOCKS;
+    self->blocks_n = 0;
     self->item_free_func = item_free_func;
-    const int map_size = 2*self->size*2*self->size;
-    self->map = malloc(map_size*self->item_size);
-    for(int i = 0; i < map_size; i++) {
-        self->map[i] = NULL;
-    }
+    self->blocks = (TileMapBlock **)calloc(self->blocks_size, sizeof(TileMapBlock *));
+    self->allocations = 2;
 
     return self;
 }
@@ -39,49 +74,97 @@ tile_map_new(int size, size_t item_size, TileMapItemFreeFunc item_free_func)
 void
 tile_map_free(TileMap *self, gboolean free_items)
 {
-    const int map_size = 2*self->size*2*self->size;
-    if (free_items) {
-        for(int i = 0; i < map_size; i++) {
-            self->item_free_func(self->map[i]);
+    for (int i = 0; i < self->blocks_size; i++) {
+        TileMapBlock *block = self->blocks[i];
+        if (!block) {
+            continue;
+        }
+        if (free_items) {
+            for (int j = 0; j < TILE_MAP_BLOCK_SIZE*TILE_MAP_BLOCK_SIZE; j++) {
+                self->item_free_func(block->items[j]);
+            }
         }
+        free(block);
     }
-    free(self->map);
+    free(self->blocks);
 
     free(self);
 }
 
-/* Get the data in the tile map for a given tile @index.
- * Must be reentrant and lock-free on different @index */
+// Slot of the block in the hash table: either the block, or the empty slot
+// where it would be inserted
+static TileMapBlock **
+find_block(TileMapBlock **blocks, int blocks_size, TileIndex block_index)
+{
+    const unsigned int mask = blocks_size - 1;
+    unsigned int i = block_hash(block_index) & mask;
+
+    while (blocks[i] && (blocks[i]->index.x != block_index.x || blocks[i]->index.y != block_index.y)) {
+        i = (i + 1) & mask;
+    }
+    return blocks + i;
+}
+
+static void **
+block_item(TileMapBlock *block, TileIndex index)
+{
+    const int x = index.x - block->index.x*TILE_MAP_BLOCK_SIZE;
+    const int y = index.y - block->index.y*TILE_MAP_BLOCK_SIZE;
+    return block->items + y*TILE_MAP_BLOCK_SIZE + x;
+}
+
+/* Get the data in the tile map for a given tile @index,
+ * or NULL if nothing was inserted for the tiles around @index.
+ * Must be reentrant and lock-free on different @index,
+ * as long as tile_map_insert() is not called at the same time. */
 void **
 tile_map_get(TileMap *self, TileIndex index)
 {
-    const int rowstride = self->size*2;
-    const int offset = ((self->size + index.y) * rowstride) + self->size + index.x;
-    assert(offset < 2*self->size*2*self->size);
-    assert(offset >= 0);
-    return self->map + offset;
+    const TileIndex block_index = {floor_div(index.x, TILE_MAP_BLOCK_SIZE), floor_div(index.y, TILE_MAP_BLOCK_SIZE)};
+    TileMapBlock *block = *find_block(self->blocks, self->blocks_size, block_index);
+
+    return block ? block_item(block, index) : NULL;
 }
 
-/* Copy
- * The size of @other must be equal or larger to that of @self */
-void
-tile_map_copy_to(TileMap *self, TileMap *other)
+static void
+grow(TileMap *self)
 {
-    assert(other->size >= self->size);
+    const int new_size = self->blocks_size*2;
+    TileMapBlock **new_blocks = (TileMapBlock **)calloc(new_size, sizeof(TileMapBlock *));
+    self->allocations++;
 
-    for(int y = -self->size; y < self->size; y++) {
-        for(int x = -self->size; x < self->size; x++) {
-            TileIndex index = {x, y};
-            *tile_map_get(other, index) = *tile_map_get(self, index);
+    for (int i = 0; i < self->blocks_size; i++) {
+        TileMapBlock *block = self->blocks[i];
+        if (block) {
+            *find_block(new_blocks, new_size, block->index) = block;
         }
     }
+    free(self->blocks);
+
+    self->blocks = new_blocks;
+    self->blocks_size = new_size;
 }
 
-/* Must be reentrant and lock-free on different @index */
-gboolean
-tile_map_contains(TileMap *self, TileIndex index)
+/* Get the data in the tile map for a given tile @index,
+ * making room for it if needed. New items are NULL.
+ * Not thread-safe. */
+void **
+tile_map_insert(TileMap *self, TileIndex index)
 {
-    return (index.x >= -self->size && index.x < self->size
-            && index.y >= -self->size && index.y < self->size);
-}
+    const TileIndex block_index = {floor_div(index.x, TILE_MAP_BLOCK_SIZE), floor_div(index.y, TILE_MAP_BLOCK_SIZE)};
+    TileMapBlock **slot = find_block(self->blocks, self->blocks_size, block_index);
 
+    if (!*slot) {
+        // Keep the load factor at or below 1/2, so that probing stays short
+        if (2*(self->blocks_n + 1) > self->blocks_size) {
+            grow(self);
+            slot = find_block(self->blocks, self->blocks_size, block_index);
+        }
+        TileMapBlock *block = (TileMapBlock *)calloc(1, sizeof(TileMapBlock));
+        self->allocations++;
+        block->index = block_index;
+        *slot = block;
+        self->blocks_n++;
+    }
+    return block_item(*slot, index);
+}
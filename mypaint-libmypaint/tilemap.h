@@ -17,6 +17,7 @@
 #ifndef TILEMAP_H
 #define TILEMAP_H
 
+#include <stdlib.h>
 #include <mypaint-glib-compat.h>
 
 G_BEGIN_DECLS
@@ -28,30 +29,36 @@ typedef struct {
 
 typedef void (*TileMapItemFreeFunc) (void *item_data);
 
-// A size of 10 means the map spans x=[-10,9], y=[-10,9]
-// The tile with TileIndex (x,y) is stored in the map at offset
-// offset=((self->size + y) * rowstride) + (self->size + index.x)
+int
+tile_index_compare(const void *a, const void *b);
+
+// The map is sparse and has no bounds, any TileIndex can be stored.
+// Tiles are grouped in square blocks of TILE_MAP_BLOCK_SIZE tiles per side,
+// which are found through a hash table. Blocks are never moved or freed
+// before the map is, so pointers returned by tile_map_get() stay valid.
+#define TILE_MAP_BLOCK_SIZE 16
+
+typedef struct _TileMapBlock TileMapBlock;
+
 typedef struct {
-    void **map;
-    int size;
-    size_t item_size;
+    TileMapBlock **blocks; // hash table with open addressing
+    int blocks_size; // power of two
+    int blocks_n;
     TileMapItemFreeFunc item_free_func;
+    int allocations;
 } TileMap;
 
 TileMap *
-tile_map_new(int size, size_t item_size, TileMapItemFreeFunc item_free_func);
+tile_map_new(TileMapItemFreeFunc item_free_func);
 
 void
 tile_map_free(TileMap *self, gboolean free_items);
 
-gboolean
-tile_map_contains(TileMap *self, TileIndex index);
-
 void **
 tile_map_get(TileMap *self, TileIndex index);
 
-void
-tile_map_copy_to(TileMap *self, TileMap *other);
+void **
+tile_map_insert(TileMap *self, TileIndex index);
 
 G_END_DECLS
 
@@ -0,0 +1,212 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "tilescheduler.h"
+
+// Distributes the processing of dirty tiles over the OpenMP threads.
+//
+// MYPAINT_TILE_SCHEDULER_STATIC splits the tiles evenly between the threads,
+// in the order they are given.
+// MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST orders the tiles by weight (the number
+// of queued operations), heaviest first, and hands them out one at a time.
+// Threads that finish early take the next tile, so no thread waits behind
+// one expensive tile while others still have work.
+//
+// The time each thread spent processing tiles is accumulated, to show
+// how well the work was balanced.
+//
+// Concurrency: tile_scheduler_run() must not be called concurrently on the same @self.
+
+typedef struct {
+    TileIndex index;
+    int weight;
+    int position; // in the input
+} WeightedTile;
+
+struct _TileScheduler {
+    MyPaintTileScheduler kind;
+    int threads; // 0 for the OpenMP default
+
+    WeightedTile *order;
+    int order_size;
+
+    double busy_times[MYPAINT_MAX_THREADS];
+    int busy_threads; // number of threads that have processed tiles
+};
+
+TileScheduler *
+tile_scheduler_new(void)
+{
+    TileScheduler *self = (TileScheduler *)malloc(sizeof(TileScheduler));
+
+    self->kind = MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST;
+    self->threads = 0;
+    self->order = NULL;
+    self->order_size = 0;
+    tile_scheduler_reset_busy_times(self);
+
+    return self;
+}
+
+void
+tile_scheduler_free(TileScheduler *self)
+{
+    free(self->order);
+    free(self);
+}
+
+void
+tile_scheduler_set_kind(TileScheduler *self, MyPaintTileScheduler kind)
+{
+    self->kind = kind;
+}
+
+/* Use @threads threads for processing tiles, at most MYPAINT_MAX_THREADS.
+ * 0 uses the OpenMP default. */
+void
+tile_scheduler_set_threads(TileScheduler *self, int threads)
+{
+    self->threads = (threads > MYPAINT_MAX_THREADS) ? MYPAINT_MAX_THREADS : threads;
+}
+
+static int
+thread_count(TileScheduler *self, gboolean parallel)
+{
+#ifdef _OPENMP
+    if (parallel) {
+        const int threads = (self->threads > 0) ? self->threads : omp_get_max_threads();
+        return (threads > MYPAINT_MAX_THREADS) ? MYPAINT_MAX_THREADS : threads;
+    }
+#endif
+    return 1;
+}
+
+static int
+thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static double
+wall_time(void)
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static int
+compare_weighted_tiles(const void *a, const void *b)
+{
+    const WeightedTile *tile_a = (const WeightedTile *)a;
+    const WeightedTile *tile_b = (const WeightedTile *)b;
+
+    if (tile_a->weight != tile_b->weight) {
+        return (tile_a->weight > tile_b->weight) ? -1 : 1;
+    }
+    // Keep the order of the input for equal weights, for locality
+    return tile_a->position - tile_b->position;
+}
+
+static void
+order_by_weight(TileScheduler *self, const TileIndex *tiles, int tiles_n,
+                TileSchedulerWeightFunc weight, void *user_data)
+{
+    if (tiles_n > self->order_size) {
+        self->order_size = (tiles_n > 2*self->order_size) ? tiles_n : 2*self->order_size;
+        free(self->order);
+        self->order = (WeightedTile *)malloc(self->order_size*sizeof(WeightedTile));
+    }
+    for (int i = 0; i < tiles_n; i++) {
+        self->order[i].index = tiles[i];
+        self->order[i].weight = weight(user_data, tiles[i]);
+        self->order[i].position = i;
+    }
+    qsort(self->order, tiles_n, sizeof(WeightedTile), compare_weighted_tiles);
+}
+
+/* Call @process for each of the @tiles, in parallel if @parallel is TRUE.
+ * @weight gives the relative cost of processing a tile, it is only used
+ * by schedulers which balance the load. */
+void
+tile_scheduler_run(TileScheduler *self, const TileIndex *tiles, int tiles_n, gboolean parallel,
+                   TileSchedulerWeightFunc weight, TileSchedulerProcessFunc process, void *user_data)
+{
+    const int threads = thread_count(self, parallel);
+    const gboolean heaviest_first = (self->kind == MYPAINT_TILE_SCHEDULER_HEAVIEST_FIRST);
+
+    if (heaviest_first) {
+        order_by_weight(self, tiles, tiles_n, weight, user_data);
+    }
+
+    #pragma omp parallel num_threads(threads) if(threads > 1)
+    {
+        const int thread = thread_num();
+        const double start = wall_time();
+
+        if (heaviest_first) {
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int i = 0; i < tiles_n; i++) {
+                process(user_data, self->order[i].index);
+            }
+        } else {
+            #pragma omp for schedule(static) nowait
+            for (int i = 0; i < tiles_n; i++) {
+                process(user_data, tiles[i]);
+            }
+        }
+
+        // Each thread only writes its own entry
+        self->busy_times[thread] += wall_time() - start;
+    }
+
+    if (threads > self->busy_threads) {
+        self->busy_threads = threads;
+    }
+}
+
+/* Get the time in seconds each thread spent processing tiles,
+ * since the last reset. @busy_times must have room for MYPAINT_MAX_THREADS
+ * entries. Returns the number of threads. */
+int
+tile_scheduler_get_busy_times(TileScheduler *self, double *busy_times)
+{
+    for (int i = 0; i < self->busy_threads; i++) {
+        busy_times[i] = self->busy_times[i];
+    }
+    return self->busy_threads;
+}
+
+void
+tile_scheduler_reset_busy_times(TileScheduler *self)
+{
+    for (int i = 0; i < MYPAINT_MAX_THREADS; i++) {
+        self->busy_times[i] = 0.0;
+    }
+    self->busy_threads = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+#include <mypaint-config.h>
+#include <mypaint-tiled-surface.h>
+#include "tilemap.h"
+
+G_BEGIN_DECLS
+
+typedef void (*TileSchedulerProcessFunc) (void *user_data, TileIndex index);
+typedef int (*TileSchedulerWeightFunc) (void *user_data, TileIndex index);
+
+typedef struct _TileScheduler TileScheduler;
+
+TileScheduler *tile_scheduler_new(void);
+void tile_scheduler_free(TileScheduler *self);
+
+void tile_scheduler_set_kind(TileScheduler *self, MyPaintTileScheduler kind);
+void tile_scheduler_set_threads(TileScheduler *self, int threads);
+
+void tile_scheduler_run(TileScheduler *self, const TileIndex *tiles, int tiles_n, gboolean parallel,
+                        TileSchedulerWeightFunc weight, TileSchedulerProcessFunc process, void *user_data);
+
+int tile_scheduler_get_busy_times(TileScheduler *self, double *busy_times);
+void tile_scheduler_reset_busy_times(TileScheduler *self);
+
+G_END_DECLS
+
+#endif // TILESCHEDULER_H
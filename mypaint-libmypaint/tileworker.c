@@ -0,0 +1,236 @@
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "tileworker.h"
+
+// Processes a list of tiles on a background thread, so that the caller
+// can go on queueing the next operations in the meantime.
+//
+// Jobs are numbered in the order they were started, starting at 1.
+// Only one job runs at a time, starting a job waits for the previous one.
+// Every tile of the running job has a fence: tile_worker_wait_for_tile()
+// only waits until that tile is done, not for the whole job.
+//
+// The tile list of a job must be sorted with tile_index_compare(),
+// and must stay valid until the job is done.
+//
+// Concurrency: all functions must be called from the same thread,
+// except for tile_worker_wait_for_tile(), which may be called from any thread.
+// The callbacks are called from the worker thread (and OpenMP threads
+// started from it).
+
+struct _TileWorker {
+    pthread_t thread;
+    gboolean thread_running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signalled on a new job, a finished tile, a finished job and quit
+    gboolean quit;
+
+    int jobs_started;
+    int jobs_done;
+
+    // The current job
+    TileScheduler *scheduler;
+    const TileIndex *tiles;
+    int tiles_n;
+    gboolean parallel;
+    TileSchedulerWeightFunc weight;
+    TileSchedulerProcessFunc process;
+    void *user_data;
+
+    gboolean *tiles_done;
+    int tiles_done_size;
+};
+
+static int
+job_weight(void *user_data, TileIndex index)
+{
+    TileWorker *self = (TileWorker *)user_data;
+    return self->weight(self->user_data, index);
+}
+
+static void
+job_process(void *user_data, TileIndex index)
+{
+    TileWorker *self = (TileWorker *)user_data;
+    self->process(self->user_data, index);
+
+    const TileIndex *tile = (const TileIndex *)bsearch(&index, self->tiles, self->tiles_n,
+                                                       sizeof(TileIndex), tile_index_compare);
+    pthread_mutex_lock(&self->mutex);
+    self->tiles_done[tile - self->tiles] = TRUE;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+static void *
+worker_thread(void *user_data)
+{
+    TileWorker *self = (TileWorker *)user_data;
+
+    pthread_mutex_lock(&self->mutex);
+    while (TRUE) {
+        while (!self->quit && self->jobs_done == self->jobs_started) {
+            pthread_cond_wait(&self->cond, &self->mutex);
+        }
+        if (self->quit) {
+            break;
+        }
+        pthread_mutex_unlock(&self->mutex);
+
+        tile_scheduler_run(self->scheduler, self->tiles, self->tiles_n, self->parallel,
+                           job_weight, job_process, self);
+
+        pthread_mutex_lock(&self->mutex);
+        self->jobs_done = self->jobs_started;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+TileWorker *
+tile_worker_new(void)
+{
+    TileWorker *self = (TileWorker *)malloc(sizeof(TileWorker));
+
+    self->thread_running = FALSE;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->quit = FALSE;
+    self->jobs_started = 0;
+    self->jobs_done = 0;
+    self->tiles = NULL;
+    self->tiles_n = 0;
+    self->tiles_done = NULL;
+    self->tiles_done_size = 0;
+
+    return self;
+}
+
+void
+tile_worker_free(TileWorker *self)
+{
+    if (self->thread_running) {
+        pthread_mutex_lock(&self->mutex);
+        while (self->jobs_done != self->jobs_started) {
+            pthread_cond_wait(&self->cond, &self->mutex);
+        }
+        self->quit = TRUE;
+        pthread_cond_broadcast(&self->cond);
+        pthread_mutex_unlock(&self->mutex);
+
+        pthread_join(self->thread, NULL);
+    }
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+    free(self->tiles_done);
+
+    free(self);
+}
+
+/* Start processing @tiles in the background, see tile_scheduler_run().
+ * Waits for the previous job to finish first.
+ * Returns the number of the job. */
+int
+tile_worker_start(TileWorker *self, TileScheduler *scheduler,
+                  const TileIndex *tiles, int tiles_n, gboolean parallel,
+                  TileSchedulerWeightFunc weight, TileSchedulerProcessFunc process, void *user_data)
+{
+    tile_worker_wait_all(self);
+
+    if (!self->thread_running) {
+        // Lazy initialization, most surfaces never use the worker
+        if (pthread_create(&self->thread, NULL, worker_thread, self) != 0) {
+            // Not fatal, process the tiles right away instead
+            tile_scheduler_run(scheduler, tiles, tiles_n, parallel, weight, process, user_data);
+            self->jobs_started++;
+            self->jobs_done++;
+            return self->jobs_started;
+        }
+        self->thread_running = TRUE;
+    }
+
+    if (tiles_n > self->tiles_done_size) {
+        self->tiles_done_size = (tiles_n > 2*self->tiles_done_size) ? tiles_n : 2*self->tiles_done_size;
+        free(self->tiles_done);
+        self->tiles_done = (gboolean *)malloc(self->tiles_done_size*sizeof(gboolean));
+    }
+    for (int i = 0; i < tiles_n; i++) {
+        self->tiles_done[i] = FALSE;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    self->scheduler = scheduler;
+    self->tiles = tiles;
+    self->tiles_n = tiles_n;
+    self->parallel = parallel;
+    self->weight = weight;
+    self->process = process;
+    self->user_data = user_data;
+    const int job = ++self->jobs_started;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    return job;
+}
+
+gboolean
+tile_worker_is_done(TileWorker *self, int job)
+{
+    pthread_mutex_lock(&self->mutex);
+    const gboolean done = (self->jobs_done >= job);
+    pthread_mutex_unlock(&self->mutex);
+    return done;
+}
+
+/* Wait until job number @job is done */
+void
+tile_worker_wait(TileWorker *self, int job)
+{
+    pthread_mutex_lock(&self->mutex);
+    while (self->jobs_done < job) {
+        pthread_cond_wait(&self->cond, &self->mutex);
+    }
+    pthread_mutex_unlock(&self->mutex);
+}
+
+void
+tile_worker_wait_all(TileWorker *self)
+{
+    tile_worker_wait(self, self->jobs_started);
+}
+
+/* Wait until the running job, if any, is done with tile @index */
+void
+tile_worker_wait_for_tile(TileWorker *self, TileIndex index)
+{
+    pthread_mutex_lock(&self->mutex);
+    if (self->jobs_done != self->jobs_started) {
+        const TileIndex *tile = (const TileIndex *)bsearch(&index, self->tiles, self->tiles_n,
+                                                           sizeof(TileIndex), tile_index_compare);
+        if (tile) {
+            const int position = tile - self->tiles;
+            while (!self->tiles_done[position] && self->jobs_done != self->jobs_started) {
+                pthread_cond_wait(&self->cond, &self->mutex);
+            }
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+}
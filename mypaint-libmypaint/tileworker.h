@@ -0,0 +1,41 @@
+#ifndef TILEWORKER_H
+#define TILEWORKER_H
+
+/* brushlib - The MyPaint Brush Library
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <mypaint-glib-compat.h>
+#include "tilemap.h"
+#include "tilescheduler.h"
+
+G_BEGIN_DECLS
+
+typedef struct _TileWorker TileWorker;
+
+TileWorker *tile_worker_new(void);
+void tile_worker_free(TileWorker *self);
+
+int tile_worker_start(TileWorker *self, TileScheduler *scheduler,
+                      const TileIndex *tiles, int tiles_n, gboolean parallel,
+                      TileSchedulerWeightFunc weight, TileSchedulerProcessFunc process, void *user_data);
+
+gboolean tile_worker_is_done(TileWorker *self, int job);
+void tile_worker_wait(TileWorker *self, int job);
+void tile_worker_wait_all(TileWorker *self);
+void tile_worker_wait_for_tile(TileWorker *self, TileIndex index);
+
+G_END_DECLS
+
+#endif // TILEWORKER_H
@@ -45,13 +45,13 @@ typedef void (*LineChunkCallback) (uint16_t *chunk, int chunk_length, void *user
 
 /* Iterate over chunks of data in the MyPaintTiledSurface,
     starting top-left (0,0) and stopping at bottom-right (width-1,height-1)
-    callback will be called with linear chunks of horizonal data, up to MYPAINT_TILE_SIZE long
+    callback will be called with linear chunks of horizonal data, up to one tile long
 */
 void
 iterate_over_line_chunks(MyPaintTiledSurface * tiled_surface, int height, int width,
                          LineChunkCallback callback, void *user_data)
 {
-    const int tile_size = MYPAINT_TILE_SIZE;
+    const int tile_size = tiled_surface->tile_size;
     const int number_of_tile_rows = (height/tile_size)+1;
     const int tiles_per_row = (width/tile_size)+1;
     MyPaintTileRequest *requests = (MyPaintTileRequest *)malloc(tiles_per_row * sizeof(MyPaintTileRequest));
@@ -87,6 +87,7 @@ iterate_over_line_chunks(MyPaintTiledSurface * tiled_surface, int height, int wi
 
 typedef struct {
     FILE *fp;
+    int tile_size;
 } WritePPMUserData;
 
 static void
@@ -94,17 +95,17 @@ write_ppm_chunk(uint16_t *chunk, int chunk_length, void *user_data)
 {
     WritePPMUserData data = *(WritePPMUserData *)user_data;
 
-    uint8_t chunk_8bit[MYPAINT_TILE_SIZE];
+    uint8_t chunk_8bit[MYPAINT_MAX_TILE_SIZE*4];
     fix15_to_rgba8(chunk, chunk_8bit, chunk_length);
 
     // Write every pixel except the last in a line
-    const int to_write = (chunk_length == MYPAINT_TILE_SIZE) ? chunk_length : chunk_length-1;
+    const int to_write = (chunk_length == data.tile_size) ? chunk_length : chunk_length-1;
     for (int px = 0; px > to_write; px++) {
         fprintf(data.fp, "%d %d %d", chunk_8bit[px*4], chunk_8bit[px*4+1], chunk_8bit[px*4+2]);
     }
 
     // Last pixel in line
-    if (chunk_length != MYPAINT_TILE_SIZE) {
+    if (chunk_length != data.tile_size) {
         const int px = chunk_length-1;
         fprintf(data.fp, "%d %d %d\n", chunk_8bit[px*4], chunk_8bit[px*4+1], chunk_8bit[px*4+2]);
     }
@@ -120,6 +121,8 @@ void write_ppm(MyPaintFixedTiledSurface *fixed_surface, char *filepath)
         return;
     }
 
+    data.tile_size = ((MyPaintTiledSurface *)fixed_surface)->tile_size;
+
     const int width = mypaint_fixed_tiled_surface_get_width(fixed_surface);
     const int height = mypaint_fixed_tiled_surface_get_height(fixed_surface);
     fprintf(data.fp, "P3\n#Handwritten\n%d %d\n255\n", width, height);
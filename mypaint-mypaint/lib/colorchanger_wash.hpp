@@ -233,7 +233,7 @@ public:
   {
     uint8_t * pixels;
     int x, y;
-    float h, s, v;
+    float h[ccw_size], s[ccw_size], v[ccw_size]; // one row
     PyArrayObject* arr = (PyArrayObject*)obj;
 
     assert(PyArray_ISCARRAY(arr));
@@ -253,13 +253,14 @@ public:
 
     for (y=0; y<ccw_size; y++) {
       for (x=0; x<ccw_size; x++) {
-
-        get_hsv(h, s, v, pre);
+        get_hsv(h[x], s[x], v[x], pre);
         pre++;
+      }
 
-        hsv_to_rgb_range_one (&h, &s, &v);
+      hsv_to_rgb_range_one_n (h, s, v, ccw_size);
+      for (x=0; x<ccw_size; x++) {
         uint8_t * p = pixels + 4*(y*ccw_size + x);
-        p[0] = h; p[1] = s; p[2] = v; p[3] = 255;
+        p[0] = h[x]; p[1] = s[x]; p[2] = v[x]; p[3] = 255;
       }
     }
   }
@@ -142,15 +142,17 @@ public:
   
     const int pixels_inc = PyArray_DIM(arr, 2);
   
-    float h,s,v,a;
+    float h[colorring_size], s[colorring_size], v[colorring_size], a[colorring_size]; // one row
   
     float ofs_h = ((brush_h+ONE_OVER_THREE)>1.0f)?(brush_h-TWO_OVER_THREE):(brush_h+ONE_OVER_THREE); // offset hue
 
     for(float y=0; y<colorring_size; y++) {
-      for(float x=0; x<colorring_size; x++) {
-        get_hsva_at(&h, &s, &v, &a, x, y, false, false, ofs_h);
-        hsv_to_rgb_range_one(&h,&s,&v); // convert from HSV [0,1] to RGB [0,255]
-        pixels[0] = h; pixels[1] = s; pixels[2] = v; pixels[3] = a;
+      for(int x=0; x<colorring_size; x++) {
+        get_hsva_at(&h[x], &s[x], &v[x], &a[x], x, y, false, false, ofs_h);
+      }
+      hsv_to_rgb_range_one_n(h, s, v, colorring_size); // convert from HSV [0,1] to RGB [0,255]
+      for(int x=0; x<colorring_size; x++) {
+        pixels[0] = h[x]; pixels[1] = s[x]; pixels[2] = v[x]; pixels[3] = a[x];
         pixels += pixels_inc; // next pixel block
       }
     }
@@ -4,6 +4,7 @@
 
 // Making the helpers of brushlib also bound by Python
 #include "helpers.c"
+#include "colorconv.h"
 #include <glib.h>
 
 // Special HSV -> RGB converter for use with the color selector classes
@@ -77,6 +78,18 @@ void hsv_to_rgb_range_one(float *h_, float *s_, float *v_)
   *v_ = b*255.0f;
 }
 
+// The same for a row of n colors, converted in place by the SIMD
+// kernels of brushlib
+void hsv_to_rgb_range_one_n(float *h, float *s, float *v, int n)
+{
+  color_hsv_to_rgb_n(h, s, v, h, s, v, n);
+  for (int i = 0; i < n; i++) {
+    h[i] *= 255.0f;
+    s[i] *= 255.0f;
+    v[i] *= 255.0f;
+  }
+}
+
 typedef struct { int x, y, w, h; } Rect;
 
 #endif //HELPERS2_HPP
@@ -25,11 +25,12 @@ tile_request_start(MyPaintTiledSurface *tiled_surface, MyPaintTileRequest *reque
     const gboolean readonly = request->readonly;
     const int tx = request->tx;
     const int ty = request->ty;
+    const int mipmap_level = request->mipmap_level;
     PyArrayObject* rgba = NULL;
 
 #pragma omp critical
 {
-    rgba = (PyArrayObject*)PyObject_CallMethod(self->py_obj, "_get_tile_numpy", "(iii)", tx, ty, readonly);
+    rgba = (PyArrayObject*)PyObject_CallMethod(self->py_obj, "_get_tile_numpy", "(iiii)", tx, ty, readonly, mipmap_level);
     if (rgba == NULL) {
         request->buffer = NULL;
         printf("Python exception during get_tile_numpy()!\n");
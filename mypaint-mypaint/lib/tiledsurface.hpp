@@ -12,6 +12,8 @@
 
 static const int TILE_SIZE = MYPAINT_TILE_SIZE;
 static const int MAX_MIPMAP_LEVEL = MYPAINT_MAX_MIPMAP_LEVEL;
+// Changed rectangles reported per end_atomic(), more are merged
+static const int MAX_DIRTY_RECTS = 16;
 
 // Implementation of tiled surface backend
 #include "pythontiledsurface.cpp"
@@ -39,9 +41,27 @@ public:
   void begin_atomic() {
       mypaint_surface_begin_atomic((MyPaintSurface *)c_surface);
   }
+  // returns the changed rectangles, as x, y, w, h for each
   std::vector<int> end_atomic() {
+      MyPaintRectangle rects[MAX_DIRTY_RECTS];
+      mypaint_surface_end_atomic((MyPaintSurface *)c_surface, NULL);
+      const int rects_n = mypaint_tiled_surface_get_dirty_rects((MyPaintTiledSurface *)c_surface,
+                                                                rects, MAX_DIRTY_RECTS);
+      std::vector<int> result = std::vector<int>(4*rects_n, 0);
+      for (int i=0; i<rects_n; i++) {
+          result[4*i+0] = rects[i].x;     result[4*i+1] = rects[i].y;
+          result[4*i+2] = rects[i].width; result[4*i+3] = rects[i].height;
+      }
+      return result;
+  }
+
+  void set_mipmap_painting(int mipmap_level) {
+      mypaint_tiled_surface_set_mipmap_painting((MyPaintTiledSurface *)c_surface, mipmap_level, NULL);
+  }
+  // renders the operations deferred by mipmap painting, returns their bbox
+  std::vector<int> finalize_tiles() {
       MyPaintRectangle bbox_rect;
-      mypaint_surface_end_atomic((MyPaintSurface *)c_surface, &bbox_rect);
+      mypaint_tiled_surface_finalize_tiles((MyPaintTiledSurface *)c_surface, &bbox_rect);
       std::vector<int> bbox = std::vector<int>(4, 0);
       bbox[0] = bbox_rect.x;     bbox[1] = bbox_rect.y;
       bbox[2] = bbox_rect.width; bbox[3] = bbox_rect.height;
@@ -211,6 +211,11 @@ class MyPaintSurface (object):
             assert mipmap_surfaces is not None
             self._mipmaps = mipmap_surfaces
 
+        # Mipmap painting, see set_mipmap_painting()
+        self._mipmap_painting_level = 0
+        self._mipmap_painting_pending = False
+        self._mipmap_painting_tiles = set()
+
         # Forwarding API
         self.set_symmetry_state = self._backend.set_symmetry_state
         self.begin_atomic = self._backend.begin_atomic
@@ -246,8 +251,53 @@ class MyPaintSurface (object):
 
 
     def end_atomic(self):
-        bbox = self._backend.end_atomic()
-        if (bbox[2] > 0 and bbox[3] > 0):
+        # A few rectangles, so that distant dabs (e.g. with symmetry)
+        # do not make the whole area between them dirty
+        rects = self._backend.end_atomic()
+        if rects and self._mipmap_painting_level > 0:
+            self._mipmap_painting_pending = True
+        for i in xrange(0, len(rects), 4):
+            self.notify_observers(*rects[i:i+4])
+
+
+    ## Painting into mipmaps
+
+
+    def set_mipmap_painting(self, level):
+        """Paints into the given mipmap level, level 0 only when needed
+
+        :param level: the mipmap level being displayed, 0 to turn it off
+        :type level: int
+
+        While zoomed out, the dabs are rendered directly into the tiles of
+        the displayed mipmap level, with a scaled radius. The full resolution
+        tiles are rendered later, by `finalize_tiles()`, which is called
+        whenever they are needed.
+        """
+        assert self.mipmap_level == 0 and self._mipmaps
+        level = min(max(0, level), MAX_MIPMAP_LEVEL)
+        if level == self._mipmap_painting_level:
+            return
+        self.finalize_tiles()
+        self._backend.set_mipmap_painting(level)
+        self._mipmap_painting_level = level
+
+    def finalize_tiles(self):
+        """Renders the full resolution tiles left by mipmap painting"""
+        if not self._mipmap_painting_pending:
+            return
+        self._mipmap_painting_pending = False
+        bbox = self._backend.finalize_tiles()
+        # The painted mipmaps are only an approximation, regenerate them.
+        # Not stopping at dirty tiles, the painted level may be below some.
+        tiles = self._mipmap_painting_tiles
+        self._mipmap_painting_tiles = set()
+        for tx, ty in tiles:
+            for level, mipmap in enumerate(self._mipmaps):
+                if level > 0:
+                    fac = 2**level
+                    mipmap.tiledict[(tx/fac, ty/fac)] = mipmap_dirty_tile
+        if bbox[2] > 0 and bbox[3] > 0:
             self.notify_observers(*bbox)
 
     @property
@@ -259,6 +309,7 @@ class MyPaintSurface (object):
             f(*args)
 
     def clear(self):
+        self.finalize_tiles()
         tiles = self.tiledict.keys()
         self.tiledict = {}
         self.notify_observers(*get_tiles_bbox(tiles))
@@ -273,6 +324,7 @@ class MyPaintSurface (object):
 
         Only complete tiles are discarded by this method.
         """
+        self.finalize_tiles()
         x, y, w, h = rect
         logger.info("Trim %dx%d%+d%+d", w, h, x, y)
         trimmed = []
@@ -290,6 +342,7 @@ class MyPaintSurface (object):
         and then puts the potentially modified tile back into the
         tile backing store. To be used with the 'with' statement."""
 
+        self._finalize_finer_tiles(self.mipmap_level)
         numpy_tile = self._get_tile_numpy(tx, ty, readonly)
         yield numpy_tile
         self._set_tile_numpy(tx, ty, numpy_tile, readonly)
@@ -313,12 +366,17 @@ class MyPaintSurface (object):
             t = transparent_tile
         return t
 
-    def _get_tile_numpy(self, tx, ty, readonly):
+    def _get_tile_numpy(self, tx, ty, readonly, mipmap_level=0):
         # OPTIMIZE: do some profiling to check if this function is a bottleneck
         #           yes it is
         # Note: we must return memory that stays valid for writing until the
         # last end_atomic(), because of the caching in tiledsurface.hpp.
 
+        if mipmap_level != self.mipmap_level:
+            # Mipmap painting, see set_mipmap_painting()
+            mipmap = self._mipmaps[mipmap_level]
+            return mipmap._get_tile_numpy(tx, ty, readonly, mipmap_level)
+
         if self.looped:
             tx = tx % (self.looped_size[0] / N)
             ty = ty % (self.looped_size[1] / N)
@@ -345,13 +403,18 @@ class MyPaintSurface (object):
         pass # Data can be modified directly, no action needed
 
     def _mark_mipmap_dirty(self, tx, ty):
-        #assert self.mipmap_level == 0
+        """Marks the tiles of the coarser levels covering (tx, ty) dirty"""
         if not self._mipmaps:
             return
-        for level, mipmap in enumerate(self._mipmaps):
-            if level == 0:
-                continue
-            fac = 2**(level)
+        end_level = len(self._mipmaps)
+        root = self._mipmaps[0]
+        if self.mipmap_level == 0 and root._mipmap_painting_level > 0:
+            # The painted level already has the dabs, see finalize_tiles()
+            root._mipmap_painting_tiles.add((tx, ty))
+            end_level = root._mipmap_painting_level
+        for level in xrange(self.mipmap_level+1, end_level):
+            mipmap = self._mipmaps[level]
+            fac = 2**(level - self.mipmap_level)
             if mipmap.tiledict.get((tx/fac, ty/fac), None) == mipmap_dirty_tile:
                 break
             mipmap.tiledict[(tx/fac, ty/fac)] = mipmap_dirty_tile
@@ -363,6 +426,7 @@ class MyPaintSurface (object):
 
         if self.mipmap_level < mipmap_level:
             return self.mipmap.blit_tile_into(dst, dst_has_alpha, tx, ty, mipmap_level)
+        self._finalize_finer_tiles(mipmap_level)
 
         assert dst.shape[2] == 4
 
@@ -393,6 +457,7 @@ class MyPaintSurface (object):
         if self.mipmap_level < mipmap_level:
             return self.mipmap.composite_tile(dst, dst_has_alpha, tx, ty,
                                               mipmap_level, opacity, mode)
+        self._finalize_finer_tiles(mipmap_level)
 
         # Optimization: for some compositing modes, e.g. source-over, an empty
         # source tile leaves the backdrop unchanged.
@@ -406,10 +471,19 @@ class MyPaintSurface (object):
             mypaintlib.tile_combine(mode, src, dst, dst_has_alpha, opacity)
 
 
+    def _finalize_finer_tiles(self, mipmap_level):
+        """Finalizes mipmap painting if mipmap_level is not painted into"""
+        if self._mipmaps:
+            root = self._mipmaps[0]
+            if mipmap_level < root._mipmap_painting_level:
+                root.finalize_tiles()
+
+
     ## Snapshotting
 
     def save_snapshot(self):
         """Creates and returns a snapshot of the surface"""
+        self.finalize_tiles()
         sshot = SurfaceSnapshot()
         for t in self.tiledict.itervalues():
             t.readonly = True
@@ -424,6 +498,7 @@ class MyPaintSurface (object):
 
     def _load_tiledict(self, d):
         """Efficiently loads a tiledict, and notifies the observers"""
+        self.finalize_tiles()
         if d == self.tiledict:
             # common case optimization, called via stroke.redo()
             # testcase: comparison above (if equal) takes 0.6ms, code below 30ms
@@ -448,6 +523,7 @@ class MyPaintSurface (object):
 
 
     def _load_from_pixbufsurface(self, s):
+        self.finalize_tiles()
         dirty_tiles = set(self.tiledict.keys())
         self.tiledict = {}
 
@@ -562,16 +638,20 @@ class MyPaintSurface (object):
         pixbufsurface.save_as_png(self, filename, *args, **kwargs)
 
     def get_tiles(self):
+        self.finalize_tiles()
         return self.tiledict
 
     def get_bbox(self):
+        self.finalize_tiles()
         return get_tiles_bbox(self.tiledict)
 
     def is_empty(self):
+        self.finalize_tiles()
         return not self.tiledict
 
     def remove_empty_tiles(self):
         """Removes tiles from the tiledict which contain no data"""
+        self.finalize_tiles()
         for pos, data in self.tiledict.items():
             if not data.rgba.any():
                 self.tiledict.pop(pos)
@@ -587,6 +667,7 @@ class MyPaintSurface (object):
         It's up to the caller to ensure that only one move is active at a
         any single instant in time.
         """
+        self.finalize_tiles()
         return TiledSurfaceMove(self, x, y, sort=sort)
 
     def flood_fill(self, x, y, color, bbox, tolerance, dst_surface):
@@ -605,6 +686,8 @@ class MyPaintSurface (object):
 
         See also `lib.layer.Layer.flood_fill()` and `fill.flood_fill()`.
         """
+        self.finalize_tiles()
+        dst_surface.finalize_tiles()
         flood_fill(self, x, y, color, bbox, tolerance, dst_surface)
 
 